@@ -0,0 +1,117 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <map>
+
+//Converts a .hex font into a glyph atlas (see framebuffer::font_atlas), so nothing needs to be parsed at runtime.
+
+const uint32_t codepoints = 0x110000;
+const uint32_t pages = codepoints >> 8;
+const uint16_t no_block = 0xFFFF;
+const uint32_t no_glyph = 0xFFFFFFFFU;
+
+bool parse_line(const std::string& line, uint32_t& cp, std::vector<uint32_t>& bits)
+{
+	size_t splitter = line.find(':');
+	if(splitter == std::string::npos || splitter == 0 || splitter > 6)
+		return false;
+	size_t hexlen = line.length() - splitter - 1;
+	if(hexlen != 32 && hexlen != 64)
+		return false;
+	if(line.find_first_not_of("0123456789ABCDEFabcdef", splitter + 1) != std::string::npos)
+		return false;
+	if(line.find_first_not_of("0123456789ABCDEFabcdef") != splitter)
+		return false;
+	cp = strtoul(line.substr(0, splitter).c_str(), NULL, 16);
+	if(cp >= codepoints)
+		return false;
+	bits.clear();
+	for(size_t i = splitter + 1; i < line.length(); i += 8)
+		bits.push_back(strtoul(line.substr(i, 8).c_str(), NULL, 16));
+	return true;
+}
+
+template<typename T> void write_array(std::ostream& out, const char* type, const char* name,
+	const std::vector<T>& data, unsigned digits)
+{
+	out << "\tconst " << type << " " << name << "[] = {";
+	for(size_t i = 0; i < data.size(); i++) {
+		if(i % 8 == 0)
+			out << std::endl << "\t\t";
+		out << "0x" << std::hex << std::setw(digits) << std::setfill('0') << (uint64_t)data[i] << std::dec
+			<< ",";
+	}
+	out << std::endl << "\t};" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc != 3) {
+		std::cerr << "Usage: hex2atlas <symbol> <file>" << std::endl;
+		return 1;
+	}
+	std::ifstream in(argv[2]);
+	if(!in) {
+		std::cerr << "Can't open " << argv[2] << std::endl;
+		return 1;
+	}
+	std::map<uint32_t, std::vector<uint32_t>> glyphs;
+	std::string line;
+	unsigned lineno = 0;
+	std::vector<uint32_t> bits;
+	while(std::getline(in, line)) {
+		lineno++;
+		if(line.length() && line[line.length() - 1] == '\r')
+			line = line.substr(0, line.length() - 1);
+		if(line == "" || line[0] == '#')
+			continue;
+		uint32_t cp;
+		if(!parse_line(line, cp, bits)) {
+			std::cerr << argv[2] << ":" << lineno << ": Invalid line '" << line << "'" << std::endl;
+			return 1;
+		}
+		glyphs[cp] = bits;
+	}
+	//Space is always blank and narrow.
+	glyphs[32] = std::vector<uint32_t>(4, 0);
+
+	//Glyph bitmaps, identical ones stored only once.
+	std::vector<uint32_t> data;
+	std::map<std::vector<uint32_t>, uint32_t> offsets;
+	//Page table and descriptor blocks.
+	std::vector<uint16_t> page_table(pages, no_block);
+	std::vector<uint32_t> blocks;
+	for(auto& i : glyphs) {
+		uint32_t page = i.first >> 8;
+		if(page_table[page] == no_block) {
+			page_table[page] = blocks.size() / 256;
+			blocks.resize(blocks.size() + 256, no_glyph);
+		}
+		if(!offsets.count(i.second)) {
+			offsets[i.second] = data.size();
+			data.insert(data.end(), i.second.begin(), i.second.end());
+		}
+		bool wide = (i.second.size() == 8);
+		blocks[256 * page_table[page] + (i.first & 255)] = (offsets[i.second] << 1) | (wide ? 1 : 0);
+	}
+	if(blocks.size() / 256 >= no_block) {
+		std::cerr << "Too many glyph pages" << std::endl;
+		return 1;
+	}
+
+	std::cout << "#include \"library/framebuffer.hpp\"" << std::endl << std::endl;
+	std::cout << "//Generated from " << argv[2] << " by hex2atlas, do not edit." << std::endl;
+	std::cout << "namespace" << std::endl << "{" << std::endl;
+	write_array(std::cout, "uint32_t", "bits", data, 8);
+	write_array(std::cout, "uint16_t", "page_table", page_table, 4);
+	write_array(std::cout, "uint32_t", "blocks", blocks, 8);
+	std::cout << "}" << std::endl << std::endl;
+	std::cout << "extern const framebuffer::font_atlas " << argv[1] << ";" << std::endl;
+	std::cout << "const framebuffer::font_atlas " << argv[1] << " = {bits, page_table, blocks, "
+		<< glyphs.size() << "};" << std::endl;
+	return 0;
+}
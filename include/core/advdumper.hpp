@@ -3,6 +3,8 @@
 
 #include <string>
 #include <set>
+#include <list>
+#include <memory>
 #include <stdexcept>
 #include <iostream>
 
@@ -129,6 +131,13 @@ private:
 	std::string d_id;
 };
 
+/**
+ * Dispatches frames, samples and changes to the dumpers.
+ *
+ * The dumpers are called on a dump thread, so the emulation thread can emulate next frames while frames are being
+ * scaled, rendered and encoded. Only a few frames are queued: if the dump thread falls behind, the emulation thread
+ * waits. Lua on_video callbacks still run on the emulation thread, so the HUD is prepared there.
+ */
 class master_dumper
 {
 public:
@@ -205,10 +214,28 @@ public:
 		virtual ~notifier() throw();
 		virtual void dump_status_change() = 0;
 	};
+/**
+ * HUD prepared for a frame by Lua on_video callbacks, as snapshots safe to draw on the dump thread.
+ */
+	struct video_hud
+	{
+		framebuffer::queue rq;
+		uint32_t hscl;
+		uint32_t vscl;
+		uint32_t lgap;
+		uint32_t tgap;
+		uint32_t rgap;
+		uint32_t bgap;
+		bool killed;
+	};
 /**
  * Ctor.
  */
 	master_dumper(lua_state& _lua2);
+/**
+ * Dtor.
+ */
+	~master_dumper();
 /**
  * Get instance for specified dumper.
  */
@@ -238,7 +265,8 @@ public:
  */
 	void add_dumper(dumper_base& n);
 /**
- * Remove dumper update notifier object.
+ * Remove dumper update notifier object. Waits for anything queued to the dumper to be handled first. Must be
+ * called before tearing down anything the dumper callbacks use.
  */
 	void drop_dumper(dumper_base& n);
 /**
@@ -247,12 +275,24 @@ public:
 	unsigned get_dumper_count() throw();
 /**
  * Call all notifiers (on_frame).
+ *
+ * Parameter _frame: The frame. It is kept until the dumpers have been called, so it must not be written to.
+ * Parameter fps_n: Fps numerator.
+ * Parameter fps_d: Fps denominator.
  */
-	void on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d);
+	void on_frame(std::shared_ptr<const framebuffer::raw> _frame, uint32_t fps_n, uint32_t fps_d);
 /**
  * Call all notifiers (on_sample).
  */
 	void on_sample(short l, short r);
+/**
+ * Call all notifiers (on_samples) for a block of samples.
+ *
+ * Parameter samples: The samples. If stereo, each sample takes two elements (L, R).
+ * Parameter count: Number of samples.
+ * Parameter stereo: If true, samples are stereo, else mono.
+ */
+	void on_samples(const short* samples, size_t count, bool stereo);
 /**
  * Call all notifiers (on_rate_change)
  *
@@ -277,33 +317,55 @@ public:
  * End all dumps.
  */
 	void end_dumps();
+/**
+ * Wait for the dump thread to handle everything queued.
+ */
+	void flush();
 /**
  * Set output stream.
  */
 	void set_output(std::ostream* _output);
 /**
- * Render Lua HUD on video.
+ * Render prepared HUD on video.
  *
  * Parameter target: The target screen to render on.
  * Parameter source: The source screen to read.
- * Parameter hscl: The horizontal scale factor.
- * Parameter vscl: The vertical scale factor.
- * Parameter lgap: Left gap.
- * Parameter tgap: Top gap.
- * Parameter rgap: Right gap
- * Parameter bgap: Bottom gap.
- * Parameter fn: Function to call between running lua hooks and actually rendering.
- * Returns: True if frame should be dumped, false if not.
+ * Parameter hud: The HUD.
  */
-	template<bool X> bool render_video_hud(struct framebuffer::fb<X>& target, struct framebuffer::raw& source,
-		uint32_t hscl, uint32_t vscl, uint32_t lgap, uint32_t tgap, uint32_t rgap, uint32_t bgap,
-		std::function<void()> fn);
+	template<bool X> void render_video_hud(struct framebuffer::fb<X>& target, const struct framebuffer::raw& source,
+		const video_hud& hud);
 /**
  * Calculate number of sound samples to drop due to dropped frame.
  */
 	uint64_t killed_audio_length(uint32_t fps_n, uint32_t fps_d, double& fraction);
 private:
+	master_dumper(const master_dumper&);
+	master_dumper& operator=(const master_dumper&);
+	struct dump_event
+	{
+		enum type
+		{
+			EV_FRAME,
+			EV_SAMPLES,
+			EV_RATE,
+			EV_GAMEINFO
+		} type;
+		//The dumpers to call, with HUD for frames and samples to skip for samples.
+		std::list<dumper_base*> targets;
+		std::map<dumper_base*, video_hud> huds;
+		std::map<dumper_base*, uint64_t> skip;
+		std::shared_ptr<const framebuffer::raw> frame;
+		uint32_t n;
+		uint32_t d;
+		std::vector<short> samples;
+		bool stereo;
+		gameinfo gi;
+	};
 	void statuschange();
+	dump_event* new_event(enum dump_event::type type);
+	void enqueue(dump_event* e);
+	void deliver(dump_event& ev);
+	void entry_point();
 	friend class dumper_base;
 	std::map<dumper_factory_base*, dumper_base*> dumpers;
 	std::set<notifier*> notifications;
@@ -314,6 +376,13 @@ private:
 	std::ostream* output;
 	threads::rlock lock;
 	lua_state& lua2;
+	//Events queued to the dump thread, started on first event.
+	threads::lock qlock;
+	threads::cv qcond;
+	std::list<dump_event*> queue;
+	unsigned queued_frames;
+	bool quitting;
+	threads::thread* dthread;
 };
 
 class dumper_base
@@ -322,14 +391,41 @@ public:
 	dumper_base();
 	dumper_base(master_dumper& _mdumper, dumper_factory_base& _fbase);
 	virtual ~dumper_base() throw();
+/**
+ * Get how the frame should be rendered, for preparing the HUD. Called on the emulation thread before on_frame()
+ * is called for the frame on the dump thread.
+ *
+ * The default is to not render the frame: render_video_hud() copies it unscaled with no HUD.
+ *
+ * Parameter frame: The frame.
+ * Parameter hscl: The horizontal scale factor, initially 1.
+ * Parameter vscl: The vertical scale factor, initially 1.
+ * Parameter lgap: Left gap, initially 0.
+ * Parameter tgap: Top gap, initially 0.
+ * Parameter rgap: Right gap, initially 0.
+ * Parameter bgap: Bottom gap, initially 0.
+ * Returns: True if the frame is rendered with render_video_hud(), false if not.
+ */
+	virtual bool video_geometry(const struct framebuffer::raw& frame, uint32_t& hscl, uint32_t& vscl,
+		uint32_t& lgap, uint32_t& tgap, uint32_t& rgap, uint32_t& bgap);
 /**
  * New frame available.
  */
-	virtual void on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d) = 0;
+	virtual void on_frame(const struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d) = 0;
 /**
  * New sample available.
  */
 	virtual void on_sample(short l, short r) = 0;
+/**
+ * Block of new samples available.
+ *
+ * The default implementation calls on_sample() for each sample.
+ *
+ * Parameter samples: The samples. If stereo, each sample takes two elements (L, R).
+ * Parameter count: Number of samples.
+ * Parameter stereo: If true, samples are stereo, else mono.
+ */
+	virtual void on_samples(const short* samples, size_t count, bool stereo);
 /**
  * Sample rate is changing.
  */
@@ -343,36 +439,38 @@ public:
  */
 	virtual void on_end() = 0;
 /**
- * Render Lua HUD on video. samples_killed is incremented if needed.
+ * Render the frame being dumped with Lua HUD, as told by video_geometry(). Only callable from on_frame().
  *
  * Parameter target: The target screen to render on.
  * Parameter source: The source screen to read.
- * Parameter fps_n: Fps numerator.
- * Parameter fps_d: Fps denominator.
- * Parameter hscl: The horizontal scale factor.
- * Parameter vscl: The vertical scale factor.
- * Parameter lgap: Left gap.
- * Parameter tgap: Top gap.
- * Parameter rgap: Right gap
- * Parameter bgap: Bottom gap.
- * Parameter fn: Function to call between running lua hooks and actually rendering.
+ * Parameter fn: Function to call before rendering, if the frame is to be dumped.
  * Returns: True if frame should be dumped, false if not.
  */
-	template<bool X> bool render_video_hud(struct framebuffer::fb<X>& target, struct framebuffer::raw& source,
-		uint32_t fps_n, uint32_t fps_d, uint32_t hscl, uint32_t vscl, uint32_t lgap, uint32_t tgap,
-		uint32_t rgap, uint32_t bgap, std::function<void()> fn)
+	template<bool X> bool render_video_hud(struct framebuffer::fb<X>& target,
+		const struct framebuffer::raw& source, std::function<void()> fn)
 	{
-		bool r = mdumper->render_video_hud(target, source, hscl, vscl, lgap, tgap, rgap, bgap, fn);
-		if(!r)
-			samples_killed += mdumper->killed_audio_length(fps_n, fps_d, akillfrac);
-		return r;
+		if(hud && hud->killed)
+			return false;
+		if(fn)
+			fn();
+		if(hud)
+			mdumper->render_video_hud(target, source, *hud);
+		else {
+			target.reallocate(source.get_width(), source.get_height(), false);
+			target.set_origin(0, 0);
+			target.copy_from(source, 1, 1);
+		}
+		return true;
 	}
 private:
 	friend class master_dumper;
+	//Only accessed on the emulation thread.
 	uint64_t samples_killed;
 	master_dumper* mdumper;
 	dumper_factory_base* fbase;
 	double akillfrac;
+	//HUD for the frame being dumped, if any.
+	const master_dumper::video_hud* hud;
 };
 
 #endif
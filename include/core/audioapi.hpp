@@ -1,8 +1,10 @@
 #ifndef _audioapi__hpp__included__
 #define _audioapi__hpp__included__
 
+#include "library/spsc-ring.hpp"
 #include "library/threads.hpp"
 
+#include <atomic>
 #include <map>
 #include <cstdint>
 #include <cstdlib>
@@ -12,35 +14,6 @@
 class audioapi_instance
 {
 public:
-/**
- * Audio API music buffer.
- */
-	struct buffer
-	{
-/**
- * The samples.
- *
- * Note: May be NULL if no samples are available..
- */
-		int16_t* samples;
-/**
- * Playback pointer in samples structure.
- */
-		size_t pointer;
-/**
- * Total number of samples in this buffer.
- */
-		size_t total;
-/**
- * True if buffer is stereo, false if mono.
- */
-		bool stereo;
-/**
- * The rate in samples per second the buffer is supposed to be played at.
- */
-		double rate;
-	};
-
 /**
  * Audio API VU calculator.
  */
@@ -96,6 +69,21 @@ public:
  * Parameter rate: Rate of buffer in samples per second.
  */
 	void submit_buffer(int16_t* samples, size_t count, bool stereo, double rate);
+/**
+ * Get space in music buffer to write stereo samples to directly, avoiding a copy.
+ *
+ * Parameter count: Maximum number of samples wanted. Filled with number of samples that fit (may be 0 if the buffer
+ *	is full; then use submit_buffer()).
+ * Returns: Pointer to write the samples (L, R) to.
+ */
+	int16_t* get_music_buffer(size_t& count);
+/**
+ * Submit samples written to space returned by get_music_buffer() for playback.
+ *
+ * Parameter count: Number of samples written.
+ * Parameter rate: Rate of samples in samples per second.
+ */
+	void commit_music_buffer(size_t count, double rate);
 /**
  * Get the voice channel playback/record rate.
  *
@@ -185,6 +173,30 @@ public:
  */
 	float voicer_volume();
 
+/**
+ * Set target music latency.
+ *
+ * The playback rate is adjusted so that about this much music stays buffered. The effective target is raised if the
+ * sound driver requests larger blocks than fit into it.
+ *
+ * Parameter ms: The latency in milliseconds.
+ */
+	void music_latency(unsigned ms);
+/**
+ * Get target music latency.
+ *
+ * Returns: The latency in milliseconds.
+ */
+	unsigned music_latency();
+/**
+ * Get number of music buffer underruns (driver needed music, but none was buffered).
+ */
+	uint64_t music_underruns();
+/**
+ * Get number of music buffer overruns (music was discarded because too much was buffered).
+ */
+	uint64_t music_overruns();
+
 //The following are intended to be used by the driver from the callback
 /**
  * Get mixed music + voice buffer to play (at voice rate).
@@ -194,15 +206,6 @@ public:
  * Parameter stereo: If true, return stereo buffer, else mono.
  */
 	void get_mixed(int16_t* samples, size_t count, bool stereo);
-/**
- * Get music channel buffer to play.
- *
- * Parameter played: Number of samples to ACK as played.
- * Returns: Buffer to play.
- *
- * Note: This should only be called from the sound driver.
- */
-	struct buffer get_music(size_t played);
 /**
  * Get voice channel buffer to play.
  *
@@ -250,20 +253,24 @@ private:
 	};
 	dummy_cb_proc dummyproc;
 	threads::thread* dummythread;
-	//3 music buffers is not enough due to huge blocksizes used by SDL.
-	const static unsigned MUSIC_BUFFERS = 8;
+	const static unsigned music_bufsize = 65536;
 	const static unsigned voicep_bufsize = 65536;
 	const static unsigned voicer_bufsize = 65536;
-	const static unsigned music_bufsize = 8192;
 	float voicep_buffer[voicep_bufsize];
 	float voicer_buffer[voicer_bufsize];
-	int16_t music_buffer[MUSIC_BUFFERS * music_bufsize];
-	volatile bool music_stereo[MUSIC_BUFFERS];
-	volatile double music_rate[MUSIC_BUFFERS];
-	volatile size_t music_size[MUSIC_BUFFERS];
-	unsigned music_ptr;
-	unsigned last_complete_music_seen;
-	volatile unsigned last_complete_music;
+	//Music is always stored as stereo (L, R) pairs. Written only by emulator, read only by sound driver.
+	spsc::ring<int16_t> music_ring;
+	int16_t* music_direct;
+	std::atomic<double> music_rate;
+	std::atomic<unsigned> _music_latency;
+	std::atomic<uint64_t> _music_underruns;
+	std::atomic<uint64_t> _music_overruns;
+	//These are only touched from the sound driver side.
+	bool music_primed;
+	size_t music_block;
+	double music_fill_avg;
+	double music_adjust_i;
+	double music_play_rate;
 	volatile unsigned voicep_get;
 	volatile unsigned voicep_put;
 	volatile unsigned voicer_get;
@@ -278,7 +285,7 @@ private:
 	volatile float _voicep_volume;
 	volatile float _voicer_volume;
 	resampler music_resampler;
-	bool last_adjust;	//Adjusting consequtively is too hard.
+	void update_music_rate(size_t count);
 	static bool vu_disabled;
 };
 
@@ -100,8 +100,9 @@ public:
  */
 	std::map<std::string, std::string> button_keys;
 private:
-	void do_analog_action(const std::string& a);
-	void do_autofire_action(const std::string& a, int mode);
+	void do_analog_action(const command::signature::result& a);
+	void do_autofire_action(const command::signature::result& a, int mode);
+	void do_autofire_action(const std::string& name, uint32_t duty, uint32_t cyclelen, int mode);
 	void do_action(const std::string& name, short state, int mode);
 	void promote_key(keyboard::ctrlrkey& k);
 	void add_button(const std::string& name, const controller_bind& binding);
@@ -137,10 +138,10 @@ private:
 	command::_fnptr<const std::string&> button_h;
 	command::_fnptr<const std::string&> button_t;
 	command::_fnptr<const std::string&> button_d;
-	command::_fnptr<const std::string&> button_ap;
-	command::_fnptr<const std::string&> button_ar;
-	command::_fnptr<const std::string&> button_at;
-	command::_fnptr<const std::string&> button_a;
+	command::_sigfnptr button_ap;
+	command::_sigfnptr button_ar;
+	command::_sigfnptr button_at;
+	command::_sigfnptr button_a;
 	command::_fnptr<> afire_p;
 	command::_fnptr<> afire_n;
 	command::_fnptr<> ahold_p;
@@ -148,6 +148,10 @@ public:
  * Request a break.
  */
 	void request_break();
+/**
+ * Are there read, write, execute or trace hooks that could request a break?
+ */
+	bool can_break();
 	//These are public only for some debugging stuff.
 	typedef std::list<callback_base*> cb_list;
 	std::map<uint64_t, cb_list> read_cb;
@@ -29,6 +29,8 @@ struct emulator_dispatch
 	dispatch::source<> mbranch_change;
 	dispatch::source<bool> core_changed;
 	dispatch::source<> voice_stream_change;
+	dispatch::source<uint64_t, uint64_t> voice_job_progress;
+	dispatch::source<bool, std::string> voice_job_finish;
 	dispatch::source<> vu_change;
 	dispatch::source<> subtitle_change;
 	dispatch::source<unsigned, unsigned, int> multitrack_change;
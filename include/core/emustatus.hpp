@@ -6,9 +6,11 @@
 #include <set>
 #include <map>
 #include "library/command.hpp"
+#include "library/threads.hpp"
 #include "library/triplebuffer.hpp"
 
 class movie_logic;
+class input_queue;
 class project_state;
 class voice_commentary;
 class emulator_runmode;
@@ -56,16 +58,66 @@ struct _lsnes_status
 	std::map<std::string, std::u32string> lvars;	//Lua variables.
 };
 
+/**
+ * Descriptions of save slots.
+ *
+ * Save slots are read on a worker thread, and status is updated when done. What has been read is kept in file set
+ * by set_persist_file(), so slots need not be read again if they have not changed. On Linux, slots changed by others
+ * are noticed using inotify. The worker is started by the first get(), and never for headless instances.
+ */
 struct slotinfo_cache
 {
-	slotinfo_cache(movie_logic& _mlogic, command::group& _cmd);
+	slotinfo_cache(movie_logic& _mlogic, command::group& _cmd, input_queue& _iqueue);
+	~slotinfo_cache();
+/**
+ * Get description of save slot. Never waits for the slot to be read.
+ */
 	std::string get(const std::string& _filename);
 	void flush(const std::string& _filename);
 	void flush();
+/**
+ * Set file to keep descriptions in, empty for none.
+ */
+	void set_persist_file(const std::string& _filename);
 private:
-	std::map<std::string, std::string> cache;
+	struct entry
+	{
+		bool exists;
+		std::string identity;
+		std::string projectid;
+		uint64_t rerecords;
+		uint64_t current_frame;
+	};
+	slotinfo_cache(const slotinfo_cache&);
+	slotinfo_cache& operator=(const slotinfo_cache&);
+	void entry_point();
+	void read_persisted(threads::alock& h);
+	void write_persisted(threads::alock& h);
+	void check_changes(threads::alock& h);
+	//These are called with mlock held.
+	void start_worker();
+	void wake();
+	threads::lock mlock;
+	threads::cv cond;
+	std::map<std::string, entry> cache;
+	//Entries read from persist file, not checked yet.
+	std::map<std::string, entry> persisted;
+	std::set<std::string> requests;
+	//Incremented on each flush, results read before that are stale.
+	uint64_t generation;
+	std::string persist_file;
+	bool persist_changed;
+	bool quitting;
+	//Directory watches, by watch descriptor and by directory.
+	int watch_fd;
+	//Written to by wake(), so the worker can sleep until directories change.
+	int wake_fd;
+	std::map<int, std::string> watch_dirs;
+	std::set<std::string> watched;
+	threads::thread* worker;
 	movie_logic& mlogic;
 	command::group& cmd;
+	input_queue& iqueue;
 	command::_fnptr<> flushcmd;
 };
 
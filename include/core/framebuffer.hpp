@@ -8,6 +8,7 @@
 #include "library/triplebuffer.hpp"
 
 #include <stdexcept>
+#include <atomic>
 
 class subtitle_commentary;
 class memwatch_set;
@@ -33,6 +34,26 @@ public:
 	emu_framebuffer(subtitle_commentary& _subtitles, settingvar::group& _settings, memwatch_set& _mwatch,
 		keyboard::keyboard& _keyboard, emulator_dispatch& _dispatch, lua_state& _lua2, loaded_rom& _rom,
 		status_updater& _supdater, command::group& _cmd, input_queue& _iqueue);
+	~emu_framebuffer();
+/**
+ * How the next frame is output.
+ */
+	enum frameskip_mode
+	{
+		FS_DRAW,		//Drawn normally.
+		FS_SKIP,		//Not drawn, but kept in case it turns out to be the last frame before stopping.
+		FS_SKIP_PIXELS		//Not drawn, and the core need not output pixels.
+	};
+/**
+ * Frameskip statistics, counting only frames emulated while fast-forwarding.
+ */
+	struct frameskip_stats
+	{
+		uint64_t drawn;			//Number of frames drawn.
+		uint64_t skipped;		//Number of frames skipped.
+		uint64_t drawn_time;		//Total time taken by drawn frames in microseconds.
+		uint64_t skipped_time;		//Total time taken by skipped frames in microseconds.
+	};
 /**
  * The main framebuffer.
  */
@@ -42,7 +63,7 @@ public:
  */
 	static framebuffer::raw screen_corrupt;
 /**
- * The main screen to draw on.
+ * The composited screen picked up by last call to render_framebuffer(). Stays valid until the next call.
  */
 	framebuffer::fb<false> main_screen;
 /**
@@ -59,12 +80,54 @@ public:
  * Redraw the framebuffer, reusing contents from last redraw. Runs lua hooks if last redraw ran them.
  */
 	void redraw_framebuffer();
+/**
+ * Decide how the next frame is output. When fast-forwarding with no dumper active, frames are skipped while the
+ * display has not shown the last frame drawn yet, as it could not show them anyway.
+ *
+ * Parameter fast: Fast-forwarding or seeking.
+ * Parameter known_not_last: The next frame is known not to be the last one before stopping.
+ * Parameter dumping: A dumper is active.
+ * Returns: The mode for the next frame.
+ */
+	frameskip_mode begin_frame(bool fast, bool known_not_last, bool dumping);
+/**
+ * Output a frame received from core: either draw it, running Lua paint hooks, or skip it as decided by begin_frame().
+ *
+ * Returns: The frame, shared with the display. NULL if the core did not output pixels (FS_SKIP_PIXELS).
+ */
+	std::shared_ptr<const framebuffer::raw> output_frame(framebuffer::raw& screen);
+/**
+ * Get a frame received from core as shared frame, without displaying it. Frames in lent memory are not copied.
+ */
+	std::shared_ptr<const framebuffer::raw> share_frame(framebuffer::raw& screen) throw(std::bad_alloc);
+/**
+ * Signal end of frame started by begin_frame().
+ *
+ * Parameter usec: Time taken by the frame in microseconds.
+ */
+	void end_frame(uint64_t usec);
+/**
+ * Draw the last frame skipped, if it has not been superseded by a drawn frame.
+ */
+	void flush_skipped_frame();
+/**
+ * Lend memory for core to render the next frame into. Frames output from such memory are not copied.
+ *
+ * Parameter size: Size of memory needed in bytes.
+ * Returns: The memory. Stays valid until this has been called three more times.
+ */
+	char* lend_frame_memory(size_t size) throw(std::bad_alloc);
+/**
+ * Get frameskip statistics.
+ */
+	frameskip_stats get_frameskip_stats();
 /**
  * Return last complete framebuffer.
  */
-	framebuffer::raw get_framebuffer() throw(std::bad_alloc);
+	std::shared_ptr<const framebuffer::raw> get_framebuffer() throw();
 /**
- * Render framebuffer to main screen.
+ * Pick up the latest composited frame into main screen. Composition (scaling the frame and running the render
+ * queue) is done on a separate thread, started on the first call.
  */
 	void render_framebuffer();
 /**
@@ -82,13 +145,16 @@ public:
 /**
  * Get latest screen received from core.
  */
-	framebuffer::raw& render_get_latest_screen();
+	const framebuffer::raw& render_get_latest_screen();
 	void render_get_latest_screen_end();
 private:
 	void do_screenshot(command::arg_filename a);
+	void redraw_framebuffer(std::shared_ptr<const framebuffer::raw> todraw, bool no_lua, bool spontaneous);
+	void composite_frame();
+	class compositor;
 	struct render_info
 	{
-		framebuffer::raw fbuf;
+		std::shared_ptr<const framebuffer::raw> fbuf;
 		framebuffer::queue rq;
 		uint32_t hscl;
 		uint32_t vscl;
@@ -96,11 +162,37 @@ private:
 		uint32_t rgap;
 		uint32_t tgap;
 		uint32_t bgap;
+		uint64_t serial;
 	};
 	render_info buffer1;
 	render_info buffer2;
 	render_info buffer3;
 	triplebuffer::triplebuffer<render_info> buffering;
+	struct composed_frame
+	{
+		framebuffer::fb<false> screen;
+		uint32_t lgap;
+		uint32_t tgap;
+		uint64_t serial;
+	};
+	composed_frame composed1;
+	composed_frame composed2;
+	composed_frame composed3;
+	triplebuffer::triplebuffer<composed_frame> composing;
+	//The compositor thread, set before display_active.
+	compositor* comp;
+	std::atomic<bool> display_active;
+	//Held by display while it uses main screen.
+	bool composed_held;
+	framebuffer::raw_pool frames;
+	//Serial of last frame drawn, and last frame shown by display.
+	uint64_t drawn_serial;
+	std::atomic<uint64_t> displayed_serial;
+	frameskip_mode fs_mode;
+	bool fs_fast;
+	unsigned consecutive_skips;
+	std::shared_ptr<const framebuffer::raw> skipped_frame;
+	frameskip_stats fs_stats;
 	bool last_redraw_no_lua;
 	subtitle_commentary& subtitles;
 	settingvar::group& settings;
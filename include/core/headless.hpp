@@ -0,0 +1,53 @@
+#ifndef _headless__hpp__included__
+#define _headless__hpp__included__
+
+#include <string>
+#include <vector>
+#include <functional>
+
+struct loaded_rom;
+struct moviefile;
+
+/**
+ * Startup and shutdown shared by the frontends that play a movie without a window (lsnes-dumpavi,
+ * lsnes-verifystate).
+ */
+
+/**
+ * Initialize the system RNG and mark main() reached. Exits with status 1 if the RNG can't be initialized.
+ *
+ * Parameter argc: Argument count from main().
+ * Parameter argv: Arguments from main().
+ * Returns: The command line arguments, without the program name.
+ */
+std::vector<std::string> headless_startup(int argc, char** argv);
+/**
+ * Seed the random generator, and initialize the platform and Lua.
+ */
+void headless_init();
+/**
+ * Get the movie filename: the last command line argument that is not an option.
+ *
+ * Parameter cmdline: The command line arguments.
+ * Returns: The filename, or "" if none.
+ */
+std::string headless_movie_filename(const std::vector<std::string>& cmdline);
+/**
+ * Load the ROM for a movie and set the nominal framerate from it. Exits with status 1 if the ROM can't be loaded.
+ *
+ * Parameter movfn: The movie filename.
+ * Parameter cmdline: The command line arguments.
+ * Returns: The loaded ROM.
+ */
+loaded_rom headless_load_rom(const std::string& movfn, const std::vector<std::string>& cmdline);
+/**
+ * Load the movie and run it until the emulator quits, then shut down Lua and release the movie. Exits with status 1 on
+ * fatal error.
+ *
+ * Parameter r: The ROM loaded by headless_load_rom().
+ * Parameter movfn: The movie filename.
+ * Parameter on_start: Called with the movie after the ROM has been loaded with its settings, just before running.
+ */
+void headless_run(loaded_rom& r, const std::string& movfn, std::function<void(moviefile& mv)> on_start);
+
+#endif
@@ -1,10 +1,9 @@
 #ifndef _instance_map__hpp__included__
 #define _instance_map__hpp__included__
 
+#include "core/instance.hpp"
 #include <map>
 
-class emulator_instance;
-
 template<typename T> class instance_map
 {
 public:
@@ -71,4 +70,89 @@ private:
 	std::map<emulator_instance*, T*> instances;
 };
 
+/**
+ * Per-instance state, created on first use by the current instance (CORE()).
+ *
+ * This is meant for cores that support multiple instances: the lookup is cached per thread, so it is cheap enough
+ * to do on every access. The state of other than the main instance is freed when the instance is destroyed.
+ */
+template<typename T> class instance_state
+{
+public:
+/**
+ * Destroy the states.
+ */
+	~instance_state()
+	{
+		for(auto i : states)
+			delete i.second;
+		states.clear();
+	}
+/**
+ * Get the state of the current instance, creating it if needed.
+ */
+	T& operator()()
+	{
+		emulator_instance& inst = CORE();
+		cache_entry& c = cache();
+		if(c.owner == this && c.serial == inst.serial)
+			return *c.state;
+		T* state;
+		{
+			threads::alock h(lock);
+			if(states.count(inst.serial))
+				state = states[inst.serial];
+			else {
+				state = new T;
+				try {
+					states[inst.serial] = state;
+					if(&inst != &lsnes_instance) {
+						uint64_t serial = inst.serial;
+						inst.on_destroy([this, serial]() { this->destroy(serial); });
+					}
+				} catch(...) {
+					states.erase(inst.serial);
+					delete state;
+					throw;
+				}
+			}
+		}
+		c.owner = this;
+		c.serial = inst.serial;
+		c.state = state;
+		return *state;
+	}
+private:
+	struct cache_entry
+	{
+		instance_state<T>* owner;
+		uint64_t serial;
+		T* state;
+	};
+	static cache_entry& cache()
+	{
+		static thread_local cache_entry c = {NULL, 0, NULL};
+		return c;
+	}
+	void destroy(uint64_t serial)
+	{
+		T* state = NULL;
+		{
+			threads::alock h(lock);
+			if(states.count(serial)) {
+				state = states[serial];
+				states.erase(serial);
+			}
+		}
+		//The cache entry of this thread might still point to the state. Serials are not reused, so entries
+		//of other threads can never match it again.
+		cache_entry& c = cache();
+		if(c.owner == this && c.serial == serial)
+			c.owner = NULL;
+		delete state;
+	}
+	threads::lock lock;
+	std::map<uint64_t, T*> states;
+};
+
 #endif
@@ -2,6 +2,10 @@
 #define _instance__hpp__included__
 
 #include "library/threads.hpp"
+#include <functional>
+#include <list>
+#include <stdexcept>
+#include <string>
 
 class movie_logic;
 class memory_space;
@@ -30,6 +34,8 @@ class loaded_rom;
 class save_jukebox;
 class emulator_runmode;
 class status_updater;
+class state_hash_log;
+class input_search;
 namespace command { class group; }
 namespace lua { class state; }
 namespace settingvar { class group; }
@@ -127,16 +133,93 @@ struct emulator_instance
 	save_jukebox* jukebox;
 	emulator_runmode* runmode;
 	status_updater* supdater;
+	state_hash_log* statelog;
+	input_search* search;
 	threads::id emu_thread;
 	time_t random_seed_value;
+/**
+ * Serial number of the instance. Unlike the address, serial numbers are never reused.
+ */
+	uint64_t serial;
 	dtor_list D;
+/**
+ * Register a function to call when this instance is destroyed.
+ *
+ * The functions are called in reverse order of registration, before any of the instance objects are destroyed.
+ *
+ * Parameter fn: The function to call.
+ */
+	void on_destroy(std::function<void()> fn);
 private:
 	emulator_instance(const emulator_instance&);
 	emulator_instance& operator=(const emulator_instance&);
+	threads::lock destroy_lock;
+	std::list<std::function<void()>> destroy_fns;
 };
 
 extern emulator_instance lsnes_instance;
 
+/**
+ * Get the current emulator instance of the calling thread.
+ *
+ * Returns: The instance set by set_current_instance(), or the main instance if none.
+ */
 emulator_instance& CORE();
 
+/**
+ * Set the current emulator instance of the calling thread.
+ *
+ * Parameter inst: The new current instance, or NULL for the main instance.
+ * Returns: The previous current instance, or NULL if it was the main instance.
+ */
+emulator_instance* set_current_instance(emulator_instance* inst) throw();
+
+/**
+ * A headless emulator instance running in its own thread.
+ *
+ * The instance has no UI, and is the current instance (CORE()) in its thread. Only cores that can run in multiple
+ * instances (core_core::multi_instance()) can be loaded into it.
+ */
+class headless_instance
+{
+public:
+/**
+ * Create a new instance and start running a function in it.
+ *
+ * The instance is destroyed when the function returns.
+ *
+ * Parameter fn: The function to run. Gets the instance as parameter.
+ * Throws std::bad_alloc: Not enough memory.
+ * Throws std::runtime_error: Can't start thread.
+ */
+	headless_instance(std::function<void(emulator_instance& inst)> fn) throw(std::bad_alloc, std::runtime_error);
+/**
+ * Wait for the function to finish and destroy the thread.
+ */
+	~headless_instance() throw();
+/**
+ * Wait for the function to finish.
+ */
+	void join() throw();
+/**
+ * Has the function finished?
+ */
+	bool finished() throw();
+/**
+ * Get the error the function failed with.
+ *
+ * Returns: The error message, or "" if the function didn't fail (or hasn't finished).
+ */
+	std::string get_error() throw(std::bad_alloc);
+private:
+	headless_instance(const headless_instance&);
+	headless_instance& operator=(const headless_instance&);
+	void run(std::function<void(emulator_instance& inst)> fn);
+	threads::lock lock;
+	threads::thread* thread;
+	bool done;
+	bool joined;
+	std::string error;
+};
+
 #endif
@@ -38,10 +38,17 @@ public:
 	bool collection_loaded();
 	std::list<playback_stream_info> get_stream_info();
 	void play_stream(uint64_t id);
+/**
+ * Export, import and superstream export run in background, in parallel where the format needs transcoding. Only one
+ * can run at a time. Progress is signaled via voice_job_progress and completion via voice_job_finish (and imported
+ * streams via voice_stream_change).
+ */
 	void export_stream(uint64_t id, const std::string& filename, external_stream_format fmt);
-	uint64_t import_stream(uint64_t ts, const std::string& filename, external_stream_format fmt);
+	void import_stream(uint64_t ts, const std::string& filename, external_stream_format fmt);
 	void delete_stream(uint64_t id);
 	void export_superstream(const std::string& filename);
+	bool job_running();
+	void cancel_job();
 	void load_collection(const std::string& filename);
 	void unload_collection();
 	void alter_timebase(uint64_t id, uint64_t ts);
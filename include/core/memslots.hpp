@@ -0,0 +1,132 @@
+#ifndef _memslots__hpp__included__
+#define _memslots__hpp__included__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include "library/threads.hpp"
+
+struct moviefile;
+struct core_type;
+
+/**
+ * In-memory save slots ($MEMORY:<name>), and cache of savestate files recently saved or loaded.
+ *
+ * When the slots take more memory than the budget, the core states, host memories and screenshots of least recently
+ * used slots are compressed. If that is not enough, cached files are dropped and then save slots are spilled to
+ * disk. SRAMs, initial RAM contents and anchor savestates identical between slots are only stored once. The input,
+ * branches and subtitles each slot keeps count against the budget too, but are only freed by dropping cached files.
+ */
+class memory_slots
+{
+public:
+/**
+ * Statistics.
+ */
+	struct stats
+	{
+		size_t slots;		//Number of slots.
+		size_t files;		//Number of cached files.
+		size_t compressed;	//Number of slots and files compressed in memory.
+		size_t spilled;		//Number of slots spilled to disk.
+		uint64_t state_bytes;	//Memory used by core states, host memories, screenshots and input.
+		uint64_t shared_bytes;	//Memory used by deduplicated data.
+		uint64_t budget;	//Memory budget.
+	};
+/**
+ * Get the slots.
+ */
+	static memory_slots& singleton();
+/**
+ * Store a copy of movie into slot, replacing anything already there.
+ *
+ * Parameter slot: The slot name.
+ * Parameter mv: The movie.
+ * Throws std::bad_alloc: Not enough memory.
+ */
+	void put(const std::string& slot, const moviefile& mv) throw(std::bad_alloc);
+/**
+ * Copy movie from slot.
+ *
+ * Parameter slot: The slot name.
+ * Parameter mv: The movie to copy to.
+ * Throws std::bad_alloc: Not enough memory.
+ * Throws std::runtime_error: No such slot, or reading it back from disk failed.
+ */
+	void get(const std::string& slot, moviefile& mv) throw(std::bad_alloc, std::runtime_error);
+/**
+ * Call function with movie in slot, without the data that may be compressed or deduplicated (core state, host
+ * memory, screenshot, SRAMs, initial RAM contents and anchor savestate).
+ *
+ * Parameter slot: The slot name.
+ * Parameter fn: The function to call.
+ * Throws std::runtime_error: No such slot.
+ */
+	void peek(const std::string& slot, std::function<void(const moviefile& mv)> fn) throw(std::runtime_error);
+/**
+ * Identify a file, by everything that changes if the file is replaced or written to.
+ *
+ * Parameter filename: The file.
+ * Parameter romtype: The type of ROM the file is to be read with.
+ * Returns: The identity, or empty string if file can't be accessed.
+ */
+	static std::string file_identity(const std::string& filename, core_type& romtype) throw(std::bad_alloc);
+/**
+ * Cache a copy of movie as contents of file.
+ *
+ * Parameter filename: The file.
+ * Parameter identity: Identity of the file, from file_identity().
+ * Parameter mv: The movie.
+ * Parameter fixup: If not empty, called with the copy to make it match what would be read from the file.
+ * Throws std::bad_alloc: Not enough memory.
+ */
+	void put_file(const std::string& filename, const std::string& identity, const moviefile& mv,
+		std::function<void(moviefile& mv)> fixup = std::function<void(moviefile& mv)>()) throw(std::bad_alloc);
+/**
+ * Copy movie from file cache.
+ *
+ * Parameter filename: The file.
+ * Parameter identity: Current identity of the file, from file_identity().
+ * Parameter mv: The movie to copy to.
+ * Returns: True if copied, false if the file is not cached or has changed since.
+ * Throws std::bad_alloc: Not enough memory.
+ */
+	bool get_file(const std::string& filename, const std::string& identity, moviefile& mv) throw(std::bad_alloc);
+/**
+ * Drop file from cache.
+ *
+ * Parameter filename: The file.
+ */
+	void drop_file(const std::string& filename) throw();
+/**
+ * Get statistics.
+ */
+	stats get_stats() throw();
+private:
+	struct slot;
+	typedef std::shared_ptr<const std::vector<char>> shared_blob;
+	memory_slots();
+	~memory_slots();
+	memory_slots(const memory_slots&);
+	memory_slots& operator=(const memory_slots&);
+	slot& lookup(const std::string& name) throw(std::runtime_error);
+	slot* make_slot(const moviefile& mv) throw(std::bad_alloc);
+	void restore(slot& s, moviefile& mv) throw(std::bad_alloc, std::runtime_error);
+	void replace(std::map<std::string, slot*>& in, const std::string& name, slot* s) throw();
+	shared_blob intern(const std::string& key, const std::vector<char>& data) throw(std::bad_alloc);
+	void enforce_budget(uint64_t budget) throw();
+	uint64_t memory_use() throw();
+	threads::lock mlock;
+	std::map<std::string, slot*> slots;
+	std::map<std::string, slot*> files;
+	//Possible duplicates by key and size, most recently used first.
+	std::map<std::pair<std::string, size_t>, std::vector<std::weak_ptr<const std::vector<char>>>> pool;
+	uint64_t shared_bytes;
+	uint64_t last_budget;
+	uint64_t use_counter;
+};
+
+#endif
@@ -89,12 +89,22 @@ public:
  * Release memory for mov, mf and rrd.
  */
 	void release_memory();
+/**
+ * Set the controls input_poll() returns when there is no movie.
+ *
+ * Headless instances run without a movie, and feed their input using this.
+ *
+ * parameter controls: The controls.
+ */
+	void set_headless_controls(const portctrl::frame& controls) throw();
 private:
 	movie_logic(const movie_logic&);
 	movie_logic& operator=(const movie_logic&);
 	movie* mov;
 	moviefile* mf;
 	rrdata_set* rrd;
+	portctrl::frame headless_controls;
+	bool have_headless_controls;
 };
 
 #endif
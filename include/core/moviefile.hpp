@@ -285,11 +285,6 @@ struct moviefile
  * returns: Length of the movie in milliseconds.
  */
 	uint64_t get_movie_length() throw();
-/**
- * Return reference to memory slot.
- */
-	static moviefile*& memref(const std::string& slot);
-
 /**
  * Copy data.
  */
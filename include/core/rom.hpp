@@ -99,6 +99,10 @@ struct loaded_rom
  * Get MSU-1 base fileaname.
  */
 	const std::string& get_msu1_base() { return image->get_msu1_base(); }
+/**
+ * Get handle to the ROM image set.
+ */
+	rom_image_handle get_image() { return image; }
 	//ROM methods.
 	std::string get_core_identifier() { return rtype().get_core_identifier(); }
 	std::pair<uint32_t, uint32_t> get_scale_factors(uint32_t width, uint32_t height)
@@ -154,6 +158,7 @@ struct loaded_rom
 	{
 		rtype().debug_reset();
 	}
+	void set_render_skip(bool skip) { rtype().set_render_skip(skip); }
 	//Region methods.
 	const std::string& orig_region_get_iname() { return image->get_region().get_iname(); }
 	const std::string& orig_region_get_hname() { return image->get_region().get_hname(); }
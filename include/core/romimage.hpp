@@ -220,6 +220,7 @@ private:
 
 void record_filehash(const std::string& file, uint64_t prefix, const std::string& hash);
 void set_hasher_callback(std::function<void(uint64_t, uint64_t)> cb);
+std::list<std::pair<std::string, uint64_t>> lookup_files_by_hash(const std::string& hash);
 rom_image_handle construct_rom(const std::string& movie_filename, const std::vector<std::string>& cmdline);
 
 //Map of preferred cores for each extension and type.
@@ -0,0 +1,76 @@
+#ifndef _search__hpp__included__
+#define _search__hpp__included__
+
+#include "library/command.hpp"
+#include <cstdint>
+#include <string>
+
+class loaded_rom;
+class movie_logic;
+class memory_space;
+class emulator_dispatch;
+class input_queue;
+
+/**
+ * Beam search over controller input, run on headless worker instances.
+ *
+ * The search starts from the current core state. Each step tries every combination of a set of buttons held for
+ * a fixed number of frames, on each candidate kept from the previous step. Resulting states with equal hash are
+ * only explored once, and the candidates with the highest fitness (an expression over memory) are kept. When
+ * the search finishes, the best input sequences are added as movie branches forked at the current frame.
+ *
+ * The search is described by a JSON file with the following fields:
+ * - buttons: Array of "<controller> <button>" (controller numbered from 1). Mandatory, at most 12 entries.
+ * - fitness: Expression to maximize. Variables are written as $name. Mandatory.
+ * - vars: Object mapping variable names to memory reads "<type> <address>", with the type letters of memory
+ *   watches (b/B, w/W, o/O, d/D, q/Q, f/F).
+ * - steps: Number of steps to search (default 10).
+ * - hold: Number of frames each combination is held (default 1).
+ * - beam: Number of candidates kept each step (default 16).
+ * - results: Number of branches to create (default 1).
+ * - threads: Number of worker instances (default: number of CPUs).
+ * - branch: Prefix of names of branches to create (default "search").
+ */
+class input_search
+{
+public:
+/**
+ * Ctor.
+ */
+	input_search(loaded_rom& _rom, movie_logic& _mlogic, memory_space& _memory, emulator_dispatch& _dispatch,
+		input_queue& _iqueue, command::group& _cmd);
+/**
+ * Dtor. Aborts any search in progress.
+ */
+	~input_search();
+/**
+ * Start a search.
+ *
+ * Parameter filename: The JSON file describing the search.
+ * Throws std::runtime_error: Bad search description, search already running or core can't run headless.
+ */
+	void start(const std::string& filename);
+/**
+ * Abort the search in progress. No branches are created.
+ */
+	void stop();
+/**
+ * Is a search in progress?
+ */
+	bool running() { return job != NULL; }
+private:
+	struct search_job;
+	void finish(search_job* j);
+	loaded_rom& rom;
+	movie_logic& mlogic;
+	memory_space& memory;
+	emulator_dispatch& dispatch;
+	input_queue& iqueue;
+	command::group& cmd;
+	search_job* job;
+	uint64_t generation;
+	command::_fnptr<command::arg_filename> startcmd;
+	command::_fnptr<> stopcmd;
+};
+
+#endif
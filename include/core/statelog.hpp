@@ -0,0 +1,110 @@
+#ifndef _statelog__hpp__included__
+#define _statelog__hpp__included__
+
+#include "library/command.hpp"
+#include <cstdint>
+#include <fstream>
+#include <map>
+
+class loaded_rom;
+class movie_logic;
+
+/**
+ * Log of emulator state hashes, one record per emulated frame.
+ *
+ * The log file is 8-byte magic followed by 16-byte records: the frame number and first 8 bytes of SHA-256 of the
+ * core state, both big-endian. If the same frame appears multiple times (due to loading states while logging),
+ * the last record wins.
+ */
+class state_hash_log
+{
+public:
+/**
+ * Verification status.
+ */
+	enum verify_status
+	{
+		V_NONE,		//Not verifying.
+		V_RUNNING,	//Verification in progress.
+		V_MATCH,	//All logged frames matched.
+		V_DESYNC	//Found a frame that differs.
+	};
+/**
+ * Ctor.
+ */
+	state_hash_log(loaded_rom& _rom, movie_logic& _mlogic, command::group& _cmd);
+/**
+ * Dtor.
+ */
+	~state_hash_log();
+/**
+ * Start logging state hashes.
+ *
+ * Parameter filename: The file to log to. Overwritten if it exists.
+ * Parameter quit_after: If nonzero, quit the emulator after logging this frame.
+ * Throws std::runtime_error: Can't open the file.
+ */
+	void start(const std::string& filename, uint64_t quit_after = 0);
+/**
+ * Stop logging state hashes.
+ */
+	void stop();
+/**
+ * Start verifying against logged state hashes.
+ *
+ * Only every <interval>th logged frame is checked at first. Each checked frame that matches is saved as
+ * checkpoint, and when a checked frame differs, the last checkpoint is loaded and every frame is checked from
+ * there to find the exact frame.
+ *
+ * Parameter filename: The log to verify against.
+ * Parameter interval: Checkpoint interval in frames.
+ * Parameter quit_when_done: If true, quit the emulator when verification finishes.
+ * Throws std::runtime_error: Can't read the log.
+ */
+	void verify(const std::string& filename, uint64_t interval = 1000, bool quit_when_done = false);
+/**
+ * Get verification status.
+ */
+	verify_status get_verify_status() { return vstatus; }
+/**
+ * Get the first frame found to differ. Only valid if status is V_DESYNC.
+ */
+	uint64_t get_desync_frame() { return desync_frame; }
+/**
+ * Notify that a frame has been emulated.
+ */
+	void frame_emulated();
+/**
+ * Compute hash of the current core state.
+ */
+	static uint64_t state_hash(loaded_rom& rom);
+/**
+ * Read a state hash log.
+ *
+ * Parameter filename: The file to read.
+ * Returns: Map from frame number to state hash.
+ * Throws std::runtime_error: Can't read the log.
+ */
+	static std::map<uint64_t, uint64_t> read(const std::string& filename);
+private:
+	void finish_verify(verify_status status, uint64_t frame);
+	loaded_rom& rom;
+	movie_logic& mlogic;
+	command::group& cmd;
+	std::ofstream* out;
+	uint64_t unflushed;
+	uint64_t quit_after;
+	verify_status vstatus;
+	std::map<uint64_t, uint64_t> reference;
+	uint64_t interval;
+	bool fine;
+	bool have_checkpoint;
+	uint64_t checkpoint_frame;
+	uint64_t desync_frame;
+	bool quit_when_done;
+	command::_fnptr<command::arg_filename> startcmd;
+	command::_fnptr<> stopcmd;
+	command::_fnptr<command::arg_filename> verifycmd;
+};
+
+#endif
@@ -275,6 +275,24 @@ struct lsnes_core_enumerate_cores
 	void (*remove_disasm)(void* handle);
 	//Input: Render text into bitmap. Returns 0 on success, -1 on failure. Only available if emu_flags>=2.
 	int (*render_text)(struct lsnes_core_fontrender_req* req);
+	//Input: Lend a buffer to render next frame into. Only available if emu_flags1>=3.
+	//type => Pixel format.
+	//physwidth => Physical width of the buffer.
+	//physheight => Physical height of the buffer.
+	//physstride => Filled with physical stride of the buffer (in bytes).
+	//Returns the buffer, or NULL on failure. Submit it with submit_frame as usual, the emulator then uses the frame
+	//without copying it. The buffer remains valid until get_frame_buffer has been called two more times, so the core
+	//may keep the previous frame for redraws. Don't write into a buffer after submitting it.
+	char* (*get_frame_buffer)(enum lsnes_core_pixel_format type, size_t physwidth, size_t physheight,
+		size_t* physstride);
+	//Input: Lend space in sound buffer to write stereo samples (L, R interleaved) into. Only available if
+	//emu_flags1>=3.
+	//count => Maximum number of samples wanted. Filled with number of samples that fit. This may be less than
+	//requested (the space wraps around) or 0 if the buffer is full. Then use submit_sound for the rest.
+	//Returns pointer to the space.
+	int16_t* (*get_sound_buffer)(size_t* count);
+	//Input: Submit samples written into space from get_sound_buffer. Only available if emu_flags1>=3.
+	void (*commit_sound)(size_t count, double rate);
 };
 
 //Request 1: Request information about core.
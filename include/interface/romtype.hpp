@@ -362,6 +362,8 @@ struct core_core
 	std::vector<std::string> get_trace_cpus();
 	void debug_reset();
 	bool isnull() const;
+	bool multi_instance() const;
+	void set_render_skip(bool skip);
 	void reset_to_load() { c_reset_to_load(); }
 	bool safe_to_unload(loadlib::module& mod) { return !mod.is_marked(this); }
 protected:
@@ -539,6 +541,16 @@ protected:
  * Is null core (only NULL core should define this).
  */
 	virtual bool c_isnull() const;
+/**
+ * Can the core run in several emulator instances at once (keeps no global mutable state)?
+ */
+	virtual bool c_multi_instance() const;
+/**
+ * Set if following frames are going to be displayed (or dumped). If not, core may skip rendering them.
+ *
+ * The default does nothing.
+ */
+	virtual void c_set_render_skip(bool skip);
 private:
 	std::vector<portctrl::type*> port_types;
 	bool hidden;
@@ -623,6 +635,7 @@ public:
 	std::vector<std::string> get_trace_cpus() { return core->get_trace_cpus(); }
 	void debug_reset() { core->debug_reset(); }
 	bool isnull() const { return core->isnull(); }
+	void set_render_skip(bool skip) { core->set_render_skip(skip); }
 	void reset_to_load() { return core->reset_to_load(); }
 	bool safe_to_unload(loadlib::module& mod) const { return core->safe_to_unload(mod); }
 protected:
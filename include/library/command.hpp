@@ -7,6 +7,7 @@
 #include <set>
 #include <map>
 #include <list>
+#include <cstdint>
 
 namespace command
 {
@@ -289,6 +290,106 @@ struct arg_filename
 	operator std::string() { return v; }
 };
 
+/**
+ * Precompiled argument signature.
+ *
+ * The signature is compiled once on construction. Parsing arguments against it does not allocate memory.
+ *
+ * The signature is a space-separated list of fields:
+ * - 'word': A token not containing whitespace.
+ * - 'int': A signed decimal integer.
+ * - 'uint': An unsigned decimal integer.
+ * - 'rest': Rest of the arguments (possibly empty). Must be the last field.
+ *
+ * A field prefixed with '?' is optional. Optional fields may only be followed by other optional fields.
+ */
+class signature
+{
+public:
+/**
+ * Maximum number of fields in signature.
+ */
+	const static size_t max_fields = 8;
+/**
+ * Result of parsing.
+ *
+ * Note: Refers to the argument string passed to parse, so that must stay alive while this is used.
+ */
+	class result
+	{
+	public:
+/**
+ * Get number of fields present.
+ */
+		size_t count() const throw() { return fields; }
+/**
+ * Is field present?
+ */
+		bool present(size_t i) const throw() { return i < fields; }
+/**
+ * Get field as string.
+ *
+ * Returns: The field, or empty string if not present.
+ */
+		std::string str(size_t i) const throw(std::bad_alloc);
+/**
+ * Get value of int field.
+ *
+ * Returns: The value, or 0 if not present.
+ */
+		int64_t get_int(size_t i) const throw() { return present(i) ? value[i].i : 0; }
+/**
+ * Get value of uint field.
+ *
+ * Returns: The value, or 0 if not present.
+ */
+		uint64_t get_uint(size_t i) const throw() { return present(i) ? value[i].u : 0; }
+	private:
+		friend class signature;
+		const char* base;
+		size_t fields;
+		size_t start[max_fields];
+		size_t length[max_fields];
+		union { int64_t i; uint64_t u; } value[max_fields];
+	};
+/**
+ * Compile a signature.
+ *
+ * Parameter spec: The signature specification.
+ * Parameter err: The error to throw from parse_or_throw(), NULL for generic message.
+ * Throws std::runtime_error: Bad signature.
+ */
+	signature(const char* spec, const char* err = NULL) throw(std::bad_alloc, std::runtime_error);
+/**
+ * Parse arguments.
+ *
+ * Parameter args: The arguments.
+ * Parameter res: The result is written here.
+ * Returns: True if arguments match, false otherwise.
+ */
+	bool parse(const std::string& args, result& res) const throw();
+/**
+ * Parse arguments, throwing if they don't match.
+ *
+ * Parameter args: The arguments.
+ * Parameter res: The result is written here.
+ * Throws std::runtime_error: Arguments don't match.
+ */
+	void parse_or_throw(const std::string& args, result& res) const throw(std::runtime_error);
+private:
+	enum field_type
+	{
+		F_WORD,
+		F_INT,
+		F_UINT,
+		F_REST
+	};
+	field_type types[max_fields];
+	size_t nfields;
+	size_t nmandatory;
+	const char* errmsg;
+};
+
 /**
  * Run command function helper.
  *
@@ -379,6 +480,67 @@ private:
 	std::string help;
 };
 
+/**
+ * Wrap function taking parsed arguments as command.
+ */
+class _sigfnptr : public base
+{
+public:
+/**
+ * Create a new command.
+ *
+ * parameter _group: The group command will be part of.
+ * parameter _name: Name, description and help for the command.
+ * parameter _sig: The argument signature (see class signature).
+ * parameter _err: Error message to print on bad arguments, NULL for generic message.
+ * parameter _fn: Function to call on command.
+ */
+	_sigfnptr(group& _group, stub _name, const char* _sig, const char* _err,
+		std::function<void(const signature::result& a)> _fn) throw(std::bad_alloc, std::runtime_error)
+		: base(_group, _name.name, false), sig(_sig, _err)
+	{
+		shorthelp = _name.desc;
+		help = _name.help;
+		fn = _fn;
+	}
+/**
+ * Destroy a commnad.
+ */
+	~_sigfnptr() throw()
+	{
+	}
+/**
+ * Invoke a command.
+ *
+ * parameter a: Arguments to function.
+ */
+	void invoke(const std::string& a) throw(std::bad_alloc, std::runtime_error)
+	{
+		signature::result r;
+		sig.parse_or_throw(a, r);
+		fn(r);
+	}
+/**
+ * Get short description.
+ */
+	std::string get_short_help() throw(std::bad_alloc)
+	{
+		return shorthelp;
+	}
+/**
+ * Get long help.
+ */
+	std::string get_long_help() throw(std::bad_alloc)
+	{
+		return help;
+	}
+private:
+	signature sig;
+	std::function<void(const signature::result& a)> fn;
+	std::string shorthelp;
+	std::string help;
+};
+
 /**
  * Function pointer command factory.
  */
@@ -0,0 +1,32 @@
+#ifndef _library__cpufeatures__hpp__included__
+#define _library__cpufeatures__hpp__included__
+
+#include "arch-detect.hpp"
+
+/**
+ * Compiler can build code for instruction set extensions not enabled globally (via target attribute), and
+ * select between them at runtime.
+ */
+#if defined(ARCH_IS_I386) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define ARCH_HAS_X86_DISPATCH
+#endif
+
+namespace cpufeatures
+{
+/**
+ * Does the CPU support SHA extensions (together with SSSE3 and SSE4.1)?
+ */
+bool has_sha();
+/**
+ * Does the CPU and OS support AVX2?
+ */
+bool has_avx2();
+/**
+ * Disable (or re-enable) use of all instruction set extensions, making the above report no support.
+ *
+ * Used to compare the portable code against the accelerated versions.
+ */
+void set_disabled(bool disabled);
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <set>
 #include <string>
 #include <cstdlib>
+#include <cstdint>
 
 namespace directory
 {
@@ -11,6 +12,14 @@ std::set<std::string> enumerate(const std::string& dir, const std::string& match
 std::string absolute_path(const std::string& relative);
 uintmax_t size(const std::string& path);
 time_t mtime(const std::string& path);
+uint64_t inode(const std::string& path);
+/**
+ * Get string identifying file contents: it changes if the file is replaced or written to.
+ *
+ * Parameter path: The file.
+ * Returns: The identity, or empty string if the file can't be accessed.
+ */
+std::string identity(const std::string& path);
 bool exists(const std::string& filename);
 bool is_regular(const std::string& filename);
 bool is_directory(const std::string& filename);
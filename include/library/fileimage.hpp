@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <list>
 #include <vector>
+#include <map>
 #include "threads.hpp"
 
 namespace fileimage
@@ -73,8 +74,76 @@ private:
 	hash* hasher;
 };
 
+/**
+ * Persistent database of file hashes.
+ *
+ * Entries are keyed by absolute filename and prefix length, and are only considered valid if the size,
+ * modification time and inode number of the file still match. The database is an append-only text file
+ * which is compacted on load when it has accumulated enough stale records.
+ */
+class hashcache
+{
+public:
+/**
+ * Create a cache that is not backed by a file.
+ */
+	hashcache();
+/**
+ * Set the backing file, loading any existing entries from it.
+ *
+ * Parameter filename: The database file. Empty string for none.
+ */
+	void set_file(const std::string& filename);
+/**
+ * Look up a hash.
+ *
+ * Parameter filename: The file to look up.
+ * Parameter prefix: The prefix length.
+ * Returns: The hash, or empty string if not known or stale.
+ */
+	std::string lookup(const std::string& filename, uint64_t prefix);
+/**
+ * Record a hash.
+ *
+ * Parameter filename: The file hashed.
+ * Parameter prefix: The prefix length.
+ * Parameter value: The hash.
+ */
+	void store(const std::string& filename, uint64_t prefix, const std::string& value);
+/**
+ * Find files with given hash. Stale entries are not returned.
+ *
+ * Parameter value: The hash to search for.
+ * Returns: List of (filename, prefix) pairs.
+ */
+	std::list<std::pair<std::string, uint64_t>> lookup_by_hash(const std::string& value);
+private:
+	struct entry
+	{
+		uint64_t size;
+		time_t mtime;
+		uint64_t inode;
+		std::string hash;
+	};
+	typedef std::pair<std::string, uint64_t> key_t;
+	bool is_fresh(const std::string& filename, const entry& e);
+	void insert(const key_t& key, const entry& e);
+	void erase(const key_t& key);
+	void append(const key_t& key, const entry& e);
+	void compact();
+	hashcache(const hashcache&);
+	hashcache& operator=(const hashcache&);
+	threads::lock mlock;
+	std::string dbfile;
+	std::map<key_t, entry> entries;
+	std::multimap<std::string, key_t> by_hash;
+	uint64_t records;
+};
+
 /**
  * Class performing SHA-256 hashing.
+ *
+ * Files are hashed in parallel by a pool of worker threads.
  */
 class hash
 {
@@ -99,6 +168,14 @@ public:
  * Compute SHA-256 of file.
  */
 	hashval operator()(const std::string& filename, std::function<uint64_t(uint64_t)> prefixlen);
+/**
+ * Set the persistent hash cache database file.
+ */
+	void set_cache_file(const std::string& filename);
+/**
+ * Find files with known hash from the cache database.
+ */
+	std::list<std::pair<std::string, uint64_t>> lookup_by_hash(const std::string& value);
 /**
  * Thread entrypoint.
  */
@@ -106,8 +183,10 @@ public:
 private:
 	void link(hashval& future);
 	void unlink(hashval& future);
-	void send_callback(uint64_t this_completed);
+	void send_callback();
 	void send_idle();
+	void resolve_all(unsigned cbid, const std::string& hash, uint64_t prefix);
+	void resolve_error_all(unsigned cbid, const std::string& err);
 
 	friend class hashval;
 	struct queue_job
@@ -117,14 +196,17 @@ private:
 		uint64_t size;
 		unsigned cbid;
 		volatile unsigned interested;
+		bool running;
 	};
 	hash(const hash&);
 	hash& operator=(const hash&);
-	threads::thread* hash_thread;
+	std::vector<threads::thread*> hash_threads;
 	threads::lock mlock;
 	threads::cv condition;
 	std::list<queue_job> queue;
-	std::list<queue_job>::iterator current_job;
+	hashcache cache;
+	unsigned busy;
+	uint64_t completed;
 	hashval* first_future;
 	hashval* last_future;
 	unsigned next_cbid;
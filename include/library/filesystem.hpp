@@ -2,6 +2,7 @@
 #define _library__filesystem__hpp__included
 
 #include <cstdint>
+#include <list>
 #include <map>
 #include <string>
 #include <fstream>
@@ -12,9 +13,13 @@
 #define SUPERCLUSTER_SIZE (static_cast<uint64_t>(CLUSTER_SIZE) * CLUSTERS_PER_SUPER)
 #define FILESYSTEM_SUPERBLOCK 1
 #define FILESYSTEM_ROOTDIR 2
+#define FILESYSTEM_CACHE_CLUSTERS 256
 
 /**
  * A filesystem.
+ *
+ * Recently used clusters are cached in memory (up to FILESYSTEM_CACHE_CLUSTERS). Writes go through to backing file
+ * immediately.
  */
 class filesystem
 {
@@ -206,6 +211,8 @@ private:
 	filesystem(const filesystem&);
 	filesystem& operator=(const filesystem&);
 	void link_cluster(uint32_t cluster, uint32_t linkto);
+	char* cluster_data(uint32_t cluster);
+	void cache_invalidate(uint32_t cluster);
 	struct supercluster
 	{
 		unsigned free_clusters;
@@ -213,8 +220,15 @@ private:
 		void load(std::fstream& s, uint32_t index);
 		void save(std::fstream& s, uint32_t index);
 	};
+	struct cached_cluster
+	{
+		char data[CLUSTER_SIZE];
+		std::list<uint32_t>::iterator lru;
+	};
 	uint32_t supercluster_count;
 	std::map<uint32_t, supercluster> superclusters;
+	std::map<uint32_t, cached_cluster> cache;
+	std::list<uint32_t> cache_lru;
 	std::fstream backing;
 };
 
@@ -8,7 +8,10 @@
 #include <iostream>
 #include <stdexcept>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include "framebuffer.hpp"
+#include "threads.hpp"
 
 namespace framebuffer
 {
@@ -28,6 +31,22 @@ public:
 		void render(uint8_t* buf, size_t stride, uint32_t u, uint32_t v, uint32_t w, uint32_t h) const;
 		void dump(std::ostream& s) const;
 	};
+/**
+ * A laid out string.
+ */
+	struct run
+	{
+		struct entry
+		{
+			uint32_t x;		//X position relative to start.
+			uint32_t y;		//Y position relative to start.
+			const glyph* g;		//The glyph.
+		};
+		std::vector<entry> glyphs;	//Glyphs to draw, in order.
+		uint32_t width;			//Width of bounding box.
+		uint32_t height;		//Height of bounding box.
+		uint32_t advance_y;		//Total vertical advance from newlines.
+	};
 	font2();
 	font2(const std::string& file);
 	font2(struct font& bfont);
@@ -39,10 +58,32 @@ public:
 	std::pair<uint32_t, uint32_t>  get_metrics(const std::u32string& str, uint32_t xalign) const;
 	void for_each_glyph(const std::u32string& str, uint32_t xalign, std::function<void(uint32_t x, uint32_t y,
 		const glyph& g)> cb) const;
+/**
+ * Get layout of string. Recently used layouts are cached, so this is cheap for strings drawn every frame.
+ *
+ * Parameter str: The string.
+ * Parameter xalign: The x alignment (only affects tabs).
+ * Returns: The layout. Stays valid until the glyphs of font are changed.
+ */
+	std::shared_ptr<const run> get_run(const std::u32string& str, uint32_t xalign) const
+		throw(std::bad_alloc);
+/**
+ * Render a laid out string to bitmap, one byte per pixel (1 for set, 0 for clear).
+ *
+ * Parameter r: The layout.
+ * Parameter buf: The buffer to render on, must be large enough to hold the bounding box.
+ * Parameter stride: The stride on buffer.
+ */
+	void render_run(const run& r, uint8_t* buf, size_t stride) const throw();
 	void dump(const std::string& file) const;
 private:
+	font2(const font2&);
+	font2& operator=(const font2&);
 	std::map<std::u32string, glyph> glyphs;
 	unsigned rowadvance;
+	mutable threads::lock runs_lock;
+	//Key is alignment followed by the string.
+	mutable std::unordered_map<std::u32string, std::shared_ptr<const run>> runs;
 };
 }
 #endif
@@ -7,6 +7,9 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 #include "framebuffer-pixfmt.hpp"
 #include "threads.hpp"
 #include "memtracker.hpp"
@@ -134,14 +137,14 @@ struct raw
  *
  * parameter data: The vector to write the data to (in format compatible with load()).
  */
-	void save(std::vector<char>& data) throw(std::bad_alloc);
+	void save(std::vector<char>& data) const throw(std::bad_alloc);
 /**
  * Save contents of framebuffer as a PNG.
  *
  * parameter file: The filename to save to.
  * throws std::runtime_error: Can't save the PNG.
  */
-	void save_png(const std::string& file) throw(std::bad_alloc, std::runtime_error);
+	void save_png(const std::string& file) const throw(std::bad_alloc, std::runtime_error);
 /**
  * Get width.
  *
@@ -179,6 +182,54 @@ private:
 	size_t stride;			//Stride in pixels.
 	size_t allocated;		//Amount of memory allocated (only meaningful if user_memory=true).
 	template<bool X> friend class fb;
+	friend class raw_pool;
+};
+
+/**
+ * Pool of framebuffers.
+ *
+ * Frames are handed out as shared read-only handles, so they can be passed around without copying. A frame is reused
+ * once nothing but the pool references it anymore.
+ *
+ * The pool can also lend memory to render frames into. Frames in lent memory are handed out without copying.
+ */
+class raw_pool
+{
+public:
+/**
+ * Create a new pool.
+ *
+ * Parameter max_frames: Maximum number of frames to keep for reuse.
+ */
+	raw_pool(size_t max_frames = 6) throw();
+/**
+ * Copy a framebuffer into a frame from the pool.
+ *
+ * If src is in memory returned by lend(), it is not copied. The handle refers to the lent memory instead, and the
+ * memory is not lent again while the handle exists.
+ *
+ * Parameter src: The framebuffer to copy.
+ * Returns: Handle to the copy.
+ */
+	std::shared_ptr<const raw> make_copy(const raw& src) throw(std::bad_alloc);
+/**
+ * Lend memory to render a frame into.
+ *
+ * The memory stays valid until lend() has been called three more times. It is never memory referenced by a handle.
+ *
+ * Parameter size: Size of memory needed in bytes.
+ * Returns: The memory.
+ */
+	char* lend(size_t size) throw(std::bad_alloc);
+private:
+	raw_pool(const raw_pool&);
+	raw_pool& operator=(const raw_pool&);
+	threads::lock lock;
+	std::vector<std::shared_ptr<raw>> frames;
+	std::vector<std::shared_ptr<std::vector<char>>> lent;
+	std::shared_ptr<std::vector<char>> last_lent[3];
+	unsigned last_lent_next;
+	size_t max_frames;
 };
 
 
@@ -255,7 +306,7 @@ struct fb
  * parameter hscale Horizontal scale factor.
  * parameter vscale Vertical scale factor.
  */
-	void copy_from(raw& scr, size_t hscale, size_t vscale) throw();
+	void copy_from(const raw& scr, size_t hscale, size_t vscale) throw();
 
 /**
  * Get pointer into specified row.
@@ -376,6 +427,11 @@ struct object
  * Clone the object.
  */
 	virtual void clone(struct queue& q) const throw(std::bad_alloc) = 0;
+/**
+ * Clone the object, copying whatever it draws from that its owner may change or free. The copy can be drawn and
+ * destroyed on another thread. Default is to clone().
+ */
+	virtual void snapshot(struct queue& q) throw(std::bad_alloc);
 };
 
 /**
@@ -481,6 +537,21 @@ struct color_mod
 	color_mod(const std::string& name, std::function<void(int64_t&)> fn);
 };
 
+/**
+ * Precompiled glyph atlas, as generated by buildaux/hex2atlas from a .hex font.
+ *
+ * Codepoints are split into pages of 256. pages[] has one entry per page (0x1100 total), giving the number of its
+ * descriptor block, or 0xFFFF if the page has no glyphs. Each block has 256 descriptors, which are either 0xFFFFFFFF
+ * (no glyph) or the offset of glyph bitmap in bits[] shifted left by one, ORed with 1 if the glyph is wide.
+ */
+struct font_atlas
+{
+	const uint32_t* bits;		//Glyph bitmaps, in the same format as glyph::data.
+	const uint16_t* pages;		//Block number for each page.
+	const uint32_t* blocks;		//Glyph descriptors.
+	size_t glyph_count;		//Number of glyphs.
+};
+
 /**
  * Bitmap font (8x16).
  */
@@ -515,10 +586,24 @@ struct font
 		size_t y;		//Y position.
 		const glyph* dglyph;	//The glyph itself.
 	};
+
+	/**
+	 * Laid out string, without doubling.
+	 */
+	struct run
+	{
+		std::vector<layout> glyphs;	//Glyphs to draw, in order.
+		size_t width;			//Width of bounding box.
+		size_t height;			//Height of bounding box.
+	};
 /**
  * Constructor.
  */
 	font() throw(std::bad_alloc);
+/**
+ * Destructor.
+ */
+	~font() throw();
 /**
  * Load a .hex format font.
  *
@@ -527,6 +612,12 @@ struct font
  * Throws std::runtime_error: Bad font data.
  */
 	void load_hex(const char* data, size_t size) throw(std::bad_alloc, std::runtime_error);
+/**
+ * Load a precompiled glyph atlas. This is cheap, as glyphs are looked up from the atlas on demand.
+ *
+ * Parameter atlas: The atlas. Must stay valid for the lifetime of the font.
+ */
+	void load_atlas(const font_atlas& atlas) throw(std::bad_alloc);
 /**
  * Locate glyph.
  *
@@ -549,6 +640,14 @@ struct font
  * Returns: String layout.
  */
 	std::vector<layout> dolayout(const std::string& string) throw(std::bad_alloc);
+/**
+ * Get layout of string. Recently used layouts are cached, so this is cheap for strings drawn every frame.
+ *
+ * Parameter string: The string.
+ * Parameter alignx: The x alignment (only affects tabs).
+ * Returns: The layout. Stays valid until a font is loaded.
+ */
+	std::shared_ptr<const run> get_run(const std::string& string, uint32_t alignx) throw(std::bad_alloc);
 /**
  * Get width of string.
  *
@@ -604,7 +703,16 @@ private:
 	std::map<uint32_t, glyph> glyphs;
 	size_t tabstop;
 	std::vector<uint32_t> memory;
+	const font_atlas* atlas;
+	//Glyphs of atlas, materialized a page at a time on first use.
+	std::atomic<glyph*>* atlas_pages;
+	threads::lock runs_lock;
+	//Key is alignment followed by the string.
+	std::unordered_map<std::string, std::shared_ptr<const run>> runs;
 	void load_hex_glyph(const char* data, size_t size) throw(std::bad_alloc, std::runtime_error);
+	const glyph& get_atlas_glyph(uint32_t glyph) throw();
+	font(const font&);
+	font& operator=(const font&);
 };
 
 
@@ -646,6 +754,10 @@ struct queue
  * Copy objects from another render queue.
  */
 	void copy_from(queue& q) throw(std::bad_alloc);
+/**
+ * Copy snapshots of objects from another render queue.
+ */
+	void snapshot_from(queue& q) throw(std::bad_alloc);
 /**
  * Helper for clone.
  */
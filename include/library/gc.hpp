@@ -2,23 +2,102 @@
 #define _library__gc__hpp__included__
 
 #include <cstdlib>
+#include <cstdint>
 
 namespace GC
 {
+/**
+ * Collection statistics.
+ */
+struct stats
+{
+/**
+ * Number of live items, in young and old generation.
+ */
+	uint64_t young_items;
+	uint64_t old_items;
+/**
+ * Number of minor (young generation) and major (whole heap) collections finished.
+ */
+	uint64_t minor_collections;
+	uint64_t major_collections;
+/**
+ * Total number of items freed.
+ */
+	uint64_t freed;
+/**
+ * Total number of items promoted to old generation.
+ */
+	uint64_t promoted;
+/**
+ * Length of last and longest collection pause in microseconds.
+ */
+	uint64_t last_pause;
+	uint64_t max_pause;
+/**
+ * Is a major collection in progress?
+ */
+	bool major_in_progress;
+};
+
+/**
+ * A garbage-collected object.
+ *
+ * Objects are kept in intrusive lists, one per generation. New objects are young; young objects surviving a
+ * collection are promoted to old generation. Minor collections only look at the young generation, while major
+ * collections are incremental: each step does a bounded amount of marking or sweeping.
+ *
+ * Objects referenced by GC::pointers are roots. References between objects are reported by trace(). Those are
+ * assumed to be set when the object is constructed; if an object later changes what it references, it must call
+ * write_barrier().
+ *
+ * There is one heap, locked internally, so pointers may be copied and items created on any thread while another
+ * thread collects. New items join the heap only when a pointer adopts them, so the collector never traces an item
+ * that is still being constructed.
+ */
 class item
 {
 public:
 	item();
+	item(const item& i);
+	item& operator=(const item& i);
 	virtual ~item();
 	void mark_root();
 	void unmark_root();
+/**
+ * Add a fully constructed new item to the heap. Called by pointer when it adopts the item.
+ */
+	void enroll();
+/**
+ * Do a full collection, freeing all unreachable items. Finishes any incremental collection in progress.
+ */
 	static void do_gc();
+/**
+ * Do a bounded amount of collection work: a minor collection if young generation has grown large enough, or a step
+ * of major collection if one is in progress or old generation has grown large enough.
+ */
+	static void gc_step();
+/**
+ * Get collection statistics.
+ */
+	static stats get_stats();
 protected:
 	virtual void trace() = 0;
 	void mark();
+/**
+ * Signal that the references traced by trace() have changed.
+ */
+	void write_barrier();
 private:
+	friend struct heap;
+	item* prev;
+	item* next;
 	size_t root_count;
-	bool reachable;
+	bool epoch;
+	bool old;
+	bool gray;
+	bool remembered;
+	bool enrolled;
 };
 
 struct obj_tag {};
@@ -32,10 +111,12 @@ public:
 	pointer(T* obj)
 	{
 		ptr = obj;
+		if(ptr) ptr->enroll();
 	}
 	template<typename... U> pointer(obj_tag tag, U... args)
 	{
 		ptr = new T(args...);
+		ptr->enroll();
 	}
 	pointer(const pointer& p)
 	{
@@ -14,6 +14,7 @@
 #include "string.hpp"
 #include "utf8.hpp"
 #include "int24.hpp"
+#include "slab.hpp"
 #include "lua-version.hpp"
 
 namespace lua
@@ -227,6 +228,8 @@ public:
 	void set_soft_oom_handler(void (*oom)(int status)) { soft_oom_handler = oom ? oom : builtin_soft_oom; }
 /**
  * Set memory use change handler.
+ *
+ * The memory use is charged and reported in batches, so the handler is not called for every allocation.
  */
 	void set_memory_change_handler(std::function<void(ssize_t change)> cb)
 	{
@@ -283,6 +286,8 @@ public:
 	}
 /**
  * Get memory use.
+ *
+ * This includes memory charged in advance for future allocations.
  */
 	size_t get_memory_use()
 	{
@@ -553,6 +558,11 @@ private:
 	static void builtin_oom();
 	static void builtin_soft_oom(int status);
 	static void* builtin_alloc(void* user, void* old, size_t olds, size_t news);
+	void* raw_realloc(void* old, size_t olds, size_t news) throw();
+	void raw_free(void* old, size_t olds) throw();
+	bool reserve_memory(size_t amount);
+	void unreserve_memory(size_t amount);
+	void release_memory_credit();
 	void (*oom_handler)();
 	void (*soft_oom_handler)(int status);
 	std::function<void(ssize_t change)> memory_change;
@@ -560,6 +570,8 @@ private:
 	bool interruptable;
 	size_t memory_limit;
 	size_t memory_use;
+	size_t memory_credit;
+	slab::pool small_blocks;
 	lua_State* lua_handle;
 	state(state&);
 	state& operator=(state&);
@@ -0,0 +1,35 @@
+#ifndef _library__lzblock__hpp__included__
+#define _library__lzblock__hpp__included__
+
+#include <vector>
+#include <cstdlib>
+#include <stdexcept>
+
+/**
+ * Fast LZ77 compression of memory blocks. Trades compression ratio for speed, several hundred megabytes per second
+ * either way, so it is suitable for compressing things like savestates on the fly.
+ */
+namespace lzblock
+{
+/**
+ * Compress a block of data.
+ *
+ * Parameter in: The data to compress.
+ * Parameter size: Size of the data.
+ * Returns: The compressed data.
+ * Throws std::bad_alloc: Not enough memory.
+ */
+std::vector<char> compress(const char* in, size_t size) throw(std::bad_alloc);
+/**
+ * Decompress a block compressed with compress().
+ *
+ * Parameter in: The compressed data.
+ * Parameter size: Size of the compressed data.
+ * Returns: The decompressed data.
+ * Throws std::bad_alloc: Not enough memory.
+ * Throws std::runtime_error: The compressed data is corrupt.
+ */
+std::vector<char> decompress(const char* in, size_t size) throw(std::bad_alloc, std::runtime_error);
+}
+
+#endif
@@ -67,6 +67,7 @@ struct typeinfo
 	virtual std::string format(void* obj, _format fmt) = 0;
 	virtual uint64_t tounsigned(void* obj) = 0;
 	virtual int64_t tosigned(void* obj) = 0;
+	virtual double tofloat(void* obj) = 0;
 	virtual bool toboolean(void* obj) = 0;
 	virtual std::set<operinfo*> operations() = 0;
 	void* copy_allocate(void* src)
@@ -204,6 +205,10 @@ template<class T> struct typeinfo_wrapper : public typeinfo
 	{
 		return ((T*)obj)->tosigned();
 	}
+	double tofloat(void* obj)
+	{
+		return ((T*)obj)->tofloat();
+	}
 	bool toboolean(void* obj)
 	{
 		return ((T*)obj)->toboolean();
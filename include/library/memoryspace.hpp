@@ -258,6 +258,119 @@ private:
 	static int sysendian;
 };
 
+/**
+ * Batch of typed reads over strided records.
+ *
+ * The batch is laid out once on construction, refreshing it does not allocate memory and does only one region lookup
+ * if all the records are in the same directly mapped region.
+ */
+class memory_batch
+{
+public:
+/**
+ * Type of field.
+ */
+	enum type
+	{
+		T_U8,
+		T_S8,
+		T_U16,
+		T_S16,
+		T_U24,
+		T_S24,
+		T_U32,
+		T_S32,
+		T_U64,
+		T_S64,
+		T_F32,
+		T_F64
+	};
+/**
+ * A field in record.
+ */
+	struct field
+	{
+		field() {}
+		field(uint64_t _offset, type _t) : offset(_offset), t(_t) {}
+/**
+ * Offset of field from start of record.
+ */
+		uint64_t offset;
+/**
+ * Type of field.
+ */
+		type t;
+	};
+/**
+ * Create a new batch.
+ *
+ * Parameter base: The address of the first record.
+ * Parameter fields: The fields in each record.
+ * Parameter rows: Number of records.
+ * Parameter stride: Distance between records.
+ * Throws std::runtime_error: Batch too large.
+ */
+	memory_batch(uint64_t base, const std::vector<field>& fields, uint64_t rows, uint64_t stride);
+/**
+ * Get type by name.
+ *
+ * Parameter name: The name (byte, sbyte, word, sword, hword, shword, dword, sdword, qword, sqword, float or double).
+ * Throws std::runtime_error: Unknown type.
+ */
+	static type type_by_name(const std::string& name);
+/**
+ * Get size of type.
+ */
+	static unsigned type_size(type t) throw();
+/**
+ * Get size of record (end of last field).
+ */
+	uint64_t record_size() const throw() { return recsize; }
+/**
+ * Get number of values (records * fields).
+ */
+	size_t size() const throw() { return values.size(); }
+/**
+ * Get number of fields per record.
+ */
+	size_t field_count() const throw() { return fields.size(); }
+/**
+ * Get number of records.
+ */
+	uint64_t row_count() const throw() { return rows; }
+/**
+ * Get type of value.
+ *
+ * Parameter i: Index of value (row * field_count() + field).
+ */
+	type get_type(size_t i) const throw() { return fields[i % fields.size()].t; }
+/**
+ * Get value.
+ *
+ * Parameter i: Index of value (row * field_count() + field).
+ * Returns: The value (must be of the type of field).
+ */
+	template<typename T> T get(size_t i) const throw()
+	{
+		T v;
+		memcpy(static_cast<void*>(&v), &values[i], sizeof(T));
+		return v;
+	}
+/**
+ * Reread all the values from memory.
+ *
+ * Parameter m: The memory space to read.
+ */
+	void refresh(memory_space& m);
+private:
+	uint64_t base;
+	uint64_t rows;
+	uint64_t stride;
+	uint64_t recsize;
+	std::vector<field> fields;
+	std::vector<uint64_t> values;
+};
+
 /**
  * Calculate span of strided request.
  *
@@ -3,11 +3,78 @@
 
 #include <cstdint>
 #include <stdexcept>
+#include <string>
 #include <vector>
 #include <map>
 
 namespace ogg
 {
+class page;
+
+/**
+ * A packet in Ogg bitstream, referencing data stored elsewhere.
+ *
+ * The data is only valid as long as whatever returned the view says it is.
+ */
+class packet_view
+{
+public:
+/**
+ * Constructor.
+ */
+	packet_view() throw();
+/**
+ * Constructor.
+ */
+	packet_view(uint64_t granule, bool first, bool last, bool spans, bool eos, bool bos, const uint8_t* d,
+		size_t dlen) throw();
+/**
+ * Is the packet first within its page?
+ */
+	bool get_first_page() const throw() { return first_page; }
+/**
+ * Is the packet last within its page?
+ */
+	bool get_last_page() const throw() { return last_page; }
+/**
+ * Is the packet spanning multiple pages?
+ */
+	bool get_spans_page() const throw() { return spans_page; }
+/**
+ * Is atomic (first, last and on one page)?
+ */
+	bool get_atomic() const throw() { return first_page && last_page && !spans_page; }
+/**
+ * Get the granule position within page the packet finished at.
+ */
+	uint64_t get_granulepos() const throw() { return granulepos; }
+/**
+ * Does the page this ends on have EOS set?
+ */
+	bool get_on_eos_page() const throw() { return eos_page; }
+/**
+ * Does the page this starts on have BOS set?
+ */
+	bool get_on_bos_page() const throw() { return bos_page; }
+/**
+ * Get length of packet data.
+ */
+	size_t get_length() const throw() { return length; }
+/**
+ * Get packet data.
+ */
+	const uint8_t* get_data() const throw() { return data; }
+private:
+	bool first_page;
+	bool last_page;
+	bool spans_page;
+	bool eos_page;
+	bool bos_page;
+	uint64_t granulepos;
+	const uint8_t* data;
+	size_t length;
+};
+
 /**
  * A packet in Ogg bitstream.
  */
@@ -23,6 +90,10 @@ public:
  */
 	packet(uint64_t granule, bool first, bool last, bool spans, bool eos, bool bos,
 		const std::vector<uint8_t>& d);
+/**
+ * Copy the data referenced by view.
+ */
+	packet(const packet_view& v);
 /**
  * Is the packet first within its page?
  */
@@ -73,6 +144,93 @@ private:
 	std::vector<uint8_t> data;
 };
 
+/**
+ * A page in Ogg bitstream, parsed in place.
+ *
+ * The view refers to the buffer it was parsed from, which has to stay valid as long as the view is used.
+ */
+class page_view
+{
+public:
+/**
+ * Create a view of no page.
+ */
+	page_view() throw();
+/**
+ * Parse a page in buffer.
+ *
+ * Parameter buffer: The buffer to read.
+ * Parameter advance: The number of bytes in page is stored here.
+ * Throws std::runtime_error: Bad page.
+ */
+	page_view(const char* buffer, size_t& advance) throw(std::runtime_error);
+/**
+ * Create a view of a page.
+ */
+	page_view(const page& p) throw();
+/**
+ * Get the continue flag of page.
+ */
+	bool get_continue() const throw() { return flag_continue; }
+/**
+ * Get the BOS flag of page.
+ */
+	bool get_bos() const throw() { return flag_bos; }
+/**
+ * Get the EOS flag of page.
+ */
+	bool get_eos() const throw() { return flag_eos; }
+/**
+ * Get the granulepos of page.
+ */
+	uint64_t get_granulepos() const throw() { return granulepos; }
+/**
+ * Get stream identifier.
+ */
+	uint32_t get_stream() const throw() { return stream; }
+/**
+ * Get sequence number.
+ */
+	uint32_t get_sequence() const throw() { return sequence; }
+/**
+ * Get number of packets.
+ */
+	uint8_t get_packet_count() const throw() { return packet_count; }
+/**
+ * Get the packet.
+ */
+	std::pair<const uint8_t*, size_t> get_packet(size_t packetno) const throw()
+	{
+		if(packetno >= packet_count)
+			return std::make_pair(reinterpret_cast<const uint8_t*>(NULL), 0);
+		else
+			return std::make_pair(data + packets[packetno], packets[packetno + 1] - packets[packetno]);
+	}
+/**
+ * Get the last packet incomplete flag.
+ */
+	bool get_last_packet_incomplete() const throw() { return last_incomplete; }
+private:
+	friend class page;
+	friend class stream_reader;
+	friend class stream_reader_mmap;
+	void parse(const char* buffer, size_t& advance) throw();
+	uint8_t version;
+	bool flag_continue;
+	bool flag_bos;
+	bool flag_eos;
+	bool last_incomplete;
+	uint64_t granulepos;
+	uint32_t stream;
+	uint32_t sequence;
+	uint8_t segment_count;
+	uint8_t packet_count;
+	uint16_t data_count;
+	const uint8_t* data;
+	const uint8_t* segments;
+	uint16_t packets[256];
+};
+
 /**
  * A page in Ogg bitstream.
  */
@@ -210,6 +368,7 @@ public:
  */
 	const static uint64_t granulepos_none;
 private:
+	friend class page_view;
 	uint8_t version;
 	bool flag_continue;
 	bool flag_bos;
@@ -248,10 +407,22 @@ public:
  * Input a page.
  */
 	bool page_in(const page& p);
+/**
+ * Input a page without copying it.
+ *
+ * The buffer the page is in must stay valid until all its packets have been output.
+ */
+	bool page_in(const page_view& p);
 /**
  * Output a packet.
  */
 	void packet_out(packet& pkt);
+/**
+ * Output a packet without copying it.
+ *
+ * The view is valid until the next call to page_in() or packet_out().
+ */
+	void packet_out(packet_view& pkt);
 /**
  * Discard a packet.
  */
@@ -265,13 +436,15 @@ private:
 		uint64_t granule);
 	std::ostream& errors_to;
 	std::vector<uint8_t> partial;
+	std::vector<uint8_t> assembled;
 	bool started_bos;
 	bool seen_page;
 	bool damaged_packet;
 	uint32_t imprint_stream;
 	uint32_t page_seq;
 	uint32_t page_era;
-	page last_page;
+	page_view last_page;
+	page owned_page;
 	uint32_t dpacket;
 	uint32_t packets;
 	uint64_t last_granulepos;
@@ -351,6 +524,13 @@ public:
  * Returns: True if page was obtained, false if not.
  */
 	bool get_page(page& page) throw(std::exception);
+/**
+ * Read a page from stream, without copying it.
+ *
+ * Parameter page: The page is assigned here if successful. Valid until the next call to get_page().
+ * Returns: True if page was obtained, false if not.
+ */
+	bool get_page(page_view& page) throw(std::exception);
 /**
  * Set stream to report errors to.
  *
@@ -366,9 +546,11 @@ private:
 	stream_reader& operator=(const stream_reader&);
 	void fill_buffer();
 	void discard_buffer(size_t amount);
+	bool scan_page(size_t& advance);
 	bool eof;
 	char buffer[65536];
 	size_t left;
+	size_t pending;
 	uint64_t last_offset;
 	uint64_t start_offset;
 	std::ostream* errors_to;
@@ -396,6 +578,53 @@ private:
 	std::istream& is;
 };
 
+/**
+ * Ogg stream reader reading a memory-mapped file.
+ *
+ * Pages are parsed in place in the mapping, so nothing is copied.
+ */
+class stream_reader_mmap
+{
+public:
+/**
+ * Constructor.
+ *
+ * Parameter filename: The file to read.
+ * Throws std::runtime_error: Can't open or map the file.
+ */
+	stream_reader_mmap(const std::string& filename) throw(std::bad_alloc, std::runtime_error);
+/**
+ * Destructor.
+ */
+	~stream_reader_mmap() throw();
+/**
+ * Read a page from stream.
+ *
+ * Parameter page: The page is assigned here if successful. Valid as long as the reader exists.
+ * Returns: True if page was obtained, false if not.
+ */
+	bool get_page(page_view& page) throw(std::exception);
+/**
+ * Set stream to report errors to.
+ *
+ * Parameter strm: The stream.
+ */
+	void set_errors_to(std::ostream& os);
+/**
+ * Starting offset of last packet returned.
+ */
+	uint64_t get_last_offset() { return last_offset; }
+private:
+	stream_reader_mmap(const stream_reader_mmap&);
+	stream_reader_mmap& operator=(const stream_reader_mmap&);
+	const char* base;
+	size_t size;
+	size_t offset;
+	uint64_t last_offset;
+	std::vector<char> fallback;
+	std::ostream* errors_to;
+};
+
 /**
  * Ogg stream writer.
  */
@@ -449,6 +678,61 @@ public:
 private:
 	std::ostream& os;
 };
+
+/**
+ * Ogg packet writer for single logical stream.
+ *
+ * Packets are packed into pages directly in a preallocated page-sized arena, and each page is written with one
+ * call to the stream writer. For packets shorter than 65025 bytes, the pages are identical to ones ogg::muxer makes,
+ * when it is flushed each time a packet doesn't fit. Longer packets span pages, and unlike with the muxer, the page
+ * with the end of such packet is also filled with the packets that follow.
+ */
+class packet_writer
+{
+public:
+/**
+ * Constructor.
+ *
+ * Parameter out: The stream writer to write the pages to.
+ * Parameter streamid: The stream identifier.
+ * Parameter seq: The sequence number of first page (BOS is set if 0).
+ */
+	packet_writer(stream_writer& out, uint32_t streamid, uint32_t seq = 0) throw(std::bad_alloc);
+/**
+ * Destructor.
+ */
+	~packet_writer() throw();
+/**
+ * Write a packet. If the packet doesn't fit on the current page, the page is written out first.
+ *
+ * Parameter data: The packet data.
+ * Parameter len: The packet length.
+ * Parameter granule: The granule position at end of packet.
+ */
+	void put_packet(const uint8_t* data, size_t len, uint64_t granule) throw(std::exception);
+/**
+ * Write out the current page, if it has anything on it.
+ *
+ * Parameter eos: If set, this page is marked as the end of stream.
+ */
+	void flush(bool eos = false) throw(std::exception);
+/**
+ * Get sequence number of next page.
+ */
+	uint32_t get_sequence() const throw() { return seq; }
+private:
+	packet_writer(const packet_writer&);
+	packet_writer& operator=(const packet_writer&);
+	stream_writer& out;
+	uint32_t strmid;
+	uint32_t seq;
+	bool cont;
+	uint64_t granulepos;
+	uint8_t segment_count;
+	uint8_t segments[255];
+	size_t data_count;
+	char* arena;
+};
 }
 
 #endif
@@ -33,6 +33,16 @@ struct encoder
 	uint32_t colorkey;
 	std::vector<uint32_t> data;
 	std::vector<uint32_t> palette;
+/**
+ * Compression level (0-9, like zlib). Higher levels compress better but are slower. Level 0 stores the image
+ * uncompressed and unfiltered. Default is 6.
+ */
+	int level;
+/**
+ * Maximum number of threads to use for filtering and compression. Large images are split into bands of rows that
+ * are compressed in parallel. Default is 1.
+ */
+	unsigned threads;
 	void encode(const std::string& file) const;
 	void encode(std::ostream& file) const;
 };
@@ -172,9 +172,20 @@ public:
 		hash(hashout, reinterpret_cast<const uint8_t*>(&data[0]), data.size());
 		return tostring(hashout);
 	}
+/**
+ * Hashes many blocks of data at once. Faster than hashing the blocks one at a time if there are many small blocks.
+ *
+ * Parameter hashout: Array of count 32-byte buffers to write the hashes to.
+ * Parameter data: Array of count pointers to the data to hash.
+ * Parameter datalen: Array of count lengths of data hashed.
+ * Parameter count: Number of blocks to hash.
+ * Throws std::bad_alloc: Not enough memory.
+ */
+	static void hash_multi(uint8_t* const* hashout, const uint8_t* const* data, const size_t* datalen,
+		size_t count) throw(std::bad_alloc);
 private:
 	uint32_t state[8];
-	uint32_t datablock[16];
+	uint8_t datablock[64];
 	unsigned blockbytes;
 	uint64_t totalbytes;
 	bool finished;
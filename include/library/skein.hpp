@@ -65,6 +65,20 @@ struct hash
  * Parameter bits: Number of bits to output.
  */
 	void read_partial(uint8_t* output, uint64_t startblock, uint64_t bits) throw();
+/**
+ * Hash many messages at once. Faster than hashing the messages one at a time if there are many small ones.
+ *
+ * Parameter v: The variant to use.
+ * Parameter outbits: Number of output bits.
+ * Parameter output: Array of count buffers to store the outputs to.
+ * Parameter data: Array of count pointers to the messages.
+ * Parameter datalen: Array of count message lengths in bytes.
+ * Parameter count: Number of messages.
+ * Throws std::bad_alloc: Not enough memory.
+ * Throws std::runtime_error: Variant is invalid.
+ */
+	static void hash_multi(variant v, uint64_t outbits, uint8_t* const* output, const uint8_t* const* data,
+		const size_t* datalen, size_t count) throw(std::bad_alloc, std::runtime_error);
 private:
 	void typechange(uint8_t newtype);
 	void configure();
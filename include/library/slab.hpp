@@ -0,0 +1,104 @@
+#ifndef _library__slab__hpp__included__
+#define _library__slab__hpp__included__
+
+#include <cstdlib>
+#include <vector>
+
+namespace slab
+{
+/**
+ * Pool of small memory blocks in size classes.
+ *
+ * Blocks are carved from large chunks and recycled through a free list per size class, so allocating and freeing
+ * a block is a couple of pointer operations. The size of block has to be passed when freeing it (it determines the
+ * free list). Chunks are only returned to the system when the pool is cleared or destroyed.
+ *
+ * The pool is not locked: each pool must only be used by one thread at a time.
+ */
+class pool
+{
+public:
+/**
+ * Size classes are multiples of this.
+ */
+	const static size_t granularity = 16;
+/**
+ * Largest size served by pool.
+ */
+	const static size_t max_size = 256;
+/**
+ * Size of chunks blocks are carved from.
+ */
+	const static size_t chunk_size = 65536;
+/**
+ * Create a new empty pool.
+ */
+	pool() throw();
+/**
+ * Destroy a pool, freeing all blocks.
+ */
+	~pool() throw();
+/**
+ * Is a block of specified size served by the pool?
+ */
+	static bool handles(size_t size) throw() { return size > 0 && size <= max_size; }
+/**
+ * Are blocks of two sizes interchangeable?
+ */
+	static bool same_class(size_t size1, size_t size2) throw()
+	{
+		return size_class(size1) == size_class(size2);
+	}
+/**
+ * Allocate a block.
+ *
+ * Parameter size: The size of block. Must be served by pool.
+ * Returns: The block, or NULL if out of memory.
+ */
+	void* allocate(size_t size) throw()
+	{
+		unsigned c = size_class(size);
+		block* b = free_list[c];
+		if(!b)
+			return allocate_slow(c);
+		free_list[c] = b->next;
+		return b;
+	}
+/**
+ * Free a block.
+ *
+ * Parameter ptr: The block to free.
+ * Parameter size: The size block was allocated with (or size in same class).
+ */
+	void release(void* ptr, size_t size) throw()
+	{
+		unsigned c = size_class(size);
+		block* b = reinterpret_cast<block*>(ptr);
+		b->next = free_list[c];
+		free_list[c] = b;
+	}
+/**
+ * Free all blocks and return the memory to system.
+ */
+	void clear() throw();
+/**
+ * Get amount of memory taken from the system.
+ */
+	size_t get_reserved() const throw() { return chunks.size() * chunk_size; }
+private:
+	struct block
+	{
+		block* next;
+	};
+	static unsigned size_class(size_t size) throw() { return (size - 1) / granularity; }
+	void* allocate_slow(unsigned sclass) throw();
+	pool(const pool&);
+	pool& operator=(const pool&);
+	block* free_list[max_size / granularity];
+	char* bump;
+	size_t bump_left;
+	std::vector<char*> chunks;
+};
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef _library_spsc_ring__hpp__included__
+#define _library_spsc_ring__hpp__included__
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace spsc
+{
+/**
+ * Lock-free single-producer single-consumer ring buffer of trivially copyable elements.
+ *
+ * Exactly one thread may call the write-side functions (write(), write_free()) and exactly one thread may call the
+ * read-side functions (read(), peek(), consume()) concurrently. Functions returning sizes can be called from either
+ * side, but the value is only a snapshot.
+ */
+template<typename T>
+class ring
+{
+public:
+/**
+ * Create a new ring.
+ *
+ * Parameter _capacity: Capacity in elements. Rounded up to power of two.
+ * Throws std::bad_alloc: Not enough memory.
+ */
+	ring(size_t _capacity) throw(std::bad_alloc)
+	{
+		capacity = 1;
+		while(capacity < _capacity)
+			capacity <<= 1;
+		mask = capacity - 1;
+		buffer = new T[capacity];
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+	~ring() throw()
+	{
+		delete[] buffer;
+	}
+/**
+ * Get capacity of ring.
+ */
+	size_t get_capacity() const throw() { return capacity; }
+/**
+ * Get number of elements available for reading.
+ */
+	size_t size() const throw()
+	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+/**
+ * Get number of elements that can be written (producer side).
+ */
+	size_t write_free() const throw()
+	{
+		return capacity - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+	}
+/**
+ * Write elements (producer side).
+ *
+ * Parameter data: The elements to write.
+ * Parameter count: Number of elements.
+ * Returns: Number of elements actually written (less than count if the ring was full).
+ */
+	size_t write(const T* data, size_t count) throw()
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t t = tail.load(std::memory_order_acquire);
+		size_t space = capacity - (h - t);
+		if(count > space)
+			count = space;
+		size_t off = h & mask;
+		size_t first = (count < capacity - off) ? count : (capacity - off);
+		memcpy(buffer + off, data, first * sizeof(T));
+		if(count > first)
+			memcpy(buffer, data + first, (count - first) * sizeof(T));
+		head.store(h + count, std::memory_order_release);
+		return count;
+	}
+/**
+ * Get the contiguous writable region at the end of the ring (producer side).
+ *
+ * Parameter count: Filled with number of elements in the region. This may be less than write_free() if space wraps.
+ * Returns: Pointer to first writable element.
+ */
+	T* write_region(size_t& count) throw()
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t t = tail.load(std::memory_order_acquire);
+		size_t off = h & mask;
+		count = capacity - (h - t);
+		if(count > capacity - off)
+			count = capacity - off;
+		return buffer + off;
+	}
+/**
+ * Publish elements written to region returned by write_region() (producer side).
+ *
+ * Parameter count: Number of elements to publish. Must not exceed size of the region.
+ */
+	void commit(size_t count) throw()
+	{
+		head.store(head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+/**
+ * Get the contiguous readable region at the start of the ring (consumer side).
+ *
+ * Parameter count: Filled with number of elements in the region. This may be less than size() if data wraps.
+ * Returns: Pointer to first readable element.
+ */
+	const T* peek(size_t& count) const throw()
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t h = head.load(std::memory_order_acquire);
+		size_t off = t & mask;
+		count = h - t;
+		if(count > capacity - off)
+			count = capacity - off;
+		return buffer + off;
+	}
+/**
+ * Release elements from start of the ring (consumer side).
+ *
+ * Parameter count: Number of elements to release. Must not exceed size().
+ */
+	void consume(size_t count) throw()
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+/**
+ * Read elements (consumer side).
+ *
+ * Parameter data: The buffer to store the elements to.
+ * Parameter count: Maximum number of elements to read.
+ * Returns: Number of elements actually read.
+ */
+	size_t read(T* data, size_t count) throw()
+	{
+		size_t done = 0;
+		while(done < count) {
+			size_t avail;
+			const T* p = peek(avail);
+			if(!avail)
+				break;
+			if(avail > count - done)
+				avail = count - done;
+			memcpy(data + done, p, avail * sizeof(T));
+			consume(avail);
+			done += avail;
+		}
+		return done;
+	}
+/**
+ * Discard all data (consumer side).
+ */
+	void clear() throw()
+	{
+		tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+	}
+private:
+	ring(const ring<T>&);
+	ring<T>& operator=(const ring<T>&);
+	T* buffer;
+	size_t capacity;
+	size_t mask;
+	//Head and tail are on separate cache lines to avoid producer and consumer bouncing the same line. Padding
+	//instead of alignas, as operator new does not honor extended alignment before C++17.
+	char pad1[64];
+	std::atomic<size_t> head;
+	char pad2[64];
+	std::atomic<size_t> tail;
+	char pad3[64];
+};
+}
+
+#endif
@@ -106,6 +106,27 @@ struct lua_loaded_bitmap
 	template<bool png> static int load_str(lua::state& L, lua::parameters& P);
 };
 
+/**
+ * Copy of bitmap contents, for drawing after the bitmap itself may have changed or been freed.
+ */
+struct lua_bitmap_snapshot
+{
+/**
+ * Copy paletted bitmap, with the palette.
+ */
+	lua_bitmap_snapshot(lua_bitmap& b, lua_palette& p);
+/**
+ * Copy direct color bitmap.
+ */
+	lua_bitmap_snapshot(lua_dbitmap& d);
+	size_t width;
+	size_t height;
+	//Palette indices, or empty if direct color.
+	std::vector<uint16_t> indices;
+	//Palette, or the pixels if direct color.
+	std::vector<framebuffer::color> colors;
+};
+
 template<bool T> class lua_bitmap_holder
 {
 public:
@@ -149,6 +170,24 @@ private:
 	lua_dbitmap& d;
 };
 
+template<bool T> class lua_bitmap_snapshot_holder
+{
+public:
+	lua_bitmap_snapshot_holder(lua_bitmap_snapshot& _s) : s(_s) {};
+	size_t stride() { return s.width; }
+	void lock() {}
+	void unlock() {}
+	void draw(size_t bmpidx, typename framebuffer::fb<T>::element_t& target)
+	{
+		if(s.indices.empty())
+			s.colors[bmpidx].apply(target);
+		else if(s.indices[bmpidx] < s.colors.size())
+			s.colors[s.indices[bmpidx]].apply(target);
+	}
+private:
+	lua_bitmap_snapshot& s;
+};
+
 
 template<bool T, class B> void lua_bitmap_composite(struct framebuffer::fb<T>& scr, int32_t xp,
 	int32_t yp, const range& X, const range& Y, const range& sX, const range& sY, bool outside, B bmp) throw()
@@ -2,6 +2,7 @@
 #include "core/instance.hpp"
 #include "core/misc.hpp"
 #include "library/globalwrap.hpp"
+#include "library/minmax.hpp"
 #include "library/string.hpp"
 #include "lua/lua.hpp"
 
@@ -13,6 +14,9 @@ namespace
 {
 	globalwrap<std::map<std::string, dumper_factory_base*>> S_dumpers;
 	globalwrap<std::set<dumper_factory_base::notifier*>> S_notifiers;
+
+	//Frames queued to the dump thread before the emulation thread waits.
+	const unsigned max_queued_frames = 3;
 }
 
 master_dumper::gameinfo::gameinfo() throw(std::bad_alloc)
@@ -162,6 +166,8 @@ dumper_base::dumper_base()
 	mdumper = NULL;
 	fbase = NULL;
 	samples_killed = 0;
+	akillfrac = 0;
+	hud = NULL;
 }
 
 dumper_base::dumper_base(master_dumper& _mdumper, dumper_factory_base& _fbase)
@@ -170,6 +176,8 @@ dumper_base::dumper_base(master_dumper& _mdumper, dumper_factory_base& _fbase)
 	threads::arlock h(mdumper->lock);
 	mdumper->dumpers[fbase] = this;
 	samples_killed = 0;
+	akillfrac = 0;
+	hud = NULL;
 }
 
 dumper_base::~dumper_base() throw()
@@ -180,6 +188,22 @@ dumper_base::~dumper_base() throw()
 	mdumper->statuschange();
 }
 
+bool dumper_base::video_geometry(const struct framebuffer::raw& frame, uint32_t& hscl, uint32_t& vscl,
+	uint32_t& lgap, uint32_t& tgap, uint32_t& rgap, uint32_t& bgap)
+{
+	return false;
+}
+
+void dumper_base::on_samples(const short* samples, size_t count, bool stereo)
+{
+	if(stereo)
+		for(size_t i = 0; i < count; i++)
+			on_sample(samples[2 * i + 0], samples[2 * i + 1]);
+	else
+		for(size_t i = 0; i < count; i++)
+			on_sample(samples[i], samples[i]);
+}
+
 master_dumper::notifier::~notifier() throw()
 {
 }
@@ -190,6 +214,24 @@ master_dumper::master_dumper(lua_state& _lua2)
 	current_rate_n = 48000;
 	current_rate_d = 1;
 	output = &std::cerr;
+	queued_frames = 0;
+	quitting = false;
+	dthread = NULL;
+}
+
+master_dumper::~master_dumper()
+{
+	if(dthread) {
+		{
+			threads::alock h(qlock);
+			quitting = true;
+			qcond.notify_all();
+		}
+		dthread->join();
+		delete dthread;
+	}
+	for(auto i : queue)
+		delete i;
 }
 
 dumper_base* master_dumper::get_instance(dumper_factory_base* f) throw()
@@ -227,6 +269,8 @@ void master_dumper::add_dumper(dumper_base& n)
 
 void master_dumper::drop_dumper(dumper_base& n)
 {
+	//Nothing queued may refer to the dumper after this.
+	flush();
 	threads::arlock h(lock);
 	sdumpers.erase(&n);
 }
@@ -254,74 +298,218 @@ unsigned master_dumper::get_dumper_count() throw()
 	return sdumpers.size();
 }
 
-void master_dumper::on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+master_dumper::dump_event* master_dumper::new_event(enum dump_event::type type)
 {
-	threads::arlock h(lock);
-	for(auto i : sdumpers)
+	dump_event* e = new dump_event;
+	e->type = type;
+	e->targets.insert(e->targets.end(), sdumpers.begin(), sdumpers.end());
+	return e;
+}
+
+void master_dumper::enqueue(dump_event* e)
+{
+	threads::alock h(qlock);
+	try {
+		if(!dthread)
+			dthread = new threads::thread([this]() { this->entry_point(); });
+	} catch(...) {
+		delete e;
+		throw;
+	}
+	//Wait for the dump thread to catch up, so memory use stays bounded.
+	if(e->type == dump_event::EV_FRAME) {
+		while(queued_frames >= max_queued_frames)
+			qcond.wait(h);
+		queued_frames++;
+	}
+	queue.push_back(e);
+	qcond.notify_all();
+}
+
+void master_dumper::flush()
+{
+	threads::alock h(qlock);
+	while(!queue.empty())
+		qcond.wait(h);
+}
+
+void master_dumper::entry_point()
+{
+	threads::alock h(qlock);
+	while(true) {
+		while(queue.empty() && !quitting)
+			qcond.wait(h);
+		if(queue.empty())
+			return;
+		//Stays queued until delivered, so flush() waits for it.
+		dump_event* e = queue.front();
+		h.unlock();
+		deliver(*e);
+		h.lock();
+		queue.pop_front();
+		if(e->type == dump_event::EV_FRAME)
+			queued_frames--;
+		qcond.notify_all();
+		h.unlock();
+		//The frame may be freed here, so don't hold the lock.
+		delete e;
+		h.lock();
+	}
+}
+
+void master_dumper::deliver(dump_event& ev)
+{
+	for(auto i : ev.targets)
 		try {
-			i->on_frame(_frame, fps_n, fps_d);
+			switch(ev.type) {
+			case dump_event::EV_FRAME:
+				i->hud = ev.huds.count(i) ? &ev.huds[i] : NULL;
+				i->on_frame(*ev.frame, ev.n, ev.d);
+				i->hud = NULL;
+				break;
+			case dump_event::EV_SAMPLES: {
+				size_t c = ev.samples.size() / (ev.stereo ? 2 : 1);
+				uint64_t k = ev.skip.count(i) ? ev.skip[i] : 0;
+				if(k < c)
+					i->on_samples(&ev.samples[k * (ev.stereo ? 2 : 1)], c - k, ev.stereo);
+				break;
+			}
+			case dump_event::EV_RATE:
+				i->on_rate_change(ev.n, ev.d);
+				break;
+			case dump_event::EV_GAMEINFO:
+				i->on_gameinfo_change(ev.gi);
+				break;
+			}
 		} catch(std::exception& e) {
-			(*output) << "Error in on_frame: " << e.what() << std::endl;
+			i->hud = NULL;
+			(*output) << "Error in dumper: " << e.what() << std::endl;
 		} catch(...) {
-			(*output) << "Error in on_frame: <unknown error>" << std::endl;
+			i->hud = NULL;
+			(*output) << "Error in dumper: <unknown error>" << std::endl;
 		}
 }
 
-void master_dumper::on_sample(short l, short r)
+void master_dumper::on_frame(std::shared_ptr<const framebuffer::raw> _frame, uint32_t fps_n, uint32_t fps_d)
 {
-	threads::arlock h(lock);
-	for(auto i : sdumpers)
+	dump_event* e;
+	{
+		threads::arlock h(lock);
+		if(sdumpers.empty())
+			return;
+		e = new_event(dump_event::EV_FRAME);
+		e->frame = _frame;
+		e->n = fps_n;
+		e->d = fps_d;
 		try {
-			if(__builtin_expect(i->samples_killed, 0)) {
-				i->samples_killed--;
-				continue;
+			//Lua runs here, on the emulation thread.
+			for(auto i : sdumpers) {
+				uint32_t hscl = 1, vscl = 1, lgap = 0, tgap = 0, rgap = 0, bgap = 0;
+				if(!i->video_geometry(*_frame, hscl, vscl, lgap, tgap, rgap, bgap))
+					continue;
+				video_hud& hud = e->huds[i];
+				//The queue Lua draws to refers to Lua objects, so it must not leave this thread. The dump
+				//thread gets a snapshot of it instead.
+				framebuffer::queue lrq;
+				struct lua::render_context lrc;
+				lrc.left_gap = lgap;
+				lrc.right_gap = rgap;
+				lrc.bottom_gap = bgap;
+				lrc.top_gap = tgap;
+				lrc.queue = &lrq;
+				lrc.width = _frame->get_width();
+				lrc.height = _frame->get_height();
+				hud.killed = false;
+				lua2.callback_do_video(&lrc, hud.killed, hscl, vscl);
+				hud.rq.snapshot_from(lrq);
+				hud.hscl = hscl;
+				hud.vscl = vscl;
+				hud.lgap = lrc.left_gap;
+				hud.tgap = lrc.top_gap;
+				hud.rgap = lrc.right_gap;
+				hud.bgap = lrc.bottom_gap;
+				if(hud.killed)
+					i->samples_killed += killed_audio_length(fps_n, fps_d, i->akillfrac);
 			}
-			i->on_sample(l, r);
-		} catch(std::exception& e) {
-			(*output) << "Error in on_sample: " << e.what() << std::endl;
 		} catch(...) {
-			(*output) << "Error in on_sample: <unknown error>" << std::endl;
+			delete e;
+			throw;
 		}
+	}
+	enqueue(e);
 }
 
-void master_dumper::on_rate_change(uint32_t n, uint32_t d)
+void master_dumper::on_sample(short l, short r)
 {
-	threads::arlock h(lock);
-	uint32_t ga = gcd(n, d);
-	n /= ga;
-	d /= ga;
-	if(n != current_rate_n || d != current_rate_d) {
-		current_rate_n = n;
-		current_rate_d = d;
-	} else
-		return;
-
-	for(auto i : sdumpers)
+	short x[2] = {l, r};
+	on_samples(x, 1, true);
+}
+
+void master_dumper::on_samples(const short* samples, size_t count, bool stereo)
+{
+	dump_event* e;
+	{
+		threads::arlock h(lock);
+		if(sdumpers.empty())
+			return;
+		e = new_event(dump_event::EV_SAMPLES);
 		try {
-			i->on_rate_change(current_rate_n, current_rate_d);
-		} catch(std::exception& e) {
-			(*output) << "Error in on_rate_change: " << e.what() << std::endl;
+			e->samples.assign(samples, samples + count * (stereo ? 2 : 1));
+			e->stereo = stereo;
+			for(auto i : sdumpers)
+				if(__builtin_expect(i->samples_killed, 0)) {
+					uint64_t k = min(i->samples_killed, (uint64_t)count);
+					i->samples_killed -= k;
+					e->skip[i] = k;
+				}
 		} catch(...) {
-			(*output) << "Error in on_rate_change: <unknown error>" << std::endl;
+			delete e;
+			throw;
 		}
+	}
+	enqueue(e);
+}
+
+void master_dumper::on_rate_change(uint32_t n, uint32_t d)
+{
+	dump_event* e;
+	{
+		threads::arlock h(lock);
+		uint32_t ga = gcd(n, d);
+		n /= ga;
+		d /= ga;
+		if(n != current_rate_n || d != current_rate_d) {
+			current_rate_n = n;
+			current_rate_d = d;
+		} else
+			return;
+		if(sdumpers.empty())
+			return;
+		e = new_event(dump_event::EV_RATE);
+		e->n = current_rate_n;
+		e->d = current_rate_d;
+	}
+	enqueue(e);
 }
 
 void master_dumper::on_gameinfo_change(const gameinfo& gi)
 {
-	threads::arlock h(lock);
-	current_gi = gi;
-	for(auto i : sdumpers)
-		try {
-			i->on_gameinfo_change(current_gi);
-		} catch(std::exception& e) {
-			(*output) << "Error in on_gameinfo_change: " << e.what() << std::endl;
-		} catch(...) {
-			(*output) << "Error in on_gameinfo_change: <unknown error>" << std::endl;
-		}
+	dump_event* e;
+	{
+		threads::arlock h(lock);
+		current_gi = gi;
+		if(sdumpers.empty())
+			return;
+		e = new_event(dump_event::EV_GAMEINFO);
+		e->gi = current_gi;
+	}
+	enqueue(e);
 }
 
 void master_dumper::end_dumps()
 {
+	//Before taking the lock, as the dumpers are dropped with it held.
+	flush();
 	threads::arlock h(lock);
 	while(sdumpers.size() > 0) {
 		auto d = *sdumpers.begin();
@@ -343,29 +531,15 @@ void master_dumper::set_output(std::ostream* _output)
 	output = _output;
 }
 
-template<bool X> bool master_dumper::render_video_hud(struct framebuffer::fb<X>& target,
-	struct framebuffer::raw& source, uint32_t hscl, uint32_t vscl, uint32_t lgap, uint32_t tgap, uint32_t rgap,
-	uint32_t bgap, std::function<void()> fn)
-{
-	bool lua_kill_video = false;
-	struct lua::render_context lrc;
-	framebuffer::queue rq;
-	lrc.left_gap = lgap;
-	lrc.right_gap = rgap;
-	lrc.bottom_gap = bgap;
-	lrc.top_gap = tgap;
-	lrc.queue = &rq;
-	lrc.width = source.get_width();
-	lrc.height = source.get_height();
-	lua2.callback_do_video(&lrc, lua_kill_video, hscl, vscl);
-	if(fn)
-		fn();
-	target.reallocate(lrc.left_gap + source.get_width() * hscl + lrc.right_gap, lrc.top_gap +
-		source.get_height() * vscl + lrc.bottom_gap, false);
-	target.set_origin(lrc.left_gap, lrc.top_gap);
-	target.copy_from(source, hscl, vscl);
-	rq.run(target);
-	return !lua_kill_video;
+template<bool X> void master_dumper::render_video_hud(struct framebuffer::fb<X>& target,
+	const struct framebuffer::raw& source, const video_hud& hud)
+{
+	target.reallocate(hud.lgap + source.get_width() * hud.hscl + hud.rgap, hud.tgap +
+		source.get_height() * hud.vscl + hud.bgap, false);
+	target.set_origin(hud.lgap, hud.tgap);
+	target.copy_from(source, hud.hscl, hud.vscl);
+	//Running the queue does not change it. It holds only snapshots, so nothing else touches it either.
+	const_cast<framebuffer::queue&>(hud.rq).run(target);
 }
 
 uint64_t master_dumper::killed_audio_length(uint32_t fps_n, uint32_t fps_d, double& fraction)
@@ -377,9 +551,7 @@ uint64_t master_dumper::killed_audio_length(uint32_t fps_n, uint32_t fps_d, doub
 	return y;
 }
 
-template bool master_dumper::render_video_hud(struct framebuffer::fb<false>& target, struct framebuffer::raw& source,
-	uint32_t hscl, uint32_t vscl, uint32_t lgap, uint32_t tgap, uint32_t rgap, uint32_t bgap,
-	std::function<void()> fn);
-template bool master_dumper::render_video_hud(struct framebuffer::fb<true>& target, struct framebuffer::raw& source,
-	uint32_t hscl, uint32_t vscl, uint32_t lgap, uint32_t tgap, uint32_t rgap, uint32_t bgap,
-	std::function<void()> fn);
+template void master_dumper::render_video_hud(struct framebuffer::fb<false>& target,
+	const struct framebuffer::raw& source, const video_hud& hud);
+template void master_dumper::render_video_hud(struct framebuffer::fb<true>& target,
+	const struct framebuffer::raw& source, const video_hud& hud);
@@ -12,8 +12,11 @@
 #include <unistd.h>
 #include <sys/time.h>
 
-#define MUSIC_BUFFERS 8
 #define MAX_VOICE_ADJUST 200
+//Default target music latency in milliseconds.
+#define DEFAULT_MUSIC_LATENCY 60
+//Excess music beyond this many times target latency gets dropped.
+#define MUSIC_LATENCY_LIMIT 3
 
 bool audioapi_instance::vu_disabled = false;
 
@@ -104,23 +107,25 @@ exit:
 }
 
 audioapi_instance::audioapi_instance()
-	: dummyproc(*this)
+	: dummyproc(*this), music_ring(2 * music_bufsize)
 {
 	dummythread = NULL;
-	music_ptr = 0;
-	last_complete_music_seen = MUSIC_BUFFERS + 1;
-	last_complete_music = MUSIC_BUFFERS;
-	for(unsigned i = 0; i < MUSIC_BUFFERS; i++) {
-		music_size[i] = 0;
-		music_rate[i] = 48000;
-		music_stereo[i] = false;
-	}
+	music_direct = NULL;
+	music_rate = 48000;
+	_music_latency = DEFAULT_MUSIC_LATENCY;
+	_music_underruns = 0;
+	_music_overruns = 0;
+	music_primed = false;
+	music_block = 0;
+	music_fill_avg = 0;
+	music_adjust_i = 0;
 	voicep_get = 0;
 	voicep_put = 0;
 	voicer_get = 0;
 	voicer_put = 0;
 	voice_rate_play = 40000;
 	orig_voice_rate_play = 40000;
+	music_play_rate = 40000;
 	voice_rate_rec = 40000;
 	dummy_cb_active_record = false;
 	dummy_cb_active_play = false;
@@ -128,7 +133,6 @@ audioapi_instance::audioapi_instance()
 	_music_volume = 1;
 	_voicep_volume = 32767.0;
 	_voicer_volume = 1.0/32768;
-	last_adjust = false;
 }
 
 audioapi_instance::~audioapi_instance()
@@ -157,6 +161,9 @@ void audioapi_instance::voice_rate(unsigned rate_rec, unsigned rate_play)
 		orig_voice_rate_play = voice_rate_play = rate_play;
 	else
 		orig_voice_rate_play = voice_rate_play = 40000;
+	music_play_rate = orig_voice_rate_play;
+	music_block = 0;
+	music_adjust_i = 0;
 	dummy_cb_active_play = !rate_play;
 }
 
@@ -214,89 +221,76 @@ void audioapi_instance::record_voice(float* samples, size_t count)
 
 void audioapi_instance::submit_buffer(int16_t* samples, size_t count, bool stereo, double rate)
 {
+	CORE().mdumper->on_samples(samples, count, stereo);
+	if(rate < 100)
+		rate = 48000;	//Apparently there are buffers with zero rate.
+	music_rate = rate;
+	size_t written;
 	if(stereo)
-		for(unsigned i = 0; i < count; i++)
-			CORE().mdumper->on_sample(samples[2 * i + 0], samples[2 * i + 1]);
-	else
-		for(unsigned i = 0; i < count; i++)
-			CORE().mdumper->on_sample(samples[i], samples[i]);
-	//Limit buffers to avoid overrunning.
-	if(count > music_bufsize / (stereo ? 2 : 1))
-		count = music_bufsize / (stereo ? 2 : 1);
-	unsigned bidx = last_complete_music;
-	bidx = (bidx > (MUSIC_BUFFERS - 2)) ? 0 : bidx + 1;
-	memcpy(music_buffer + bidx * music_bufsize, samples, count * (stereo ? 2 : 1) * sizeof(int16_t));
-	music_stereo[bidx] = stereo;
-	music_rate[bidx] = rate;
-	music_size[bidx] = count;
-	last_complete_music = bidx;
-}
-
-struct audioapi_instance::buffer audioapi_instance::get_music(size_t played)
-{
-	unsigned midx = last_complete_music_seen;
-	unsigned midx2 = last_complete_music;
-	if(midx2 >= MUSIC_BUFFERS) {
-		//Special case: No buffer.
-		struct buffer out;
-		out.samples = NULL;
-		out.pointer = 0;
-		//The rest are arbitrary.
-		out.total = 64;
-		out.stereo = false;
-		out.rate = 48000;
-		return out;
-	}
-	//Handle ACK. If the current buffer is too old, we want to ignore the ACK.
-	if(midx >= MUSIC_BUFFERS) {
-		//Load initial buffer.
-		midx = last_complete_music_seen = 0;
-		music_ptr = 0;
-	} else {
-		music_ptr += played;
-		//Otherwise, check if current buffer is not next on the line to be overwritten.
-		if((midx2 + 1) % MUSIC_BUFFERS == midx) {
-			//It is, bump buffer by one.
-			if(!last_adjust && voice_rate_play > orig_voice_rate_play - MAX_VOICE_ADJUST)
-				voice_rate_play--;
-			last_adjust = true;
-			midx = last_complete_music_seen = (midx + 1) % MUSIC_BUFFERS;
-			music_ptr = 0;
-		} else if(music_ptr >= music_size[midx] && midx != midx2) {
-			//It isn't, but current buffer is finished.
-			midx = last_complete_music_seen = (midx + 1) % MUSIC_BUFFERS;
-			music_ptr = 0;
-			last_adjust = false;
-		} else if(music_ptr >= music_size[midx] && midx == midx2) {
-			if(!last_adjust && voice_rate_play < orig_voice_rate_play + MAX_VOICE_ADJUST)
-				voice_rate_play++;
-			last_adjust = true;
-			//Current buffer is finished, but there is no new buffer.
-			//Send silence.
-		} else {
-			last_adjust = false;
-			//Can continue.
+		written = music_ring.write(samples, 2 * count) / 2;
+	else {
+		int16_t tmp[1024];
+		written = 0;
+		while(written < count) {
+			size_t n = min(count - written, sizeof(tmp) / sizeof(tmp[0]) / 2);
+			for(size_t i = 0; i < n; i++)
+				tmp[2 * i + 0] = tmp[2 * i + 1] = samples[written + i];
+			size_t w = music_ring.write(tmp, 2 * n) / 2;
+			written += w;
+			if(w < n)
+				break;
 		}
 	}
-	//Fill the structure.
-	struct buffer out;
-	if(music_ptr < music_size[midx]) {
-		out.samples = music_buffer + midx * music_bufsize;
-		out.pointer = music_ptr;
-		out.total = music_size[midx];
-		out.stereo = music_stereo[midx];
-		out.rate = music_rate[midx];
-	} else {
-		//Run out of buffers to play.
-		out.samples = NULL;
-		out.pointer = 0;
-		out.total = 64;		//Arbitrary.
-		out.stereo = music_stereo[midx];
-		out.rate = music_rate[midx];
-		if(out.rate < 100)
-			out.rate = 48000;	//Apparently there are buffers with zero rate.
+	if(written < count)
+		_music_overruns++;
+}
+
+int16_t* audioapi_instance::get_music_buffer(size_t& count)
+{
+	size_t avail;
+	music_direct = music_ring.write_region(avail);
+	count = min(count, avail / 2);
+	return music_direct;
+}
+
+void audioapi_instance::commit_music_buffer(size_t count, double rate)
+{
+	CORE().mdumper->on_samples(music_direct, count, true);
+	if(rate < 100)
+		rate = 48000;	//Apparently there are buffers with zero rate.
+	music_rate = rate;
+	music_ring.commit(2 * count);
+}
+
+void audioapi_instance::update_music_rate(size_t count)
+{
+	double rate = music_rate;
+	//Track the largest block the driver asks for, as latency below that can't be sustained.
+	size_t block = count * rate / music_play_rate + 1;
+	if(block > music_block)
+		music_block = block;
+	double target = max(rate * _music_latency / 1000, 2.0 * music_block);
+	target = min(target, music_bufsize / (2.0 * MUSIC_LATENCY_LIMIT));
+	size_t fill = music_ring.size() / 2;
+	if(fill > MUSIC_LATENCY_LIMIT * target) {
+		//Way too much buffered (e.g. running at turbo speed). Drop the oldest excess.
+		music_ring.consume(2 * (fill - (size_t)target));
+		fill = target;
+		_music_overruns++;
 	}
-	return out;
+	if(!music_primed && fill >= target) {
+		music_primed = true;
+		music_fill_avg = fill;
+	}
+	if(!music_primed)
+		return;
+	//PI controller on smoothed fill level. Playing slower consumes music faster.
+	music_fill_avg += 0.1 * (fill - music_fill_avg);
+	double err = max(min((music_fill_avg - target) / target, 1.0), -1.0);
+	music_adjust_i = max(min(music_adjust_i + 0.002 * err, 1.0), -1.0);
+	double adjust = max(min(0.5 * err + music_adjust_i, 1.0), -1.0);
+	music_play_rate = orig_voice_rate_play - adjust * MAX_VOICE_ADJUST;
+	voice_rate_play = floor(music_play_rate + 0.5);
 }
 
 void audioapi_instance::get_voice(float* samples, size_t count)
@@ -341,8 +335,10 @@ void audioapi_instance::init()
 	voicep_put = 0;
 	voicer_get = 0;
 	voicer_put = 0;
-	last_complete_music = 3;
-	last_complete_music_seen = 4;
+	music_ring.clear();
+	music_primed = false;
+	music_block = 0;
+	music_adjust_i = 0;
 	dummy_cb_active_play = true;
 	dummy_cb_active_record = true;
 	dummy_cb_quit = false;
@@ -388,77 +384,77 @@ float audioapi_instance::voicer_volume()
 	return _voicer_volume * 32768;
 }
 
+void audioapi_instance::music_latency(unsigned ms)
+{
+	_music_latency = ms;
+}
+
+unsigned audioapi_instance::music_latency()
+{
+	return _music_latency;
+}
+
+uint64_t audioapi_instance::music_underruns()
+{
+	return _music_underruns;
+}
+
+uint64_t audioapi_instance::music_overruns()
+{
+	return _music_overruns;
+}
+
 void audioapi_instance::get_mixed(int16_t* samples, size_t count, bool stereo)
 {
 	const size_t intbuf_size = 256;
 	float intbuf[intbuf_size];
 	float intbuf2[intbuf_size];
+	update_music_rate(count);
+	double ratio = music_play_rate / music_rate;
 	while(count > 0) {
-		buffer b = get_music(0);
-		float* in = intbuf;
-		float* out = intbuf2;
-		size_t outdata_used;
-		if(b.stereo) {
-			size_t indata = min(b.total - b.pointer, intbuf_size / 2);
-			size_t outdata = min(intbuf_size / 2, count);
-			size_t indata_used = indata;
-			outdata_used = outdata;
-			if(b.samples)
-				for(size_t i = 0; i < 2 * indata; i++)
-					intbuf[i] = _music_volume * b.samples[i + 2 * b.pointer];
-			else
+		size_t outdata = min(intbuf_size / 2, count);
+		size_t outdata_used = 0;
+		if(music_primed) {
+			size_t indata;
+			const int16_t* src = music_ring.peek(indata);
+			indata = min(indata / 2, intbuf_size / 2);
+			if(indata) {
 				for(size_t i = 0; i < 2 * indata; i++)
-					intbuf[i] = 0;
-			music_resampler.resample(in, indata, out, outdata, (double)voice_rate_play / b.rate, true);
-			indata_used -= indata;
-			outdata_used -= outdata;
-			get_music(indata_used);
-			get_voice(intbuf, outdata_used);
-
-			vu_mleft(intbuf2, outdata_used, true, voice_rate_play, 1 / 32768.0);
-			vu_mright(intbuf2 + 1, outdata_used, true, voice_rate_play, 1 / 32768.0);
-			vu_vout(intbuf, outdata_used, false, voice_rate_play, 1 / 32768.0);
-
-			for(size_t i = 0; i < outdata_used * (stereo ? 2 : 1); i++)
-				intbuf2[i] = max(min(intbuf2[i] + intbuf[i / 2], 32766.0f), -32767.0f);
-			if(stereo)
-				for(size_t i = 0; i < outdata_used * 2; i++)
-					samples[i] = intbuf2[i];
-			else
-				for(size_t i = 0; i < outdata_used; i++)
-					samples[i] = (intbuf2[2 * i + 0] + intbuf2[2 * i + 1]) / 2;
-		} else {
-			size_t indata = min(b.total - b.pointer, intbuf_size);
-			size_t outdata = min(intbuf_size, count);
-			size_t indata_used = indata;
+					intbuf[i] = _music_volume * src[i];
+				float* in = intbuf;
+				float* out = intbuf2;
+				size_t inleft = indata;
+				size_t outleft = outdata;
+				music_resampler.resample(in, inleft, out, outleft, ratio, true);
+				music_ring.consume(2 * (indata - inleft));
+				outdata_used = outdata - outleft;
+			} else {
+				//Ran out of music. Send silence until enough is buffered again.
+				_music_underruns++;
+				music_primed = false;
+			}
+		}
+		if(!music_primed) {
+			for(size_t i = 0; i < 2 * outdata; i++)
+				intbuf2[i] = 0;
 			outdata_used = outdata;
-			if(b.samples)
-				for(size_t i = 0; i < indata; i++)
-					intbuf[i] = _music_volume * b.samples[i + b.pointer];
-			else
-				for(size_t i = 0; i < indata; i++)
-					intbuf[i] = 0;
-			music_resampler.resample(in, indata, out, outdata, (double)voice_rate_play / b.rate, false);
-			indata_used -= indata;
-			outdata_used -= outdata;
-			get_music(indata_used);
-			get_voice(intbuf, outdata_used);
-
-			vu_mleft(intbuf2, outdata_used, false, voice_rate_play, 1 / 32768.0);
-			vu_mright(intbuf2, outdata_used, false, voice_rate_play, 1 / 32768.0);
-			vu_vout(intbuf, outdata_used, false, voice_rate_play, 1 / 32768.0);
+		}
+		if(!outdata_used)
+			continue;	//Resampler ate input without producing output.
+		get_voice(intbuf, outdata_used);
 
+		vu_mleft(intbuf2, outdata_used, true, voice_rate_play, 1 / 32768.0);
+		vu_mright(intbuf2 + 1, outdata_used, true, voice_rate_play, 1 / 32768.0);
+		vu_vout(intbuf, outdata_used, false, voice_rate_play, 1 / 32768.0);
+
+		for(size_t i = 0; i < outdata_used * 2; i++)
+			intbuf2[i] = max(min(intbuf2[i] + intbuf[i / 2], 32766.0f), -32767.0f);
+		if(stereo)
+			for(size_t i = 0; i < outdata_used * 2; i++)
+				samples[i] = intbuf2[i];
+		else
 			for(size_t i = 0; i < outdata_used; i++)
-				intbuf2[i] = max(min(intbuf2[i] + intbuf[i], 32766.0f), -32767.0f);
-			if(stereo)
-				for(size_t i = 0; i < outdata_used; i++) {
-					samples[2 * i + 0] = intbuf2[i];
-					samples[2 * i + 1] = intbuf2[i];
-				}
-			else
-				for(size_t i = 0; i < outdata_used; i++)
-					samples[i] = intbuf2[i];
-		}
+				samples[i] = (intbuf2[2 * i + 0] + intbuf2[2 * i + 1]) / 2;
 		samples += (stereo ? 2 : 1) * outdata_used;
 		count -= outdata_used;
 	}
@@ -23,6 +23,10 @@
 
 namespace
 {
+	//<name> [[<duty>] <cyclelen>]
+	const char* autofire_signature = "word ?uint ?uint";
+	const char* autofire_error = "Invalid autofire parameters";
+
 	unsigned next_id_from_map(std::map<std::string, unsigned>& map, const std::string& key, unsigned base)
 	{
 		if(!map.count(key))
@@ -41,10 +45,14 @@ button_mapping::button_mapping(controller_state& _controls, keyboard::mapper& _m
 	button_h(cmd, CBUTTON::h, [this](const std::string& a) { this->do_action(a, 1, 1); }),
 	button_t(cmd, CBUTTON::t, [this](const std::string& a) { this->do_action(a, 1, 2); }),
 	button_d(cmd, CBUTTON::d, [this](const std::string& a) { this->do_action(a, 0, 3); }),
-	button_ap(cmd, CBUTTON::ap, [this](const std::string& a) { this->do_autofire_action(a, 1); }),
-	button_ar(cmd, CBUTTON::ar, [this](const std::string& a) { this->do_autofire_action(a, 0); }),
-	button_at(cmd, CBUTTON::at, [this](const std::string& a) { this->do_autofire_action(a, -1); }),
-	button_a(cmd, CBUTTON::a, [this](const std::string& a) { this->do_analog_action(a); }),
+	button_ap(cmd, CBUTTON::ap, autofire_signature, autofire_error,
+		[this](const command::signature::result& a) { this->do_autofire_action(a, 1); }),
+	button_ar(cmd, CBUTTON::ar, autofire_signature, autofire_error,
+		[this](const command::signature::result& a) { this->do_autofire_action(a, 0); }),
+	button_at(cmd, CBUTTON::at, autofire_signature, autofire_error,
+		[this](const command::signature::result& a) { this->do_autofire_action(a, -1); }),
+	button_a(cmd, CBUTTON::a, "word int", "Invalid analog action",
+		[this](const command::signature::result& a) { this->do_analog_action(a); }),
 	afire_p(cmd, BMODE::afp, [this]() { this->promote_autofire = true; }),
 	afire_n(cmd, BMODE::afn, [this]() { this->promote_autofire = false; }),
 	ahold_p(cmd, BMODE::ahp, [this]() { this->promote_autohold = true; }),
@@ -369,12 +377,14 @@ bool button_mapping::check_button_active(const std::string& name)
 	bool complain = true;
 	auto ckey = keyboard.get_current_key();
 	if(ckey) {
+		static const command::signature sig("word word ?rest");
 		auto cb = mapper.get_controllerkeys_kbdkey(ckey);
 		for(auto i : cb) {
-			regex_results r = regex("[^ \t]+[ \t]+([^ \t]+)([ \t]+.*)?", i->get_command());
-			if(!r)
+			command::signature::result r;
+			std::string c = i->get_command();
+			if(!sig.parse(c, r))
 				continue;
-			if(active_buttons.count(r[1]))
+			if(active_buttons.count(r.str(1)))
 				complain = false;
 		}
 	}
@@ -396,7 +406,7 @@ void button_mapping::do_button_action(const std::string& name, short newstate, i
 	if(x.bind.mode != 0)
 		return;
 	if(mode == 0 && newstate == 1 && promote_autofire) {
-		this->do_autofire_action(name, -1);
+		this->do_autofire_action(name, 1, 2, -1);
 	}
 	if(mode == 1 || (mode == 0 && promote_autohold && newstate == 1)) {
 		//Autohold.
@@ -470,12 +480,13 @@ void button_mapping::do_action(const std::string& name, short state, int mode)
 	}
 }
 
-void button_mapping::do_analog_action(const std::string& a)
+void button_mapping::do_analog_action(const command::signature::result& a)
 {
 	int _value;
-	regex_results r = regex("([^ \t]+)[ \t]+(-?[0-9]+)[ \t]*", a, "Invalid analog action");
-	std::string name = r[1];
-	int value = parse_value<int>(r[2]);
+	std::string name = a.str(0);
+	if(a.get_int(1) < std::numeric_limits<int>::min() || a.get_int(1) > std::numeric_limits<int>::max())
+		throw std::runtime_error("Invalid analog action");
+	int value = a.get_int(1);
 	if(!all_buttons.count(name)) {
 		messages << "No such button " << name << std::endl;
 		return;
@@ -496,19 +507,24 @@ void button_mapping::do_analog_action(const std::string& a)
 	controls.analog(x.port, x.controller, x.bind.control1, _value);
 }
 
-void button_mapping::do_autofire_action(const std::string& a, int mode)
+void button_mapping::do_autofire_action(const command::signature::result& a, int mode)
+{
+	uint64_t duty = 1;
+	uint64_t cyclelen = 2;
+	if(a.count() == 3) {
+		duty = a.get_uint(1);
+		cyclelen = a.get_uint(2);
+	} else if(a.count() == 2)
+		cyclelen = a.get_uint(1);
+	if(duty >= cyclelen || cyclelen > std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error(autofire_error);
+	do_autofire_action(a.str(0), duty, cyclelen, mode);
+}
+
+void button_mapping::do_autofire_action(const std::string& name, uint32_t duty, uint32_t cyclelen, int mode)
 {
-	regex_results r = regex("([^ \t]+)(([ \t]+([0-9]+))?[ \t]+([0-9]+))?[ \t]*", a,
-		"Invalid autofire parameters");
-	std::string name = r[1];
-	std::string _duty = r[4];
-	std::string _cyclelen = r[5];
-	if(_duty == "") _duty = "1";
-	if(_cyclelen == "") _cyclelen = "2";
-	uint32_t duty = parse_value<uint32_t>(_duty);
-	uint32_t cyclelen = parse_value<uint32_t>(_cyclelen);
 	if(duty >= cyclelen)
-		throw std::runtime_error("Invalid autofire parameters");
+		throw std::runtime_error(autofire_error);
 	if(!all_buttons.count(name)) {
 		messages << "No such button " << name << std::endl;
 		return;
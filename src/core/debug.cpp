@@ -220,6 +220,11 @@ void debug_context::request_break()
 	requesting_break = true;
 }
 
+bool debug_context::can_break()
+{
+	return !read_cb.empty() || !write_cb.empty() || !exec_cb.empty() || !trace_cb.empty();
+}
+
 debug_context::tracelog_file::tracelog_file(debug_context& _parent)
 	: parent(_parent)
 {
@@ -11,6 +11,7 @@ emulator_dispatch::emulator_dispatch()
 	sound_unmute("sound_unmute"), mode_change("mode_change"), core_change("core_change"),
 	title_change("title_change"), branch_change("branch_change"), mbranch_change("mbranch_change"),
 	core_changed("core_changed"), voice_stream_change("voice_stream_change"),
+	voice_job_progress("voice_job_progress"), voice_job_finish("voice_job_finish"),
 	vu_change("vu_change"), subtitle_change("subtitle_change"), multitrack_change("multitrack_change"),
 	action_update("action_update")
 {
@@ -30,6 +31,8 @@ void emulator_dispatch::set_error_streams(std::ostream* stream)
 	status_update.errors_to(stream);
 	subtitle_change.errors_to(stream);
 	voice_stream_change.errors_to(stream);
+	voice_job_progress.errors_to(stream);
+	voice_job_finish.errors_to(stream);
 	vu_change.errors_to(stream);
 	core_changed.errors_to(stream);
 	multitrack_change.errors_to(stream);
@@ -4,6 +4,7 @@
 #include "core/dispatch.hpp"
 #include "core/emustatus.hpp"
 #include "core/framerate.hpp"
+#include "core/instance.hpp"
 #include "core/inthread.hpp"
 #include "core/jukebox.hpp"
 #include "core/memorywatch.hpp"
@@ -12,11 +13,21 @@
 #include "core/moviefile.hpp"
 #include "core/multitrack.hpp"
 #include "core/project.hpp"
+#include "core/queue.hpp"
 #include "core/rom.hpp"
 #include "core/runmode.hpp"
+#include "library/directory.hpp"
 #include "lua/lua.hpp"
 
+#include <cstdio>
+#include <fstream>
 #include <sstream>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 const int _lsnes_status::pause_none = 0;
 const int _lsnes_status::pause_normal = 1;
@@ -24,41 +35,308 @@ const int _lsnes_status::pause_break = 2;
 const uint64_t _lsnes_status::subframe_savepoint = 0xFFFFFFFFFFFFFFFEULL;
 const uint64_t _lsnes_status::subframe_video = 0xFFFFFFFFFFFFFFFFULL;
 
-slotinfo_cache::slotinfo_cache(movie_logic& _mlogic, command::group& _cmd)
-	: mlogic(_mlogic), cmd(_cmd),
+namespace
+{
+#if defined(__linux__)
+	std::string directory_of(const std::string& filename)
+	{
+		size_t split = filename.find_last_of("/");
+		return (split == std::string::npos) ? std::string(".") : filename.substr(0, split);
+	}
+#endif
+}
+
+slotinfo_cache::slotinfo_cache(movie_logic& _mlogic, command::group& _cmd, input_queue& _iqueue)
+	: mlogic(_mlogic), cmd(_cmd), iqueue(_iqueue),
 	flushcmd(cmd, CLOADSAVE::flushslots, [this]() { this->flush(); })
 {
+	generation = 0;
+	persist_changed = false;
+	quitting = false;
+	watch_fd = -1;
+	wake_fd = -1;
+	worker = NULL;
+}
+
+slotinfo_cache::~slotinfo_cache()
+{
+	if(worker) {
+		{
+			threads::alock h(mlock);
+			quitting = true;
+			wake();
+		}
+		worker->join();
+		delete worker;
+	}
+#if defined(__linux__)
+	if(watch_fd >= 0)
+		close(watch_fd);
+	if(wake_fd >= 0)
+		close(wake_fd);
+#endif
 }
 
 std::string slotinfo_cache::get(const std::string& _filename)
 {
+	//Headless instances show no status.
+	if(&mlogic != lsnes_instance.mlogic)
+		return "";
 	std::string filename = resolve_relative_path(_filename);
+	threads::alock h(mlock);
+	if(!worker)
+		start_worker();
 	if(!cache.count(filename)) {
-		std::ostringstream out;
-		try {
-			moviefile::brief_info info(filename);
-			if(!mlogic)
-				out << "No movie";
-			else if(mlogic.get_mfile().projectid == info.projectid)
-				out << info.rerecords << "R/" << info.current_frame << "F";
-			else
-				out << "Wrong movie";
-		} catch(...) {
-			out << "Nonexistent";
+		if(!requests.count(filename)) {
+			requests.insert(filename);
+			wake();
 		}
-		cache[filename] = out.str();
+		return "...";
 	}
-	return cache[filename];
+	entry& e = cache[filename];
+	std::ostringstream out;
+	if(!e.exists)
+		out << "Nonexistent";
+	else if(!mlogic)
+		out << "No movie";
+	else if(mlogic.get_mfile().projectid == e.projectid)
+		out << e.rerecords << "R/" << e.current_frame << "F";
+	else
+		out << "Wrong movie";
+	return out.str();
 }
 
 void slotinfo_cache::flush(const std::string& _filename)
 {
-	cache.erase(resolve_relative_path(_filename));
+	std::string filename = resolve_relative_path(_filename);
+	threads::alock h(mlock);
+	cache.erase(filename);
+	persisted.erase(filename);
+	generation++;
 }
 
 void slotinfo_cache::flush()
 {
+	threads::alock h(mlock);
 	cache.clear();
+	generation++;
+}
+
+void slotinfo_cache::set_persist_file(const std::string& _filename)
+{
+	threads::alock h(mlock);
+	if(persist_file == _filename)
+		return;
+	persist_file = _filename;
+	persisted.clear();
+	persist_changed = true;
+	wake();
+}
+
+void slotinfo_cache::start_worker()
+{
+#if defined(__linux__)
+	//Without a way to wake the worker, it could not wait for changes. Kept if starting the thread fails.
+	if(watch_fd < 0 && wake_fd < 0) {
+		watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(watch_fd >= 0 && wake_fd < 0) {
+			close(watch_fd);
+			watch_fd = -1;
+		}
+	}
+#endif
+	worker = new threads::thread([this]() { this->entry_point(); });
+}
+
+void slotinfo_cache::wake()
+{
+	cond.notify_all();
+#if defined(__linux__)
+	if(wake_fd >= 0) {
+		uint64_t one = 1;
+		ssize_t r = write(wake_fd, &one, sizeof(one));
+		(void)r;
+	}
+#endif
+}
+
+void slotinfo_cache::entry_point()
+{
+	threads::alock h(mlock);
+	bool changed = false;
+	while(true) {
+		if(quitting)
+			return;
+		if(persist_changed) {
+			persist_changed = false;
+			read_persisted(h);
+			continue;
+		}
+		if(!requests.empty()) {
+			std::string filename = *requests.begin();
+			uint64_t gen = generation;
+			entry e;
+			e.exists = false;
+			e.rerecords = 0;
+			e.current_frame = 0;
+			bool have_old = persisted.count(filename);
+			entry old = have_old ? persisted[filename] : e;
+			h.unlock();
+			e.identity = directory::identity(filename);
+			if(have_old && e.identity != "" && old.identity == e.identity) {
+				//Unchanged since last time, no need to read it.
+				e = old;
+			} else if(e.identity != "") {
+				try {
+					moviefile::brief_info info(filename);
+					e.exists = true;
+					e.projectid = info.projectid;
+					e.rerecords = info.rerecords;
+					e.current_frame = info.current_frame;
+				} catch(...) {
+				}
+			}
+			h.lock();
+			//If flushed meanwhile, the result may be stale, so read it again.
+			if(gen != generation)
+				continue;
+			requests.erase(filename);
+			cache[filename] = e;
+			persisted.erase(filename);
+#if defined(__linux__)
+			std::string dir = directory_of(filename);
+			if(watch_fd >= 0 && !watched.count(dir)) {
+				int wd = inotify_add_watch(watch_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO |
+					IN_MOVED_FROM | IN_DELETE);
+				if(wd >= 0) {
+					watched.insert(dir);
+					watch_dirs[wd] = dir;
+				}
+			}
+#endif
+			changed = true;
+			continue;
+		}
+		if(changed) {
+			changed = false;
+			write_persisted(h);
+			iqueue.run_async([]() { CORE().supdater->update(); }, [](std::exception& e) {});
+			continue;
+		}
+#if defined(__linux__)
+		if(watch_fd >= 0) {
+			//Sleep until a watched directory changes or wake() is called.
+			h.unlock();
+			struct pollfd fds[2];
+			fds[0].fd = watch_fd;
+			fds[0].events = POLLIN;
+			fds[1].fd = wake_fd;
+			fds[1].events = POLLIN;
+			poll(fds, 2, -1);
+			uint64_t count;
+			ssize_t r = read(wake_fd, &count, sizeof(count));
+			(void)r;
+			h.lock();
+			check_changes(h);
+			continue;
+		}
+#endif
+		cond.wait(h);
+	}
+}
+
+void slotinfo_cache::check_changes(threads::alock& h)
+{
+#if defined(__linux__)
+	if(watch_fd < 0)
+		return;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(true) {
+		ssize_t r = read(watch_fd, buf, sizeof(buf));
+		if(r <= 0)
+			return;
+		for(char* ptr = buf; ptr < buf + r;) {
+			struct inotify_event* ev = reinterpret_cast<struct inotify_event*>(ptr);
+			ptr += sizeof(struct inotify_event) + ev->len;
+			if(!ev->len || !watch_dirs.count(ev->wd))
+				continue;
+			std::string filename = watch_dirs[ev->wd] + "/" + ev->name;
+			//Read again slots that are being shown or read.
+			if(cache.count(filename) || requests.count(filename)) {
+				cache.erase(filename);
+				requests.insert(filename);
+				generation++;
+			}
+			persisted.erase(filename);
+		}
+	}
+#endif
+}
+
+void slotinfo_cache::read_persisted(threads::alock& h)
+{
+	std::string filename = persist_file;
+	std::map<std::string, entry> loaded;
+	h.unlock();
+	if(filename != "") {
+		std::ifstream in(filename);
+		std::string line;
+		while(std::getline(in, line)) {
+			//Identity, project ID, rerecords, frame and filename, separated by tabs.
+			std::string fields[4];
+			size_t pos = 0;
+			bool ok = true;
+			for(unsigned i = 0; i < 4 && ok; i++) {
+				size_t split = line.find('\t', pos);
+				ok = (split != std::string::npos);
+				if(ok)
+					fields[i] = line.substr(pos, split - pos);
+				pos = split + 1;
+			}
+			if(!ok)
+				continue;
+			entry e;
+			e.exists = true;
+			e.identity = fields[0];
+			e.projectid = fields[1];
+			e.rerecords = strtoull(fields[2].c_str(), NULL, 10);
+			e.current_frame = strtoull(fields[3].c_str(), NULL, 10);
+			loaded[line.substr(pos)] = e;
+		}
+	}
+	h.lock();
+	//The file may have been changed again meanwhile.
+	if(filename == persist_file)
+		persisted = loaded;
+}
+
+void slotinfo_cache::write_persisted(threads::alock& h)
+{
+	if(persist_file == "")
+		return;
+	std::string filename = persist_file;
+	//Keep entries read from file that have not been needed yet.
+	std::map<std::string, entry> entries = persisted;
+	for(auto& i : cache)
+		if(i.second.exists)
+			entries[i.first] = i.second;
+	h.unlock();
+	std::string tmp = filename + ".tmp";
+	{
+		std::ofstream out(tmp);
+		for(auto& i : entries)
+			out << i.second.identity << "\t" << i.second.projectid << "\t" << i.second.rerecords << "\t"
+				<< i.second.current_frame << "\t" << i.first << std::endl;
+		if(!out) {
+			out.close();
+			remove(tmp.c_str());
+			h.lock();
+			return;
+		}
+	}
+	directory::rename_overwrite(tmp.c_str(), filename.c_str());
+	h.lock();
 }
 
 status_updater::status_updater(project_state& _project, movie_logic& _mlogic, voice_commentary& _commentary,
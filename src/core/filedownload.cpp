@@ -1,4 +1,5 @@
 #include "core/filedownload.hpp"
+#include "core/memslots.hpp"
 #include "core/moviedata.hpp"
 #include "core/rom.hpp"
 #include "interface/romtype.hpp"
@@ -156,9 +157,8 @@ void file_download::_do_async(loaded_rom& rom)
 				for(auto i : sysregs)
 					gametype = &i->get_type();
 		}
-		auto mv = moviefile::memref(target_slot);
-		moviefile::memref(target_slot) = new moviefile(tempname2, *gametype);
-		delete mv;
+		moviefile mv(tempname2, *gametype);
+		memory_slots::singleton().put(target_slot, mv);
 		remove(tempname2.c_str());
 	} catch(std::exception& e) {
 		remove(tempname2.c_str());
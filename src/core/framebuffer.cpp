@@ -16,6 +16,7 @@
 #include "library/framebuffer-pixfmt-lrgb.hpp"
 #include "library/minmax.hpp"
 #include "library/triplebuffer.hpp"
+#include "library/workthread.hpp"
 #include "lua/lua.hpp"
 
 namespace
@@ -76,6 +77,12 @@ namespace
 		draw_special_screen(target, rl_corrupt);
 	}
 
+	//At least one of this many frames is drawn even if the display seems to lag behind, in case it is not being
+	//updated at all.
+	const unsigned max_consecutive_skips = 60;
+
+	const uint32_t WORKFLAG_COMPOSITE = 1;
+
 	settingvar::supervariable<settingvar::model_int<0, 8191>> SET_dtb(lsnes_setgrp, "top-border",
 		"UI‣Top padding", 0);
 	settingvar::supervariable<settingvar::model_int<0, 8191>> SET_dbb(lsnes_setgrp, "bottom-border",
@@ -88,14 +95,70 @@ namespace
 
 framebuffer::raw emu_framebuffer::screen_corrupt;
 
+//Composites frames for display, so neither the emulation nor the UI thread has to.
+class emu_framebuffer::compositor : public workthread
+{
+public:
+	compositor(emu_framebuffer& _fbuf)
+		: fbuf(_fbuf)
+	{
+		fire();
+	}
+	void queue_frame()
+	{
+		set_workflag(WORKFLAG_COMPOSITE);
+	}
+protected:
+	void entry()
+	{
+		while(1) {
+			wait_workflag();
+			uint32_t work = clear_workflag(~workthread::quit_request);
+			//Frames queued while compositing coalesce into one, only the latest one gets composited.
+			if(work & WORKFLAG_COMPOSITE)
+				fbuf.composite_frame();
+			if(work & workthread::quit_request)
+				return;
+		}
+	}
+private:
+	emu_framebuffer& fbuf;
+};
+
 emu_framebuffer::emu_framebuffer(subtitle_commentary& _subtitles, settingvar::group& _settings, memwatch_set& _mwatch,
 	keyboard::keyboard& _keyboard, emulator_dispatch& _dispatch, lua_state& _lua2, loaded_rom& _rom,
 	status_updater& _supdater, command::group& _cmd, input_queue& _iqueue)
-	: buffering(buffer1, buffer2, buffer3), subtitles(_subtitles), settings(_settings), mwatch(_mwatch),
+	: buffering(buffer1, buffer2, buffer3), composing(composed1, composed2, composed3), subtitles(_subtitles), settings(_settings), mwatch(_mwatch),
 	keyboard(_keyboard), edispatch(_dispatch), lua2(_lua2), rom(_rom), supdater(_supdater), cmd(_cmd),
 	iqueue(_iqueue), screenshot(cmd, CFRAMEBUF::ss, [this](command::arg_filename a) { this->do_screenshot(a); })
 {
 	last_redraw_no_lua = false;
+	std::shared_ptr<const framebuffer::raw> empty(new framebuffer::raw);
+	buffer1.fbuf = buffer2.fbuf = buffer3.fbuf = empty;
+	buffer1.serial = buffer2.serial = buffer3.serial = 0;
+	drawn_serial = 0;
+	displayed_serial = 0;
+	fs_mode = FS_DRAW;
+	fs_fast = false;
+	consecutive_skips = 0;
+	fs_stats.drawn = 0;
+	fs_stats.skipped = 0;
+	fs_stats.drawn_time = 0;
+	fs_stats.skipped_time = 0;
+	composed1.serial = composed2.serial = composed3.serial = 0;
+	composed1.lgap = composed2.lgap = composed3.lgap = 0;
+	composed1.tgap = composed2.tgap = composed3.tgap = 0;
+	comp = NULL;
+	display_active = false;
+	composed_held = false;
+}
+
+emu_framebuffer::~emu_framebuffer()
+{
+	if(comp) {
+		comp->request_quit();
+		delete comp;
+	}
 }
 
 void emu_framebuffer::do_screenshot(command::arg_filename file)
@@ -107,9 +170,8 @@ void emu_framebuffer::do_screenshot(command::arg_filename file)
 
 void emu_framebuffer::take_screenshot(const std::string& file) throw(std::bad_alloc, std::runtime_error)
 {
-	render_info& ri = buffering.get_read();
-	ri.fbuf.save_png(file);
-	buffering.put_read();
+	std::shared_ptr<const framebuffer::raw> f = get_framebuffer();
+	f->save_png(file);
 }
 
 
@@ -135,9 +197,16 @@ void emu_framebuffer::init_special_screens() throw(std::bad_alloc)
 }
 
 void emu_framebuffer::redraw_framebuffer(framebuffer::raw& todraw, bool no_lua, bool spontaneous)
+{
+	//This is the only copy made of the frame, everything else shares it.
+	redraw_framebuffer(frames.make_copy(todraw), no_lua, spontaneous);
+}
+
+void emu_framebuffer::redraw_framebuffer(std::shared_ptr<const framebuffer::raw> todraw, bool no_lua,
+	bool spontaneous)
 {
 	uint32_t hscl, vscl;
-	auto g = rom.get_scale_factors(todraw.get_width(), todraw.get_height());
+	auto g = rom.get_scale_factors(todraw->get_width(), todraw->get_height());
 	hscl = g.first;
 	vscl = g.second;
 	render_info& ri = buffering.get_write();
@@ -148,13 +217,14 @@ void emu_framebuffer::redraw_framebuffer(framebuffer::raw& todraw, bool no_lua,
 	lrc.bottom_gap = 0;
 	lrc.top_gap = 0;
 	lrc.queue = &ri.rq;
-	lrc.width = todraw.get_width() * hscl;
-	lrc.height = todraw.get_height() * vscl;
+	lrc.width = todraw->get_width() * hscl;
+	lrc.height = todraw->get_height() * vscl;
 	if(!no_lua) {
 		lua2.callback_do_paint(&lrc, spontaneous);
 		subtitles.render(lrc);
 	}
 	ri.fbuf = todraw;
+	ri.serial = ++drawn_serial;
 	ri.hscl = hscl;
 	ri.vscl = vscl;
 	ri.lgap = max(lrc.left_gap, (unsigned)SET_dlb(settings));
@@ -163,32 +233,130 @@ void emu_framebuffer::redraw_framebuffer(framebuffer::raw& todraw, bool no_lua,
 	ri.bgap = max(lrc.bottom_gap, (unsigned)SET_dbb(settings));
 	mwatch.watch(ri.rq);
 	buffering.put_write();
-	edispatch.screen_update();
+	//With display, screen update is signaled when the frame has been composited.
+	if(display_active)
+		comp->queue_frame();
+	else
+		edispatch.screen_update();
 	last_redraw_no_lua = no_lua;
 	supdater.update();
+	//Anything skipped is older than this.
+	skipped_frame.reset();
 }
 
 void emu_framebuffer::redraw_framebuffer()
 {
-	framebuffer::raw copy;
-	buffering.read_last_write_synchronous([&copy](render_info& ri) { copy = ri.fbuf; });
+	std::shared_ptr<const framebuffer::raw> last;
+	buffering.read_last_write_synchronous([&last](render_info& ri) { last = ri.fbuf; });
 	//Redraws are never spontaneous
-	redraw_framebuffer(copy, last_redraw_no_lua, false);
+	redraw_framebuffer(last, last_redraw_no_lua, false);
 }
 
-void emu_framebuffer::render_framebuffer()
+emu_framebuffer::frameskip_mode emu_framebuffer::begin_frame(bool fast, bool known_not_last, bool dumping)
+{
+	fs_fast = fast;
+	bool display_behind = (displayed_serial != drawn_serial);
+	if(fast && !dumping && display_behind && consecutive_skips < max_consecutive_skips) {
+		consecutive_skips++;
+		fs_mode = known_not_last ? FS_SKIP_PIXELS : FS_SKIP;
+	} else {
+		consecutive_skips = 0;
+		fs_mode = FS_DRAW;
+	}
+	return fs_mode;
+}
+
+std::shared_ptr<const framebuffer::raw> emu_framebuffer::output_frame(framebuffer::raw& screen)
+{
+	std::shared_ptr<const framebuffer::raw> f;
+	if(fs_mode == FS_DRAW) {
+		f = frames.make_copy(screen);
+		redraw_framebuffer(f, false, true);
+	} else if(fs_mode == FS_SKIP) {
+		f = skipped_frame = frames.make_copy(screen);
+	} else {
+		//The core did not draw anything, so there is nothing to show.
+		skipped_frame.reset();
+	}
+	return f;
+}
+
+std::shared_ptr<const framebuffer::raw> emu_framebuffer::share_frame(framebuffer::raw& screen)
+	throw(std::bad_alloc)
+{
+	return frames.make_copy(screen);
+}
+
+void emu_framebuffer::end_frame(uint64_t usec)
+{
+	if(fs_fast && fs_mode == FS_DRAW) {
+		fs_stats.drawn++;
+		fs_stats.drawn_time += usec;
+	} else if(fs_fast) {
+		fs_stats.skipped++;
+		fs_stats.skipped_time += usec;
+	}
+	//Frames output outside emulation (if any) are always drawn.
+	fs_mode = FS_DRAW;
+	fs_fast = false;
+}
+
+void emu_framebuffer::flush_skipped_frame()
+{
+	if(!skipped_frame)
+		return;
+	std::shared_ptr<const framebuffer::raw> f = skipped_frame;
+	redraw_framebuffer(f, false, true);
+}
+
+char* emu_framebuffer::lend_frame_memory(size_t size) throw(std::bad_alloc)
+{
+	return frames.lend(size);
+}
+
+emu_framebuffer::frameskip_stats emu_framebuffer::get_frameskip_stats()
+{
+	return fs_stats;
+}
+
+void emu_framebuffer::composite_frame()
 {
 	render_info& ri = buffering.get_read();
-	main_screen.reallocate(ri.fbuf.get_width() * ri.hscl + ri.lgap + ri.rgap, ri.fbuf.get_height() * ri.vscl +
+	composed_frame& cf = composing.get_write();
+	cf.screen.reallocate(ri.fbuf->get_width() * ri.hscl + ri.lgap + ri.rgap, ri.fbuf->get_height() * ri.vscl +
 		ri.tgap + ri.bgap);
-	main_screen.set_origin(ri.lgap, ri.tgap);
-	main_screen.copy_from(ri.fbuf, ri.hscl, ri.vscl);
-	ri.rq.run(main_screen);
+	cf.screen.set_origin(ri.lgap, ri.tgap);
+	cf.screen.copy_from(*ri.fbuf, ri.hscl, ri.vscl);
+	ri.rq.run(cf.screen);
+	cf.lgap = ri.lgap;
+	cf.tgap = ri.tgap;
+	cf.serial = ri.serial;
+	composing.put_write();
+	buffering.put_read();
+	edispatch.screen_update();
+}
+
+void emu_framebuffer::render_framebuffer()
+{
+	if(!display_active) {
+		//First frame to display. Start compositing, beginning with the frame already there.
+		comp = new compositor(*this);
+		display_active = true;
+		comp->queue_frame();
+	}
+	//The composited frame is used in place, so it is held until the next call.
+	if(composed_held)
+		composing.put_read();
+	composed_frame& cf = composing.get_read();
+	composed_held = true;
+	displayed_serial = cf.serial;
+	main_screen.set(cf.screen.rowptr(0), cf.screen.get_width(), cf.screen.get_height(), cf.screen.get_stride());
+	main_screen.set_origin(cf.lgap, cf.tgap);
 	//We would want divide by 2, but we'll do it ourselves in order to do mouse.
 	keyboard::mouse_calibration xcal;
 	keyboard::mouse_calibration ycal;
-	xcal.offset = ri.lgap;
-	ycal.offset = ri.tgap;
+	xcal.offset = cf.lgap;
+	ycal.offset = cf.tgap;
 	auto kbd = &keyboard;
 	iqueue.run_async([kbd, xcal, ycal]() {
 		keyboard::key* mouse_x = kbd->try_lookup_key("mouse_x");
@@ -198,25 +366,24 @@ void emu_framebuffer::render_framebuffer()
 		if(mouse_y && mouse_y->get_type() == keyboard::KBD_KEYTYPE_MOUSE)
 			mouse_y->cast_mouse()->set_calibration(ycal);
 	}, [](std::exception& e){});
-	buffering.put_read();
 }
 
 std::pair<uint32_t, uint32_t> emu_framebuffer::get_framebuffer_size()
 {
 	uint32_t v, h;
 	render_info& ri = buffering.get_read();
-	v = ri.fbuf.get_width();
-	h = ri.fbuf.get_height();
+	v = ri.fbuf->get_width();
+	h = ri.fbuf->get_height();
 	buffering.put_read();
 	return std::make_pair(h, v);
 }
 
-framebuffer::raw emu_framebuffer::get_framebuffer() throw(std::bad_alloc)
+std::shared_ptr<const framebuffer::raw> emu_framebuffer::get_framebuffer() throw()
 {
 	render_info& ri = buffering.get_read();
-	framebuffer::raw copy = ri.fbuf;
+	std::shared_ptr<const framebuffer::raw> f = ri.fbuf;
 	buffering.put_read();
-	return copy;
+	return f;
 }
 
 void emu_framebuffer::render_kill_request(void* obj)
@@ -226,9 +393,9 @@ void emu_framebuffer::render_kill_request(void* obj)
 	buffer3.rq.kill_request(obj);
 }
 
-framebuffer::raw& emu_framebuffer::render_get_latest_screen()
+const framebuffer::raw& emu_framebuffer::render_get_latest_screen()
 {
-	return buffering.get_read().fbuf;
+	return *buffering.get_read().fbuf;
 }
 
 void emu_framebuffer::render_get_latest_screen_end()
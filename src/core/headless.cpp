@@ -0,0 +1,90 @@
+#include "lsnes.hpp"
+
+#include "core/controller.hpp"
+#include "core/framerate.hpp"
+#include "core/headless.hpp"
+#include "core/instance.hpp"
+#include "core/mainloop.hpp"
+#include "core/messages.hpp"
+#include "core/misc.hpp"
+#include "core/moviedata.hpp"
+#include "core/random.hpp"
+#include "core/rom.hpp"
+#include "core/window.hpp"
+#include "interface/romtype.hpp"
+#include "library/crandom.hpp"
+#include "lua/lua.hpp"
+
+std::vector<std::string> headless_startup(int argc, char** argv)
+{
+	try {
+		crandom::init();
+	} catch(std::exception& e) {
+		std::cerr << "Error initializing system RNG" << std::endl;
+		exit(1);
+	}
+
+	reached_main();
+	std::vector<std::string> cmdline;
+	for(int i = 1; i < argc; i++)
+		cmdline.push_back(argv[i]);
+	return cmdline;
+}
+
+void headless_init()
+{
+	set_random_seed();
+	platform::init();
+	init_lua(lsnes_instance);
+}
+
+std::string headless_movie_filename(const std::vector<std::string>& cmdline)
+{
+	std::string movfn;
+	for(auto i : cmdline)
+		if(i.length() > 0 && i[0] != '-')
+			movfn = i;
+	return movfn;
+}
+
+loaded_rom headless_load_rom(const std::string& movfn, const std::vector<std::string>& cmdline)
+{
+	init_main_callbacks();
+	struct loaded_rom r;
+	try {
+		std::map<std::string, std::string> tmp;
+		r = construct_rom(movfn, cmdline);
+		r.load(tmp, 1000000000, 0);
+		messages << "Using core: " << r.get_core_identifier() << std::endl;
+	} catch(std::bad_alloc& e) {
+		OOM_panic();
+	} catch(std::exception& e) {
+		messages << "FATAL: Can't load ROM: " << e.what() << std::endl;
+		quit_lua(lsnes_instance);
+		fatal_error();
+	}
+	lsnes_instance.framerate->set_nominal_framerate(r.region_approx_framerate());
+	return r;
+}
+
+void headless_run(loaded_rom& r, const std::string& movfn, std::function<void(moviefile& mv)> on_start)
+{
+	moviefile* movie;
+	try {
+		movie = new moviefile(movfn, r.get_internal_rom_type());
+		*lsnes_instance.rom = r;
+		lsnes_instance.rom->set_internal_region(movie->gametype->get_region());
+		lsnes_instance.rom->load(movie->settings, movie->movie_rtc_second, movie->movie_rtc_subsecond);
+		on_start(*movie);
+		main_loop(r, *movie, true);
+	} catch(std::bad_alloc& e) {
+		OOM_panic();
+	} catch(std::exception& e) {
+		messages << "FATAL: " << e.what() << std::endl;
+		quit_lua(lsnes_instance);
+		fatal_error();
+	}
+	quit_lua(lsnes_instance);
+	lsnes_instance.mlogic->release_memory();
+	lsnes_instance.buttons->cleanup();
+}
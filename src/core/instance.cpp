@@ -14,6 +14,7 @@
 #include "core/keymapper.hpp"
 #include "core/mbranch.hpp"
 #include "core/memorymanip.hpp"
+#include "core/memslots.hpp"
 #include "core/memorywatch.hpp"
 #include "core/messages.hpp"
 #include "core/misc.hpp"
@@ -26,9 +27,12 @@
 #include "core/rom.hpp"
 #include "core/runmode.hpp"
 #include "core/settings.hpp"
+#include "core/search.hpp"
+#include "core/statelog.hpp"
 #include "fonts/wrapper.hpp"
 #include "library/command.hpp"
 #include "library/framebuffer.hpp"
+#include "library/gc.hpp"
 #include "library/keyboard.hpp"
 #include "library/keyboard-mapper.hpp"
 #include "library/lua-base.hpp"
@@ -36,6 +40,7 @@
 #include "library/settingvar.hpp"
 #include "lua/lua.hpp"
 
+#include <atomic>
 #include <deque>
 #ifdef __linux__
 #include <execinfo.h>
@@ -68,8 +73,15 @@ void dtor_list::destroy()
 	list = NULL;
 }
 
+namespace
+{
+	std::atomic<uint64_t> next_serial(0);
+	thread_local emulator_instance* current_instance;
+}
+
 emulator_instance::emulator_instance()
 {
+	serial = next_serial++;
 	//Preinit.
 	D.prealloc(fbuf);
 	D.prealloc(project);
@@ -82,7 +94,7 @@ emulator_instance::emulator_instance()
 	D.init(command);
 	D.init(iqueue, *command);
 	D.init(mlogic);
-	D.init(slotcache, *mlogic, *command);
+	D.init(slotcache, *mlogic, *command, *iqueue);
 	D.init(memory);
 	D.init(settings);
 	D.init(lua);
@@ -117,6 +129,8 @@ emulator_instance::emulator_instance()
 	D.init(runmode);
 	D.init(supdater, *project, *mlogic, *commentary, *status, *runmode, *mdumper, *jukebox, *slotcache,
 	       *framerate, *controls, *mteditor, *lua2, *rom, *mwatch, *dispatch);
+	D.init(statelog, *rom, *mlogic, *command);
+	D.init(search, *rom, *mlogic, *memory, *dispatch, *iqueue, *command);
 
 	status_A->valid = false;
 	status_B->valid = false;
@@ -130,13 +144,28 @@ emulator_instance::emulator_instance()
 
 emulator_instance::~emulator_instance()
 {
+	std::list<std::function<void()>> fns;
+	{
+		threads::alock h(destroy_lock);
+		std::swap(fns, destroy_fns);
+	}
+	for(auto i = fns.rbegin(); i != fns.rend(); i++)
+		(*i)();
 	D.destroy();
 }
 
+void emulator_instance::on_destroy(std::function<void()> fn)
+{
+	threads::alock h(destroy_lock);
+	destroy_fns.push_back(fn);
+}
+
 emulator_instance lsnes_instance;
 
 emulator_instance& CORE()
 {
+	if(current_instance)
+		return *current_instance;
 	if(threads::id() != lsnes_instance.emu_thread) {
 		std::cerr << "WARNING: CORE() called in wrong thread." << std::endl;
 #ifdef __linux__
@@ -147,6 +176,75 @@ emulator_instance& CORE()
 	return lsnes_instance;
 }
 
+emulator_instance* set_current_instance(emulator_instance* inst) throw()
+{
+	emulator_instance* old = current_instance;
+	current_instance = (inst == &lsnes_instance) ? NULL : inst;
+	return old;
+}
+
+headless_instance::headless_instance(std::function<void(emulator_instance& inst)> fn) throw(std::bad_alloc,
+	std::runtime_error)
+{
+	done = false;
+	joined = false;
+	try {
+		thread = new threads::thread([this, fn]() { this->run(fn); });
+	} catch(std::bad_alloc& e) {
+		throw;
+	} catch(std::exception& e) {
+		throw std::runtime_error(std::string("Can't start instance thread: ") + e.what());
+	}
+}
+
+headless_instance::~headless_instance() throw()
+{
+	join();
+	delete thread;
+}
+
+void headless_instance::join() throw()
+{
+	if(joined)
+		return;
+	thread->join();
+	joined = true;
+}
+
+bool headless_instance::finished() throw()
+{
+	threads::alock h(lock);
+	return done;
+}
+
+std::string headless_instance::get_error() throw(std::bad_alloc)
+{
+	threads::alock h(lock);
+	return error;
+}
+
+void headless_instance::run(std::function<void(emulator_instance& inst)> fn)
+{
+	std::string err;
+	try {
+		//The instance stays current until it has been destroyed, so its destroy hooks see the right instance.
+		emulator_instance inst;
+		inst.emu_thread = threads::this_id();
+		set_current_instance(&inst);
+		fn(inst);
+	} catch(std::exception& e) {
+		err = e.what();
+		if(err == "")
+			err = "Unknown error";
+	} catch(...) {
+		err = "Unknown error";
+	}
+	set_current_instance(NULL);
+	threads::alock h(lock);
+	error = err;
+	done = true;
+}
+
 namespace
 {
 	uint32_t digits(size_t num)
@@ -171,4 +269,44 @@ namespace
 				messages << i.first << std::string(pad_spaces, ' ') << i.second << std::endl;
 			}
 		});
+
+	command::fnptr<> CMD_gc_stats(lsnes_cmds, "show-gc", "Show garbage collector statistics",
+		"show-gc\nShow garbage collector statistics",
+		[]() throw(std::bad_alloc, std::runtime_error) {
+			GC::stats s = GC::item::get_stats();
+			messages << "Items: " << s.young_items << " young, " << s.old_items << " old" << std::endl;
+			messages << "Collections: " << s.minor_collections << " minor, " << s.major_collections
+				<< " major" << (s.major_in_progress ? " (one in progress)" : "") << std::endl;
+			messages << "Freed " << s.freed << " items, promoted " << s.promoted << " items" << std::endl;
+			messages << "Pause: last " << s.last_pause << "us, longest " << s.max_pause << "us" << std::endl;
+		});
+
+	command::fnptr<> CMD_frameskip_stats(lsnes_cmds, "show-frameskip", "Show frameskip statistics",
+		"show-frameskip\nShow statistics of frames skipped while fast-forwarding",
+		[]() throw(std::bad_alloc, std::runtime_error) {
+			auto s = CORE().fbuf->get_frameskip_stats();
+			uint64_t frames = s.drawn + s.skipped;
+			messages << "Frames while fast-forwarding: " << s.drawn << " drawn, " << s.skipped << " skipped"
+				<< std::endl;
+			if(!s.drawn || !frames)
+				return;
+			double drawn_avg = 1.0 * s.drawn_time / s.drawn;
+			double avg = 1.0 * (s.drawn_time + s.skipped_time) / frames;
+			messages << "Average frame time: " << drawn_avg << "us drawn";
+			if(s.skipped)
+				messages << ", " << 1.0 * s.skipped_time / s.skipped << "us skipped";
+			messages << std::endl;
+			if(avg > 0)
+				messages << "Realized speedup from skipping: " << drawn_avg / avg << "x" << std::endl;
+		});
+
+	command::fnptr<> CMD_memslot_stats(lsnes_cmds, "show-memory-slots", "Show memory save slot statistics",
+		"show-memory-slots\nShow statistics of in-memory save slots and cached savestate files",
+		[]() throw(std::bad_alloc, std::runtime_error) {
+			auto s = memory_slots::singleton().get_stats();
+			messages << "Slots: " << s.slots << ", cached files: " << s.files << " (" << s.compressed
+				<< " compressed, " << s.spilled << " spilled to disk)" << std::endl;
+			messages << "Memory: " << s.state_bytes << " bytes of states and input, " << s.shared_bytes
+				<< " bytes of shared data, budget " << s.budget << " bytes" << std::endl;
+		});
 }
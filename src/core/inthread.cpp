@@ -20,9 +20,13 @@
 #include "library/string.hpp"
 #include "library/workthread.hpp"
 
+#include <algorithm>
 #include <cstdint>
 #include <cmath>
+#include <functional>
 #include <list>
+#include <map>
+#include <set>
 #include <iostream>
 #include <fstream>
 #include <cstring>
@@ -60,6 +64,14 @@
 #define PLAY_THRESHOLD_DIV 30
 //Special granule position: None.
 #define GRANULEPOS_NONE 0xFFFFFFFFFFFFFFFFULL
+//How far ahead packets are prefetched (in samples).
+#define PREFETCH_AHEAD 96000
+//Minimum time advance between prefetches (in samples).
+#define PREFETCH_INTERVAL 12000
+//Length of segment processed in parallel by export/import jobs (in samples, multiple of OPUS_BLOCK_SIZE).
+#define JOB_SEGMENT 480000
+//Number of blocks encoded before each import segment to get encoder state to converge.
+#define JOB_ENCODER_WARMUP 25
 
 namespace
 {
@@ -68,6 +80,8 @@ namespace
 	class stream_collection;
 	class bitrate_tracker;
 	class inthread_th;
+	class packet_prefetcher;
+	class commentary_job;
 
 	settingvar::supervariable<settingvar::model_int<OPUS_MIN_BITRATE,OPUS_MAX_BITRATE>> SET_opus_bitrate(
 		lsnes_setgrp, "opus-bitrate", "commentary‣Bitrate", OPUS_BITRATE);
@@ -86,6 +100,8 @@ namespace
 			last_rate = 0;
 			current_collection = NULL;
 			int_task = NULL;
+			prefetch = NULL;
+			job = NULL;
 		}
 		//Recording active flag.
 		volatile bool active_flag;
@@ -112,6 +128,10 @@ namespace
 		threads::lock current_collection_lock;
 		//The task handling the stuff.
 		inthread_th* int_task;
+		//The packet prefetcher.
+		packet_prefetcher* prefetch;
+		//The export/import job running in background (only touched from UI thread).
+		commentary_job* job;
 		//Functions.
 		void start_management_stream(opus_stream& s);
 		void advance_time(uint64_t newtime);
@@ -127,6 +147,9 @@ namespace
 		void handle_tangent_positive_edge(opus::encoder& e, opus_stream*& active_stream,
 			bitrate_tracker& brtrack);
 		void handle_tangent_negative_edge(opus_stream*& active_stream, bitrate_tracker& brtrack);
+		void add_imported_stream(opus_stream& st);
+		void start_job(commentary_job* j);
+		void stop_job();
 		settingvar::group& settings;
 		emulator_dispatch& edispatch;
 		audioapi_instance& audio;
@@ -242,6 +265,9 @@ namespace
 		//Read the packet.
 		//Can throw.
 		std::vector<unsigned char> packet(filesystem::ref from_sys);
+		//Read the packet into buffer, reusing its storage.
+		//Can throw.
+		void packet(filesystem::ref from_sys, std::vector<unsigned char>& buf);
 	private:
 		uint64_t descriptor;
 	};
@@ -249,15 +275,20 @@ namespace
 	std::vector<unsigned char> opus_packetinfo::packet(filesystem::ref from_sys)
 	{
 		std::vector<unsigned char> ret;
+		packet(from_sys, ret);
+		return ret;
+	}
+
+	void opus_packetinfo::packet(filesystem::ref from_sys, std::vector<unsigned char>& buf)
+	{
 		uint64_t off = offset();
 		uint32_t sz = size();
 		uint32_t cluster = off / CLUSTER_SIZE;
 		uint32_t coff = off % CLUSTER_SIZE;
-		ret.resize(sz);
-		size_t r = from_sys.read_data(cluster, coff, &ret[0], sz);
+		buf.resize(sz);
+		size_t r = from_sys.read_data(cluster, coff, &buf[0], sz);
 		if(r != sz)
 			throw std::runtime_error("Incomplete read");
-		return ret;
 	}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -269,10 +300,9 @@ namespace
 		//Read stream with specified base time and specified start clusters.
 		//Can throw.
 		opus_stream(uint64_t base, filesystem::ref filesys, uint32_t ctrl_cluster, uint32_t data_cluster);
-		//Import a stream with specified base time.
+		//Import an OggOpus stream with specified base time.
 		//Can throw.
-		opus_stream(uint64_t base, filesystem::ref filesys, std::ifstream& data,
-			voice_commentary::external_stream_format extfmt, settingvar::group& settings);
+		opus_stream(uint64_t base, filesystem::ref filesys, ogg::stream_reader_mmap& data);
 		//Delete this stream (also puts a ref)
 		void delete_stream() { deleting = true; put_ref(); }
 		//Export a stream.
@@ -283,12 +313,27 @@ namespace
 		{
 			return (seqno < packets.size()) ? packets[seqno].length() : 0;
 		}
+		//Get the packet containing specified sample (counted from start of pregap).
+		uint32_t packet_at(uint64_t sample)
+		{
+			auto i = std::upper_bound(packet_starts.begin(), packet_starts.end(), sample);
+			return (i == packet_starts.begin()) ? 0 : (i - packet_starts.begin() - 1);
+		}
 		//Get data of specified packet.
 		//Can throw.
 		std::vector<unsigned char> packet(uint32_t seqno)
 		{
 			return (seqno < packets.size()) ? packets[seqno].packet(fs) : std::vector<unsigned char>();
 		}
+		//Get data of specified packet into buffer, reusing its storage.
+		//Can throw.
+		void packet(uint32_t seqno, std::vector<unsigned char>& buf)
+		{
+			if(seqno < packets.size())
+				packets[seqno].packet(fs, buf);
+			else
+				buf.clear();
+		}
 		//Get base time in samples for stream.
 		uint64_t timebase() { return s_timebase; }
 		//Set base time in samples for stream.
@@ -338,14 +383,14 @@ namespace
 	private:
 		void export_stream_sox(std::ofstream& data);
 		void export_stream_oggopus(std::ofstream& data);
-		void import_stream_sox(std::ifstream& data, settingvar::group& settings);
-		void import_stream_oggopus(std::ifstream& data);
+		void import_stream_oggopus(ogg::stream_reader_mmap& data);
 
 		opus_stream(const opus_stream&);
 		opus_stream& operator=(const opus_stream&);
 		void destroy();
 		filesystem::ref fs;
 		std::vector<opus_packetinfo> packets;
+		std::vector<uint64_t> packet_starts;
 		uint64_t total_len;
 		uint64_t s_timebase;
 		uint32_t next_cluster;
@@ -446,6 +491,7 @@ namespace
 					uint16_t psize = serialization::u16b(buf + i);
 					uint8_t plen = serialization::u8b(buf + i + 2);
 					total_size += psize;
+					packet_starts.push_back(total_len);
 					total_len += 120 * plen;
 					opus_packetinfo p(psize, plen, 1ULL * next_cluster * CLUSTER_SIZE +
 						next_offset);
@@ -464,8 +510,7 @@ out_parsing:
 		}
 	}
 
-	opus_stream::opus_stream(uint64_t base, filesystem::ref filesys, std::ifstream& data,
-		voice_commentary::external_stream_format extfmt, settingvar::group& settings)
+	opus_stream::opus_stream(uint64_t base, filesystem::ref filesys, ogg::stream_reader_mmap& data)
 		: fs(filesys)
 	{
 		refcount = 1;
@@ -482,20 +527,19 @@ out_parsing:
 		pregap_length = 0;
 		postgap_length = 0;
 		gain = 0;
-		if(extfmt == voice_commentary::EXTFMT_OGGOPUS)
-			import_stream_oggopus(data);
-		else if(extfmt == voice_commentary::EXTFMT_SOX)
-			import_stream_sox(data, settings);
+		import_stream_oggopus(data);
 	}
 
-	void opus_stream::import_stream_oggopus(std::ifstream& data)
+	void opus_stream::import_stream_oggopus(ogg::stream_reader_mmap& reader)
 	{
-		ogg::stream_reader_iostreams reader(data);
 		reader.set_errors_to(messages);
 		struct opus::ogg_header h;
 		struct opus::ogg_tags t;
-		ogg::page page;
+		//The packets point into the mapped file, no copies are made except of packets spanning pages.
+		ogg::page_view page;
 		ogg::demuxer d(messages);
+		//The header parsers want owned packets.
+		ogg::packet hp;
 		int state = 0;
 		postgap_length = 0;
 		uint64_t datalen = 0;
@@ -503,7 +547,7 @@ out_parsing:
 		uint64_t last_granulepos = 0;
 		try {
 			while(true) {
-				ogg::packet p;
+				ogg::packet_view p;
 				if(!d.wants_packet_out()) {
 					if(!reader.get_page(page))
 						break;
@@ -513,7 +557,8 @@ out_parsing:
 					d.packet_out(p);
 				switch(state) {
 				case 0:		//Not locked.
-					h.parse(p);
+					hp = ogg::packet(p);
+					h.parse(hp);
 					if(h.streams != 1)
 						throw std::runtime_error("Multistream OggOpus streams are not "
 							"supported");
@@ -522,17 +567,17 @@ out_parsing:
 					gain = h.gain;
 					break;
 				case 1:		//Expecting comment.
-					t.parse(p);
+					hp = ogg::packet(p);
+					t.parse(hp);
 					state = 2;	//Data page.
 					if(page.get_eos())
 						throw std::runtime_error("Empty OggOpus stream");
 					break;
 				case 2:		//Data page.
 				case 3:		//Data page.
-					const std::vector<uint8_t>& pkt = p.get_vector();
-					uint8_t tcnt = opus::packet_tick_count(&pkt[0], pkt.size());
+					uint8_t tcnt = opus::packet_tick_count(p.get_data(), p.get_length());
 					if(tcnt) {
-						write(tcnt, &pkt[0], pkt.size());
+						write(tcnt, p.get_data(), p.get_length());
 						datalen += tcnt * 120;
 					}
 					if(p.get_last_page()) {
@@ -576,87 +621,21 @@ out:
 		}
 	}
 
-	void opus_stream::import_stream_sox(std::ifstream& data, settingvar::group& settings)
-	{
-		bitrate_tracker brtrack;
-		unsigned char tmpi[65536];
-		float tmp[OPUS_MAX_OUT];
-		char header[260];
-		data.read(header, 32);
-		if(!data)
-			throw std::runtime_error("Can't read .sox header");
-		if(serialization::u32l(header + 0) != 0x586F532EULL)
-			throw std::runtime_error("Bad .sox header magic");
-		if(serialization::u8b(header + 4) > 28)
-			data.read(header + 32, serialization::u8b(header + 4) - 28);
-		if(!data)
-			throw std::runtime_error("Can't read .sox header");
-		if(serialization::u64l(header + 16) != 4676829883349860352ULL)
-			throw std::runtime_error("Bad .sox sampling rate");
-		if(serialization::u32l(header + 24) != 1)
-			throw std::runtime_error("Only mono streams are supported");
-		uint64_t samples = serialization::u64l(header + 8);
-		opus::encoder enc(opus::samplerate::r48k, false, opus::application::voice);
-		enc.ctl(opus::bitrate(SET_opus_bitrate(settings)));
-		int32_t pregap = enc.ctl(opus::lookahead);
-		pregap_length = pregap;
-		for(uint64_t i = 0; i < samples + pregap; i += OPUS_BLOCK_SIZE) {
-			size_t bs = OPUS_BLOCK_SIZE;
-			if(i + bs > samples + pregap)
-				bs = samples + pregap - i;
-			//We have to read zero bytes after the end of stream.
-			size_t readable = bs;
-			if(readable + i > samples)
-				readable = max(samples, i) - i;
-			if(readable > 0)
-				data.read(reinterpret_cast<char*>(tmpi), 4 * readable);
-			if(readable < bs)
-				memset(tmpi + 4 * readable, 0, 4 * (bs - readable));
-			if(!data) {
-				if(ctrl_cluster) fs.free_cluster_chain(ctrl_cluster);
-				if(data_cluster) fs.free_cluster_chain(data_cluster);
-				throw std::runtime_error("Can't read .sox data");
-			}
-			for(size_t j = 0; j < bs; j++)
-				tmp[j] = static_cast<float>(serialization::s32l(tmpi + 4 * j)) / 268435456;
-			if(bs < OPUS_BLOCK_SIZE)
-				postgap_length = OPUS_BLOCK_SIZE - bs;
-			for(size_t j = bs; j < OPUS_BLOCK_SIZE; j++)
-				tmp[j] = 0;
-			try {
-				const size_t opus_out_max2 = SET_opus_max_bitrate(settings) *
-					OPUS_BLOCK_SIZE / 384000;
-				size_t r = enc.encode(tmp, OPUS_BLOCK_SIZE, tmpi, opus_out_max2);
-				write(OPUS_BLOCK_SIZE / 120, tmpi, r);
-				brtrack.submit(r, bs);
-			} catch(std::exception& e) {
-				if(ctrl_cluster) fs.free_cluster_chain(ctrl_cluster);
-				if(data_cluster) fs.free_cluster_chain(data_cluster);
-				(stringfmt() << "Error encoding opus packet: " << e.what()).throwex();
-			}
-		}
-		messages << "Imported stream: " << brtrack;
-		try {
-			write_trailier();
-		} catch(...) {
-			if(ctrl_cluster) fs.free_cluster_chain(ctrl_cluster);
-			if(data_cluster) fs.free_cluster_chain(data_cluster);
-			throw;
-		}
-	}
-
 	void opus_stream::destroy()
 	{
 		if(deleting) {
 			//We catch the errors and print em, because otherwise put_ref could throw, which would
 			//be too much.
+			//Streams that were never written to have no clusters.
 			try {
-				fs.free_cluster_chain(ctrl_cluster);
+				if(ctrl_cluster)
+					fs.free_cluster_chain(ctrl_cluster);
 			} catch(std::exception& e) {
 				messages << "Failed to delete stream control file: " << e.what();
 			}
 			try {
-				fs.free_cluster_chain(data_cluster);
+				if(data_cluster)
+					fs.free_cluster_chain(data_cluster);
 			} catch(std::exception& e) {
 				messages << "Failed to delete stream data file: " << e.what();
 			}
@@ -694,12 +673,12 @@ out:
 		writer.put_page(hpage);
 		seq = tags.serialize([&writer](const ogg::page& p) { writer.put_page(p); }, stream_id);
 
-		struct ogg::page ppage;
-		ogg::muxer mux(stream_id, seq);
+		//Pages are packed directly in the writer, and the packet buffer is reused.
+		ogg::packet_writer pwriter(writer, stream_id, seq);
+		std::vector<unsigned char> p;
 		for(size_t i = 0; i < packets.size(); i++) {
-			std::vector<unsigned char> p;
 			try {
-				p = packet(i);
+				packet(i, p);
 			} catch(std::exception& e) {
 				(stringfmt() << "Error reading opus packet: " << e.what()).throwex();
 			}
@@ -710,18 +689,9 @@ out:
 				true_granule += samples;
 			else
 				true_granule = max(true_granule, true_granule + samples - postgap_length);
-			if(!mux.wants_packet_in() || !mux.packet_fits(p.size()))
-				while(mux.has_page_out()) {
-					mux.page_out(ppage);
-					writer.put_page(ppage);
-				}
-			mux.packet_in(p, true_granule);
-		}
-		mux.signal_eos();
-		while(mux.has_page_out()) {
-			mux.page_out(ppage);
-			writer.put_page(ppage);
+			pwriter.put_packet(&p[0], p.size(), true_granule);
 		}
+		pwriter.flush(true);
 	}
 
 	void opus_stream::export_stream_sox(std::ofstream& data)
@@ -744,7 +714,7 @@ out:
 			try {
 				uint32_t pregap_throw = 0;
 				uint32_t postgap_throw = 0;
-				std::vector<unsigned char> p = packet(i);
+				packet(i, p);
 				uint32_t len = packet_length(i);
 				dec.decode(&p[0], p.size(), tmp, OPUS_MAX_OUT);
 				bool is_last = (i == packets.size() - 1);
@@ -801,6 +771,7 @@ out:
 			fs.write_data(next_mcluster, next_moffset, descriptor, 4, used_mcluster, used_moffset);
 			uint64_t off = static_cast<uint64_t>(used_cluster) * CLUSTER_SIZE + used_offset;
 			opus_packetinfo p(payload_len, len, off);
+			packet_starts.push_back(total_len);
 			total_len += p.length();
 			packets.push_back(p);
 		} catch(std::exception& e) {
@@ -860,6 +831,7 @@ out:
 		opus_stream& stream;
 		uint32_t next_block;
 		uint32_t blocks;
+		std::vector<unsigned char> pdata;
 	};
 
 	opus_playback_stream::opus_playback_stream(opus_stream& data)
@@ -898,7 +870,7 @@ out:
 		unsigned plen = stream.packet_length(next_block);
 		if(plen + output_left > OPUS_MAX_OUT)
 			return;
-		std::vector<unsigned char> pdata = stream.packet(next_block);
+		stream.packet(next_block, pdata);
 		try {
 			size_t c = decoder->decode(&pdata[0], pdata.size(), output + output_left,
 				OPUS_MAX_OUT - output_left);
@@ -996,6 +968,60 @@ out:
 	}
 
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//Index of stream time intervals.
+	//The entries are sorted by start time and form an implicit balanced tree (root of each range is at its midpoint),
+	//each node storing the maximum end time in its subtree. Queries take O(log n) plus the number of matches.
+	struct interval_index
+	{
+		struct entry
+		{
+			uint64_t start;
+			uint64_t end;
+			uint64_t index;
+		};
+		//Rebuild the index. The entries must be sorted by start time.
+		void build(const std::vector<entry>& _entries);
+		//Get indices of entries overlapping [lo, hi), in start time order.
+		void query(uint64_t lo, uint64_t hi, std::list<uint64_t>& out) { query(0, entries.size(), lo, hi, out); }
+	private:
+		uint64_t build(size_t b, size_t e);
+		void query(size_t b, size_t e, uint64_t lo, uint64_t hi, std::list<uint64_t>& out);
+		std::vector<entry> entries;
+		std::vector<uint64_t> maxend;
+	};
+
+	void interval_index::build(const std::vector<entry>& _entries)
+	{
+		entries = _entries;
+		maxend.resize(entries.size());
+		build(0, entries.size());
+	}
+
+	uint64_t interval_index::build(size_t b, size_t e)
+	{
+		if(b >= e)
+			return 0;
+		size_t m = (b + e) / 2;
+		maxend[m] = max(entries[m].end, max(build(b, m), build(m + 1, e)));
+		return maxend[m];
+	}
+
+	void interval_index::query(size_t b, size_t e, uint64_t lo, uint64_t hi, std::list<uint64_t>& out)
+	{
+		if(b >= e)
+			return;
+		size_t m = (b + e) / 2;
+		if(maxend[m] <= lo)
+			return;		//Everything in this subtree has ended.
+		query(b, m, lo, hi, out);
+		if(entries[m].start >= hi)
+			return;		//This and everything after starts too late.
+		if(entries[m].end > lo)
+			out.push_back(entries[m].index);
+		query(m + 1, e, lo, hi, out);
+	}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	//Collection of streams.
 	struct stream_collection
@@ -1007,7 +1033,9 @@ out:
 		//Destroy a collection. All streams are destroyed but not deleted.
 		~stream_collection();
 		//Get list of streams active at given point.
-		std::list<uint64_t> streams_at(uint64_t point);
+		std::list<uint64_t> streams_at(uint64_t point) { return streams_between(point, point + 1); }
+		//Get list of streams active at any point in [lo, hi).
+		std::list<uint64_t> streams_between(uint64_t lo, uint64_t hi);
 		//Add a stream into collection.
 		//Can throw.
 		uint64_t add_stream(opus_stream& stream);
@@ -1035,9 +1063,6 @@ out:
 		void alter_stream_gain(uint64_t index, uint16_t newgain);
 		//Enumerate all valid stream indices, in time order.
 		std::list<uint64_t> all_streams();
-		//Export the entiere superstream.
-		//Can throw.
-		void export_superstream(std::ofstream& out);
 	private:
 		filesystem::ref fs;
 		uint64_t next_index;
@@ -1046,8 +1071,10 @@ out:
 		std::set<uint64_t> free_indices;
 		std::map<uint64_t, uint64_t> entries;
 		std::multimap<uint64_t, uint64_t> streams_by_time;
-		//FIXME: Something more efficient.
 		std::map<uint64_t, opus_stream*> streams;
+		//Index of stream intervals, rebuilt on next query if dirty.
+		interval_index by_interval;
+		bool index_dirty;
 	};
 
 	stream_collection::stream_collection(filesystem::ref filesys)
@@ -1055,6 +1082,7 @@ out:
 	{
 		next_stream = 0;
 		next_index = 0;
+		index_dirty = true;
 		//The stream index table is in cluster 2.
 		uint32_t next_cluster = 2;
 		uint32_t next_offset = 0;
@@ -1092,18 +1120,24 @@ out:
 		streams.clear();
 	}
 
-	std::list<uint64_t> stream_collection::streams_at(uint64_t point)
+	std::list<uint64_t> stream_collection::streams_between(uint64_t lo, uint64_t hi)
 	{
 		threads::alock m(mlock);
-		std::list<uint64_t> s;
-		for(auto i : streams) {
-			uint64_t start = i.second->timebase();
-			uint64_t end = start + i.second->length();
-			if(point >= start && point < end) {
-				i.second->get_ref();
-				s.push_back(i.first);
+		if(index_dirty) {
+			std::vector<interval_index::entry> e;
+			e.reserve(streams_by_time.size());
+			for(auto i : streams_by_time) {
+				interval_index::entry x;
+				x.start = i.first;
+				x.end = i.first + streams[i.second]->length();
+				x.index = i.second;
+				e.push_back(x);
 			}
+			by_interval.build(e);
+			index_dirty = false;
 		}
+		std::list<uint64_t> s;
+		by_interval.query(lo, hi, s);
 		return s;
 	}
 
@@ -1135,6 +1169,7 @@ out:
 			fs.write_data(write_cluster, write_offset, buffer, 16, dummy1, dummy2);
 			streams_by_time.insert(std::make_pair(stream.timebase(), idx));
 			entries[idx] = entry_number;
+			index_dirty = true;
 			return idx;
 		} catch(std::exception& e) {
 			(stringfmt() << "Failed to add stream: " << e.what()).throwex();
@@ -1170,6 +1205,7 @@ out:
 			}
 		streams[index]->delete_stream();
 		streams.erase(index);
+		index_dirty = true;
 	}
 
 	void stream_collection::alter_stream_timebase(uint64_t index, uint64_t newts)
@@ -1196,6 +1232,7 @@ out:
 				}
 			streams[index]->timebase(newts);
 			streams_by_time.insert(std::make_pair(newts, index));
+			index_dirty = true;
 		} catch(std::exception& e) {
 			(stringfmt() << "Failed to alter stream timebase: " << e.what()).throwex();
 		}
@@ -1223,103 +1260,621 @@ out:
 		return s;
 	}
 
-	void stream_collection::export_superstream(std::ofstream& out)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//Reads packets about to be played in background, so the playback finds them in filesystem cache instead of
+	//waiting for disk.
+	class packet_prefetcher
 	{
-		std::list<uint64_t> slist = all_streams();
-		//Find the total length of superstream.
-		uint64_t len = 0;
-		for(auto i : slist) {
-			opus_stream* s = get_stream(i);
-			if(s) {
-				len = max(len, s->timebase() + s->length());
-				s->put_ref();
+	public:
+		packet_prefetcher(voicesub_state& _state);
+		~packet_prefetcher();
+		//Request prefetch starting from given time. Jump is set if time did not advance continuously.
+		void request(uint64_t time, bool jump);
+	private:
+		void entry();
+		void prefetch(uint64_t time);
+		voicesub_state& state;
+		threads::lock lmut;
+		threads::cv lcond;
+		uint64_t req_time;
+		bool req_pending;
+		bool req_jump;
+		bool quitting;
+		//First packet not yet prefetched, by stream index.
+		std::map<uint64_t, uint32_t> done;
+		threads::thread* worker;
+	};
+
+	packet_prefetcher::packet_prefetcher(voicesub_state& _state)
+		: state(_state)
+	{
+		req_time = 0;
+		req_pending = false;
+		req_jump = false;
+		quitting = false;
+		worker = new threads::thread([this]() { this->entry(); });
+	}
+
+	packet_prefetcher::~packet_prefetcher()
+	{
+		{
+			threads::alock h(lmut);
+			quitting = true;
+			lcond.notify_all();
+		}
+		worker->join();
+		delete worker;
+	}
+
+	void packet_prefetcher::request(uint64_t time, bool jump)
+	{
+		threads::alock h(lmut);
+		req_time = time;
+		req_pending = true;
+		req_jump = req_jump || jump;
+		lcond.notify_all();
+	}
+
+	void packet_prefetcher::entry()
+	{
+		uint64_t last_time = 0;
+		threads::alock h(lmut);
+		while(true) {
+			while(!req_pending && !quitting)
+				lcond.wait(h);
+			if(quitting)
+				return;
+			uint64_t t = req_time;
+			bool jump = req_jump || t < last_time;
+			req_pending = false;
+			req_jump = false;
+			//Requests come every iteration, with time barely advanced. Don't bother until it has advanced
+			//enough.
+			if(!jump && t < last_time + PREFETCH_INTERVAL)
+				continue;
+			if(jump)
+				done.clear();
+			last_time = t;
+			h.unlock();
+			prefetch(t);
+			h.lock();
+		}
+	}
+
+	void packet_prefetcher::prefetch(uint64_t t)
+	{
+		std::list<std::pair<uint64_t, opus_stream*>> s;
+		{
+			threads::alock m(state.current_collection_lock);
+			if(!state.current_collection)
+				return;
+			for(auto i : state.current_collection->streams_between(t, t + PREFETCH_AHEAD)) {
+				opus_stream* x = state.current_collection->get_stream(i);
+				if(x)
+					s.push_back(std::make_pair(i, x));
+			}
+		}
+		std::map<uint64_t, uint32_t> ndone;
+		for(auto i : s) {
+			opus_stream& x = *i.second;
+			uint64_t base = x.timebase();
+			uint64_t from = max(t, base) - base + x.get_pregap();
+			uint64_t to = min(t + PREFETCH_AHEAD, base + x.length()) - base + x.get_pregap();
+			uint32_t b = max(x.packet_at(from), done.count(i.first) ? done[i.first] : 0);
+			uint32_t end = min(x.packet_at(to) + 1, x.blocks());
+			try {
+				//The data itself is not needed, just getting it into cache.
+				for(; b < end; b++)
+					x.packet(b);
+			} catch(std::exception& e) {
+				//Playback will report the error.
+			}
+			ndone[i.first] = b;
+			x.put_ref();
+		}
+		std::swap(done, ndone);
+	}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//Background export/import job.
+	//The job is split into segments, which are processed in parallel by worker threads, and then consumed in
+	//order. Progress and completion are reported via voice_job_progress and voice_job_finish.
+	class commentary_job
+	{
+	public:
+		commentary_job(voicesub_state& _state, const std::string& _name, uint64_t _segments);
+		virtual ~commentary_job();
+		//Start processing in background.
+		void start();
+		//Request the job to stop. Takes effect at next segment boundary.
+		void cancel();
+		//Wait for the job to end.
+		void join();
+		//Has the job ended?
+		bool ended();
+	protected:
+		//Process a segment. Called in parallel from worker threads.
+		//Can throw.
+		virtual void process(uint64_t segment) = 0;
+		//Consume a processed segment. Called in segment order from single thread.
+		//Can throw.
+		virtual void consume(uint64_t segment) = 0;
+		//All segments have been consumed.
+		//Can throw.
+		virtual void finish() = 0;
+		//The job failed or was canceled.
+		virtual void abort() = 0;
+		//Set number of segments. Only valid before start().
+		void set_segments(uint64_t _segments) { segments = _segments; }
+		voicesub_state& state;
+	private:
+		commentary_job(const commentary_job&);
+		commentary_job& operator=(const commentary_job&);
+		void coordinate();
+		void work();
+		std::string name;
+		uint64_t segments;
+		uint64_t next_process;
+		uint64_t next_consume;
+		uint64_t window;
+		std::set<uint64_t> processed;
+		std::string error;
+		bool canceled;
+		bool is_ended;
+		threads::lock lmut;
+		threads::cv lcond;
+		threads::thread* coordinator;
+	};
+
+	commentary_job::commentary_job(voicesub_state& _state, const std::string& _name, uint64_t _segments)
+		: state(_state), name(_name), segments(_segments)
+	{
+		next_process = 0;
+		next_consume = 0;
+		window = 1;
+		canceled = false;
+		is_ended = false;
+		coordinator = NULL;
+	}
+
+	commentary_job::~commentary_job()
+	{
+		join();
+	}
+
+	void commentary_job::start()
+	{
+		coordinator = new threads::thread([this]() { this->coordinate(); });
+	}
+
+	void commentary_job::cancel()
+	{
+		threads::alock h(lmut);
+		canceled = true;
+		lcond.notify_all();
+	}
+
+	void commentary_job::join()
+	{
+		if(!coordinator)
+			return;
+		coordinator->join();
+		delete coordinator;
+		coordinator = NULL;
+	}
+
+	bool commentary_job::ended()
+	{
+		threads::alock h(lmut);
+		return is_ended;
+	}
+
+	void commentary_job::work()
+	{
+		threads::alock h(lmut);
+		while(true) {
+			//Don't run too far ahead of consumer, so the memory use stays bounded.
+			while(!canceled && next_process < segments && next_process >= next_consume + window)
+				lcond.wait(h);
+			if(canceled || next_process >= segments)
+				return;
+			uint64_t seg = next_process++;
+			h.unlock();
+			std::string err;
+			try {
+				process(seg);
+			} catch(std::bad_alloc& e) {
+				err = "Out of memory";
+			} catch(std::exception& e) {
+				err = e.what();
+			}
+			h.lock();
+			if(err != "") {
+				if(error == "")
+					error = err;
+				canceled = true;
+			}
+			processed.insert(seg);
+			lcond.notify_all();
+		}
+	}
+
+	void commentary_job::coordinate()
+	{
+		std::vector<threads::thread*> workers;
+		unsigned nthreads = threads::thread::hardware_concurrency();
+		if(!nthreads)
+			nthreads = 1;
+		nthreads = min(static_cast<uint64_t>(nthreads), max(segments, static_cast<uint64_t>(1)));
+		{
+			threads::alock h(lmut);
+			window = 2 * nthreads + 2;
+		}
+		try {
+			for(unsigned i = 0; i < nthreads; i++)
+				workers.push_back(new threads::thread([this]() { this->work(); }));
+		} catch(std::exception& e) {
+			cancel();
+			threads::alock h(lmut);
+			error = "Can't start worker threads";
+		}
+		threads::alock h(lmut);
+		while(true) {
+			while(!canceled && next_consume < segments && !processed.count(next_consume))
+				lcond.wait(h);
+			if(canceled || next_consume >= segments)
+				break;
+			uint64_t seg = next_consume;
+			processed.erase(seg);
+			h.unlock();
+			std::string err;
+			try {
+				consume(seg);
+			} catch(std::bad_alloc& e) {
+				err = "Out of memory";
+			} catch(std::exception& e) {
+				err = e.what();
+			}
+			state.edispatch.voice_job_progress(seg + 1, segments);
+			h.lock();
+			if(err != "") {
+				if(error == "")
+					error = err;
+				canceled = true;
+			}
+			next_consume++;
+			lcond.notify_all();
+		}
+		h.unlock();
+		for(auto i : workers) {
+			i->join();
+			delete i;
+		}
+		h.lock();
+		bool ok = !canceled;
+		h.unlock();
+		if(ok) {
+			try {
+				finish();
+			} catch(std::exception& e) {
+				error = e.what();
+				ok = false;
+			}
+		}
+		if(!ok)
+			abort();
+		//The message is only set if the job failed.
+		std::string result;
+		if(ok)
+			messages << name << " finished." << std::endl;
+		else if(error != "")
+			messages << (result = name + " failed: " + error) << std::endl;
+		else
+			messages << name << " canceled." << std::endl;
+		state.edispatch.voice_job_finish(ok, result);
+		h.lock();
+		is_ended = true;
+	}
+
+	//Job consisting of single segment, running given functions.
+	class function_job : public commentary_job
+	{
+	public:
+		//Work is run in background, then finish if it succeeded. Cleanup is always done when job is destroyed.
+		function_job(voicesub_state& _state, const std::string& _name, std::function<void()> _work,
+			std::function<void()> _finish, std::function<void()> _cleanup)
+			: commentary_job(_state, _name, 1), fn_work(_work), fn_finish(_finish), fn_cleanup(_cleanup)
+		{
+		}
+		~function_job()
+		{
+			join();
+			fn_cleanup();
+		}
+	protected:
+		void process(uint64_t segment) { fn_work(); }
+		void consume(uint64_t segment) {}
+		void finish() { fn_finish(); }
+		void abort() {}
+	private:
+		std::function<void()> fn_work;
+		std::function<void()> fn_finish;
+		std::function<void()> fn_cleanup;
+	};
+
+	//Job with result of type T for each segment.
+	template<typename T>
+	class segment_job : public commentary_job
+	{
+	public:
+		segment_job(voicesub_state& _state, const std::string& _name, uint64_t _segments)
+			: commentary_job(_state, _name, _segments)
+		{
+		}
+	protected:
+		//Process a segment. Called in parallel from worker threads.
+		virtual void process_segment(uint64_t segment, T& result) = 0;
+		//Consume a result. Called in segment order from single thread.
+		virtual void consume_segment(uint64_t segment, T& result) = 0;
+	private:
+		void process(uint64_t segment)
+		{
+			T r;
+			process_segment(segment, r);
+			threads::alock h(rlock);
+			std::swap(results[segment], r);
+		}
+		void consume(uint64_t segment)
+		{
+			T r;
+			{
+				threads::alock h(rlock);
+				std::swap(results[segment], r);
+				results.erase(segment);
 			}
+			consume_segment(segment, r);
 		}
+		threads::lock rlock;
+		std::map<uint64_t, T> results;
+	};
+
+	//Export streams mixed together into .sox file.
+	//Each segment is decoded independently, seeking each stream to start of segment.
+	class sox_export_job : public segment_job<std::vector<char>>
+	{
+	public:
+		//Takes over the stream references and the output file.
+		//Can throw.
+		sox_export_job(voicesub_state& _state, const std::string& _name, std::ofstream* _out,
+			const std::list<opus_stream*>& _streams, uint64_t _origin, uint64_t _length);
+		~sox_export_job();
+	protected:
+		void process_segment(uint64_t segment, std::vector<char>& result);
+		void consume_segment(uint64_t segment, std::vector<char>& result);
+		void finish();
+		void abort() {}
+	private:
+		std::ofstream* out;
+		//Streams with their timebases, as those might change during export.
+		std::list<std::pair<opus_stream*, uint64_t>> streams;
+		uint64_t origin;
+		uint64_t length;
+	};
+
+	sox_export_job::sox_export_job(voicesub_state& _state, const std::string& _name, std::ofstream* _out,
+		const std::list<opus_stream*>& _streams, uint64_t _origin, uint64_t _length)
+		: segment_job<std::vector<char>>(_state, _name, (_length + JOB_SEGMENT - 1) / JOB_SEGMENT),
+		out(_out), origin(_origin), length(_length)
+	{
+		for(auto i : _streams)
+			streams.push_back(std::make_pair(i, i->timebase()));
 		char header[32];
 		serialization::u64l(header, 0x1C586F532EULL);			//Magic and header size.
-		serialization::u64l(header + 8, len);
+		serialization::u64l(header + 8, length);
 		serialization::u64l(header + 16, 4676829883349860352ULL);	//Sampling rate.
 		serialization::u64l(header + 24, 1);
-		out.write(header, 32);
-		if(!out)
-			throw std::runtime_error("Error writing PCM output");
-
-		//Find the first valid stream.
-		auto next_i = slist.begin();
-		opus_stream* next_stream = NULL;
-		while(next_i != slist.end()) {
-			next_stream = get_stream(*next_i);
-			next_i++;
-			if(next_stream)
-				break;
+		out->write(header, 32);
+		if(!*out) {
+			for(auto i : streams)
+				i.first->put_ref();
+			delete out;
+			throw std::runtime_error("Error writing PCM data.");
+		}
+	}
+
+	sox_export_job::~sox_export_job()
+	{
+		join();
+		for(auto i : streams)
+			i.first->put_ref();
+		delete out;
+	}
+
+	void sox_export_job::process_segment(uint64_t segment, std::vector<char>& result)
+	{
+		uint64_t start = origin + segment * JOB_SEGMENT;
+		uint64_t samples = min(static_cast<uint64_t>(JOB_SEGMENT), length - segment * JOB_SEGMENT);
+		std::vector<float> mix(samples);
+		std::vector<float> tmp;
+		for(auto i : streams) {
+			uint64_t sstart = i.second;
+			uint64_t send = sstart + i.first->length();
+			if(send <= start || sstart >= start + samples)
+				continue;
+			uint64_t offset = (sstart > start) ? sstart - start : 0;
+			uint64_t count = min(send, start + samples) - (start + offset);
+			opus_playback_stream p(*i.first);
+			if(start > sstart)
+				p.skip(start - sstart);
+			tmp.resize(count);
+			p.read(&tmp[0], count);
+			for(uint64_t j = 0; j < count; j++)
+				mix[offset + j] += tmp[j];
 		}
-		uint64_t next_ts;
-		next_ts = next_stream ? next_stream->timebase() : len;
+		result.resize(4 * samples);
+		for(uint64_t j = 0; j < samples; j++)
+			serialization::s32l(&result[4 * j], mix[j] * 268435456);
+	}
+
+	void sox_export_job::consume_segment(uint64_t segment, std::vector<char>& result)
+	{
+		out->write(&result[0], result.size());
+		if(!*out)
+			throw std::runtime_error("Error writing PCM data.");
+	}
+
+	void sox_export_job::finish()
+	{
+		out->close();
+		if(!*out)
+			throw std::runtime_error("Error writing PCM data.");
+	}
+
+	//Import .sox file as new stream.
+	//Each segment is encoded with its own encoder, which is first fed some audio before the segment.
+	class sox_import_job : public segment_job<std::vector<std::vector<unsigned char>>>
+	{
+	public:
+		//Takes over the input file.
+		//Can throw.
+		sox_import_job(voicesub_state& _state, const std::string& _name, std::ifstream* _in, uint64_t ts);
+		~sox_import_job();
+	protected:
+		void process_segment(uint64_t segment, std::vector<std::vector<unsigned char>>& result);
+		void consume_segment(uint64_t segment, std::vector<std::vector<unsigned char>>& result);
+		void finish();
+		void abort();
+	private:
+		static uint64_t read_header(std::ifstream& in);
+		std::ifstream* in;
+		threads::lock inlock;
+		uint64_t data_offset;
+		uint64_t samples;
+		uint64_t blocks;
+		int32_t pregap;
+		int32_t bitrate;
+		size_t opus_out_max;
+		opus_stream* stream;
+		bitrate_tracker brtrack;
+	};
 
-		std::list<opus_playback_stream*> active;
+	sox_import_job::sox_import_job(voicesub_state& _state, const std::string& _name, std::ifstream* _in,
+		uint64_t ts)
+		: segment_job<std::vector<std::vector<unsigned char>>>(_state, _name, 0), in(_in)
+	{
+		stream = NULL;
 		try {
-			for(uint64_t s = 0; s < len;) {
-				if(s == next_ts) {
-					active.push_back(new opus_playback_stream(*next_stream));
-					next_stream->put_ref();
-					next_stream = NULL;
-					while(next_i != slist.end()) {
-						next_stream = get_stream(*next_i);
-						next_i++;
-						if(!next_stream)
-							continue;
-						uint64_t next_ts = next_stream->timebase();
-						if(next_ts > s)
-							break;
-						//Okay, this starts too...
-						active.push_back(new opus_playback_stream(*next_stream));
-						next_stream->put_ref();
-						next_stream = NULL;
-					};
-					next_ts = next_stream ? next_stream->timebase() : len;
-				}
-				uint64_t maxsamples = min(next_ts - s, static_cast<uint64_t>(OUTPUT_BLOCK));
-				maxsamples = min(maxsamples, len - s);
-				char outbuf[4 * OUTPUT_BLOCK];
-				float buf1[OUTPUT_BLOCK];
-				float buf2[OUTPUT_BLOCK];
-				for(size_t t = 0; t < maxsamples; t++)
-					buf1[t] = 0;
-				for(auto t : active) {
-					t->read(buf2, maxsamples);
-					for(size_t u = 0; u < maxsamples; u++)
-						buf1[u] += buf2[u];
-				}
-				for(auto t = active.begin(); t != active.end();) {
-					if((*t)->eof()) {
-						auto todel = t;
-						t++;
-						delete *todel;
-						active.erase(todel);
-					} else
-						t++;
-				}
-				for(size_t t = 0; t < maxsamples; t++)
-					serialization::s32l(outbuf + 4 * t, buf1[t] * 268435456);
-				out.write(outbuf, 4 * maxsamples);
-				if(!out)
-					throw std::runtime_error("Failed to write PCM");
-				s += maxsamples;
+			samples = read_header(*in);
+			data_offset = in->tellg();
+			bitrate = SET_opus_bitrate(state.settings);
+			opus_out_max = SET_opus_max_bitrate(state.settings) * OPUS_BLOCK_SIZE / 384000;
+			opus::encoder enc(opus::samplerate::r48k, false, opus::application::voice);
+			enc.ctl(opus::bitrate(bitrate));
+			pregap = enc.ctl(opus::lookahead);
+			blocks = (samples + pregap + OPUS_BLOCK_SIZE - 1) / OPUS_BLOCK_SIZE;
+			threads::alock m(state.current_collection_lock);
+			if(!state.current_collection)
+				throw std::runtime_error("No collection loaded");
+			stream = new opus_stream(ts, state.current_collection->get_filesystem());
+			stream->set_pregap(pregap);
+			stream->set_potsgap(blocks * OPUS_BLOCK_SIZE - samples - pregap);
+		} catch(...) {
+			delete in;
+			throw;
+		}
+		set_segments((blocks * OPUS_BLOCK_SIZE + JOB_SEGMENT - 1) / JOB_SEGMENT);
+	}
+
+	sox_import_job::~sox_import_job()
+	{
+		join();
+		if(stream)
+			stream->delete_stream();
+		delete in;
+	}
+
+	uint64_t sox_import_job::read_header(std::ifstream& in)
+	{
+		char header[260];
+		in.read(header, 32);
+		if(!in)
+			throw std::runtime_error("Can't read .sox header");
+		if(serialization::u32l(header + 0) != 0x586F532EULL)
+			throw std::runtime_error("Bad .sox header magic");
+		if(serialization::u8b(header + 4) > 28)
+			in.read(header + 32, serialization::u8b(header + 4) - 28);
+		if(!in)
+			throw std::runtime_error("Can't read .sox header");
+		if(serialization::u64l(header + 16) != 4676829883349860352ULL)
+			throw std::runtime_error("Bad .sox sampling rate");
+		if(serialization::u32l(header + 24) != 1)
+			throw std::runtime_error("Only mono streams are supported");
+		return serialization::u64l(header + 8);
+	}
+
+	void sox_import_job::process_segment(uint64_t segment, std::vector<std::vector<unsigned char>>& result)
+	{
+		const uint64_t segblocks = JOB_SEGMENT / OPUS_BLOCK_SIZE;
+		uint64_t first = segment * segblocks;
+		uint64_t last = min(blocks, first + segblocks);
+		uint64_t warm = (first > JOB_ENCODER_WARMUP) ? first - JOB_ENCODER_WARMUP : 0;
+		//Input is followed by zeroes, so that the pregap can be thrown away.
+		uint64_t nsamples = (last - warm) * OPUS_BLOCK_SIZE;
+		uint64_t start = warm * OPUS_BLOCK_SIZE;
+		uint64_t readable = (samples > start) ? min(samples - start, nsamples) : 0;
+		std::vector<char> raw(4 * readable);
+		if(readable) {
+			threads::alock h(inlock);
+			in->clear();
+			in->seekg(data_offset + 4 * start, std::ios_base::beg);
+			in->read(&raw[0], 4 * readable);
+			if(!*in)
+				throw std::runtime_error("Can't read .sox data");
+		}
+		std::vector<float> pcm(nsamples);
+		for(uint64_t j = 0; j < readable; j++)
+			pcm[j] = static_cast<float>(serialization::s32l(&raw[4 * j])) / 268435456;
+		opus::encoder enc(opus::samplerate::r48k, false, opus::application::voice);
+		enc.ctl(opus::bitrate(bitrate));
+		unsigned char tmp[65536];
+		for(uint64_t b = warm; b < last; b++) {
+			size_t r;
+			try {
+				r = enc.encode(&pcm[(b - warm) * OPUS_BLOCK_SIZE], OPUS_BLOCK_SIZE, tmp, opus_out_max);
+			} catch(std::exception& e) {
+				(stringfmt() << "Error encoding opus packet: " << e.what()).throwex();
 			}
-		} catch(std::exception& e) {
-			(stringfmt() << "Failed to export PCM: " << e.what()).throwex();
+			if(b >= first)
+				result.push_back(std::vector<unsigned char>(tmp, tmp + r));
 		}
-		for(auto t = active.begin(); t != active.end();) {
-			if((*t)->eof()) {
-				auto todelete = t;
-				t++;
-				delete *todelete;
-				active.erase(todelete);
-			} else
-				t++;
+	}
+
+	void sox_import_job::consume_segment(uint64_t segment, std::vector<std::vector<unsigned char>>& result)
+	{
+		const uint64_t segblocks = JOB_SEGMENT / OPUS_BLOCK_SIZE;
+		for(size_t i = 0; i < result.size(); i++) {
+			uint64_t start = (segment * segblocks + i) * OPUS_BLOCK_SIZE;
+			stream->write(OPUS_BLOCK_SIZE / 120, &result[i][0], result[i].size());
+			brtrack.submit(result[i].size(), min(static_cast<uint64_t>(OPUS_BLOCK_SIZE),
+				samples + pregap - start));
 		}
 	}
 
+	void sox_import_job::finish()
+	{
+		messages << "Imported stream: " << brtrack;
+		stream->write_trailier();
+		state.add_imported_stream(*stream);
+		stream = NULL;
+	}
+
+	void sox_import_job::abort()
+	{
+		if(stream)
+			stream->delete_stream();
+		stream = NULL;
+	}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	void voicesub_state::start_management_stream(opus_stream& s)
 	{
@@ -1487,6 +2042,8 @@ out:
 			jump_time(sampletime);
 		else
 			advance_time(sampletime);
+		if(prefetch)
+			prefetch->request(sampletime, jumping);
 	}
 
 	void voicesub_state::decompress_active_streams(float* out, size_t& use)
@@ -1581,6 +2138,36 @@ out:
 		active_stream = NULL;
 	}
 
+	void voicesub_state::add_imported_stream(opus_stream& st)
+	{
+		threads::alock m2(current_collection_lock);
+		if(!current_collection)
+			throw std::runtime_error("No collection loaded");
+		current_collection->add_stream(st);
+		st.unlock();	//Not locked.
+		edispatch.voice_stream_change();
+	}
+
+	void voicesub_state::start_job(commentary_job* j)
+	{
+		if(job && !job->ended()) {
+			delete j;
+			throw std::runtime_error("Another export or import is in progress");
+		}
+		delete job;
+		job = j;
+		job->start();
+	}
+
+	void voicesub_state::stop_job()
+	{
+		if(!job)
+			return;
+		job->cancel();
+		delete job;
+		job = NULL;
+	}
+
 	class inthread_th : public workthread
 	{
 	public:
@@ -1763,8 +2350,10 @@ void voice_commentary::init()
 	internal = new voicesub_state(settings, edispatch, audio);
 	auto _internal = get_state(internal);
 	try {
+		_internal->prefetch = new packet_prefetcher(*_internal);
 		_internal->int_task = new inthread_th(_internal, audio);
 	} catch(...) {
+		delete _internal->prefetch;
 		delete _internal;
 		throw;
 	}
@@ -1773,9 +2362,12 @@ void voice_commentary::init()
 void voice_commentary::kill()
 {
 	auto _internal = get_state(internal);
+	_internal->stop_job();
 	_internal->int_task->kill();
 	delete _internal->int_task;
 	_internal->int_task = NULL;
+	delete _internal->prefetch;
+	_internal->prefetch = NULL;
 	delete _internal;
 	internal = NULL;
 }
@@ -1846,48 +2438,92 @@ void voice_commentary::export_stream(uint64_t id, const std::string& filename,
 	voice_commentary::external_stream_format fmt)
 {
 	auto _internal = get_state(internal);
-	threads::alock m2(_internal->current_collection_lock);
-	if(!_internal->current_collection)
-		throw std::runtime_error("No collection loaded");
-	opus_stream* st = _internal->current_collection->get_stream(id);
-	if(!st)
-		return;
-	std::ofstream s(filename, std::ios_base::out | std::ios_base::binary);
-	if(!s) {
-		st->put_ref();
-		throw std::runtime_error("Can't open output file");
-	}
-	try {
-		st->export_stream(s, fmt);
-	} catch(std::exception& e) {
-		st->put_ref();
-		(stringfmt() << "Export failed: " << e.what()).throwex();
+	commentary_job* j;
+	{
+		threads::alock m2(_internal->current_collection_lock);
+		if(!_internal->current_collection)
+			throw std::runtime_error("No collection loaded");
+		opus_stream* st = _internal->current_collection->get_stream(id);
+		if(!st)
+			return;
+		std::ofstream* s = new std::ofstream(filename, std::ios_base::out | std::ios_base::binary);
+		if(!*s) {
+			delete s;
+			st->put_ref();
+			throw std::runtime_error("Can't open output file");
+		}
+		if(fmt == EXTFMT_SOX) {
+			//Constructor takes over the stream reference and the file.
+			j = new sox_export_job(*_internal, "Export", s, std::list<opus_stream*>(1, st),
+				st->timebase(), st->length());
+		} else {
+			//Oggopus just copies the packets, nothing to do in parallel.
+			try {
+				j = new function_job(*_internal, "Export", [st, s, fmt]() {
+					st->export_stream(*s, fmt);
+					s->close();
+					if(!*s)
+						throw std::runtime_error("Error writing output file");
+				}, []() {}, [st, s]() {
+					st->put_ref();
+					delete s;
+				});
+			} catch(...) {
+				st->put_ref();
+				delete s;
+				throw;
+			}
+		}
 	}
-	st->put_ref();
+	_internal->start_job(j);
 }
 
-uint64_t voice_commentary::import_stream(uint64_t ts, const std::string& filename,
+void voice_commentary::import_stream(uint64_t ts, const std::string& filename,
 	voice_commentary::external_stream_format fmt)
 {
 	auto _internal = get_state(internal);
-	threads::alock m2(_internal->current_collection_lock);
-	if(!_internal->current_collection)
+	if(!collection_loaded())
 		throw std::runtime_error("No collection loaded");
-
-	std::ifstream s(filename, std::ios_base::in | std::ios_base::binary);
-	if(!s)
-		throw std::runtime_error("Can't open input file");
-	opus_stream* st = new opus_stream(ts, _internal->current_collection->get_filesystem(), s, fmt, settings);
-	uint64_t id;
-	try {
-		id = _internal->current_collection->add_stream(*st);
-	} catch(...) {
-		st->delete_stream();
-		throw;
+	commentary_job* j;
+	if(fmt == EXTFMT_SOX) {
+		std::ifstream* s = new std::ifstream(filename, std::ios_base::in | std::ios_base::binary);
+		if(!*s) {
+			delete s;
+			throw std::runtime_error("Can't open input file");
+		}
+		//Constructor takes over the file.
+		j = new sox_import_job(*_internal, "Import", s, ts);
+	} else {
+		//Map the file now, so errors opening it are reported immediately.
+		ogg::stream_reader_mmap* s = new ogg::stream_reader_mmap(filename);
+		//Oggopus has the packets already, nothing to do in parallel.
+		filesystem::ref fs;
+		{
+			threads::alock m2(_internal->current_collection_lock);
+			if(_internal->current_collection)
+				fs = _internal->current_collection->get_filesystem();
+		}
+		//Shared between the functions.
+		opus_stream** st = new opus_stream*(NULL);
+		try {
+			j = new function_job(*_internal, "Import", [st, s, ts, fs]() {
+				*st = new opus_stream(ts, fs, *s);
+			}, [st, _internal]() {
+				_internal->add_imported_stream(**st);
+				*st = NULL;
+			}, [st, s]() {
+				if(*st)
+					(*st)->delete_stream();
+				delete st;
+				delete s;
+			});
+		} catch(...) {
+			delete st;
+			delete s;
+			throw;
+		}
 	}
-	st->unlock();	//Not locked.
-	edispatch.voice_stream_change();
-	return id;
+	_internal->start_job(j);
 }
 
 void voice_commentary::delete_stream(uint64_t id)
@@ -1903,18 +2539,53 @@ void voice_commentary::delete_stream(uint64_t id)
 void voice_commentary::export_superstream(const std::string& filename)
 {
 	auto _internal = get_state(internal);
-	threads::alock m2(_internal->current_collection_lock);
-	if(!_internal->current_collection)
-		throw std::runtime_error("No collection loaded");
-	std::ofstream s(filename, std::ios_base::out | std::ios_base::binary);
-	if(!s)
-		throw std::runtime_error("Can't open output file");
-	_internal->current_collection->export_superstream(s);
+	commentary_job* j;
+	{
+		threads::alock m2(_internal->current_collection_lock);
+		if(!_internal->current_collection)
+			throw std::runtime_error("No collection loaded");
+		std::ofstream* s = new std::ofstream(filename, std::ios_base::out | std::ios_base::binary);
+		if(!*s) {
+			delete s;
+			throw std::runtime_error("Can't open output file");
+		}
+		std::list<opus_stream*> streams;
+		uint64_t len = 0;
+		for(auto i : _internal->current_collection->all_streams()) {
+			opus_stream* st = _internal->current_collection->get_stream(i);
+			if(st) {
+				len = max(len, st->timebase() + st->length());
+				streams.push_back(st);
+			}
+		}
+		//Constructor takes over the stream references and the file.
+		j = new sox_export_job(*_internal, "Superstream export", s, streams, 0, len);
+	}
+	_internal->start_job(j);
+}
+
+bool voice_commentary::job_running()
+{
+	if(!internal)
+		return false;
+	auto _internal = get_state(internal);
+	return _internal->job && !_internal->job->ended();
+}
+
+void voice_commentary::cancel_job()
+{
+	if(!internal)
+		return;
+	auto _internal = get_state(internal);
+	if(_internal->job)
+		_internal->job->cancel();
 }
 
 void voice_commentary::load_collection(const std::string& filename)
 {
 	auto _internal = get_state(internal);
+	//The job might use the old collection.
+	_internal->stop_job();
 	threads::alock m2(_internal->current_collection_lock);
 	filesystem::ref newfs;
 	stream_collection* newc;
@@ -1930,6 +2601,7 @@ void voice_commentary::unload_collection()
 {
 	if(!internal) return;
 	auto _internal = get_state(internal);
+	_internal->stop_job();
 	threads::alock m2(_internal->current_collection_lock);
 	if(_internal->current_collection)
 		delete _internal->current_collection;
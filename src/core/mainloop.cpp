@@ -27,6 +27,7 @@
 #include "core/rom.hpp"
 #include "core/runmode.hpp"
 #include "core/settings.hpp"
+#include "core/statelog.hpp"
 #include "core/window.hpp"
 #include "interface/callbacks.hpp"
 #include "interface/c-interface.hpp"
@@ -75,6 +76,15 @@ namespace
 	//Macro hold.
 	bool macro_hold_1;
 	bool macro_hold_2;
+
+	//Is emulation running faster than the display may be able to keep up with?
+	bool fast_forwarding(emulator_instance& core)
+	{
+		if(core.runmode->is_skiplag())
+			return true;
+		return core.runmode->is_freerunning() && (stop_at_frame_active || core.framerate->turboed ||
+			core.framerate->get_speed_multiplier() > 1);
+	}
 }
 
 void mainloop_signal_need_rewind(void* ptr)
@@ -164,6 +174,9 @@ portctrl::frame movie_logic::update_controls(bool subframe, bool forced) throw(s
 		core.runmode->set_point(emulator_runmode::P_START);
 		core.supdater->update();
 	}
+	//When fast-forward stops, the last frame must be shown even if it was skipped.
+	if(!fast_forwarding(core))
+		core.fbuf->flush_skipped_frame();
 	platform::flush_command_queue();
 	portctrl::frame tmp = core.controls->get(core.mlogic->get_movie().get_current_frame());
 	core.rom->pre_emulate_frame(tmp);	//Preset controls, the lua will override if needed.
@@ -221,12 +234,18 @@ public:
 	{
 	}
 
+	static bool headless(emulator_instance& core)
+	{
+		return &core != &lsnes_instance;
+	}
+
 	int16_t get_input(unsigned port, unsigned index, unsigned control)
 	{
 		auto& core = CORE();
 		int16_t x;
 		x = core.mlogic->input_poll(port, index, control);
-		core.lua2->callback_snoop_input(port, index, control, x);
+		if(!headless(core))
+			core.lua2->callback_snoop_input(port, index, control, x);
 		return x;
 	}
 
@@ -243,7 +262,9 @@ public:
 
 	void notify_latch(std::list<std::string>& args)
 	{
-		CORE().lua2->callback_do_latch(args);
+		auto& core = CORE();
+		if(!headless(core))
+			core.lua2->callback_do_latch(args);
 	}
 
 	void timer_tick(uint32_t increment, uint32_t per_second)
@@ -283,14 +304,22 @@ public:
 	void output_frame(framebuffer::raw& screen, uint32_t fps_n, uint32_t fps_d)
 	{
 		auto& core = CORE();
+		//Headless instances have no Lua state, display or dumpers.
+		if(headless(core))
+			return;
 		core.lua2->callback_do_frame_emulated();
 		core.runmode->set_point(emulator_runmode::P_VIDEO);
-		core.fbuf->redraw_framebuffer(screen, false, true);
+		auto frame = core.fbuf->output_frame(screen);
 		auto rate = core.rom->get_audio_rate();
 		uint32_t gv = gcd(fps_n, fps_d);
 		uint32_t ga = gcd(rate.first, rate.second);
 		core.mdumper->on_rate_change(rate.first / ga, rate.second / ga);
-		core.mdumper->on_frame(screen, fps_n / gv, fps_d / gv);
+		if(!core.mdumper->get_dumper_count())
+			return;
+		//Dumping started after the frame was set to be output without pixels.
+		if(!frame)
+			frame = core.fbuf->share_frame(screen);
+		core.mdumper->on_frame(frame, fps_n / gv, fps_d / gv);
 	}
 
 	void action_state_updated()
@@ -937,7 +966,18 @@ void main_loop(struct loaded_rom& rom, struct moviefile& initial, bool load_has_
 			just_did_loadstate = false;
 		}
 		core.dbg->do_callback_frame(core.mlogic->get_movie().get_current_frame(), false);
+		//The core can skip drawing frames that are not the last before the seek target. This is only done in
+		//read-only playback without breakpoints: if the seek is stopped early, the paused screen is up to
+		//max_consecutive_skips frames old until the next frame, and a break would show it mid-frame.
+		bool known_not_last = stop_at_frame_active && core.mlogic->get_movie().readonly_mode() &&
+			!core.dbg->can_break() && core.mlogic->get_movie().get_current_frame() + 2 < stop_at_frame;
+		auto fsmode = core.fbuf->begin_frame(fast_forwarding(core), known_not_last,
+			core.mdumper->get_dumper_count() > 0);
+		core.rom->set_render_skip(fsmode == emu_framebuffer::FS_SKIP_PIXELS);
+		uint64_t frame_start = framerate_regulator::get_utime();
 		core.rom->emulate();
+		core.fbuf->end_frame(framerate_regulator::get_utime() - frame_start);
+		core.statelog->frame_emulated();
 		random_mix_timing_entropy();
 		if(core.runmode->is_freerunning())
 			platform::wait(core.framerate->to_wait_frame(framerate_regulator::get_utime()));
@@ -972,7 +1012,11 @@ void set_stop_at_frame(uint64_t frame)
 
 void do_flush_slotinfo()
 {
-	CORE().slotcache->flush();
+	auto& core = CORE();
+	core.slotcache->flush();
+	//Slot descriptions are kept with the project.
+	auto p = core.project->get();
+	core.slotcache->set_persist_file(p ? p->directory + "/" + p->prefix + ".slotinfo" : "");
 }
 
 void switch_projects(const std::string& newproj)
@@ -1010,6 +1054,8 @@ void do_break_pause()
 	auto& core = CORE();
 	core.runmode->set_break();
 	core.supdater->update();
+	//Show the last frame even if it was skipped.
+	core.fbuf->flush_skipped_frame();
 	core.fbuf->redraw_framebuffer();
 	while(core.runmode->is_paused_break()) {
 		platform::set_paused(true);
@@ -177,14 +177,15 @@ namespace
 		~memorymanip_command() throw() {}
 		void invoke(const std::string& args) throw(std::bad_alloc, std::runtime_error)
 		{
-			regex_results t = regex("(([^ \t]+)([ \t]+([^ \t]+)([ \t]+([^ \t].*)?)?)?)?", args);
-			if(!t) {
+			static const command::signature sig("?word ?word ?rest");
+			command::signature::result t;
+			if(!sig.parse(args, t)) {
 				address_bad = true;
 				return;
 			}
-			firstword = t[2];
-			secondword = t[4];
-			has_tail = (t[6] != "");
+			firstword = t.str(0);
+			secondword = t.str(1);
+			has_tail = (t.str(2) != "");
 			address_bad = true;
 			value_bad = true;
 			has_value = (secondword != "");
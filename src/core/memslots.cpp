@@ -0,0 +1,399 @@
+#include "core/instance.hpp"
+#include "core/memslots.hpp"
+#include "core/misc.hpp"
+#include "core/moviefile.hpp"
+#include "core/settings.hpp"
+#include "library/directory.hpp"
+#include "library/lzblock.hpp"
+#include "library/serialization.hpp"
+#include "library/settingvar.hpp"
+#include "library/string.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	settingvar::supervariable<settingvar::model_int<0, 1048576>> SET_memslot_budget(lsnes_setgrp,
+		"memory-slot-budget", "Movie‣Memory slot budget (MB)", 256);
+
+	//Number of earlier blobs with same key and size compared against when deduplicating.
+	const size_t dedup_candidates = 4;
+	//Core state, host memory and screenshot.
+	const unsigned state_parts = 3;
+
+	const char* data(const std::vector<char>& v)
+	{
+		return v.size() ? &v[0] : NULL;
+	}
+
+	std::vector<char>* state_part(moviefile& mv, unsigned i)
+	{
+		switch(i) {
+		case 0:		return &mv.dyn.savestate;
+		case 1:		return &mv.dyn.host_memory;
+		default:	return &mv.dyn.screenshot;
+		}
+	}
+}
+
+struct memory_slots::slot
+{
+	enum form_t
+	{
+		RAW,
+		COMPRESSED,
+		SPILLED
+	};
+	slot()
+	{
+		skeleton = NULL;
+		form = RAW;
+		is_file = false;
+		last_use = 0;
+	}
+	~slot()
+	{
+		delete skeleton;
+		if(form == SPILLED)
+			remove(spillfile.c_str());
+	}
+	uint64_t memory()
+	{
+		uint64_t x = 0;
+		for(unsigned i = 0; i < state_parts; i++)
+			x += parts[i].size();
+		//The skeleton keeps a whole copy of the input (the active input is one of the branches).
+		for(auto& i : skeleton->branches)
+			x += i.second.binary_size();
+		for(auto& i : skeleton->subtitles)
+			x += i.second.length();
+		return x + skeleton->c_rrdata.size();
+	}
+	void compress()
+	{
+		for(unsigned i = 0; i < state_parts; i++)
+			lzblock::compress(data(parts[i]), parts[i].size()).swap(parts[i]);
+		form = COMPRESSED;
+	}
+	void spill()
+	{
+		std::string name = get_temp_file();
+		std::ofstream out(name, std::ios::binary);
+		for(unsigned i = 0; i < state_parts; i++) {
+			char size[8];
+			serialization::u64l(size, parts[i].size());
+			out.write(size, 8);
+			out.write(data(parts[i]), parts[i].size());
+		}
+		if(!out) {
+			out.close();
+			remove(name.c_str());
+			throw std::runtime_error("Can't write spill file");
+		}
+		for(unsigned i = 0; i < state_parts; i++)
+			std::vector<char>().swap(parts[i]);
+		spillfile = name;
+		form = SPILLED;
+	}
+	void unspill()
+	{
+		std::ifstream in(spillfile, std::ios::binary);
+		for(unsigned i = 0; i < state_parts; i++) {
+			char size[8];
+			in.read(size, 8);
+			parts[i].resize(in ? serialization::u64l(size) : 0);
+			if(parts[i].size())
+				in.read(&parts[i][0], parts[i].size());
+		}
+		if(!in)
+			throw std::runtime_error("Can't read spill file '" + spillfile + "'");
+		remove(spillfile.c_str());
+		form = COMPRESSED;
+	}
+	//The movie, without anything below.
+	moviefile* skeleton;
+	std::map<std::string, shared_blob> sram;
+	std::map<std::string, shared_blob> movie_sram;
+	std::map<std::string, shared_blob> ramcontent;
+	shared_blob anchor_savestate;
+	std::vector<char> parts[state_parts];
+	form_t form;
+	//Cached files are dropped instead of spilled.
+	bool is_file;
+	std::string identity;
+	std::string spillfile;
+	uint64_t last_use;
+};
+
+memory_slots& memory_slots::singleton()
+{
+	static memory_slots x;
+	return x;
+}
+
+memory_slots::memory_slots()
+{
+	shared_bytes = 0;
+	last_budget = 0;
+	use_counter = 0;
+}
+
+memory_slots::~memory_slots()
+{
+	for(auto i : slots)
+		delete i.second;
+	for(auto i : files)
+		delete i.second;
+}
+
+memory_slots::shared_blob memory_slots::intern(const std::string& key, const std::vector<char>& data)
+	throw(std::bad_alloc)
+{
+	auto& cands = pool[std::make_pair(key, data.size())];
+	for(auto i = cands.begin(); i != cands.end();) {
+		shared_blob b = i->lock();
+		if(!b) {
+			i = cands.erase(i);
+			continue;
+		}
+		if(!data.size() || !memcmp(&(*b)[0], &data[0], data.size())) {
+			//Keep the match first, as it is likely to be asked for again.
+			std::rotate(cands.begin(), i, i + 1);
+			return b;
+		}
+		i++;
+	}
+	uint64_t& counter = shared_bytes;
+	shared_blob b(new std::vector<char>(data), [&counter](const std::vector<char>* v) {
+		counter -= v->size();
+		delete v;
+	});
+	counter += data.size();
+	cands.insert(cands.begin(), b);
+	if(cands.size() > dedup_candidates)
+		cands.pop_back();
+	return b;
+}
+
+memory_slots::slot* memory_slots::make_slot(const moviefile& mv) throw(std::bad_alloc)
+{
+	slot* s = new slot;
+	try {
+		s->skeleton = new moviefile();
+		moviefile& m = *s->skeleton;
+		m.copy_fields(mv);
+		for(unsigned i = 0; i < state_parts; i++)
+			s->parts[i].swap(*state_part(m, i));
+		for(auto& i : m.dyn.sram)
+			s->sram[i.first] = intern("sram:" + i.first, i.second);
+		for(auto& i : m.movie_sram)
+			s->movie_sram[i.first] = intern("sram:" + i.first, i.second);
+		for(auto& i : m.ramcontent)
+			s->ramcontent[i.first] = intern("ram:" + i.first, i.second);
+		s->anchor_savestate = intern("anchor", m.anchor_savestate);
+		m.dyn.sram.clear();
+		m.movie_sram.clear();
+		m.ramcontent.clear();
+		std::vector<char>().swap(m.anchor_savestate);
+		s->last_use = ++use_counter;
+	} catch(...) {
+		delete s;
+		throw;
+	}
+	return s;
+}
+
+void memory_slots::replace(std::map<std::string, slot*>& in, const std::string& name, slot* s) throw()
+{
+	auto i = in.find(name);
+	if(i != in.end()) {
+		delete i->second;
+		if(s)
+			i->second = s;
+		else
+			in.erase(i);
+	} else if(s)
+		in[name] = s;
+}
+
+void memory_slots::put(const std::string& name, const moviefile& mv) throw(std::bad_alloc)
+{
+	uint64_t budget = 1048576ULL * SET_memslot_budget(*CORE().settings);
+	threads::alock h(mlock);
+	replace(slots, name, make_slot(mv));
+	last_budget = budget;
+	enforce_budget(budget);
+}
+
+std::string memory_slots::file_identity(const std::string& filename, core_type& romtype) throw(std::bad_alloc)
+{
+	std::string id = directory::identity(filename);
+	if(id == "")
+		return "";
+	//The same file is read differently with different cores.
+	return (stringfmt() << id << ":" << &romtype).str();
+}
+
+void memory_slots::put_file(const std::string& filename, const std::string& identity, const moviefile& mv,
+	std::function<void(moviefile& mv)> fixup) throw(std::bad_alloc)
+{
+	uint64_t budget = 1048576ULL * SET_memslot_budget(*CORE().settings);
+	threads::alock h(mlock);
+	slot* s = make_slot(mv);
+	s->is_file = true;
+	s->identity = identity;
+	if(fixup)
+		fixup(*s->skeleton);
+	replace(files, filename, s);
+	last_budget = budget;
+	enforce_budget(budget);
+}
+
+bool memory_slots::get_file(const std::string& filename, const std::string& identity, moviefile& mv)
+	throw(std::bad_alloc)
+{
+	threads::alock h(mlock);
+	auto i = files.find(filename);
+	if(i == files.end())
+		return false;
+	if(i->second->identity != identity) {
+		//Changed by someone else.
+		replace(files, filename, NULL);
+		return false;
+	}
+	try {
+		restore(*i->second, mv);
+	} catch(std::bad_alloc& e) {
+		throw;
+	} catch(std::exception& e) {
+		replace(files, filename, NULL);
+		return false;
+	}
+	return true;
+}
+
+void memory_slots::drop_file(const std::string& filename) throw()
+{
+	threads::alock h(mlock);
+	replace(files, filename, NULL);
+}
+
+memory_slots::slot& memory_slots::lookup(const std::string& name) throw(std::runtime_error)
+{
+	auto i = slots.find(name);
+	if(i == slots.end())
+		throw std::runtime_error("No such memory save");
+	return *i->second;
+}
+
+void memory_slots::restore(slot& s, moviefile& mv) throw(std::bad_alloc, std::runtime_error)
+{
+	s.last_use = ++use_counter;
+	if(s.form == slot::SPILLED)
+		s.unspill();
+	if(s.form == slot::COMPRESSED) {
+		//Loaded slots are likely to be loaded again, so keep them uncompressed for now.
+		std::vector<char> raw[state_parts];
+		for(unsigned i = 0; i < state_parts; i++)
+			raw[i] = lzblock::decompress(data(s.parts[i]), s.parts[i].size());
+		for(unsigned i = 0; i < state_parts; i++)
+			raw[i].swap(s.parts[i]);
+		s.form = slot::RAW;
+	}
+	mv.copy_fields(*s.skeleton);
+	for(unsigned i = 0; i < state_parts; i++)
+		*state_part(mv, i) = s.parts[i];
+	for(auto& i : s.sram)
+		mv.dyn.sram[i.first] = *i.second;
+	for(auto& i : s.movie_sram)
+		mv.movie_sram[i.first] = *i.second;
+	for(auto& i : s.ramcontent)
+		mv.ramcontent[i.first] = *i.second;
+	mv.anchor_savestate = *s.anchor_savestate;
+	enforce_budget(last_budget);
+}
+
+void memory_slots::get(const std::string& name, moviefile& mv) throw(std::bad_alloc, std::runtime_error)
+{
+	threads::alock h(mlock);
+	restore(lookup(name), mv);
+}
+
+void memory_slots::peek(const std::string& name, std::function<void(const moviefile& mv)> fn)
+	throw(std::runtime_error)
+{
+	threads::alock h(mlock);
+	fn(*lookup(name).skeleton);
+}
+
+uint64_t memory_slots::memory_use() throw()
+{
+	uint64_t x = shared_bytes;
+	for(auto i : slots)
+		x += i.second->memory();
+	for(auto i : files)
+		x += i.second->memory();
+	return x;
+}
+
+void memory_slots::enforce_budget(uint64_t budget) throw()
+{
+	while(memory_use() > budget) {
+		//Compress the least recently used uncompressed slot. If there is none, drop the least recently used
+		//cached file, or failing that, spill the least recently used compressed slot.
+		slot* victim = NULL;
+		std::string victim_name;
+		for(auto m : {&slots, &files})
+			for(auto i : *m)
+				if(i.second->form == slot::RAW && (!victim || i.second->last_use < victim->last_use))
+					victim = i.second;
+		if(!victim)
+			for(auto i : files)
+				if(!victim || i.second->last_use < victim->last_use) {
+					victim = i.second;
+					victim_name = i.first;
+				}
+		if(!victim)
+			for(auto i : slots)
+				if(i.second->form == slot::COMPRESSED && (!victim || i.second->last_use <
+					victim->last_use))
+					victim = i.second;
+		if(!victim)
+			return;
+		try {
+			if(victim->form == slot::RAW)
+				victim->compress();
+			else if(victim->is_file)
+				replace(files, victim_name, NULL);
+			else
+				victim->spill();
+		} catch(std::exception& e) {
+			//Just go over the budget.
+			return;
+		}
+	}
+}
+
+memory_slots::stats memory_slots::get_stats() throw()
+{
+	threads::alock h(mlock);
+	stats s;
+	s.slots = slots.size();
+	s.files = files.size();
+	s.compressed = 0;
+	s.spilled = 0;
+	s.state_bytes = 0;
+	for(auto m : {&slots, &files})
+		for(auto i : *m) {
+			if(i.second->form == slot::COMPRESSED)
+				s.compressed++;
+			if(i.second->form == slot::SPILLED)
+				s.spilled++;
+			s.state_bytes += i.second->memory();
+		}
+	s.shared_bytes = shared_bytes;
+	s.budget = last_budget;
+	return s;
+}
@@ -12,6 +12,7 @@ movie_logic::movie_logic() throw()
 	mf = NULL;
 	mov = NULL;
 	rrd = NULL;
+	have_headless_controls = false;
 }
 
 void movie_logic::set_movie(movie& _mov, bool free_old) throw()
@@ -71,7 +72,7 @@ void movie_logic::new_frame_starting(bool dont_poll) throw(std::bad_alloc, std::
 short movie_logic::input_poll(unsigned port, unsigned dev, unsigned id) throw(std::bad_alloc, std::runtime_error)
 {
 	if(!mov)
-		return 0;
+		return have_headless_controls ? headless_controls.axis3(port, dev, id) : 0;
 	//If this is for something else than 0-0-x, drop out of poll advance if any.
 	bool force = false;
 	if(port || dev) force = notify_user_poll();
@@ -82,6 +83,12 @@ short movie_logic::input_poll(unsigned port, unsigned dev, unsigned id) throw(st
 	return mov->next_input(port, dev, id);
 }
 
+void movie_logic::set_headless_controls(const portctrl::frame& controls) throw()
+{
+	headless_controls = controls;
+	have_headless_controls = true;
+}
+
 void movie_logic::release_memory()
 {
 	delete rrd;
@@ -238,7 +238,7 @@ void do_save_state(const std::string& filename, int binary) throw(std::bad_alloc
 			target.namehint[i] = img.namehint;
 		}
 		target.dyn.savestate = core.rom->save_core_state();
-		core.fbuf->get_framebuffer().save(target.dyn.screenshot);
+		core.fbuf->get_framebuffer()->save(target.dyn.screenshot);
 		core.mlogic->get_movie().save_state(target.projectid, target.dyn.save_frame,
 			target.dyn.lagged_frames, target.dyn.pollcounters);
 		target.dyn.poll_flag = core.rom->get_pflag();
@@ -1,3 +1,4 @@
+#include "core/memslots.hpp"
 #include "core/moviefile-common.hpp"
 #include "core/moviefile.hpp"
 #include "core/random.hpp"
@@ -30,7 +31,6 @@
 namespace
 {
 	const char* movie_file_id = "Movie files";
-	std::map<std::string, moviefile*> memory_saves;
 
 	bool check_binary_magic(int s)
 	{
@@ -47,6 +47,35 @@ namespace
 		return !strcmp(buf, "lsmv\x1A");
 	}
 
+	//Cache state just saved to file, as it will be read from the file.
+	void cache_saved_state(const std::string& filename, const moviefile& mv, rrdata_set& rrd)
+	{
+		if(!mv.gametype || !mv.dyn.save_frame)
+			return;
+		core_type& romtype = mv.gametype->get_type();
+		std::string identity = memory_slots::file_identity(filename, romtype);
+		if(identity == "")
+			return;
+		std::vector<char> c_rrdata;
+		rrd.write(c_rrdata);
+		memory_slots::singleton().put_file(filename, identity, mv, [&romtype, &c_rrdata](moviefile& m) {
+			m.force_corrupt = false;
+			m.start_paused = false;
+			m.lazy_project_create = false;
+			m.c_rrdata = c_rrdata;
+			m.rerecords = (stringfmt() << rrdata_set::count(c_rrdata)).str();
+			//Settings with default values are not saved.
+			auto& sgroup = romtype.get_settings();
+			for(auto i = m.settings.begin(); i != m.settings.end();) {
+				if(!sgroup.settings.count(i->first) || sgroup.settings.find(i->first)->second.dflt ==
+					i->second)
+					m.settings.erase(i++);
+				else
+					i++;
+			}
+		});
+	}
+
 	void write_whole(int s, const char* buf, size_t size)
 	{
 		size_t w = 0;
@@ -70,19 +99,18 @@ moviefile::brief_info::brief_info(const std::string& filename)
 {
 	regex_results rr;
 	if(rr = regex("\\$MEMORY:(.*)", filename)) {
-		if(!memory_saves.count(rr[1]) && memory_saves[rr[1]])
-			throw std::runtime_error("No such memory save");
-		moviefile& mv = *memory_saves[rr[1]];
-		sysregion = mv.gametype->get_name();
-		corename = mv.coreversion;
-		projectid = mv.projectid;
-		current_frame = mv.dyn.save_frame;
-		rerecords = mv.rerecords_mem;
-		for(unsigned i = 0; i < ROM_SLOT_COUNT; i++) {
-			hash[i] = mv.romimg_sha256[i];
-			hashxml[i] = mv.romxml_sha256[i];
-			hint[i] = mv.namehint[i];
-		}
+		memory_slots::singleton().peek(rr[1], [this](const moviefile& mv) {
+			sysregion = mv.gametype->get_name();
+			corename = mv.coreversion;
+			projectid = mv.projectid;
+			current_frame = mv.dyn.save_frame;
+			rerecords = mv.rerecords_mem;
+			for(unsigned i = 0; i < ROM_SLOT_COUNT; i++) {
+				hash[i] = mv.romimg_sha256[i];
+				hashxml[i] = mv.romxml_sha256[i];
+				hint[i] = mv.namehint[i];
+			}
+		});
 		return;
 	}
 	{
@@ -153,31 +181,36 @@ moviefile::moviefile(const std::string& movie, core_type& romtype) throw(std::ba
 {
 	regex_results rr;
 	if(rr = regex("\\$MEMORY:(.*)", movie)) {
-		if(!memory_saves.count(rr[1]) || !memory_saves[rr[1]])
-			throw std::runtime_error("No such memory save");
-		moviefile& s = *memory_saves[rr[1]];
-		copy_fields(s);
+		memory_slots::singleton().get(rr[1], *this);
 		return;
 	}
 	input = NULL;
 	start_paused = false;
 	force_corrupt = false;
 	lazy_project_create = false;
+	//Files saved or loaded recently need not be parsed again, if they have not changed since.
+	std::string identity = memory_slots::file_identity(movie, romtype);
+	if(identity != "" && memory_slots::singleton().get_file(movie, identity, *this))
+		return;
+	bool binary;
 	{
 		int s = open(movie.c_str(), O_RDONLY | EXTRA_OPENFLAGS);
 		if(s < 0) {
 			int err = errno;
 			(stringfmt() << "Can't read file '" << movie << "': " << strerror(err)).throwex();
 		}
-		if(check_binary_magic(s)) {
+		binary = check_binary_magic(s);
+		if(binary)
 			try { binary_io(s, romtype); } catch(...) { close(s); throw; }
-			close(s);
-			return;
-		}
 		close(s);
 	}
-	zip::reader r(movie);
-	load(r, romtype);
+	if(!binary) {
+		zip::reader r(movie);
+		load(r, romtype);
+	}
+	//Only savestates are loaded over and over again.
+	if(identity != "" && dyn.save_frame)
+		memory_slots::singleton().put_file(movie, identity, *this);
 }
 
 void moviefile::fixup_current_branch(const moviefile& mv)
@@ -193,16 +226,10 @@ void moviefile::save(const std::string& movie, unsigned compression, bool binary
 {
 	regex_results rr;
 	if(rr = regex("\\$MEMORY:(.*)", movie)) {
-		auto tmp = new moviefile();
-		try {
-			tmp->copy_fields(*this);
-			memory_saves[rr[1]] = tmp;
-		} catch(...) {
-			delete tmp;
-			throw;
-		}
+		memory_slots::singleton().put(rr[1], *this);
 		return;
 	}
+	memory_slots::singleton().drop_file(movie);
 	if(binary) {
 		std::string tmp = movie + ".tmp";
 		int strm = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | EXTRA_OPENFLAGS, 0644);
@@ -226,10 +253,12 @@ void moviefile::save(const std::string& movie, unsigned compression, bool binary
 		directory::rename_overwrite(movie.c_str(), backup.c_str());
 		if(directory::rename_overwrite(tmp.c_str(), movie.c_str()) < 0)
 			throw std::runtime_error("Can't rename '" + tmp + "' -> '" + movie + "'");
-		return;
+	} else {
+		zip::writer w(movie, compression);
+		save(w, rrd, as_state);
 	}
-	zip::writer w(movie, compression);
-	save(w, rrd, as_state);
+	if(as_state)
+		cache_saved_state(movie, *this, rrd);
 }
 
 void moviefile::save(std::ostream& stream, rrdata_set& rrd, bool as_state) throw(std::bad_alloc, std::runtime_error)
@@ -279,11 +308,6 @@ uint64_t moviefile::get_movie_length() throw()
 	return t;
 }
 
-moviefile*& moviefile::memref(const std::string& slot)
-{
-	return memory_saves[slot];
-}
-
 void moviefile::copy_fields(const moviefile& mv)
 {
 	force_corrupt = mv.force_corrupt;
@@ -89,6 +89,7 @@ namespace
 		unsigned c_action_flags(unsigned id) { return 0; }
 		int c_reset_action(bool hard) { return -1; }
 		bool c_isnull() const { return true; }
+		bool c_multi_instance() const { return true; }
 		void c_set_debug_flags(uint64_t addr, unsigned int sflags, unsigned int cflags) {}
 		void c_set_cheat(uint64_t addr, uint64_t value, bool set) {}
 		void c_debug_reset() {}
@@ -66,9 +66,14 @@ void loaded_rom::load(std::map<std::string, std::string>& settings, uint64_t rtc
 	throw(std::bad_alloc, std::runtime_error)
 {
 	auto& core = CORE();
+	//Other instances are headless: They may only use cores that support that, and don't own the current ROM.
+	bool main_instance = (&core == &lsnes_instance);
+	if(!main_instance && !rtype().get_core()->multi_instance())
+		throw std::runtime_error("The core does not support running in multiple instances");
 	core_type* old_type = current_rom_type;
 	core_core* old_core = current_rom_type->get_core();
-	current_rom_type = &get_null_type();
+	if(main_instance)
+		current_rom_type = &get_null_type();
 	if(&rtype() != &get_null_type())
 		image->setup_region(rtype().get_preferred_region());
 	if(!region)
@@ -96,6 +101,11 @@ void loaded_rom::load(std::map<std::string, std::string>& settings, uint64_t rtc
 	core.framerate->set_nominal_framerate(1.0 * nominal_fps.first / nominal_fps.second);
 	core.mdumper->on_rate_change(nominal_hz.first, nominal_hz.second);
 
+	if(!main_instance) {
+		(*core.cmapper)();
+		core.dispatch->core_changed(true);
+		return;
+	}
 	current_rom_type = &rtype();
 	current_region = region;
 	//If core changes, unload the cartridge.
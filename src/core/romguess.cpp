@@ -12,11 +12,29 @@ namespace
 {
 	bool db_loaded;
 	std::map<std::pair<std::string, uint64_t>, std::string> our_db;
+	std::multimap<std::string, std::pair<std::string, uint64_t>> our_db_by_hash;
 	std::string database_name()
 	{
 		return get_config_path() + "/rom.db";
 	}
 
+	void db_set(const std::pair<std::string, uint64_t>& key, const std::string& hash)
+	{
+		if(our_db.count(key)) {
+			auto r = our_db_by_hash.equal_range(our_db[key]);
+			for(auto i = r.first; i != r.second; i++)
+				if(i->second == key) {
+					our_db_by_hash.erase(i);
+					break;
+				}
+		}
+		if(hash != "") {
+			our_db[key] = hash;
+			our_db_by_hash.insert(std::make_pair(hash, key));
+		} else
+			our_db.erase(key);
+	}
+
 	void load_db()
 	{
 		std::ifstream db(database_name());
@@ -36,11 +54,7 @@ namespace
 					hash = hash.substr(0, split2);
 					try { prefix = parse_value<uint64_t>(_prefix); } catch(...) {};
 				}
-				if(hash != "") {
-					our_db[std::make_pair(filename, prefix)] = hash;
-				} else {
-					our_db.erase(std::make_pair(filename, prefix));
-				}
+				db_set(std::make_pair(filename, prefix), hash);
 			}
 		}
 		db_loaded = true;
@@ -56,10 +70,7 @@ namespace
 			return;		//Already correct.
 		if(our_db.count(key) && our_db[key] == hash)
 			return;		//Already correct.
-		if(hash != "")
-			our_db[key] = hash;
-		else
-			our_db.erase(key);
+		db_set(key, hash);
 		std::ofstream db(database_name(), std::ios::app);
 		db << hash << ":" << prefix << "|" << file << std::endl;
 	}
@@ -81,10 +92,16 @@ namespace
 		if(!db_loaded) load_db();
 		//Database read. The read is for keys with given value.
 		std::list<std::pair<std::string, uint64_t>> x;
-		for(auto i : our_db)
-			if(i.second == hash) {
-				x.push_back(i.first);
-			}
+		std::set<std::pair<std::string, uint64_t>> seen;
+		auto r = our_db_by_hash.equal_range(hash);
+		for(auto i = r.first; i != r.second; i++) {
+			x.push_back(i->second);
+			seen.insert(i->second);
+		}
+		//Files the hasher has seen, but were never recorded by ROM loading.
+		for(auto i : lookup_files_by_hash(hash))
+			if(!seen.count(i))
+				x.push_back(i);
 		return x;
 	}
 
@@ -498,4 +498,9 @@ void set_hasher_callback(std::function<void(uint64_t, uint64_t)> cb)
 	lsnes_image_hasher.set_callback(cb);
 }
 
+std::list<std::pair<std::string, uint64_t>> lookup_files_by_hash(const std::string& hash)
+{
+	return lsnes_image_hasher.lookup_by_hash(hash);
+}
+
 std::map<std::string, core_type*> preferred_core;
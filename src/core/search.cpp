@@ -0,0 +1,531 @@
+#include "cmdhelp/search.hpp"
+#include "core/controller.hpp"
+#include "core/dispatch.hpp"
+#include "core/instance.hpp"
+#include "core/messages.hpp"
+#include "core/movie.hpp"
+#include "core/moviedata.hpp"
+#include "core/queue.hpp"
+#include "core/rom.hpp"
+#include "core/search.hpp"
+#include "library/json.hpp"
+#include "library/mathexpr-ntype.hpp"
+#include "library/memoryspace.hpp"
+#include "library/memorywatch.hpp"
+#include "library/minmax.hpp"
+#include "library/sha256.hpp"
+#include "library/string.hpp"
+#include "library/threads.hpp"
+#include "library/zip.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+
+namespace
+{
+	//Every combination of buttons is tried, so this bounds the branching factor.
+	const unsigned max_buttons = 12;
+
+	unsigned json_unsigned_default(const JSON::node& node, const std::string& pointer, unsigned dflt)
+	{
+		return (node.type_of(pointer) == JSON::number) ? node[pointer].as_uint() : dflt;
+	}
+
+	std::string json_string_default(const JSON::node& node, const std::string& pointer, const std::string& dflt)
+	{
+		return (node.type_of(pointer) == JSON::string) ? node[pointer].as_string8() : dflt;
+	}
+
+	double to_fitness(mathexpr::value v)
+	{
+		double x;
+		try {
+			x = v.type->tofloat(v._value);
+		} catch(mathexpr::error& e) {
+			throw std::runtime_error("Fitness is not a number");
+		}
+		if(std::isnan(x))
+			throw std::runtime_error("Fitness is not a number");
+		return x;
+	}
+}
+
+struct input_search::search_job
+{
+	struct button
+	{
+		unsigned port;
+		unsigned controller;
+		unsigned index;
+	};
+	struct memread
+	{
+		std::string name;
+		char type;
+		uint64_t addr;
+		int endianess;
+	};
+	struct candidate
+	{
+		std::vector<char> state;
+		std::string hash;
+		std::vector<uint32_t> path;
+		double fitness;
+		uint64_t index;
+	};
+	struct task
+	{
+		size_t parent;
+		uint32_t combo;
+		uint64_t index;
+	};
+	struct worker
+	{
+		worker() { inst = NULL; }
+		headless_instance* inst;
+		std::map<std::string, GC::pointer<mathexpr::mathexpr>> vars;
+		GC::pointer<mathexpr::mathexpr> fitness;
+		std::list<memorywatch::memread_oper*> opers;
+	};
+	search_job(input_queue& _iqueue) : iqueue(_iqueue)
+	{
+		coordinator = NULL;
+		remaining = 0;
+		quitting = false;
+		done = false;
+	}
+	~search_job()
+	{
+		{
+			threads::alock h(lock);
+			quitting = true;
+			done = true;
+		}
+		cond.notify_all();
+		if(coordinator) {
+			coordinator->join();
+			delete coordinator;
+		}
+		for(auto i : workers) {
+			delete i->inst;
+			delete i;
+		}
+	}
+	//Create per-worker copy of the fitness expression. Must be called in the emulation thread.
+	void add_worker(const std::string& fitness)
+	{
+		worker* w = new worker;
+		try {
+			for(auto& i : reads) {
+				auto o = new memorywatch::memread_oper;
+				o->bytes = 0;
+				o->signed_flag = false;
+				o->float_flag = false;
+				switch(i.type) {
+				case 'b': o->bytes = 1; o->signed_flag = true;  break;
+				case 'B': o->bytes = 1;                         break;
+				case 'w': o->bytes = 2; o->signed_flag = true;  break;
+				case 'W': o->bytes = 2;                         break;
+				case 'o': o->bytes = 3; o->signed_flag = true;  break;
+				case 'O': o->bytes = 3;                         break;
+				case 'd': o->bytes = 4; o->signed_flag = true;  break;
+				case 'D': o->bytes = 4;                         break;
+				case 'q': o->bytes = 8; o->signed_flag = true;  break;
+				case 'Q': o->bytes = 8;                         break;
+				case 'f': o->bytes = 4; o->signed_flag = true; o->float_flag = true; break;
+				case 'F': o->bytes = 8; o->signed_flag = true; o->float_flag = true; break;
+				}
+				o->endianess = i.endianess;
+				o->scale_div = 1;
+				o->addr_base = 0;
+				o->addr_size = 0;
+				o->mspace = NULL;
+				std::vector<GC::pointer<mathexpr::mathexpr>> args;
+				try {
+					args.push_back(GC::pointer<mathexpr::mathexpr>(GC::obj_tag(),
+						mathexpr::expression_value(), (stringfmt() << i.addr).str(), false));
+				} catch(...) {
+					delete o;
+					throw;
+				}
+				w->opers.push_back(o);
+				w->vars[i.name] = GC::pointer<mathexpr::mathexpr>(GC::obj_tag(),
+					mathexpr::expression_value(), o, args, true);
+			}
+			auto vars = w->vars;
+			w->fitness = mathexpr::mathexpr::parse(*mathexpr::expression_value(), fitness,
+				[&vars](const std::string& n) -> GC::pointer<mathexpr::mathexpr> {
+					if(!vars.count(n))
+						throw std::runtime_error("Unknown variable '" + n + "'");
+					return vars[n];
+				});
+		} catch(std::exception& e) {
+			delete w;
+			(stringfmt() << "Error in fitness: " << e.what()).throwex();
+		}
+		workers.push_back(w);
+	}
+	//Start worker instances and the coordinator.
+	void run(std::function<void(search_job* j)> on_done)
+	{
+		for(auto w : workers)
+			w->inst = new headless_instance([this, w](emulator_instance& inst) { this->work(*w, inst); });
+		coordinator = new threads::thread([this, on_done]() {
+			this->coordinate();
+			on_done(this);
+		});
+	}
+	void set_buttons(portctrl::frame& f, uint32_t combo)
+	{
+		for(unsigned i = 0; i < buttons.size(); i++)
+			if((combo >> i) & 1)
+				f.axis3(buttons[i].port, buttons[i].controller, buttons[i].index, 1);
+	}
+	//Search parameters. Not modified after starting.
+	std::vector<button> buttons;
+	std::vector<memread> reads;
+	unsigned steps;
+	unsigned hold;
+	unsigned beam;
+	unsigned results;
+	std::string branch;
+	const portctrl::type_set* types;
+	rom_image_handle image;
+	core_region* region;
+	std::map<std::string, std::string> settings;
+	int64_t rtc_second;
+	int64_t rtc_subsecond;
+	time_t random_seed;
+	std::string base_branch;
+	uint64_t cut;
+	input_queue& iqueue;
+	std::vector<worker*> workers;
+	threads::thread* coordinator;
+	//Shared between coordinator and workers.
+	threads::lock lock;
+	threads::cv cond;
+	std::vector<candidate> current;
+	std::vector<candidate> next;
+	std::set<std::string> seen;
+	std::map<std::string, uint64_t> step_seen;
+	std::deque<task> tasks;
+	size_t remaining;
+	bool quitting;
+	bool done;
+	std::string error;
+private:
+	void coordinate()
+	{
+		uint32_t combos = 1U << buttons.size();
+		for(unsigned step = 0; step < steps; step++) {
+			threads::alock h(lock);
+			uint64_t index = 0;
+			for(size_t i = 0; i < current.size(); i++)
+				for(uint32_t j = 0; j < combos; j++) {
+					task t;
+					t.parent = i;
+					t.combo = j;
+					t.index = index++;
+					tasks.push_back(t);
+				}
+			remaining = tasks.size();
+			next.clear();
+			step_seen.clear();
+			cond.notify_all();
+			while(remaining && !quitting)
+				cond.wait(h);
+			if(quitting)
+				break;
+			if(next.empty()) {
+				error = "All candidates failed";
+				break;
+			}
+			for(auto& i : next)
+				seen.insert(i.hash);
+			std::swap(current, next);
+			next.clear();
+		}
+		threads::alock h(lock);
+		done = true;
+		cond.notify_all();
+	}
+	bool next_task(task& t)
+	{
+		threads::alock h(lock);
+		while(tasks.empty() && !done)
+			cond.wait(h);
+		if(done)
+			return false;
+		t = tasks.front();
+		tasks.pop_front();
+		return true;
+	}
+	//Keep the best candidates ordered by fitness, ties broken by task index so the outcome does not depend on
+	//order of completion. Must be called with lock held.
+	void add_candidate(candidate& c)
+	{
+		if(seen.count(c.hash))
+			return;
+		if(step_seen.count(c.hash)) {
+			if(step_seen[c.hash] < c.index)
+				return;
+			for(auto i = next.begin(); i != next.end(); i++)
+				if(i->hash == c.hash) {
+					next.erase(i);
+					break;
+				}
+		}
+		step_seen[c.hash] = c.index;
+		auto better = [](const candidate& a, const candidate& b) -> bool {
+			if(a.fitness != b.fitness)
+				return a.fitness > b.fitness;
+			return a.index < b.index;
+		};
+		auto pos = std::upper_bound(next.begin(), next.end(), c, better);
+		if(pos == next.end() && next.size() >= beam)
+			return;
+		next.insert(pos, std::move(c));
+		if(next.size() > beam)
+			next.pop_back();
+	}
+	void work(worker& w, emulator_instance& core)
+	{
+		try {
+			core.random_seed_value = random_seed;
+			*core.rom = loaded_rom(image);
+			core.rom->set_internal_region(*region);
+			auto _settings = settings;
+			core.rom->load(_settings, rtc_second, rtc_subsecond);
+			core.controls->set_ports(*types);
+			//Nothing is ever displayed.
+			core.rom->set_render_skip(true);
+			for(auto i : w.opers)
+				i->mspace = core.memory;
+		} catch(std::exception& e) {
+			threads::alock h(lock);
+			error = std::string("Can't start worker: ") + e.what();
+			quitting = true;
+			done = true;
+			cond.notify_all();
+			return;
+		}
+		task t;
+		while(next_task(t)) {
+			candidate c;
+			bool ok = false;
+			try {
+				core.rom->load_core_state(current[t.parent].state, true);
+				portctrl::frame f(*types);
+				set_buttons(f, t.combo);
+				for(unsigned i = 0; i < hold; i++) {
+					portctrl::frame cf = f;
+					core.rom->pre_emulate_frame(cf);
+					core.mlogic->set_headless_controls(cf);
+					core.rom->emulate();
+				}
+				c.state = core.rom->save_core_state(true);
+				uint8_t hash[32];
+				sha256::hash(hash, c.state);
+				c.hash = std::string((char*)hash, 32);
+				for(auto& i : w.vars)
+					i.second->reset();
+				w.fitness->reset();
+				c.fitness = to_fitness(w.fitness->evaluate());
+				c.path = current[t.parent].path;
+				c.path.push_back(t.combo);
+				c.index = t.index;
+				ok = true;
+			} catch(std::exception& e) {
+				//Candidates that fail to emulate or evaluate are just dropped.
+			}
+			threads::alock h(lock);
+			if(ok)
+				add_candidate(c);
+			if(!--remaining)
+				cond.notify_all();
+		}
+	}
+};
+
+input_search::input_search(loaded_rom& _rom, movie_logic& _mlogic, memory_space& _memory,
+	emulator_dispatch& _dispatch, input_queue& _iqueue, command::group& _cmd)
+	: rom(_rom), mlogic(_mlogic), memory(_memory), dispatch(_dispatch), iqueue(_iqueue), cmd(_cmd),
+	startcmd(cmd, CSEARCH::start, [this](command::arg_filename a) { this->start(a); }),
+	stopcmd(cmd, CSEARCH::stop, [this]() { this->stop(); })
+{
+	job = NULL;
+	generation = 0;
+}
+
+input_search::~input_search()
+{
+	delete job;
+}
+
+void input_search::start(const std::string& filename)
+{
+	if(job)
+		throw std::runtime_error("Search already in progress");
+	if(!mlogic)
+		throw std::runtime_error("Can't search without a movie");
+	if(!rom.get_internal_rom_type().get_core()->multi_instance())
+		throw std::runtime_error("The core does not support searching");
+	auto _spec = zip::readrel(filename, "");
+	JSON::node spec(std::string(_spec.begin(), _spec.end()));
+	moviefile& mf = mlogic.get_mfile();
+
+	search_job* j = new search_job(iqueue);
+	try {
+		j->types = &mf.input->get_types();
+		if(spec.type_of("buttons") != JSON::array)
+			throw std::runtime_error("Expected array 'buttons'");
+		const JSON::node& buttons = spec["buttons"];
+		if(buttons.index_count() > max_buttons)
+			(stringfmt() << "At most " << max_buttons << " buttons can be searched").throwex();
+		for(size_t i = 0; i < buttons.index_count(); i++) {
+			std::string b = buttons.index(i).as_string8();
+			regex_results r = regex("([0-9]+)[ \t]+(.+)", b, ("Bad button '" + b + "'").c_str());
+			auto pcid = j->types->lcid_to_pcid(parse_value<unsigned>(r[1]) - 1);
+			const portctrl::controller& ctrl =
+				j->types->port_type(pcid.first).controller_info->controllers[pcid.second];
+			search_job::button x;
+			x.port = pcid.first;
+			x.controller = pcid.second;
+			x.index = ctrl.buttons.size();
+			for(unsigned k = 0; k < ctrl.buttons.size(); k++)
+				if(ctrl.buttons[k].name == r[2] && ctrl.buttons[k].type != portctrl::button::TYPE_NULL &&
+					!ctrl.buttons[k].is_analog())
+					x.index = k;
+			if(x.index == ctrl.buttons.size())
+				throw std::runtime_error("No button '" + b + "'");
+			j->buttons.push_back(x);
+		}
+		if(spec.type_of("vars") == JSON::object) {
+			const JSON::node& vars = spec["vars"];
+			for(auto i = vars.begin(); i != vars.end(); i++) {
+				std::string v = i->as_string8();
+				regex_results r = regex("([bBwWoOdDqQfF])[ \t]+((0x)?[0-9A-Fa-f]+)", v,
+					("Bad memory read '" + v + "'").c_str());
+				search_job::memread m;
+				m.name = i.key8();
+				m.type = r[1][0];
+				m.addr = strtoull(r[2].c_str(), NULL, 0);
+				auto mdata = memory.lookup(m.addr);
+				if(!mdata.first)
+					(stringfmt() << "Address 0x" << std::hex << m.addr << " is not mapped").throwex();
+				m.endianess = mdata.first->endian;
+				j->reads.push_back(m);
+			}
+		}
+		if(spec.type_of("fitness") != JSON::string)
+			throw std::runtime_error("Expected string 'fitness'");
+		std::string fitness = spec["fitness"].as_string8();
+		j->steps = json_unsigned_default(spec, "steps", 10);
+		j->hold = max(json_unsigned_default(spec, "hold", 1), 1U);
+		j->beam = max(json_unsigned_default(spec, "beam", 16), 1U);
+		j->results = json_unsigned_default(spec, "results", 1);
+		j->branch = json_string_default(spec, "branch", "search");
+		unsigned nthreads = json_unsigned_default(spec, "threads", threads::thread::hardware_concurrency());
+		if(!nthreads)
+			nthreads = 1;
+		for(unsigned i = 0; i < nthreads; i++)
+			j->add_worker(fitness);
+
+		j->image = rom.get_image();
+		j->region = &rom.get_internal_region();
+		j->settings = mf.settings;
+		j->rtc_second = mf.movie_rtc_second;
+		j->rtc_subsecond = mf.movie_rtc_subsecond;
+		j->random_seed = CORE().random_seed_value;
+		j->base_branch = mf.current_branch();
+		j->cut = mlogic.get_movie().get_current_frame_first_subframe();
+
+		search_job::candidate root;
+		root.state = rom.save_core_state(true);
+		uint8_t hash[32];
+		sha256::hash(hash, root.state);
+		root.hash = std::string((char*)hash, 32);
+		root.fitness = 0;
+		root.index = 0;
+		j->seen.insert(root.hash);
+		j->current.push_back(root);
+
+		uint64_t gen = ++generation;
+		j->run([this, gen](search_job* _j) {
+			this->iqueue.run_async([this, gen, _j]() {
+				if(this->job != _j || this->generation != gen)
+					return;
+				this->finish(_j);
+			}, [](std::exception& e) {
+				messages << "Error finishing search: " << e.what() << std::endl;
+			});
+		});
+	} catch(...) {
+		delete j;
+		throw;
+	}
+	job = j;
+	messages << "Searching " << j->steps << " steps of " << (1U << j->buttons.size()) << " combinations using "
+		<< j->workers.size() << " workers" << std::endl;
+}
+
+void input_search::stop()
+{
+	if(!job)
+		return;
+	delete job;
+	job = NULL;
+	GC::item::do_gc();
+	messages << "Search aborted" << std::endl;
+}
+
+void input_search::finish(search_job* j)
+{
+	job = NULL;
+	std::vector<search_job::candidate> best;
+	std::string error;
+	{
+		threads::alock h(j->lock);
+		std::swap(best, j->current);
+		error = j->error;
+	}
+	try {
+		if(error != "")
+			throw std::runtime_error("Search failed: " + error);
+		if(!mlogic)
+			throw std::runtime_error("Search finished, but the movie has been closed");
+		moviefile& mf = mlogic.get_mfile();
+		if(!mf.branches.count(j->base_branch) || &mf.branches[j->base_branch].get_types() != j->types)
+			throw std::runtime_error("Search finished, but the movie has changed");
+		for(size_t i = 0; i < best.size() && i < j->results; i++) {
+			std::string name = (stringfmt() << j->branch << "-" << (i + 1)).str();
+			if(name == mf.current_branch()) {
+				messages << "Not overwriting current branch '" << name << "'" << std::endl;
+				continue;
+			}
+			mf.branches.erase(name);
+			mf.fork_branch(j->base_branch, name);
+			portctrl::frame_vector& v = mf.branches[name];
+			v.resize(j->cut);
+			for(auto c : best[i].path) {
+				portctrl::frame f = v.blank_frame(true);
+				j->set_buttons(f, c);
+				for(unsigned k = 0; k < j->hold; k++)
+					v.append(f);
+			}
+			messages << "Created branch '" << name << "' (fitness " << best[i].fitness << ")"
+				<< std::endl;
+		}
+		dispatch.mbranch_change();
+	} catch(std::exception& e) {
+		messages << e.what() << std::endl;
+	}
+	//Shuts down the workers.
+	delete j;
+	GC::item::do_gc();
+}
@@ -0,0 +1,180 @@
+#include "cmdhelp/statelog.hpp"
+#include "core/messages.hpp"
+#include "core/movie.hpp"
+#include "core/rom.hpp"
+#include "core/statelog.hpp"
+#include "library/serialization.hpp"
+#include "library/sha256.hpp"
+#include "library/string.hpp"
+
+#include <cstring>
+
+namespace
+{
+	const char magic[8] = {'l', 's', 'n', 'e', 's', 'S', 'H', 'L'};
+	const char* checkpoint_name = "$MEMORY:state-hash-log-checkpoint";
+	//Flush the log after this many records, so a crash doesn't lose much.
+	const uint64_t flush_interval = 64;
+}
+
+state_hash_log::state_hash_log(loaded_rom& _rom, movie_logic& _mlogic, command::group& _cmd)
+	: rom(_rom), mlogic(_mlogic), cmd(_cmd),
+	startcmd(cmd, CSTATELOG::start, [this](command::arg_filename a) { this->start(a); }),
+	stopcmd(cmd, CSTATELOG::stop, [this]() { this->stop(); }),
+	verifycmd(cmd, CSTATELOG::verify, [this](command::arg_filename a) { this->verify(a); })
+{
+	out = NULL;
+	unflushed = 0;
+	quit_after = 0;
+	vstatus = V_NONE;
+	interval = 1;
+	fine = false;
+	have_checkpoint = false;
+	checkpoint_frame = 0;
+	desync_frame = 0;
+	quit_when_done = false;
+}
+
+state_hash_log::~state_hash_log()
+{
+	delete out;
+}
+
+void state_hash_log::start(const std::string& filename, uint64_t _quit_after)
+{
+	std::ofstream* n = new std::ofstream(filename, std::ios::binary);
+	if(!*n) {
+		delete n;
+		throw std::runtime_error("Can't open '" + filename + "'");
+	}
+	n->write(magic, sizeof(magic));
+	stop();
+	out = n;
+	quit_after = _quit_after;
+	messages << "Logging state hashes to '" << filename << "'" << std::endl;
+}
+
+void state_hash_log::stop()
+{
+	if(!out)
+		return;
+	out->close();
+	delete out;
+	out = NULL;
+	unflushed = 0;
+	quit_after = 0;
+	messages << "Stopped logging state hashes" << std::endl;
+}
+
+void state_hash_log::verify(const std::string& filename, uint64_t _interval, bool _quit_when_done)
+{
+	auto ref = read(filename);
+	if(ref.empty())
+		throw std::runtime_error("State hash log '" + filename + "' is empty");
+	reference = ref;
+	interval = _interval ? _interval : 1;
+	quit_when_done = _quit_when_done;
+	fine = (interval == 1);
+	have_checkpoint = false;
+	checkpoint_frame = 0;
+	desync_frame = 0;
+	vstatus = V_RUNNING;
+	messages << "Verifying against " << reference.size() << " logged frames (frames "
+		<< reference.begin()->first << "-" << reference.rbegin()->first << ")" << std::endl;
+}
+
+void state_hash_log::finish_verify(verify_status status, uint64_t frame)
+{
+	vstatus = status;
+	desync_frame = frame;
+	reference.clear();
+	if(status == V_MATCH)
+		messages << "State hash log verified, no differences found" << std::endl;
+	else
+		messages << "First frame with different state: " << frame << std::endl;
+	if(quit_when_done)
+		cmd.invoke("quit-emulator", "/y");
+}
+
+void state_hash_log::frame_emulated()
+{
+	if(!out && vstatus != V_RUNNING)
+		return;
+	if(!mlogic)
+		return;
+	uint64_t frame = mlogic.get_movie().get_current_frame();
+	if(out) {
+		char rec[16];
+		serialization::u64b(rec, frame);
+		serialization::u64b(rec + 8, state_hash(rom));
+		out->write(rec, sizeof(rec));
+		if(++unflushed >= flush_interval) {
+			out->flush();
+			unflushed = 0;
+		}
+		if(quit_after && frame >= quit_after) {
+			stop();
+			cmd.invoke("quit-emulator", "/y");
+		}
+	}
+	if(vstatus != V_RUNNING)
+		return;
+	uint64_t last = reference.rbegin()->first;
+	if(reference.count(frame) && (fine || frame % interval == 0 || frame == last)) {
+		if(state_hash(rom) != reference[frame]) {
+			if(fine) {
+				finish_verify(V_DESYNC, frame);
+				return;
+			}
+			//Go back to last good frame (or the beginning) and check every frame from there.
+			fine = true;
+			desync_frame = frame;
+			if(have_checkpoint) {
+				messages << "State differs at frame " << frame << ", rechecking from frame "
+					<< checkpoint_frame << std::endl;
+				cmd.invoke("load-readonly", checkpoint_name);
+			} else {
+				messages << "State differs at frame " << frame << ", rechecking from beginning"
+					<< std::endl;
+				cmd.invoke("rewind-movie");
+			}
+			return;
+		}
+		if(!fine) {
+			cmd.invoke("save-state", checkpoint_name);
+			checkpoint_frame = frame;
+			have_checkpoint = true;
+		}
+	}
+	if(fine && desync_frame && frame >= desync_frame) {
+		//The difference did not reproduce on second run.
+		messages << "Warning: Emulation is not deterministic" << std::endl;
+		finish_verify(V_DESYNC, desync_frame);
+		return;
+	}
+	if(frame >= last)
+		finish_verify(V_MATCH, 0);
+}
+
+uint64_t state_hash_log::state_hash(loaded_rom& rom)
+{
+	std::vector<char> state = rom.save_core_state(true);
+	uint8_t hash[32];
+	sha256::hash(hash, state);
+	return serialization::u64b(hash);
+}
+
+std::map<uint64_t, uint64_t> state_hash_log::read(const std::string& filename)
+{
+	std::map<uint64_t, uint64_t> ret;
+	std::ifstream in(filename, std::ios::binary);
+	if(!in)
+		throw std::runtime_error("Can't open '" + filename + "'");
+	char buf[16];
+	in.read(buf, sizeof(magic));
+	if(!in || memcmp(buf, magic, sizeof(magic)))
+		throw std::runtime_error("'" + filename + "' is not a state hash log");
+	while(in.read(buf, sizeof(buf)))
+		ret[serialization::u64b(buf)] = serialization::u64b(buf + 8);
+	return ret;
+}
@@ -30,6 +30,7 @@
 #include "core/settings.hpp"
 #include "core/framebuffer.hpp"
 #include "core/instance.hpp"
+#include "core/instance-map.hpp"
 #include "core/messages.hpp"
 #include "interface/callbacks.hpp"
 #include "interface/cover.hpp"
@@ -57,83 +58,125 @@ namespace
 	settingvar::supervariable<settingvar::model_bool<settingvar::yes_no>> gbchawk_timings(lsnes_setgrp,
 		"gambatte-gbchawk-fuckup", "Gambatte‣Use old GBCHawk timings", false);
 
-	bool do_reset_flag = false;
-	core_type* internal_rom = NULL;
-	bool rtc_fixed;
-	time_t rtc_fixed_val;
-	gambatte::GB* instance;
-	bool reallocate_debug = false;
-	bool sigillcrash = false;
+	//State is per emulator instance, so several instances can run at once.
+	struct core_state
+	{
+		core_state();
+		~core_state();
+		bool do_reset_flag;
+		core_type* internal_rom;
+		bool rtc_fixed;
+		time_t rtc_fixed_val;
+		gambatte::GB* instance;
+		bool reallocate_debug;
+		bool sigillcrash;
 #ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
-	gambatte::debugbuffer debugbuf;
-	size_t cur_romsize;
-	size_t cur_ramsize;
+		gambatte::debugbuffer debugbuf;
+		size_t cur_romsize;
+		size_t cur_ramsize;
 #endif
-	unsigned frame_overflow = 0;
-	std::vector<unsigned char> romdata;
-	std::vector<char> init_savestate;
-	uint32_t cover_fbmem[480 * 432];
-	uint32_t primary_framebuffer[160*144];
-	uint32_t accumulator_l = 0;
-	uint32_t accumulator_r = 0;
-	unsigned accumulator_s = 0;
-	bool pflag = false;
-	bool disable_breakpoints = false;
-	bool palette_colors_default[3] = {true, true, true};
-	uint32_t palette_colors[12];
-	uint32_t last_tsc_increment = 0;
+		unsigned frame_overflow;
+		std::vector<unsigned char> romdata;
+		std::vector<char> init_savestate;
+		std::vector<char> cmp_save;
+		uint32_t cover_fbmem[480 * 432];
+		uint32_t primary_framebuffer[160*144];
+		uint32_t accumulator_l;
+		uint32_t accumulator_r;
+		unsigned accumulator_s;
+		bool pflag;
+		bool disable_breakpoints;
+		bool palette_colors_default[3];
+		uint32_t palette_colors[12];
+		uint32_t last_tsc_increment;
+		framebuffer::raw cover;
+	};
+	instance_state<core_state> states;
 
 	struct interface_device_reg gb_registers[] = {
-		{"wrambank", []() -> uint64_t { return instance ? instance->getIoRam().first[0x170] & 0x07 : 0; },
-			[](uint64_t v) {}},
-		{"cyclecount", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_CYCLECOUNTER); },
+		{"wrambank", []() -> uint64_t {
+				gambatte::GB* instance = states().instance;
+				return instance ? instance->getIoRam().first[0x170] & 0x07 : 0;
+			}, [](uint64_t v) {}},
+		{"cyclecount", []() -> uint64_t {
+				return states().instance->get_cpureg(gambatte::GB::REG_CYCLECOUNTER);
+			},
 			[](uint64_t v) {}},
-		{"pc", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_PC); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_PC, v); }},
-		{"sp", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_SP); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_SP, v); }},
-		{"hf1", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_HF1); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_HF1, v); }},
-		{"hf2", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_HF2); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_HF2, v); }},
-		{"zf", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_ZF); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_ZF, v); }},
-		{"cf", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_CF); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_CF, v); }},
-		{"a", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_A); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_A, v); }},
-		{"b", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_B); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_B, v); }},
-		{"c", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_C); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_C, v); }},
-		{"d", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_D); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_D, v); }},
-		{"e", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_E); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_E, v); }},
-		{"f", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_F); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_F, v); }},
-		{"h", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_H); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_H, v); }},
-		{"l", []() -> uint64_t { return instance->get_cpureg(gambatte::GB::REG_L); },
-			[](uint64_t v) { instance->set_cpureg(gambatte::GB::REG_L, v); }},
+		{"pc", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_PC); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_PC, v); }},
+		{"sp", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_SP); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_SP, v); }},
+		{"hf1", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_HF1); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_HF1, v); }},
+		{"hf2", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_HF2); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_HF2, v); }},
+		{"zf", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_ZF); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_ZF, v); }},
+		{"cf", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_CF); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_CF, v); }},
+		{"a", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_A); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_A, v); }},
+		{"b", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_B); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_B, v); }},
+		{"c", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_C); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_C, v); }},
+		{"d", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_D); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_D, v); }},
+		{"e", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_E); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_E, v); }},
+		{"f", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_F); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_F, v); }},
+		{"h", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_H); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_H, v); }},
+		{"l", []() -> uint64_t { return states().instance->get_cpureg(gambatte::GB::REG_L); },
+			[](uint64_t v) { states().instance->set_cpureg(gambatte::GB::REG_L, v); }},
 		{NULL, NULL, NULL}
 	};
 
 	//Framebuffer.
-	struct framebuffer::info cover_fbinfo = {
-		&framebuffer::pixfmt_rgb32,		//Format.
-		(char*)cover_fbmem,		//Memory.
-		480, 432, 1920,			//Physical size.
-		480, 432, 1920,			//Logical size.
-		0, 0				//Offset.
-	};
+	struct framebuffer::info cover_fbinfo(uint32_t* mem)
+	{
+		struct framebuffer::info inf = {
+			&framebuffer::pixfmt_rgb32,	//Format.
+			(char*)mem,			//Memory.
+			480, 432, 1920,			//Physical size.
+			480, 432, 1920,			//Logical size.
+			0, 0				//Offset.
+		};
+		return inf;
+	}
+
+	core_state::core_state()
+		: do_reset_flag(false), internal_rom(NULL), rtc_fixed(false), rtc_fixed_val(0), instance(NULL),
+		reallocate_debug(false), sigillcrash(false),
+#ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
+		debugbuf(), cur_romsize(0), cur_ramsize(0),
+#endif
+		frame_overflow(0), accumulator_l(0), accumulator_r(0), accumulator_s(0), pflag(false),
+		disable_breakpoints(false), last_tsc_increment(0), cover(cover_fbinfo(cover_fbmem))
+	{
+		for(unsigned i = 0; i < 3; i++)
+			palette_colors_default[i] = true;
+		memset(palette_colors, 0, sizeof(palette_colors));
+	}
+
+	core_state::~core_state()
+	{
+		delete instance;
+#ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
+		delete[] debugbuf.wram;
+		delete[] debugbuf.cart;
+		delete[] debugbuf.sram;
+#endif
+	}
 
 #include "ports.inc"
 
 	time_t walltime_fn()
 	{
-		if(rtc_fixed)
-			return rtc_fixed_val;
+		auto& s = states();
+		if(s.rtc_fixed)
+			return s.rtc_fixed_val;
 		if(ecore_callbacks)
 			return ecore_callbacks->get_time();
 		else
@@ -145,12 +188,13 @@ namespace
 	public:
 		unsigned operator()()
 		{
+			auto& s = states();
 			unsigned v = 0;
 			for(unsigned i = 0; i < 8; i++) {
 				if(ecore_callbacks->get_input(0, 1, i))
 					v |= (1 << i);
 			}
-			pflag = true;
+			s.pflag = true;
 			return v;
 		};
 	} getinput;
@@ -169,7 +213,8 @@ namespace
 
 	void gambatte_read_handler(unsigned clazz, unsigned offset, uint8_t value, bool exec)
 	{
-		if(disable_breakpoints) return;
+		auto& s = states();
+		if(s.disable_breakpoints) return;
 		uint64_t _addr = get_address(clazz, offset);
 		if(_addr != 0xFFFFFFFFFFFFFFFFULL) {
 			if(exec)
@@ -181,7 +226,8 @@ namespace
 
 	void gambatte_write_handler(unsigned clazz, unsigned offset, uint8_t value)
 	{
-		if(disable_breakpoints) return;
+		auto& s = states();
+		if(s.disable_breakpoints) return;
 		uint64_t _addr = get_address(clazz, offset);
 		if(_addr != 0xFFFFFFFFFFFFFFFFULL)
 			ecore_callbacks->memory_write(_addr, value);
@@ -254,19 +300,20 @@ namespace
 
 	void gambatte_trace_handler(uint16_t _pc)
 	{
-		static char buffer[512];
+		auto& s = states();
+		char buffer[512];
 		char* buffer_ptr = buffer;
 		int addr = -1;
 		uint16_t opcode;
 		uint32_t pc = _pc;
 		uint16_t offset = 0;
-		std::function<uint8_t()> fetch = [pc, &offset, &buffer_ptr]() -> uint8_t {
+		std::function<uint8_t()> fetch = [pc, &offset, &buffer_ptr, &s]() -> uint8_t {
 			unsigned addr = pc + offset++;
 			uint8_t v;
 #ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
-			disable_breakpoints = true;
-			v = instance->bus_read(addr);
-			disable_breakpoints = false;
+			s.disable_breakpoints = true;
+			v = s.instance->bus_read(addr);
+			s.disable_breakpoints = false;
 #endif
 			buffer_h8(buffer_ptr, v);
 			return v;
@@ -278,11 +325,11 @@ namespace
 			*(buffer_ptr++) = ' ';
 		buffer_str(buffer_ptr, d.c_str());
 		switch(memclass[opcode >> 8]) {
-		case 1: addr = get_bc(instance); break;
-		case 2: addr = get_de(instance); break;
-		case 3: addr = get_hl(instance); break;
-		case 4: addr = 0xFF00 + instance->get_cpureg(gambatte::GB::REG_C); break;
-		case 5: if((opcode & 7) == 6)  addr = get_hl(instance); break;
+		case 1: addr = get_bc(s.instance); break;
+		case 2: addr = get_de(s.instance); break;
+		case 3: addr = get_hl(s.instance); break;
+		case 4: addr = 0xFF00 + s.instance->get_cpureg(gambatte::GB::REG_C); break;
+		case 5: if((opcode & 7) == 6)  addr = get_hl(s.instance); break;
 		}
 		while(buffer_ptr < buffer + 28)
 			*(buffer_ptr++) = ' ';
@@ -294,56 +341,56 @@ namespace
 			buffer_str(buffer_ptr, "      ");
 
 		buffer_str(buffer_ptr, "A:");
-		buffer_h8(buffer_ptr, instance->get_cpureg(gambatte::GB::REG_A));
+		buffer_h8(buffer_ptr, s.instance->get_cpureg(gambatte::GB::REG_A));
 		buffer_str(buffer_ptr, " B:");
-		buffer_h8(buffer_ptr, instance->get_cpureg(gambatte::GB::REG_B));
+		buffer_h8(buffer_ptr, s.instance->get_cpureg(gambatte::GB::REG_B));
 		buffer_str(buffer_ptr, " C:");
-		buffer_h8(buffer_ptr, instance->get_cpureg(gambatte::GB::REG_C));
+		buffer_h8(buffer_ptr, s.instance->get_cpureg(gambatte::GB::REG_C));
 		buffer_str(buffer_ptr, " D:");
-		buffer_h8(buffer_ptr, instance->get_cpureg(gambatte::GB::REG_D));
+		buffer_h8(buffer_ptr, s.instance->get_cpureg(gambatte::GB::REG_D));
 		buffer_str(buffer_ptr, " E:");
-		buffer_h8(buffer_ptr, instance->get_cpureg(gambatte::GB::REG_E));
+		buffer_h8(buffer_ptr, s.instance->get_cpureg(gambatte::GB::REG_E));
 		buffer_str(buffer_ptr, " H:");
-		buffer_h8(buffer_ptr, instance->get_cpureg(gambatte::GB::REG_H));
+		buffer_h8(buffer_ptr, s.instance->get_cpureg(gambatte::GB::REG_H));
 		buffer_str(buffer_ptr, " L:");
-		buffer_h8(buffer_ptr, instance->get_cpureg(gambatte::GB::REG_L));
+		buffer_h8(buffer_ptr, s.instance->get_cpureg(gambatte::GB::REG_L));
 		buffer_str(buffer_ptr, " SP:");
-		buffer_h16(buffer_ptr, instance->get_cpureg(gambatte::GB::REG_SP));
+		buffer_h16(buffer_ptr, s.instance->get_cpureg(gambatte::GB::REG_SP));
 		buffer_str(buffer_ptr, " F:");
-		*(buffer_ptr++) = instance->get_cpureg(gambatte::GB::REG_CF) ? 'C' : '-';
-		*(buffer_ptr++) = instance->get_cpureg(gambatte::GB::REG_ZF) ? '-' : 'Z';
-		*(buffer_ptr++) = instance->get_cpureg(gambatte::GB::REG_HF1) ? '1' : '-';
-		*(buffer_ptr++) = instance->get_cpureg(gambatte::GB::REG_HF2) ? '2' : '-';
+		*(buffer_ptr++) = s.instance->get_cpureg(gambatte::GB::REG_CF) ? 'C' : '-';
+		*(buffer_ptr++) = s.instance->get_cpureg(gambatte::GB::REG_ZF) ? '-' : 'Z';
+		*(buffer_ptr++) = s.instance->get_cpureg(gambatte::GB::REG_HF1) ? '1' : '-';
+		*(buffer_ptr++) = s.instance->get_cpureg(gambatte::GB::REG_HF2) ? '2' : '-';
 		*(buffer_ptr++) = '\0';
 		ecore_callbacks->memory_trace(0, buffer, true);
 	}
 
 	void basic_init()
 	{
-		static bool done = false;
-		if(done)
+		auto& s = states();
+		if(s.instance)
 			return;
-		done = true;
-		instance = new gambatte::GB;
-		instance->setInputGetter(&getinput);
-		instance->set_walltime_fn(walltime_fn);
+		s.instance = new gambatte::GB;
+		s.instance->setInputGetter(&getinput);
+		s.instance->set_walltime_fn(walltime_fn);
 #ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
 		uint8_t* tmp = new uint8_t[98816];
 		memset(tmp, 0, 98816);
-		debugbuf.wram = tmp;
-		debugbuf.bus = tmp + 32768;
-		debugbuf.ioamhram = tmp + 98304;
-		debugbuf.read = gambatte_read_handler;
-		debugbuf.write = gambatte_write_handler;
-		debugbuf.trace = gambatte_trace_handler;
-		debugbuf.trace_cpu = false;
-		instance->set_debug_buffer(debugbuf);
+		s.debugbuf.wram = tmp;
+		s.debugbuf.bus = tmp + 32768;
+		s.debugbuf.ioamhram = tmp + 98304;
+		s.debugbuf.read = gambatte_read_handler;
+		s.debugbuf.write = gambatte_write_handler;
+		s.debugbuf.trace = gambatte_trace_handler;
+		s.debugbuf.trace_cpu = false;
+		s.instance->set_debug_buffer(s.debugbuf);
 #endif
 	}
 
 	int load_rom_common(core_romimage* img, unsigned flags, uint64_t rtc_sec, uint64_t rtc_subsec,
 		core_type* inttype, std::map<std::string, std::string>& settings)
 	{
+		auto& s = states();
 		basic_init();
 		const char* markup = img[0].markup;
 		int flags2 = 0;
@@ -356,60 +403,60 @@ namespace
 		size_t size = img[0].size;
 
 		//Reset it really.
-		instance->~GB();
-		memset(instance, 0, sizeof(gambatte::GB));
-		new(instance) gambatte::GB;
-		instance->setInputGetter(&getinput);
-		instance->set_walltime_fn(walltime_fn);
-		memset(primary_framebuffer, 0, sizeof(primary_framebuffer));
-		frame_overflow = 0;
-
-		rtc_fixed = true;
-		rtc_fixed_val = rtc_sec;
-		instance->load(data, size, flags);
+		s.instance->~GB();
+		memset(s.instance, 0, sizeof(gambatte::GB));
+		new(s.instance) gambatte::GB;
+		s.instance->setInputGetter(&getinput);
+		s.instance->set_walltime_fn(walltime_fn);
+		memset(s.primary_framebuffer, 0, sizeof(s.primary_framebuffer));
+		s.frame_overflow = 0;
+
+		s.rtc_fixed = true;
+		s.rtc_fixed_val = rtc_sec;
+		s.instance->load(data, size, flags);
 #ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
-		size_t sramsize = instance->getSaveRam().second;
+		size_t sramsize = s.instance->getSaveRam().second;
 		size_t romsize = size;
-		if(reallocate_debug || cur_ramsize != sramsize || cur_romsize != romsize) {
-			if(debugbuf.cart) delete[] debugbuf.cart;
-			if(debugbuf.sram) delete[] debugbuf.sram;
-			debugbuf.cart = NULL;
-			debugbuf.sram = NULL;
-			if(sramsize) debugbuf.sram = new uint8_t[(sramsize + 4095) >> 12 << 12];
-			if(romsize) debugbuf.cart = new uint8_t[(romsize + 4095) >> 12 << 12];
-			if(sramsize) memset(debugbuf.sram, 0, (sramsize + 4095) >> 12 << 12);
-			if(romsize) memset(debugbuf.cart, 0, (romsize + 4095) >> 12 << 12);
-			memset(debugbuf.wram, 0, 32768);
-			memset(debugbuf.ioamhram, 0, 512);
-			debugbuf.wramcheat.clear();
-			debugbuf.sramcheat.clear();
-			debugbuf.cartcheat.clear();
-			debugbuf.trace_cpu = false;
-			reallocate_debug = false;
-			cur_ramsize = sramsize;
-			cur_romsize = romsize;
+		if(s.reallocate_debug || s.cur_ramsize != sramsize || s.cur_romsize != romsize) {
+			if(s.debugbuf.cart) delete[] s.debugbuf.cart;
+			if(s.debugbuf.sram) delete[] s.debugbuf.sram;
+			s.debugbuf.cart = NULL;
+			s.debugbuf.sram = NULL;
+			if(sramsize) s.debugbuf.sram = new uint8_t[(sramsize + 4095) >> 12 << 12];
+			if(romsize) s.debugbuf.cart = new uint8_t[(romsize + 4095) >> 12 << 12];
+			if(sramsize) memset(s.debugbuf.sram, 0, (sramsize + 4095) >> 12 << 12);
+			if(romsize) memset(s.debugbuf.cart, 0, (romsize + 4095) >> 12 << 12);
+			memset(s.debugbuf.wram, 0, 32768);
+			memset(s.debugbuf.ioamhram, 0, 512);
+			s.debugbuf.wramcheat.clear();
+			s.debugbuf.sramcheat.clear();
+			s.debugbuf.cartcheat.clear();
+			s.debugbuf.trace_cpu = false;
+			s.reallocate_debug = false;
+			s.cur_ramsize = sramsize;
+			s.cur_romsize = romsize;
 		}
-		instance->set_debug_buffer(debugbuf);
+		s.instance->set_debug_buffer(s.debugbuf);
 #endif
-		sigillcrash = false;
+		s.sigillcrash = false;
 #ifdef GAMBATTE_SUPPORTS_EMU_FLAGS
 		unsigned emuflags = 0;
 		if(settings.count("sigillcrash") && settings["sigillcrash"] == "1")
 			emuflags |= 1;
-		sigillcrash = (emuflags & 1);
-		instance->set_emuflags(emuflags);
+		s.sigillcrash = (emuflags & 1);
+		s.instance->set_emuflags(emuflags);
 #endif
-		rtc_fixed = false;
-		romdata.resize(size);
-		memcpy(&romdata[0], data, size);
-		internal_rom = inttype;
-		do_reset_flag = false;
+		s.rtc_fixed = false;
+		s.romdata.resize(size);
+		memcpy(&s.romdata[0], data, size);
+		s.internal_rom = inttype;
+		s.do_reset_flag = false;
 
 		for(unsigned i = 0; i < 12; i++)
-			if(!palette_colors_default[i >> 2])
-				instance->setDmgPaletteColor(i >> 2, i & 3, palette_colors[i]);
+			if(!s.palette_colors_default[i >> 2])
+				s.instance->setDmgPaletteColor(i >> 2, i & 3, s.palette_colors[i]);
 		//Save initial savestate.
-		instance->saveState(init_savestate);
+		s.instance->saveState(s.init_savestate);
 		return 1;
 	}
 
@@ -425,24 +472,27 @@ namespace
 #ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
 	uint8_t gambatte_bus_read(uint64_t offset)
 	{
-		disable_breakpoints = true;
-		uint8_t val = instance->bus_read(offset);
-		disable_breakpoints = false;
+		auto& s = states();
+		s.disable_breakpoints = true;
+		uint8_t val = s.instance->bus_read(offset);
+		s.disable_breakpoints = false;
 		return val;
 	}
 
 	void gambatte_bus_write(uint64_t offset, uint8_t data)
 	{
-		disable_breakpoints = true;
-		instance->bus_write(offset, data);
-		disable_breakpoints = false;
+		auto& s = states();
+		s.disable_breakpoints = true;
+		s.instance->bus_write(offset, data);
+		s.disable_breakpoints = false;
 	}
 #endif
 
 	std::list<core_vma_info> get_VMAlist()
 	{
+		auto& s = states();
 		std::list<core_vma_info> vmas;
-		if(!internal_rom)
+		if(!s.internal_rom)
 			return vmas;
 		core_vma_info sram;
 		core_vma_info wram;
@@ -451,28 +501,28 @@ namespace
 		core_vma_info rom;
 		core_vma_info bus;
 
-		auto g = instance->getSaveRam();
+		auto g = s.instance->getSaveRam();
 		sram.name = "SRAM";
 		sram.base = 0x20000;
 		sram.size = g.second;
 		sram.backing_ram = g.first;
 		sram.endian = -1;
 
-		auto g2 = instance->getWorkRam();
+		auto g2 = s.instance->getWorkRam();
 		wram.name = "WRAM";
 		wram.base = 0;
 		wram.size = g2.second;
 		wram.backing_ram = g2.first;
 		wram.endian = -1;
 
-		auto g3 = instance->getVideoRam();
+		auto g3 = s.instance->getVideoRam();
 		vram.name = "VRAM";
 		vram.base = 0x10000;
 		vram.size = g3.second;
 		vram.backing_ram = g3.first;
 		vram.endian = -1;
 
-		auto g4 = instance->getIoRam();
+		auto g4 = s.instance->getIoRam();
 		ioamhram.name = "IOAMHRAM";
 		ioamhram.base = 0x18000;
 		ioamhram.size = g4.second;
@@ -481,8 +531,8 @@ namespace
 
 		rom.name = "ROM";
 		rom.base = 0x80000000;
-		rom.size = romdata.size();
-		rom.backing_ram = (void*)&romdata[0];
+		rom.size = s.romdata.size();
+		rom.backing_ram = (void*)&s.romdata[0];
 		rom.endian = -1;
 		rom.readonly = true;
 
@@ -508,10 +558,11 @@ namespace
 
 	std::set<std::string> gambatte_srams()
 	{
+		auto& st = states();
 		std::set<std::string> s;
-		if(!internal_rom)
+		if(!st.internal_rom)
 			return s;
-		auto g = instance->getSaveRam();
+		auto g = st.instance->getSaveRam();
 		if(g.second)
 			s.insert("main");
 		s.insert("rtc");
@@ -520,12 +571,13 @@ namespace
 
 	std::string get_cartridge_name()
 	{
+		auto& s = states();
 		std::ostringstream name;
-		if(romdata.size() < 0x200)
+		if(s.romdata.size() < 0x200)
 			return "";	//Bad.
 		for(unsigned i = 0; i < 16; i++) {
-			if(romdata[0x134 + i])
-				name << (char)romdata[0x134 + i];
+			if(s.romdata[0x134 + i])
+				name << (char)s.romdata[0x134 + i];
 			else
 				break;
 		}
@@ -569,24 +621,26 @@ namespace
 				return std::make_pair(32768, 1);
 		}
 		std::map<std::string, std::vector<char>> c_save_sram() throw(std::bad_alloc) {
+			auto& st = states();
 			std::map<std::string, std::vector<char>> s;
-			if(!internal_rom)
+			if(!st.internal_rom)
 				return s;
-			auto g = instance->getSaveRam();
+			auto g = st.instance->getSaveRam();
 			s["main"].resize(g.second);
 			memcpy(&s["main"][0], g.first, g.second);
 			s["rtc"].resize(8);
-			time_t timebase = instance->getRtcBase();
+			time_t timebase = st.instance->getRtcBase();
 			for(size_t i = 0; i < 8; i++)
 				s["rtc"][i] = ((unsigned long long)timebase >> (8 * i));
 			return s;
 		}
 		void c_load_sram(std::map<std::string, std::vector<char>>& sram) throw(std::bad_alloc) {
-			if(!internal_rom)
+			auto& s = states();
+			if(!s.internal_rom)
 				return;
 			std::vector<char> x = sram.count("main") ? sram["main"] : std::vector<char>();
 			std::vector<char> x2 = sram.count("rtc") ? sram["rtc"] : std::vector<char>();
-			auto g = instance->getSaveRam();
+			auto g = s.instance->getSaveRam();
 			if(x.size()) {
 				if(x.size() != g.second)
 					messages << "WARNING: SRAM 'main': Loaded " << x.size()
@@ -597,36 +651,38 @@ namespace
 				time_t timebase = 0;
 				for(size_t i = 0; i < 8 && i < x2.size(); i++)
 					timebase |= (unsigned long long)(unsigned char)x2[i] << (8 * i);
-				instance->setRtcBase(timebase);
+				s.instance->setRtcBase(timebase);
 			}
 		}
 		void c_serialize(std::vector<char>& out) {
-			if(!internal_rom)
+			auto& s = states();
+			if(!s.internal_rom)
 				throw std::runtime_error("Can't save without ROM");
-			instance->saveState(out);
+			s.instance->saveState(out);
 			size_t osize = out.size();
-			out.resize(osize + 4 * sizeof(primary_framebuffer) / sizeof(primary_framebuffer[0]));
-			for(size_t i = 0; i < sizeof(primary_framebuffer) / sizeof(primary_framebuffer[0]); i++)
-				serialization::u32b(&out[osize + 4 * i], primary_framebuffer[i]);
-			out.push_back(frame_overflow >> 8);
-			out.push_back(frame_overflow);
+			out.resize(osize + 4 * sizeof(s.primary_framebuffer) / sizeof(s.primary_framebuffer[0]));
+			for(size_t i = 0; i < sizeof(s.primary_framebuffer) / sizeof(s.primary_framebuffer[0]); i++)
+				serialization::u32b(&out[osize + 4 * i], s.primary_framebuffer[i]);
+			out.push_back(s.frame_overflow >> 8);
+			out.push_back(s.frame_overflow);
 		}
 		void c_unserialize(const char* in, size_t insize) {
-			if(!internal_rom)
+			auto& s = states();
+			if(!s.internal_rom)
 				throw std::runtime_error("Can't load without ROM");
-			size_t foffset = insize - 2 - 4 * sizeof(primary_framebuffer) /
-				sizeof(primary_framebuffer[0]);
+			size_t foffset = insize - 2 - 4 * sizeof(s.primary_framebuffer) /
+				sizeof(s.primary_framebuffer[0]);
 			std::vector<char> tmp;
 			tmp.resize(foffset);
 			memcpy(&tmp[0], in, foffset);
-			instance->loadState(tmp);
-			for(size_t i = 0; i < sizeof(primary_framebuffer) / sizeof(primary_framebuffer[0]); i++)
-				primary_framebuffer[i] = serialization::u32b(&in[foffset + 4 * i]);
+			s.instance->loadState(tmp);
+			for(size_t i = 0; i < sizeof(s.primary_framebuffer) / sizeof(s.primary_framebuffer[0]); i++)
+				s.primary_framebuffer[i] = serialization::u32b(&in[foffset + 4 * i]);
 
 			unsigned x1 = (unsigned char)in[insize - 2];
 			unsigned x2 = (unsigned char)in[insize - 1];
-			frame_overflow = x1 * 256 + x2;
-			do_reset_flag = false;
+			s.frame_overflow = x1 * 256 + x2;
+			s.do_reset_flag = false;
 		}
 		core_region& c_get_region() { return *this; }
 		void c_power() {}
@@ -637,26 +693,27 @@ namespace
 		void  c_install_handler() { magic_flags |= 2; }
 		void c_uninstall_handler() {}
 		void c_emulate() {
-			if(!internal_rom)
+			auto& s = states();
+			if(!s.internal_rom)
 				return;
 			auto& core = CORE();
 			bool timings_fucked_up = gbchawk_timings(*core.settings);
 			bool native_rate = output_native(*core.settings);
 			int16_t reset = ecore_callbacks->get_input(0, 0, 1);
 			if(reset) {
-				instance->reset();
+				s.instance->reset();
 				messages << "GB(C) reset" << std::endl;
 			}
-			do_reset_flag = false;
+			s.do_reset_flag = false;
 
 			uint32_t samplebuffer[SAMPLES_PER_FRAME + 2064];
 			int16_t soundbuf[2 * (SAMPLES_PER_FRAME + 2064)];
 			size_t emitted = 0;
-			last_tsc_increment = 0;
+			s.last_tsc_increment = 0;
 			while(true) {
 				unsigned samples_emitted = timings_fucked_up ? 35112 :
-					(SAMPLES_PER_FRAME - frame_overflow);
-				long ret = instance->runFor(primary_framebuffer, 160, samplebuffer, samples_emitted);
+					(SAMPLES_PER_FRAME - s.frame_overflow);
+				long ret = s.instance->runFor(s.primary_framebuffer, 160, samplebuffer, samples_emitted);
 				if(native_rate)
 					for(unsigned i = 0; i < samples_emitted; i++) {
 						soundbuf[emitted++] = (int16_t)(samplebuffer[i]);
@@ -666,23 +723,23 @@ namespace
 					for(unsigned i = 0; i < samples_emitted; i++) {
 						uint32_t l = (int32_t)(int16_t)(samplebuffer[i]) + 32768;
 						uint32_t r = (int32_t)(int16_t)(samplebuffer[i] >> 16) + 32768;
-						accumulator_l += l;
-						accumulator_r += r;
-						accumulator_s++;
-						if((accumulator_s & 63) == 0) {
-							int16_t l2 = (accumulator_l >> 6) - 32768;
-							int16_t r2 = (accumulator_r >> 6) - 32768;
+						s.accumulator_l += l;
+						s.accumulator_r += r;
+						s.accumulator_s++;
+						if((s.accumulator_s & 63) == 0) {
+							int16_t l2 = (s.accumulator_l >> 6) - 32768;
+							int16_t r2 = (s.accumulator_r >> 6) - 32768;
 							soundbuf[emitted++] = l2;
 							soundbuf[emitted++] = r2;
-							accumulator_l = accumulator_r = 0;
-							accumulator_s = 0;
+							s.accumulator_l = s.accumulator_r = 0;
+							s.accumulator_s = 0;
 						}
 					}
 				ecore_callbacks->timer_tick(samples_emitted, 2097152);
-				frame_overflow += samples_emitted;
-				last_tsc_increment += samples_emitted;
-				if(frame_overflow >= SAMPLES_PER_FRAME) {
-					frame_overflow -= SAMPLES_PER_FRAME;
+				s.frame_overflow += samples_emitted;
+				s.last_tsc_increment += samples_emitted;
+				if(s.frame_overflow >= SAMPLES_PER_FRAME) {
+					s.frame_overflow -= SAMPLES_PER_FRAME;
 					break;
 				}
 				if(timings_fucked_up)
@@ -690,7 +747,7 @@ namespace
 			}
 			framebuffer::info inf;
 			inf.type = &framebuffer::pixfmt_rgb32;
-			inf.mem = reinterpret_cast<char*>(primary_framebuffer);
+			inf.mem = reinterpret_cast<char*>(s.primary_framebuffer);
 			inf.physwidth = 160;
 			inf.physheight = 144;
 			inf.physstride = 640;
@@ -705,23 +762,24 @@ namespace
 			CORE().audio->submit_buffer(soundbuf, emitted / 2, true, native_rate ? 2097152 : 32768);
 		}
 		void c_runtosave() {}
-		bool c_get_pflag() { return pflag; }
-		void c_set_pflag(bool _pflag) { pflag = _pflag; }
+		bool c_get_pflag() { return states().pflag; }
+		void c_set_pflag(bool _pflag) { states().pflag = _pflag; }
 		framebuffer::raw& c_draw_cover() {
-			static framebuffer::raw x(cover_fbinfo);
 			redraw_cover_fbinfo();
-			return x;
+			return states().cover;
 		}
 		std::string c_get_core_shortname() const { return "gambatte"+gambatte::GB::version(); }
+		bool c_multi_instance() const { return true; }
 		void c_pre_emulate_frame(portctrl::frame& cf) {
-			cf.axis3(0, 0, 1, do_reset_flag ? 1 : 0);
+			cf.axis3(0, 0, 1, states().do_reset_flag ? 1 : 0);
 		}
 		void c_execute_action(unsigned id, const std::vector<interface_action_paramval>& p)
 		{
+			auto& s = states();
 			uint32_t a, b, c, d;
 			switch(id) {
 			case 0:		//Soft reset.
-				do_reset_flag = true;
+				s.do_reset_flag = true;
 				break;
 			case 1:		//Change DMG BG palette.
 			case 2:		//Change DMG SP1 palette.
@@ -730,16 +788,16 @@ namespace
 				b = strtoul(p[1].s.c_str(), NULL, 16);
 				c = strtoul(p[2].s.c_str(), NULL, 16);
 				d = strtoul(p[3].s.c_str(), NULL, 16);
-				palette_colors[4 * (id - 1) + 0] = a;
-				palette_colors[4 * (id - 1) + 1] = b;
-				palette_colors[4 * (id - 1) + 2] = c;
-				palette_colors[4 * (id - 1) + 3] = d;
-				palette_colors_default[id - 1] = false;
-				if(instance) {
-					instance->setDmgPaletteColor(id - 1, 0, a);
-					instance->setDmgPaletteColor(id - 1, 1, b);
-					instance->setDmgPaletteColor(id - 1, 2, c);
-					instance->setDmgPaletteColor(id - 1, 3, d);
+				s.palette_colors[4 * (id - 1) + 0] = a;
+				s.palette_colors[4 * (id - 1) + 1] = b;
+				s.palette_colors[4 * (id - 1) + 2] = c;
+				s.palette_colors[4 * (id - 1) + 3] = d;
+				s.palette_colors_default[id - 1] = false;
+				if(s.instance) {
+					s.instance->setDmgPaletteColor(id - 1, 0, a);
+					s.instance->setDmgPaletteColor(id - 1, 1, b);
+					s.instance->setDmgPaletteColor(id - 1, 2, c);
+					s.instance->setDmgPaletteColor(id - 1, 3, d);
 				}
 			}
 		}
@@ -758,88 +816,91 @@ namespace
 		std::set<std::string> c_srams() { return gambatte_srams(); }
 		void c_set_debug_flags(uint64_t addr, unsigned int sflags, unsigned int cflags)
 		{
+			auto& s = states();
 #ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
-			if(addr == 0 && sflags & 8) debugbuf.trace_cpu = true;
-			if(addr == 0 && cflags & 8) debugbuf.trace_cpu = false;
+			if(addr == 0 && sflags & 8) s.debugbuf.trace_cpu = true;
+			if(addr == 0 && cflags & 8) s.debugbuf.trace_cpu = false;
 			if(addr >= 0 && addr < 32768) {
-				debugbuf.wram[addr] |= (sflags & 7);
-				debugbuf.wram[addr] &= ~(cflags & 7);
-			} else if(addr >= 0x20000 && addr < 0x20000 + instance->getSaveRam().second) {
-				debugbuf.sram[addr - 0x20000] |= (sflags & 7);
-				debugbuf.sram[addr - 0x20000] &= ~(cflags & 7);
+				s.debugbuf.wram[addr] |= (sflags & 7);
+				s.debugbuf.wram[addr] &= ~(cflags & 7);
+			} else if(addr >= 0x20000 && addr < 0x20000 + s.instance->getSaveRam().second) {
+				s.debugbuf.sram[addr - 0x20000] |= (sflags & 7);
+				s.debugbuf.sram[addr - 0x20000] &= ~(cflags & 7);
 			} else if(addr >= 0x18000 && addr < 0x18200) {
-				debugbuf.ioamhram[addr - 0x18000] |= (sflags & 7);
-				debugbuf.ioamhram[addr - 0x18000] &= ~(cflags & 7);
-			} else if(addr >= 0x80000000 && addr < 0x80000000 + romdata.size()) {
-				debugbuf.cart[addr - 0x80000000] |= (sflags & 7);
-				debugbuf.cart[addr - 0x80000000] &= ~(cflags & 7);
+				s.debugbuf.ioamhram[addr - 0x18000] |= (sflags & 7);
+				s.debugbuf.ioamhram[addr - 0x18000] &= ~(cflags & 7);
+			} else if(addr >= 0x80000000 && addr < 0x80000000 + s.romdata.size()) {
+				s.debugbuf.cart[addr - 0x80000000] |= (sflags & 7);
+				s.debugbuf.cart[addr - 0x80000000] &= ~(cflags & 7);
 			} else if(addr >= 0x1000000 && addr < 0x1010000) {
-				debugbuf.bus[addr - 0x1000000] |= (sflags & 7);
-				debugbuf.bus[addr - 0x1000000] &= ~(cflags & 7);
+				s.debugbuf.bus[addr - 0x1000000] |= (sflags & 7);
+				s.debugbuf.bus[addr - 0x1000000] &= ~(cflags & 7);
 			} else if(addr == 0xFFFFFFFFFFFFFFFFULL) {
 				//Set/Clear every known debug.
 				for(unsigned i = 0; i < 32768; i++) {
-					debugbuf.wram[i] |= ((sflags & 7) << 4);
-					debugbuf.wram[i] &= ~((cflags & 7) << 4);
+					s.debugbuf.wram[i] |= ((sflags & 7) << 4);
+					s.debugbuf.wram[i] &= ~((cflags & 7) << 4);
 				}
 				for(unsigned i = 0; i < 65536; i++) {
-					debugbuf.bus[i] |= ((sflags & 7) << 4);
-					debugbuf.bus[i] &= ~((cflags & 7) << 4);
+					s.debugbuf.bus[i] |= ((sflags & 7) << 4);
+					s.debugbuf.bus[i] &= ~((cflags & 7) << 4);
 				}
 				for(unsigned i = 0; i < 512; i++) {
-					debugbuf.ioamhram[i] |= ((sflags & 7) << 4);
-					debugbuf.ioamhram[i] &= ~((cflags & 7) << 4);
+					s.debugbuf.ioamhram[i] |= ((sflags & 7) << 4);
+					s.debugbuf.ioamhram[i] &= ~((cflags & 7) << 4);
 				}
-				for(unsigned i = 0; i < instance->getSaveRam().second; i++) {
-					debugbuf.sram[i] |= ((sflags & 7) << 4);
-					debugbuf.sram[i] &= ~((cflags & 7) << 4);
+				for(unsigned i = 0; i < s.instance->getSaveRam().second; i++) {
+					s.debugbuf.sram[i] |= ((sflags & 7) << 4);
+					s.debugbuf.sram[i] &= ~((cflags & 7) << 4);
 				}
-				for(unsigned i = 0; i < romdata.size(); i++) {
-					debugbuf.cart[i] |= ((sflags & 7) << 4);
-					debugbuf.cart[i] &= ~((cflags & 7) << 4);
+				for(unsigned i = 0; i < s.romdata.size(); i++) {
+					s.debugbuf.cart[i] |= ((sflags & 7) << 4);
+					s.debugbuf.cart[i] &= ~((cflags & 7) << 4);
 				}
 			}
 #endif
 		}
 		void c_set_cheat(uint64_t addr, uint64_t value, bool set)
 		{
+			auto& s = states();
 #ifdef GAMBATTE_SUPPORTS_ADV_DEBUG
 			if(addr >= 0 && addr < 32768) {
 				if(set) {
-					debugbuf.wram[addr] |= 8;
-					debugbuf.wramcheat[addr] = value;
+					s.debugbuf.wram[addr] |= 8;
+					s.debugbuf.wramcheat[addr] = value;
 				} else {
-					debugbuf.wram[addr] &= ~8;
-					debugbuf.wramcheat.erase(addr);
+					s.debugbuf.wram[addr] &= ~8;
+					s.debugbuf.wramcheat.erase(addr);
 				}
-			} else if(addr >= 0x20000 && addr < 0x20000 + instance->getSaveRam().second) {
+			} else if(addr >= 0x20000 && addr < 0x20000 + s.instance->getSaveRam().second) {
 				auto addr2 = addr - 0x20000;
 				if(set) {
-					debugbuf.sram[addr2] |= 8;
-					debugbuf.sramcheat[addr2] = value;
+					s.debugbuf.sram[addr2] |= 8;
+					s.debugbuf.sramcheat[addr2] = value;
 				} else {
-					debugbuf.sram[addr2] &= ~8;
-					debugbuf.sramcheat.erase(addr2);
+					s.debugbuf.sram[addr2] &= ~8;
+					s.debugbuf.sramcheat.erase(addr2);
 				}
-			} else if(addr >= 0x80000000 && addr < 0x80000000 + romdata.size()) {
+			} else if(addr >= 0x80000000 && addr < 0x80000000 + s.romdata.size()) {
 				auto addr2 = addr - 0x80000000;
 				if(set) {
-					debugbuf.cart[addr2] |= 8;
-					debugbuf.cartcheat[addr2] = value;
+					s.debugbuf.cart[addr2] |= 8;
+					s.debugbuf.cartcheat[addr2] = value;
 				} else {
-					debugbuf.cart[addr2] &= ~8;
-					debugbuf.cartcheat.erase(addr2);
+					s.debugbuf.cart[addr2] &= ~8;
+					s.debugbuf.cartcheat.erase(addr2);
 				}
 			}
 #endif
 		}
 		void c_debug_reset()
 		{
+			auto& s = states();
 			//Next load will reset trace.
-			reallocate_debug = true;
-			palette_colors_default[0] = true;
-			palette_colors_default[1] = true;
-			palette_colors_default[2] = true;
+			s.reallocate_debug = true;
+			s.palette_colors_default[0] = true;
+			s.palette_colors_default[1] = true;
+			s.palette_colors_default[2] = true;
 		}
 		std::vector<std::string> c_get_trace_cpus()
 		{
@@ -849,10 +910,11 @@ namespace
 		}
 		void c_reset_to_load()
 		{
-			instance->loadState(init_savestate);
-			memset(primary_framebuffer, 0, sizeof(primary_framebuffer));
-			frame_overflow = 0;	//frame_overflow is always 0 at the beginning.
-			do_reset_flag = false;
+			auto& s = states();
+			s.instance->loadState(s.init_savestate);
+			memset(s.primary_framebuffer, 0, sizeof(s.primary_framebuffer));
+			s.frame_overflow = 0;	//s.frame_overflow is always 0 at the beginning.
+			s.do_reset_flag = false;
 		}
 	} gambatte_core;
 
@@ -946,44 +1008,46 @@ namespace
 
 	void redraw_cover_fbinfo()
 	{
-		for(size_t i = 0; i < sizeof(cover_fbmem) / sizeof(cover_fbmem[0]); i++)
-			cover_fbmem[i] = 0x00000000;
+		auto& s = states();
+		for(size_t i = 0; i < sizeof(s.cover_fbmem) / sizeof(s.cover_fbmem[0]); i++)
+			s.cover_fbmem[i] = 0x00000000;
 		std::string ident = gambatte_core.get_core_identifier();
-		cover_render_string(cover_fbmem, 0, 0, ident, 0xFFFFFF, 0x00000, 480, 432, 1920, 4);
-		cover_render_string(cover_fbmem, 0, 16, "Internal ROM name: " + get_cartridge_name(),
+		cover_render_string(s.cover_fbmem, 0, 0, ident, 0xFFFFFF, 0x00000, 480, 432, 1920, 4);
+		cover_render_string(s.cover_fbmem, 0, 16, "Internal ROM name: " + get_cartridge_name(),
 			0xFFFFFF, 0x00000, 480, 432, 1920, 4);
 		unsigned y = 32;
 		for(auto i : cover_information()) {
-			cover_render_string(cover_fbmem, 0, y, i, 0xFFFFFF, 0x000000, 480, 432, 1920, 4);
+			cover_render_string(s.cover_fbmem, 0, y, i, 0xFFFFFF, 0x000000, 480, 432, 1920, 4);
 			y += 16;
 		}
-		if(sigillcrash) {
-			cover_render_string(cover_fbmem, 0, y, "Crash on SIGILL enabled", 0xFFFFFF, 0x000000, 480,
+		if(s.sigillcrash) {
+			cover_render_string(s.cover_fbmem, 0, y, "Crash on SIGILL enabled", 0xFFFFFF, 0x000000, 480,
 				432, 1920, 4);
 			y += 16;
 		}
 	}
 
-	std::vector<char> cmp_save;
-
 	command::fnptr<> cmp_save1(lsnes_cmds, "set-cmp-save", "", "\n", []() throw(std::bad_alloc,
 		std::runtime_error) {
-		if(!internal_rom)
+		auto& s = states();
+		if(!s.internal_rom)
 			return;
-		instance->saveState(cmp_save);
+		s.instance->saveState(s.cmp_save);
 	});
 
 	command::fnptr<> cmp_save2(lsnes_cmds, "do-cmp-save", "", "\n", []() throw(std::bad_alloc,
 		std::runtime_error) {
+		auto& s = states();
 		std::vector<char> x;
-		if(!internal_rom)
+		if(!s.internal_rom)
 			return;
-		instance->saveState(x, cmp_save);
+		s.instance->saveState(x, s.cmp_save);
 	});
 
 	int last_frame_cycles(lua::state& L, lua::parameters& P)
 	{
-		L.pushnumber(last_tsc_increment);
+		auto& s = states();
+		L.pushnumber(s.last_tsc_increment);
 		return 1;
 	}
 
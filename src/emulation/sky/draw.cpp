@@ -252,13 +252,7 @@ namespace sky
 			}
 			xstart = max(xstart, 0);
 			xend = min(xend, FB_WIDTH);
-			size_t base = FB_WIDTH * j;
-			if(j < inst.overlap_start)
-				for(signed i = xstart; i < xend; i++)
-					inst.framebuffer[base + i] = color;
-			else
-				for(signed i = xstart; i < xend; i++)
-					framebuffer_blend2(inst.framebuffer[base + i], color);
+			render_span(inst, j, xstart, xend, color);
 		}
 	}
 
@@ -274,13 +268,7 @@ namespace sky
 			xend = ceil((p4.x - p2.x) * (j - p1.y) / (p3.y - p1.y) + p2.x);
 			xstart = max(xstart, 0);
 			xend = min(xend, FB_WIDTH);
-			size_t base = FB_WIDTH * j;
-			if(j < inst.overlap_start)
-				for(signed i = xstart; i < xend; i++)
-					inst.framebuffer[base + i] = color;
-			else
-				for(signed i = xstart; i < xend; i++)
-					framebuffer_blend2(inst.framebuffer[base + i], color);
+			render_span(inst, j, xstart, xend, color);
 		}
 	}
 
@@ -292,15 +280,8 @@ namespace sky
 		signed x2 = min((int)ceil(p2.x), FB_WIDTH);
 		signed y1 = max((int)floor(p1.y), 0);
 		signed y2 = min((int)ceil(p3.y), (int)inst.overlap_end);
-		for(signed j = y1; j < y2; j++) {
-			size_t base = FB_WIDTH * j;
-			if(j < inst.overlap_start)
-				for(signed i = x1; i < x2; i++)
-					inst.framebuffer[base + i] = color;
-			else
-				for(signed i = x1; i < x2; i++)
-					framebuffer_blend2(inst.framebuffer[base + i], color);
-		}
+		for(signed j = y1; j < y2; j++)
+			render_span(inst, j, x1, x2, color);
 	}
 
 	void draw_quad_z_tunshadow(struct instance& inst, point_t p1, point_t p2, point_t p3, point_t p4,
@@ -320,7 +301,6 @@ namespace sky
 		const double center = (p1.x + p2.x) / 2;
 		for(signed j = y1; j < y2; j++) {
 			signed c1 = x2, c2 = x1;
-			size_t base = FB_WIDTH * j;
 			double ry = (p3.y - j) / (0.625 * vscale / hscale * 2 * hwidth);
 			if(ry < 1) {
 				c1 = center - hwidth * sqrt(1 - ry * ry);
@@ -335,12 +315,7 @@ namespace sky
 			}
 			c1 = max(c1, 0);
 			c2 = min(c2, FB_WIDTH);
-			if(j < inst.overlap_start)
-				for(signed i = c1; i < c2; i++)
-					inst.framebuffer[base + i] = color;
-			else
-				for(signed i = c1; i < c2; i++)
-					framebuffer_blend2(inst.framebuffer[base + i], color);
+			render_span(inst, j, c1, c2, color);
 		}
 	}
 
@@ -357,7 +332,6 @@ namespace sky
 		const double center = (p1.x + p2.x) / 2;
 		for(signed j = y1; j < y2; j++) {
 			signed c1 = x2, c2 = x2;
-			size_t base = FB_WIDTH * j;
 			double ry = (p3.y - j) / (0.625 * vscale / hscale * 2 * hwidth);
 			if(ry < 1) {
 				c1 = center - hwidth * sqrt(1 - ry * ry);
@@ -367,17 +341,8 @@ namespace sky
 			c2 = max(c2, 0);
 			x2 = min(x2, FB_WIDTH);
 			c1 = min(c1, FB_WIDTH);
-			if(j < inst.overlap_start) {
-				for(signed i = x1; i < c1; i++)
-					inst.framebuffer[base + i] = color;
-				for(signed i = c2; i < x2; i++)
-					inst.framebuffer[base + i] = color;
-			} else {
-				for(signed i = x1; i < c1; i++)
-					framebuffer_blend2(inst.framebuffer[base + i], color);
-				for(signed i = c2; i < x2; i++)
-					framebuffer_blend2(inst.framebuffer[base + i], color);
-			}
+			render_span(inst, j, x1, c1, color);
+			render_span(inst, j, c2, x2, color);
 		}
 	}
 
@@ -423,17 +388,9 @@ namespace sky
 			}
 			dstart = max(cstart, (int16_t)0);
 			dend = min(cend, (int16_t)FB_WIDTH);
-			size_t base = FB_WIDTH * j;
-			if(j < inst.overlap_start)
-				for(signed i = dstart; i < dend; i++) {
-					if(i < cistart || i >= ciend)
-						inst.framebuffer[base + i] = color;
-				}
-			else
-				for(signed i = dstart; i < dend; i++) {
-					if(i < cistart || i >= ciend)
-						framebuffer_blend2(inst.framebuffer[base + i], color);
-				}
+			//Span with the inner circle cut out.
+			render_span(inst, j, dstart, min(dend, cistart), color);
+			render_span(inst, j, max(dstart, ciend), dend, color);
 		}
 	}
 
@@ -577,18 +534,7 @@ namespace sky
 			dend = min(min(dend, nxe), (int16_t)FB_WIDTH);
 			if(dstart > nxs)
 				color += (dstart - nxs) * cstep;
-			size_t base = FB_WIDTH * j;
-			if(j < inst.overlap_start)
-				for(signed i = dstart; i < dend; i++) {
-					inst.framebuffer[base + i] = fcolor | p.colors[color >> 16];
-					color += cstep;
-				}
-			else
-				for(signed i = dstart; i < dend; i++) {
-					framebuffer_blend2(inst.framebuffer[base + i], fcolor |
-						p.colors[color >> 16]);
-					color += cstep;
-				}
+			render_span_gradient(inst, j, dstart, dend, p.colors, fcolor, color, cstep);
 		}
 	}
 
@@ -669,20 +615,11 @@ namespace sky
 			dend = min(min(dend, nxe), (int16_t)FB_WIDTH);
 			if(dstart > nxs)
 				color += (dstart - nxs) * cstep;
-			size_t base = FB_WIDTH * j;
-			if(j < inst.overlap_start)
-				for(signed i = dstart; i < dend; i++) {
-					if(i < cstart || i >= cend)
-						inst.framebuffer[base + i] = fcolor | p.colors[color >> 16];
-					color += cstep;
-				}
-			else
-				for(signed i = dstart; i < dend; i++) {
-					if(i < cstart || i >= cend)
-						framebuffer_blend2(inst.framebuffer[base + i], fcolor |
-							p.colors[color >> 16]);
-					color += cstep;
-				}
+			//Span with the pipe front cut out. Gradient continues over the cut.
+			signed split = max((signed)dstart, (signed)cend);
+			render_span_gradient(inst, j, dstart, min(dend, cstart), p.colors, fcolor, color, cstep);
+			render_span_gradient(inst, j, split, dend, p.colors, fcolor, color + (split - dstart) * cstep,
+				cstep);
 		}
 	}
 
@@ -738,30 +675,14 @@ namespace sky
 			dend = min(min(dend, nxe), (int16_t)FB_WIDTH);
 			if(dstart > nxs)
 				color += (dstart - nxs) * cstep;
-			size_t base = FB_WIDTH * j;
-			if(j < inst.overlap_start)
-				for(signed i = dstart; i < dend; i++) {
-					inst.framebuffer[base + i] = fcolor | p.colors[color >> 16];
-					color += cstep;
-				}
-			else
-				for(signed i = dstart; i < dend; i++) {
-					framebuffer_blend2(inst.framebuffer[base + i], fcolor | p.colors[color >> 16]);
-					color += cstep;
-				}
+			render_span_gradient(inst, j, dstart, dend, p.colors, fcolor, color, cstep);
 		}
 	}
 
-	void draw_level(struct instance& inst)
+	void render_level(struct instance& inst, int32_t sprite)
 	{
-		for(unsigned i = 0; i < inst.overlap_start; i++)
-			for(unsigned j = 0; j < FB_WIDTH; j++)
-				inst.framebuffer[i * FB_WIDTH + j] = inst.origbuffer[(i / FB_SCALE) * 320 +
-					(j / FB_SCALE)];
-		for(unsigned i = inst.overlap_start; i < inst.overlap_end; i++)
-			for(unsigned j = 0; j < FB_WIDTH; j++)
-				framebuffer_blend2(inst.framebuffer[i * FB_WIDTH + j], inst.origbuffer[
-				(i / FB_SCALE) * 320 + (j / FB_SCALE)]);
+		inst.level_skipped = false;
+		render_backdrop(inst);
 		static const signed dorder[] = {-3, 3, -2, 2, -1, 1, 0};
 		level& l = inst.state.curlevel;
 		double zship = inst.state.p.lpos / 65536.0;
@@ -903,7 +824,29 @@ namespace sky
 			}
 		}
 		draw_sprite(inst, (inst.state.p.hpos - 32768.0) / 5888.0, (inst.state.p.vpos - 10240.0) / 2560.0,
-			ship_sprite(inst.state));
+			sprite);
+	}
+
+	void draw_level(struct instance& inst, bool skip)
+	{
+		//Choosing the sprite advances the RNG, so it has to be done even if nothing is drawn.
+		int32_t sprite = ship_sprite(inst.state);
+		if(skip) {
+			inst.level_skipped = true;
+			inst.skipped_sprite = sprite;
+			return;
+		}
+		render_level(inst, sprite);
+	}
+
+	void draw_skipped_level(struct instance& inst)
+	{
+		if(!inst.level_skipped)
+			return;
+		render_level(inst, inst.skipped_sprite);
+		//Time is drawn over the level.
+		if(inst.state.timeattack)
+			draw_timeattack_time(inst, inst.state.waited);
 	}
 
 	const char* const period = "%&(ccK";
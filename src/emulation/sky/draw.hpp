@@ -7,7 +7,10 @@ namespace sky
 {
 	void draw_grav_g_meter(struct instance& s);
 	void draw_gauges(struct instance& s);
-	void draw_level(struct instance& inst);
+	//Draw the level. If skip is set, only update the state as drawing would, and leave framebuffer stale.
+	void draw_level(struct instance& inst, bool skip = false);
+	//Draw the level skipped by last draw_level(), if any. The game state must not have changed since.
+	void draw_skipped_level(struct instance& inst);
 	void rebuild_pipe_quad_caches(struct instance& inst, uint32_t color1, uint32_t color2, uint32_t color3,
 		uint32_t color4);
 	void draw_timeattack_time(struct instance& inst, uint16_t frames);
@@ -1,7 +1,11 @@
 #include "framebuffer.hpp"
 #include "instance.hpp"
+#include "library/minmax.hpp"
 #include <cstring>
 #include <iostream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace sky
 {
@@ -179,4 +183,103 @@ namespace sky
 			for(unsigned i = 0; i < bitmap[0]; i++)
 				inst.framebuffer[(y + j) * FB_WIDTH + (x + i)] = bitmap[j * bitmap[0] + i + 2];
 	}
+
+	namespace
+	{
+		//Set n pixels to color.
+		void fill_pixels(uint32_t* p, size_t n, uint32_t color)
+		{
+			size_t i = 0;
+#ifdef __SSE2__
+			__m128i c = _mm_set1_epi32(color);
+			for(; i + 4 <= n; i += 4)
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), c);
+#endif
+			for(; i < n; i++)
+				p[i] = color;
+		}
+
+		//framebuffer_blend2() n pixels with color.
+		void blend_pixels(uint32_t* p, size_t n, uint32_t color)
+		{
+			size_t i = 0;
+#ifdef __SSE2__
+			__m128i c = _mm_set1_epi32(color & 0x01FFFFFFU);
+			for(; i + 4 <= n; i += 4) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + i));
+				//All ones where the top bit is set (pixel is kept).
+				__m128i keep = _mm_srai_epi32(x, 31);
+				x = _mm_or_si128(_mm_and_si128(keep, x), _mm_andnot_si128(keep, c));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), x);
+			}
+#endif
+			for(; i < n; i++)
+				framebuffer_blend2(p[i], color);
+		}
+
+		//framebuffer_blend2() n pixels with corresponding pixels of src.
+		void blend_pixels(uint32_t* p, const uint32_t* src, size_t n)
+		{
+			size_t i = 0;
+#ifdef __SSE2__
+			__m128i m = _mm_set1_epi32(0x01FFFFFFU);
+			for(; i + 4 <= n; i += 4) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + i));
+				__m128i c = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), m);
+				__m128i keep = _mm_srai_epi32(x, 31);
+				x = _mm_or_si128(_mm_and_si128(keep, x), _mm_andnot_si128(keep, c));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), x);
+			}
+#endif
+			for(; i < n; i++)
+				framebuffer_blend2(p[i], src[i]);
+		}
+	}
+
+	void render_backdrop(struct instance& inst)
+	{
+		//Each origbuffer row is expanded once and reused for FB_SCALE framebuffer rows.
+		uint32_t row[FB_WIDTH];
+		unsigned lastsrc = 200;
+		unsigned rows = max(inst.overlap_start, inst.overlap_end);
+		for(unsigned i = 0; i < rows; i++) {
+			unsigned src = i / FB_SCALE;
+			if(src != lastsrc) {
+				for(unsigned j = 0; j < 320; j++)
+					for(unsigned k = 0; k < FB_SCALE; k++)
+						row[FB_SCALE * j + k] = inst.origbuffer[320 * src + j];
+				lastsrc = src;
+			}
+			if(i < inst.overlap_start)
+				memcpy(inst.framebuffer + i * FB_WIDTH, row, sizeof(row));
+			else
+				blend_pixels(inst.framebuffer + i * FB_WIDTH, row, FB_WIDTH);
+		}
+	}
+
+	void render_span(struct instance& inst, signed y, signed x1, signed x2, uint32_t color)
+	{
+		if(x2 <= x1)
+			return;
+		if(y < inst.overlap_start)
+			fill_pixels(inst.framebuffer + FB_WIDTH * y + x1, x2 - x1, color);
+		else
+			blend_pixels(inst.framebuffer + FB_WIDTH * y + x1, x2 - x1, color);
+	}
+
+	void render_span_gradient(struct instance& inst, signed y, signed x1, signed x2, const uint32_t* colors,
+		uint32_t fcolor, uint32_t cidx, uint32_t cstep)
+	{
+		uint32_t* p = inst.framebuffer + FB_WIDTH * y;
+		if(y < inst.overlap_start)
+			for(signed i = x1; i < x2; i++) {
+				p[i] = fcolor | colors[cidx >> 16];
+				cidx += cstep;
+			}
+		else
+			for(signed i = x1; i < x2; i++) {
+				framebuffer_blend2(p[i], fcolor | colors[cidx >> 16]);
+				cidx += cstep;
+			}
+	}
 }
@@ -41,6 +41,13 @@ namespace sky
 		uint32_t c2);
 	//Draw a bitmap at full resolution.
 	void draw_bitmap(struct instance& inst, const uint32_t* bitmap, unsigned x, unsigned y);
+	//Render the level backdrop (rows above overlap end) from origbuffer into framebuffer.
+	void render_backdrop(struct instance& inst);
+	//Fill pixels x1 <= x < x2 of framebuffer row y with color, blending in overlap region.
+	void render_span(struct instance& inst, signed y, signed x1, signed x2, uint32_t color);
+	//Like render_span, but color of each pixel is fcolor | colors[cidx >> 16], cidx advancing by cstep per pixel.
+	void render_span_gradient(struct instance& inst, signed y, signed x1, signed x2, const uint32_t* colors,
+		uint32_t fcolor, uint32_t cidx, uint32_t cstep);
 }
 
 #endif
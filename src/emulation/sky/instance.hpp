@@ -31,6 +31,9 @@ namespace sky
 			mplayer(state.music, state.rng)
 		{
 			memset(samplectr, 0, sizeof(samplectr));
+			skip_render = false;
+			level_skipped = false;
+			skipped_sprite = -1;
 		}
 		gstate state;
 		song_buffer* bsong;
@@ -57,6 +60,11 @@ namespace sky
 		uint16_t overlap_start;
 		uint16_t overlap_end;
 		uint32_t samplectr[4];
+		//Frames are not going to be displayed, so rendering the level can be skipped.
+		bool skip_render;
+		//Last frame of level was not rendered, and sprite it would have had.
+		bool level_skipped;
+		int32_t skipped_sprite;
 		uint32_t* get_framebuffer()
 		{
 			return indirect_flag ? fadeffect_buffer : framebuffer;
@@ -302,13 +302,18 @@ namespace sky
 		//Handle demo.
 		b = inst.state.curdemo.fetchkeys(b, inst.state.p.lpos, inst.state.p.framecounter);
 		if((b & 96) == 96) {
+			//Fadeout starts from the last frame, so that must be there.
+			draw_skipped_level(inst);
 			inst.state.p.death = physics::death_escaped;
 			return state_level_fadeout;
 		}
 		if((b & ~inst.state.lastkeys) & 32)
 			inst.state.paused = inst.state.paused ? 0 : 1;
-		if(inst.state.paused)
+		if(inst.state.paused) {
+			//Paused frame shows the last frame.
+			draw_skipped_level(inst);
 			return state_level_play;
+		}
 		int lr = 0, ad = 0;
 		bool jump = ((b & 16) != 0);
 		if((b & 1) != 0) lr--;
@@ -320,7 +325,8 @@ namespace sky
 		uint8_t death = inst.state.simulate_frame(inst.gsfx, lr, ad, jump);
 		if(!inst.state.p.death && inst.state.waited < 65535)
 			inst.state.waited++;
-		draw_level(inst);
+		//If level ends, the following fadeout needs this frame.
+		draw_level(inst, inst.skip_render && !death);
 		if(inst.state.timeattack)
 			draw_timeattack_time(inst, inst.state.waited);
 		draw_gauges(inst);
@@ -464,6 +470,7 @@ namespace sky
 
 	void handle_loadstate(struct instance& inst)
 	{
+		inst.level_skipped = false;
 		messages << "Loadstate status: " << (int)inst.state.state << std::endl;
 		if(inst.state.state > state_lockup) {
 			messages << "Invalid state in loadstate: " << (int)inst.state.state << std::endl;
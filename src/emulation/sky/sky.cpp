@@ -7,6 +7,7 @@
 #include "core/dispatch.hpp"
 #include "core/audioapi.hpp"
 #include "core/instance.hpp"
+#include "core/instance-map.hpp"
 #include "core/messages.hpp"
 #include "interface/romtype.hpp"
 #include "interface/callbacks.hpp"
@@ -14,7 +15,6 @@
 
 namespace sky
 {
-	bool pflag;
 	int cstyle = 0;
 	const unsigned iindexes[3][7] = {
 		{0, 1, 2, 3, 4, 5, 6},
@@ -36,7 +36,19 @@ namespace sky
 		0, 0				//Offset.
 	};
 
-	struct instance corei;
+	//Game state is per emulator instance, so several instances can run at once.
+	struct core_state
+	{
+		core_state() : pflag(false) {}
+		struct instance corei;
+		bool pflag;
+	};
+	instance_state<core_state> states;
+
+	struct instance& corei()
+	{
+		return states().corei;
+	}
 
 	portctrl::controller X4 = {"(system)", "(system)", {
 		{portctrl::button::TYPE_BUTTON, 'F', "framesync", true}
@@ -270,27 +282,27 @@ namespace sky
 			std::map<std::string, std::vector<char>> r;
 			std::vector<char> sram;
 			sram.resize(32);
-			memcpy(&sram[0], corei.state.sram, 32);
+			memcpy(&sram[0], corei().state.sram, 32);
 			r["sram"] = sram;
 			return r;
 		}
 		void c_load_sram(std::map<std::string, std::vector<char>>& sram) throw(std::bad_alloc) {
 			if(sram.count("sram") && sram["sram"].size() == 32)
-				memcpy(corei.state.sram, &sram["sram"][0], 32);
+				memcpy(corei().state.sram, &sram["sram"][0], 32);
 			else
-				memset(corei.state.sram, 0, 32);
+				memset(corei().state.sram, 0, 32);
 		}
 		void c_serialize(std::vector<char>& out) {
-			auto wram = corei.state.as_ram();
+			auto wram = corei().state.as_ram();
 			out.resize(wram.second);
 			memcpy(&out[0], wram.first, wram.second);
 		}
 		void c_unserialize(const char* in, size_t insize) {
-			auto wram = corei.state.as_ram();
+			auto wram = corei().state.as_ram();
 			if(insize != wram.second)
 				throw std::runtime_error("Save is of wrong size");
 			memcpy(wram.first, in, wram.second);
-			handle_loadstate(corei);
+			handle_loadstate(corei());
 		}
 		core_region& c_get_region() { return *this; }
 		void c_power() {}
@@ -302,14 +314,14 @@ namespace sky
 		void c_uninstall_handler() {}
 		void c_emulate() {
 			uint16_t x = 0;
-			if(simulate_needs_input(corei)) {
+			if(simulate_needs_input(corei())) {
 				for(unsigned i = 0; i < 7; i++)
 					if(ecore_callbacks->get_input(0, 1, iindexes[cstyle][i]))
 						x |= (1 << i);
-				pflag = true;
+				states().pflag = true;
 			}
-			simulate_frame(corei, x);
-			uint32_t* fb = corei.get_framebuffer();
+			simulate_frame(corei(), x);
+			uint32_t* fb = corei().get_framebuffer();
 			framebuffer::info inf;
 			inf.type = &framebuffer::pixfmt_rgb32;
 			inf.mem = reinterpret_cast<char*>(fb);
@@ -326,19 +338,21 @@ namespace sky
 			ecore_callbacks->output_frame(ls, 656250, 18227);
 			ecore_callbacks->timer_tick(18227, 656250);
 			size_t samples = 1333;
-			samples += corei.extrasamples();
+			samples += corei().extrasamples();
 			int16_t sbuf[2668];
-			fetch_sfx(corei, sbuf, samples);
+			fetch_sfx(corei(), sbuf, samples);
 			CORE().audio->submit_buffer(sbuf, samples, true, 48000);
 		}
 		void c_runtosave() {}
-		bool c_get_pflag() { return pflag; }
-		void c_set_pflag(bool _pflag) { pflag = _pflag; }
+		bool c_get_pflag() { return states().pflag; }
+		void c_set_pflag(bool _pflag) { states().pflag = _pflag; }
 		framebuffer::raw& c_draw_cover() {
 			static framebuffer::raw x(cover_fbinfo);
 			return x;
 		}
 		std::string c_get_core_shortname() const { return "sky"; }
+		bool c_multi_instance() const { return true; }
+		void c_set_render_skip(bool skip) { corei().skip_render = skip; }
 		void c_pre_emulate_frame(portctrl::frame& cf) {}
 		void c_execute_action(unsigned id, const std::vector<interface_action_paramval>& p) {}
 		const interface_device_reg* c_get_registers() { return sky_registers; }
@@ -350,14 +364,14 @@ namespace sky
 			size_t size = images[0].size;
 			std::string filename(_filename, _filename + size);
 			try {
-				load_rom(corei, filename);
+				load_rom(corei(), filename);
 			} catch(std::exception& e) {
 				messages << e.what();
 				return -1;
 			}
 			//Clear the RAM.
-			memset(corei.state.as_ram().first, 0, corei.state.as_ram().second);
-			rom_boot_vector(corei);
+			memset(corei().state.as_ram().first, 0, corei().state.as_ram().second);
+			rom_boot_vector(corei());
 			return 0;
 		}
 		controller_set t_controllerconfig(std::map<std::string, std::string>& settings)
@@ -374,7 +388,7 @@ namespace sky
 			std::list<core_vma_info> r;
 			core_vma_info ram;
 			ram.name = "RAM";
-			ram.backing_ram = corei.state.as_ram().first;
+			ram.backing_ram = corei().state.as_ram().first;
 			ram.size = 131072;
 			ram.base = 0;
 			ram.endian = 0;
@@ -382,17 +396,17 @@ namespace sky
 			r.push_back(ram);
 			core_vma_info wram;
 			wram.name = "WRAM";
-			wram.backing_ram = corei.state.as_ram().first + 131072;
-			wram.size = corei.state.as_ram().second - 131072 - 32;
+			wram.backing_ram = corei().state.as_ram().first + 131072;
+			wram.size = corei().state.as_ram().second - 131072 - 32;
 			wram.base = 131072;
 			wram.endian = 0;
 			wram.volatile_flag = true;
 			r.push_back(wram);
 			core_vma_info sram;
 			sram.name = "SRAM";
-			sram.backing_ram = corei.state.as_ram().first + corei.state.as_ram().second - 32;
+			sram.backing_ram = corei().state.as_ram().first + corei().state.as_ram().second - 32;
 			sram.size = 32;
-			sram.base = corei.state.as_ram().second - 32;
+			sram.base = corei().state.as_ram().second - 32;
 			sram.endian = 0;
 			sram.volatile_flag = false;
 			r.push_back(sram);
@@ -423,8 +437,8 @@ namespace sky
 		void c_reset_to_load()
 		{
 			//Clear the RAM and jump to boot vector.
-			memset(corei.state.as_ram().first, 0, corei.state.as_ram().second);
-			rom_boot_vector(corei);
+			memset(corei().state.as_ram().first, 0, corei().state.as_ram().second);
+			rom_boot_vector(corei());
 		}
 	} sky_core;
 }
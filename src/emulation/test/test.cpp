@@ -16,6 +16,7 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include "lsnes.hpp"
+#include <cstring>
 #include <sstream>
 #include <iostream>
 #include <map>
@@ -28,6 +29,7 @@
 #include "core/dispatch.hpp"
 #include "core/framebuffer.hpp"
 #include "core/instance.hpp"
+#include "core/instance-map.hpp"
 #include "core/messages.hpp"
 #include "interface/callbacks.hpp"
 #include "interface/cover.hpp"
@@ -42,17 +44,30 @@
 
 namespace
 {
-	uint32_t cover_fbmem[480 * 432];
-	bool pflag = false;
-
 	//Framebuffer.
-	struct framebuffer::info cover_fbinfo = {
-		&framebuffer::pixfmt_rgb32,		//Format.
-		(char*)cover_fbmem,		//Memory.
-		480, 432, 1920,			//Physical size.
-		480, 432, 1920,			//Logical size.
-		0, 0				//Offset.
+	struct framebuffer::info cover_fbinfo(uint32_t* mem)
+	{
+		struct framebuffer::info inf = {
+			&framebuffer::pixfmt_rgb32,	//Format.
+			(char*)mem,			//Memory.
+			480, 432, 1920,			//Physical size.
+			480, 432, 1920,			//Logical size.
+			0, 0				//Offset.
+		};
+		return inf;
+	}
+
+	//State is per emulator instance, so several instances can run at once.
+	struct core_state
+	{
+		core_state() : pflag(false), cover(cover_fbinfo(cover_fbmem)) { memset(ram, 0, sizeof(ram)); }
+		uint32_t cover_fbmem[480 * 432];
+		bool pflag;
+		framebuffer::raw cover;
+		//Position (signed 16-bit little-endian), moved by left/right and doubled by A each frame.
+		unsigned char ram[2];
 	};
+	instance_state<core_state> states;
 
 	struct interface_device_reg test_registers[] = {
 		{NULL, NULL, NULL}
@@ -74,14 +89,34 @@ namespace
 
 	void redraw_cover_fbinfo()
 	{
-		for(size_t i = 0; i < sizeof(cover_fbmem) / sizeof(cover_fbmem[0]); i++)
+		uint32_t* cover_fbmem = states().cover_fbmem;
+		for(size_t i = 0; i < 480 * 432; i++)
 			cover_fbmem[i] = 0x00000000;
 		cover_render_string(cover_fbmem, 0, 0, "TEST MODE", 0xFFFFFF, 0x00000, 480, 432, 1920, 4);
 	}
 
+	//Button indices on test controllers.
+	const unsigned button_A = 6;
+	const unsigned button_left = 17;
+	const unsigned button_right = 18;
+
+	void update_position()
+	{
+		unsigned char* ram = states().ram;
+		int16_t x = serialization::s16l(ram);
+		if(ecore_callbacks->get_input(1, 0, button_left))
+			x--;
+		if(ecore_callbacks->get_input(1, 0, button_right))
+			x++;
+		if(ecore_callbacks->get_input(1, 0, button_A))
+			x *= 2;
+		serialization::s16l(ram, x);
+	}
+
 	void redraw_screen()
 	{
-		for(size_t i = 0; i < sizeof(cover_fbmem) / sizeof(cover_fbmem[0]); i++)
+		uint32_t* cover_fbmem = states().cover_fbmem;
+		for(size_t i = 0; i < 480 * 432; i++)
 			cover_fbmem[i] = 0x00000000;
 		{
 			std::ostringstream str;
@@ -137,10 +172,20 @@ namespace
 			return s;
 		}
 		void c_load_sram(std::map<std::string, std::vector<char>>& sram) throw(std::bad_alloc) {}
-		void c_serialize(std::vector<char>& out) { out.clear(); }
-		void c_unserialize(const char* in, size_t insize) {}
+		void c_serialize(std::vector<char>& out) {
+			unsigned char* ram = states().ram;
+			out.assign(ram, ram + sizeof(states().ram));
+		}
+		void c_unserialize(const char* in, size_t insize) {
+			//Old saves have no state.
+			if(insize && insize != sizeof(states().ram))
+				throw std::runtime_error("Save is of wrong size");
+			memset(states().ram, 0, sizeof(states().ram));
+			if(insize)
+				memcpy(states().ram, in, insize);
+		}
 		core_region& c_get_region() { return *this; }
-		void c_power() {}
+		void c_power() { memset(states().ram, 0, sizeof(states().ram)); }
 		void c_unload_cartridge() {}
 		std::pair<uint32_t, uint32_t> c_get_scale_factors(uint32_t width, uint32_t height) {
 			return std::make_pair(max(512 / width, (uint32_t)1), max(448 / height, (uint32_t)1));
@@ -149,11 +194,12 @@ namespace
 		void c_uninstall_handler() {}
 		void c_emulate() {
 			int16_t audio[800] = {0};
-			pflag = false;
+			states().pflag = false;
+			update_position();
 			redraw_screen();
 			framebuffer::info inf;
 			inf.type = &framebuffer::pixfmt_rgb32;
-			inf.mem = reinterpret_cast<char*>(cover_fbmem);
+			inf.mem = reinterpret_cast<char*>(states().cover_fbmem);
 			inf.physwidth = 480;
 			inf.physheight = 432;
 			inf.physstride = 1920;
@@ -167,14 +213,14 @@ namespace
 			CORE().audio->submit_buffer(audio, 800, false, 48000);
 		}
 		void c_runtosave() {}
-		bool c_get_pflag() { return pflag; }
-		void c_set_pflag(bool _pflag) { pflag = _pflag; }
+		bool c_get_pflag() { return states().pflag; }
+		void c_set_pflag(bool _pflag) { states().pflag = _pflag; }
 		framebuffer::raw& c_draw_cover() {
-			static framebuffer::raw x(cover_fbinfo);
 			redraw_cover_fbinfo();
-			return x;
+			return states().cover;
 		}
 		std::string c_get_core_shortname() const { return "test"; }
+		bool c_multi_instance() const { return true; }
 		void c_pre_emulate_frame(portctrl::frame& cf) {}
 		void c_execute_action(unsigned id, const std::vector<interface_action_paramval>& p)
 		{
@@ -185,6 +231,7 @@ namespace
 		int t_load_rom(core_romimage* images, std::map<std::string, std::string>& settings,
 			uint64_t rtc_sec, uint64_t rtc_subsec)
 		{
+			memset(states().ram, 0, sizeof(states().ram));
 			return 0;
 		}
 		controller_set t_controllerconfig(std::map<std::string, std::string>& settings)
@@ -192,7 +239,19 @@ namespace
 			return test_controllerconfig(settings);
 		}
 		std::pair<uint64_t, uint64_t> c_get_bus_map() { return std::make_pair(0, 0); }
-		std::list<core_vma_info> c_vma_list() { return std::list<core_vma_info>(); }
+		std::list<core_vma_info> c_vma_list()
+		{
+			std::list<core_vma_info> r;
+			core_vma_info ram;
+			ram.name = "RAM";
+			ram.backing_ram = states().ram;
+			ram.size = sizeof(states().ram);
+			ram.base = 0;
+			ram.endian = -1;
+			ram.volatile_flag = true;
+			r.push_back(ram);
+			return r;
+		}
 		std::set<std::string> c_srams() { return std::set<std::string>(); }
 		unsigned c_action_flags(unsigned id) { return 1; }
 		int c_reset_action(bool hard) { return -1; }
@@ -1,8 +1,6 @@
 #include "library/framebuffer.hpp"
 
-#include <cstring>
-
-extern const char* font_hex_data;
+extern const framebuffer::font_atlas font_atlas_data;
 framebuffer::font main_font;
 
 void do_init_font()
@@ -10,6 +8,6 @@ void do_init_font()
 	static bool flag = false;
 	if(flag)
 		return;
-	main_font.load_hex(font_hex_data, strlen(font_hex_data));
+	main_font.load_atlas(font_atlas_data);
 	flag = true;
 }
@@ -13,6 +13,7 @@
 #include "library/framebuffer-pixfmt-lrgb.hpp"
 #include "fonts/wrapper.hpp"
 #include "core/audioapi.hpp"
+#include "core/framebuffer.hpp"
 #include "core/instance.hpp"
 #include "core/messages.hpp"
 
@@ -118,6 +119,7 @@ namespace
 	framebuffer::info translate_info(lsnes_core_framebuffer_info* _fb)
 	{
 		framebuffer::info fbinfo;
+		fbinfo.type = NULL;
 		switch(_fb->type) {
 		case LSNES_CORE_PIXFMT_RGB15:	fbinfo.type = &framebuffer::pixfmt_rgb15; break;
 		case LSNES_CORE_PIXFMT_BGR15:	fbinfo.type = &framebuffer::pixfmt_bgr15; break;
@@ -881,6 +883,16 @@ failed:
 		CORE().audio->submit_buffer((int16_t*)samples, count, stereo, rate);
 	}
 
+	int16_t* callback_get_sound_buffer(size_t* count)
+	{
+		return CORE().audio->get_music_buffer(*count);
+	}
+
+	void callback_commit_sound(size_t count, double rate)
+	{
+		CORE().audio->commit_music_buffer(count, rate);
+	}
+
 	void callback_notify_latch(const char** params)
 	{
 		std::list<std::string> ps;
@@ -897,6 +909,29 @@ failed:
 		ecore_callbacks->output_frame(fb, fps_n, fps_d);
 	}
 
+	char* callback_get_frame_buffer(enum lsnes_core_pixel_format type, size_t physwidth, size_t physheight,
+		size_t* physstride)
+	{
+		lsnes_core_framebuffer_info fb;
+		fb.type = type;
+		fb.mem = NULL;
+		fb.physwidth = fb.width = physwidth;
+		fb.physheight = fb.height = physheight;
+		fb.stride = fb.physstride = 0;
+		fb.offset_x = fb.offset_y = 0;
+		framebuffer::info fbinfo = translate_info(&fb);
+		if(!fbinfo.type)
+			return NULL;
+		//Round rows up to 16 bytes, so the core can use aligned stores.
+		*physstride = (physwidth * fbinfo.type->get_bpp() + 15) & ~(size_t)15;
+		//The memory comes from frame pool of the instance, so frames rendered into it need no copy.
+		try {
+			return CORE().fbuf->lend_frame_memory(*physstride * physheight);
+		} catch(std::bad_alloc& e) {
+			return NULL;
+		}
+	}
+
 	struct fpcfn
 	{
 		std::function<unsigned char()> fn;
@@ -1198,7 +1233,7 @@ no_parameters:
 		//Enumerate what the thing supports.
 		entrypoint_fn entrypoint(fn);
 		lsnes_core_enumerate_cores r;
-		r.emu_flags1 = 2;
+		r.emu_flags1 = 3;
 		r.message = callback_message;
 		r.get_input = callback_get_input;
 		r.notify_action_update = callback_notify_action_update;
@@ -1217,6 +1252,9 @@ no_parameters:
 		r.add_disasm = callback_add_disasm;
 		r.remove_disasm = callback_remove_disasm;
 		r.render_text = callback_render_text;
+		r.get_frame_buffer = callback_get_frame_buffer;
+		r.get_sound_buffer = callback_get_sound_buffer;
+		r.commit_sound = callback_commit_sound;
 		entrypoint(0, r, [](const char* name, const char* err) {
 			(stringfmt() << "LSNES_CORE_ENUMERATE_CORES(0) failed: " << err).throwex();
 		});
@@ -330,6 +330,25 @@ bool core_core::c_isnull() const
 	return false;
 }
 
+bool core_core::multi_instance() const
+{
+	return c_multi_instance();
+}
+
+bool core_core::c_multi_instance() const
+{
+	return false;
+}
+
+void core_core::set_render_skip(bool skip)
+{
+	c_set_render_skip(skip);
+}
+
+void core_core::c_set_render_skip(bool skip)
+{
+}
+
 core_sysregion::core_sysregion(const std::string& _name, core_type& _type, core_region& _region)
 	: name(_name), type(_type), region(_region)
 {
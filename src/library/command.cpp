@@ -488,6 +488,115 @@ void group::listener::kill(set& s)
 	state->set_handles.erase(&s);
 }
 
+namespace
+{
+	bool is_sigspace(char ch)
+	{
+		return (ch == ' ' || ch == '\t');
+	}
+}
+
+std::string signature::result::str(size_t i) const throw(std::bad_alloc)
+{
+	if(!present(i))
+		return "";
+	return std::string(base + start[i], length[i]);
+}
+
+signature::signature(const char* spec, const char* err) throw(std::bad_alloc, std::runtime_error)
+{
+	nfields = 0;
+	nmandatory = 0;
+	errmsg = err;
+	bool optional_seen = false;
+	std::string _spec = spec;
+	for(auto i : token_iterator<char>::foreach(_spec, {" "})) {
+		if(i == "")
+			continue;
+		bool optional = (i[0] == '?');
+		std::string t = optional ? i.substr(1) : i;
+		if(nfields == max_fields)
+			throw std::runtime_error("Too many fields in signature");
+		if(nfields > 0 && types[nfields - 1] == F_REST)
+			throw std::runtime_error("'rest' must be the last field in signature");
+		if(optional_seen && !optional)
+			throw std::runtime_error("Mandatory field after optional field in signature");
+		if(t == "word") types[nfields] = F_WORD;
+		else if(t == "int") types[nfields] = F_INT;
+		else if(t == "uint") types[nfields] = F_UINT;
+		else if(t == "rest") types[nfields] = F_REST;
+		else
+			throw std::runtime_error("Unknown field type '" + t + "' in signature");
+		optional_seen |= optional;
+		nfields++;
+		if(!optional_seen) nmandatory = nfields;
+	}
+}
+
+bool signature::parse(const std::string& args, result& res) const throw()
+{
+	const char* a = args.c_str();
+	size_t len = args.length();
+	size_t pos = 0;
+	res.base = a;
+	res.fields = 0;
+	for(size_t i = 0; i < nfields; i++) {
+		while(pos < len && is_sigspace(a[pos]))
+			pos++;
+		if(types[i] == F_REST) {
+			res.start[i] = pos;
+			res.length[i] = len - pos;
+			res.fields++;
+			return true;
+		}
+		if(pos == len) {
+			if(i < nmandatory)
+				return false;
+			break;
+		}
+		size_t end = pos;
+		while(end < len && !is_sigspace(a[end]))
+			end++;
+		res.start[i] = pos;
+		res.length[i] = end - pos;
+		if(types[i] == F_INT || types[i] == F_UINT) {
+			bool neg = false;
+			size_t p = pos;
+			if(types[i] == F_INT && a[p] == '-') {
+				neg = true;
+				p++;
+			}
+			if(p == end)
+				return false;
+			uint64_t v = 0;
+			uint64_t limit = neg ? (1ULL << 63) : (types[i] == F_INT ? (1ULL << 63) - 1 : ~0ULL);
+			for(; p < end; p++) {
+				if(a[p] < '0' || a[p] > '9')
+					return false;
+				unsigned d = a[p] - '0';
+				if(v > (limit - d) / 10)
+					return false;
+				v = 10 * v + d;
+			}
+			if(types[i] == F_INT)
+				res.value[i].i = neg ? static_cast<int64_t>(~v + 1) : static_cast<int64_t>(v);
+			else
+				res.value[i].u = v;
+		}
+		res.fields++;
+		pos = end;
+	}
+	while(pos < len && is_sigspace(a[pos]))
+		pos++;
+	return (pos == len);
+}
+
+void signature::parse_or_throw(const std::string& args, result& res) const throw(std::runtime_error)
+{
+	if(!parse(args, res))
+		throw std::runtime_error(errmsg ? errmsg : "Invalid arguments");
+}
+
 template<>
 void invoke_fn(std::function<void(const std::string& args)> fn, const std::string& args)
 {
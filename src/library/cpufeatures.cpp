@@ -0,0 +1,66 @@
+#include "cpufeatures.hpp"
+#include <cstdlib>
+#ifdef ARCH_HAS_X86_DISPATCH
+#include <cpuid.h>
+#endif
+
+namespace cpufeatures
+{
+namespace
+{
+	//Bits in the feature words below.
+	const unsigned F_SSSE3 = 1;
+	const unsigned F_SSE41 = 2;
+	const unsigned F_SHA = 4;
+	const unsigned F_AVX2 = 8;
+
+	unsigned detect()
+	{
+		unsigned ret = 0;
+#ifdef ARCH_HAS_X86_DISPATCH
+		unsigned a, b, c, d;
+		if(!__get_cpuid(1, &a, &b, &c, &d))
+			return 0;
+		if(c & (1U << 9)) ret |= F_SSSE3;
+		if(c & (1U << 19)) ret |= F_SSE41;
+		//AVX state needs to be enabled by OS (OSXSAVE and XCR0 bits 1 and 2).
+		bool os_avx = false;
+		if((c & (1U << 27)) && (c & (1U << 28))) {
+			unsigned xlo, xhi;
+			__asm__ volatile("xgetbv" : "=a"(xlo), "=d"(xhi) : "c"(0));
+			os_avx = ((xlo & 6) == 6);
+		}
+		if(__get_cpuid_max(0, NULL) >= 7) {
+			__cpuid_count(7, 0, a, b, c, d);
+			if(b & (1U << 29)) ret |= F_SHA;
+			if(os_avx && (b & (1U << 5))) ret |= F_AVX2;
+		}
+#endif
+		return ret;
+	}
+
+	bool disable_all = false;
+
+	unsigned features()
+	{
+		static unsigned f = detect();
+		return disable_all ? 0 : f;
+	}
+}
+
+bool has_sha()
+{
+	unsigned req = F_SSSE3 | F_SSE41 | F_SHA;
+	return (features() & req) == req;
+}
+
+bool has_avx2()
+{
+	return (features() & F_AVX2) != 0;
+}
+
+void set_disabled(bool disabled)
+{
+	disable_all = disabled;
+}
+}
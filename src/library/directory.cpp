@@ -1,7 +1,9 @@
 #include "directory.hpp"
 #include "string.hpp"
 #include <dirent.h>
+#include <sys/stat.h>
 #include <boost/filesystem.hpp>
+#include <sstream>
 #if defined(_WIN32) || defined(_WIN64) || defined(TEST_WIN32_CODE)
 #include <windows.h>
 #endif
@@ -50,6 +52,28 @@ time_t mtime(const std::string& path)
 	return t;
 }
 
+uint64_t inode(const std::string& path)
+{
+	//Not all platforms have meaningful inode numbers, those just report 0.
+	struct stat st;
+	if(stat(path.c_str(), &st) < 0)
+		return 0;
+	return st.st_ino;
+}
+
+std::string identity(const std::string& path)
+{
+	struct stat st;
+	if(stat(path.c_str(), &st) < 0)
+		return "";
+	std::ostringstream x;
+	x << st.st_dev << ":" << st.st_ino << ":" << st.st_size << ":" << st.st_mtime;
+#if defined(__linux__)
+	x << ":" << st.st_mtim.tv_nsec;
+#endif
+	return x.str();
+}
+
 bool exists(const std::string& filename)
 {
 	boost::system::error_code ec;
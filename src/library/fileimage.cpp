@@ -6,13 +6,12 @@
 #include "zip.hpp"
 #include "directory.hpp"
 #include <sstream>
+#include <fstream>
 
 namespace fileimage
 {
 namespace
 {
-	std::map<std::string, std::pair<time_t, std::string>> cached_entries;
-
 	threads::lock& global_queue_mutex()
 	{
 		static bool init = false;
@@ -35,59 +34,21 @@ namespace
 		return NULL;
 	}
 
-	std::string lookup_cache(const std::string& filename, uint64_t prefixlen)
+	unsigned hash_thread_count()
 	{
-		std::string cache = filename + ".sha256";
-		if(prefixlen) cache += (stringfmt() << "-" << prefixlen).str();
-		time_t filetime = directory::mtime(filename);
-		if(cached_entries.count(cache)) {
-			//Found the cache entry...
-			if(cached_entries[cache].first == filetime)
-				return cached_entries[cache].second;
-			else {
-				//Stale.
-				unlink(cache.c_str());
-				cached_entries.erase(cache);
-				return "";
-			}
-		}
-
-		std::string cached_hash;
-		time_t rfiletime;
-
-		std::ifstream in(cache);
-		if(!in)
-			return "";	//Failed.
-
-		std::string tmp;
-		std::getline(in, tmp);
-		std::istringstream _in(tmp);
-		_in >> rfiletime;
-		std::getline(in, cached_hash);
-
-		if(rfiletime == filetime) {
-			cached_entries[cache] = std::make_pair(rfiletime, cached_hash);
-		} else  {
-			//Stale.
-			unlink(cache.c_str());
-			cached_entries.erase(cache);
-			return "";
-		}
-		return cached_hash;
+		//Hashing is mostly I/O bound on big files, so more threads than this does not help.
+		unsigned n = threads::thread::hardware_concurrency();
+		return max(min(n, 4U), 1U);
 	}
 
-	void store_cache(const std::string& filename, uint64_t prefixlen, const std::string& value)
+	bool next_field(const std::string& line, size_t& pos, std::string& field)
 	{
-		std::string cache = filename + ".sha256";
-		if(prefixlen) cache += (stringfmt() << "-" << prefixlen).str();
-		time_t filetime = directory::mtime(filename);
-		std::ofstream out(cache);
-		cached_entries[cache] = std::make_pair(filetime, value);
-		if(!out)
-			return;		//Failed!
-		out << filetime << std::endl;
-		out << value << std::endl;
-		out.close();
+		size_t split = line.find_first_of("|", pos);
+		if(split == std::string::npos)
+			return false;
+		field = line.substr(pos, split - pos);
+		pos = split + 1;
+		return true;
 	}
 
 	uint64_t get_file_size(const std::string& filename)
@@ -200,9 +161,10 @@ hashval& hashval::operator=(const hashval& f)
 void hashval::resolve(unsigned id, const std::string& hash, uint64_t _prefix)
 {
 	threads::alock h(mlock);
-	hasher->unlink(*this);
 	if(id != cbid)
 		return;
+	hasher->unlink(*this);
+	hasher = NULL;
 	is_ready = true;
 	value = hash;
 	prefixv = _prefix;
@@ -212,15 +174,163 @@ void hashval::resolve(unsigned id, const std::string& hash, uint64_t _prefix)
 void hashval::resolve_error(unsigned id, const std::string& err)
 {
 	threads::alock h(mlock);
-	hasher->unlink(*this);
 	if(id != cbid)
 		return;
+	hasher->unlink(*this);
+	hasher = NULL;
 	is_ready = true;
 	error = err;
 	prefixv = 0;
 	condition.notify_all();
 }
 
+hashcache::hashcache()
+{
+	records = 0;
+}
+
+void hashcache::set_file(const std::string& filename)
+{
+	threads::alock h(mlock);
+	dbfile = filename;
+	entries.clear();
+	by_hash.clear();
+	records = 0;
+	if(dbfile == "")
+		return;
+	std::ifstream in(dbfile);
+	if(!in)
+		return;
+	std::string line;
+	while(std::getline(in, line)) {
+		istrip_CR(line);
+		records++;
+		//Format: hash|prefix|size|mtime|inode|filename
+		std::string f[5];
+		size_t pos = 0;
+		bool ok = true;
+		for(unsigned i = 0; i < 5; i++)
+			ok = ok && next_field(line, pos, f[i]);
+		if(!ok || pos >= line.length())
+			continue;
+		try {
+			entry e;
+			key_t key(line.substr(pos), parse_value<uint64_t>(f[1]));
+			e.hash = f[0];
+			e.size = parse_value<uint64_t>(f[2]);
+			e.mtime = parse_value<int64_t>(f[3]);
+			e.inode = parse_value<uint64_t>(f[4]);
+			//Later records override earlier ones.
+			insert(key, e);
+		} catch(...) {
+		}
+	}
+	in.close();
+	if(records > 2 * entries.size() + 64)
+		compact();
+}
+
+std::string hashcache::lookup(const std::string& filename, uint64_t prefix)
+{
+	key_t key(directory::absolute_path(filename), prefix);
+	threads::alock h(mlock);
+	if(!entries.count(key))
+		return "";
+	if(!is_fresh(key.first, entries[key])) {
+		erase(key);
+		return "";
+	}
+	return entries[key].hash;
+}
+
+void hashcache::store(const std::string& filename, uint64_t prefix, const std::string& value)
+{
+	key_t key(directory::absolute_path(filename), prefix);
+	entry e;
+	e.size = directory::size(key.first);
+	e.mtime = directory::mtime(key.first);
+	e.inode = directory::inode(key.first);
+	e.hash = value;
+	threads::alock h(mlock);
+	insert(key, e);
+	append(key, e);
+}
+
+std::list<std::pair<std::string, uint64_t>> hashcache::lookup_by_hash(const std::string& value)
+{
+	std::list<std::pair<std::string, uint64_t>> ret;
+	threads::alock h(mlock);
+	std::list<key_t> stale;
+	auto r = by_hash.equal_range(value);
+	for(auto i = r.first; i != r.second; i++) {
+		if(is_fresh(i->second.first, entries[i->second]))
+			ret.push_back(i->second);
+		else
+			stale.push_back(i->second);
+	}
+	for(auto& i : stale)
+		erase(i);
+	return ret;
+}
+
+bool hashcache::is_fresh(const std::string& filename, const entry& e)
+{
+	if(!directory::is_regular(filename))
+		return false;
+	return e.size == directory::size(filename) && e.mtime == directory::mtime(filename) &&
+		e.inode == directory::inode(filename);
+}
+
+void hashcache::insert(const key_t& key, const entry& e)
+{
+	erase(key);
+	entries[key] = e;
+	by_hash.insert(std::make_pair(e.hash, key));
+}
+
+void hashcache::erase(const key_t& key)
+{
+	if(!entries.count(key))
+		return;
+	auto r = by_hash.equal_range(entries[key].hash);
+	for(auto i = r.first; i != r.second; i++)
+		if(i->second == key) {
+			by_hash.erase(i);
+			break;
+		}
+	entries.erase(key);
+}
+
+void hashcache::append(const key_t& key, const entry& e)
+{
+	if(dbfile == "")
+		return;
+	std::ofstream out(dbfile, std::ios::app);
+	if(!out)
+		return;		//Failed!
+	out << e.hash << "|" << key.second << "|" << e.size << "|" << e.mtime << "|" << e.inode << "|"
+		<< key.first << std::endl;
+	records++;
+}
+
+void hashcache::compact()
+{
+	std::string tmpfile = dbfile + ".tmp";
+	{
+		std::ofstream out(tmpfile);
+		if(!out)
+			return;
+		for(auto& i : entries)
+			out << i.second.hash << "|" << i.first.second << "|" << i.second.size << "|"
+				<< i.second.mtime << "|" << i.second.inode << "|" << i.first.first << std::endl;
+		if(!out)
+			return;
+	}
+	if(directory::rename_overwrite(tmpfile.c_str(), dbfile.c_str()) < 0)
+		return;
+	records = entries.size();
+}
+
 void hash::link(hashval& future)
 {
 	//We assume caller holds global queue lock.
@@ -229,7 +339,7 @@ void hash::link(hashval& future)
 		unsigned cbid = future.cbid;
 		for(auto& i : queue)
 			if(i.cbid == cbid)
-				i.interested--;
+				i.interested++;
 	}
 	future.prev = last_future;
 	future.next = NULL;
@@ -247,8 +357,8 @@ void hash::unlink(hashval& future)
 		threads::alock h(mlock);
 		unsigned cbid = future.cbid;
 		for(auto& i : queue)
-			if(i.cbid == cbid)
-				i.interested++;
+			if(i.cbid == cbid && i.interested)
+				i.interested--;
 	}
 	if(&future == first_future)
 		first_future = future.next;
@@ -258,6 +368,28 @@ void hash::unlink(hashval& future)
 		future.prev->next = future.next;
 	if(future.next)
 		future.next->prev = future.prev;
+	future.prev = future.next = NULL;
+}
+
+void hash::resolve_all(unsigned cbid, const std::string& hash, uint64_t prefix)
+{
+	threads::alock h2(global_queue_mutex());
+	hashval* next;
+	for(hashval* fut = first_future; fut != NULL; fut = next) {
+		//Resolving unlinks the future, so grab the next one first.
+		next = fut->next;
+		fut->resolve(cbid, hash, prefix);
+	}
+}
+
+void hash::resolve_error_all(unsigned cbid, const std::string& err)
+{
+	threads::alock h2(global_queue_mutex());
+	hashval* next;
+	for(hashval* fut = first_future; fut != NULL; fut = next) {
+		next = fut->next;
+		fut->resolve_error(cbid, err);
+	}
 }
 
 hashval hash::operator()(const std::string& filename, uint64_t prefixlen)
@@ -266,11 +398,15 @@ hashval hash::operator()(const std::string& filename, uint64_t prefixlen)
 	j.filename = filename;
 	j.prefix = prefixlen;
 	j.size = get_file_size(filename);
-	j.cbid = next_cbid++;
 	j.interested = 1;
+	j.running = false;
+	{
+		threads::alock h(mlock);
+		j.cbid = next_cbid++;
+	}
 	hashval future(*this, j.cbid);
-	queue.push_back(j);
 	threads::alock h(mlock);
+	queue.push_back(j);
 	total_work += j.size;
 	work_size += j.size;
 	condition.notify_all();
@@ -283,11 +419,15 @@ hashval hash::operator()(const std::string& filename, std::function<uint64_t(uin
 	j.filename = filename;
 	j.size = get_file_size(filename);
 	j.prefix = prefixlen(j.size);
-	j.cbid = next_cbid++;
 	j.interested = 1;
+	j.running = false;
+	{
+		threads::alock h(mlock);
+		j.cbid = next_cbid++;
+	}
 	hashval future(*this, j.cbid);
-	queue.push_back(j);
 	threads::alock h(mlock);
+	queue.push_back(j);
 	total_work += j.size;
 	work_size += j.size;
 	condition.notify_all();
@@ -300,6 +440,16 @@ void hash::set_callback(std::function<void(uint64_t, uint64_t)> cb)
 	progresscb = cb;
 }
 
+void hash::set_cache_file(const std::string& filename)
+{
+	cache.set_file(filename);
+}
+
+std::list<std::pair<std::string, uint64_t>> hash::lookup_by_hash(const std::string& value)
+{
+	return cache.lookup_by_hash(value);
+}
+
 hash::hash()
 {
 	quitting = false;
@@ -308,8 +458,12 @@ hash::hash()
 	next_cbid = 0;
 	total_work = 0;
 	work_size = 0;
+	completed = 0;
+	busy = 0;
 	progresscb = [](uint64_t x, uint64_t y) -> void {};
-	hash_thread = new threads::thread(thread_trampoline, this);
+	unsigned n = hash_thread_count();
+	for(unsigned i = 0; i < n; i++)
+		hash_threads.push_back(new threads::thread(thread_trampoline, this));
 }
 
 hash::~hash()
@@ -319,75 +473,81 @@ hash::~hash()
 		quitting = true;
 		condition.notify_all();
 	}
-	hash_thread->join();
-	delete hash_thread;
+	for(auto i : hash_threads) {
+		i->join();
+		delete i;
+	}
 	threads::alock h2(global_queue_mutex());
-	while(first_future)
-		first_future->resolve_error(first_future->cbid, "Hasher deleted");
+	hashval* next;
+	for(hashval* fut = first_future; fut != NULL; fut = next) {
+		next = fut->next;
+		fut->resolve_error(fut->cbid, "Hasher deleted");
+	}
 }
 
 void hash::entrypoint()
 {
 	FILE* fp;
 	while(true) {
+		std::list<queue_job>::iterator job;
 		//Wait for work or quit signal.
 		{
 			threads::alock h(mlock);
-			while(!quitting && queue.empty()) {
-				send_idle();
+			while(true) {
+				if(quitting)
+					return;
+				for(job = queue.begin(); job != queue.end(); job++)
+					if(!job->running)
+						break;
+				if(job != queue.end())
+					break;
+				if(!busy)
+					send_idle();
 				condition.wait(h);
 			}
-			if(quitting)
-				return;
-			//We hawe work.
-			current_job = queue.begin();
+			//We have work.
+			job->running = true;
+			busy++;
 		}
 
 		//Hash this item.
 		uint64_t progress = 0;
 		std::string cached_hash;
 		fp = NULL;
-		cached_hash = lookup_cache(current_job->filename, current_job->prefix);
+		cached_hash = cache.lookup(job->filename, job->prefix);
 		if(cached_hash != "") {
-			threads::alock h2(global_queue_mutex());
-			for(hashval* fut = first_future; fut != NULL; fut = fut->next)
-				fut->resolve(current_job->cbid, cached_hash, current_job->prefix);
+			resolve_all(job->cbid, cached_hash, job->prefix);
 			goto finished;
 		}
-		fp = fopen(current_job->filename.c_str(), "rb");
+		fp = fopen(job->filename.c_str(), "rb");
 		if(!fp) {
-			threads::alock h2(global_queue_mutex());
-			for(hashval* fut = first_future; fut != NULL; fut = fut->next)
-				fut->resolve_error(current_job->cbid, "Can't open file");
+			resolve_error_all(job->cbid, "Can't open file");
 		} else {
 			sha256 hash;
-			uint64_t toskip = current_job->prefix;
+			uint64_t toskip = job->prefix;
 			while(!feof(fp) && !ferror(fp)) {
+				unsigned char buf[65536];
+				uint64_t offset = 0;
+				size_t s = fread(buf, 1, sizeof(buf), fp);
 				{
 					threads::alock h(mlock);
-					if(!current_job->interested)
+					if(!job->interested)
 						goto finished; //Aborted.
+					progress += s;
+					completed += s;
 				}
-				unsigned char buf[16384];
-				uint64_t offset = 0;
-				size_t s = fread(buf, 1, sizeof(buf), fp);
-				progress += s;
-				//The first current_job->prefix bytes need to be skipped.
+				//The first job->prefix bytes need to be skipped.
 				offset = min(toskip, (uint64_t)s);
 				toskip -= offset;
 				if(s > offset) hash.write(buf + offset, s - offset);
-				send_callback(progress);
+				send_callback();
 			}
 			if(ferror(fp)) {
-				threads::alock h2(global_queue_mutex());
-				for(hashval* fut = first_future; fut != NULL; fut = fut->next)
-					fut->resolve_error(current_job->cbid, "Can't read file");
+				resolve_error_all(job->cbid, "Can't read file");
 			} else {
 				std::string hval = hash.read();
-				threads::alock h2(global_queue_mutex());
-				for(hashval* fut = first_future; fut != NULL; fut = fut->next)
-					fut->resolve(current_job->cbid, hval, current_job->prefix);
-				store_cache(current_job->filename, current_job->prefix, hval);
+				resolve_all(job->cbid, hval, job->prefix);
+				cache.store(job->filename, job->prefix, hval);
 			}
 		}
 finished:
@@ -395,22 +555,25 @@ finished:
 		//Okay, this work item is complete.
 		{
 			threads::alock h(mlock);
-			total_work -= current_job->size;
-			queue.erase(current_job);
+			total_work -= job->size;
+			completed -= progress;
+			queue.erase(job);
+			busy--;
+			condition.notify_all();
 		}
-		send_callback(0);
+		send_callback();
 	}
 }
 
-void hash::send_callback(uint64_t this_completed)
+void hash::send_callback()
 {
 	uint64_t amount;
 	{
 		threads::alock h(mlock);
-		if(this_completed > total_work)
+		if(completed > total_work)
 			amount = 0;
 		else
-			amount = total_work - this_completed;
+			amount = total_work - completed;
 	}
 	progresscb(amount, work_size);
 }
@@ -57,7 +57,8 @@ uint32_t filesystem::allocate_cluster()
 					uint32_t cluster = i * CLUSTERS_PER_SUPER + j;
 					char buffer[CLUSTER_SIZE];
 					memset(buffer, 0, CLUSTER_SIZE);
-					backing.seekp(cluster * CLUSTER_SIZE, std::ios_base::beg);
+					cache_invalidate(cluster);
+					backing.seekp(static_cast<uint64_t>(cluster) * CLUSTER_SIZE, std::ios_base::beg);
 					backing.write(buffer, CLUSTER_SIZE);
 					if(!backing)
 						throw std::runtime_error("Can't zero out the new cluster");
@@ -163,11 +164,7 @@ size_t filesystem::read_data(uint32_t& cluster, uint32_t& ptr, void* data, uint3
 		//Read to end of cluster.
 		size_t maxread = min(length, max(static_cast<uint32_t>(CLUSTER_SIZE), ptr) - ptr);
 		if(maxread) {
-			backing.clear();
-			backing.seekg(cluster * CLUSTER_SIZE + ptr, std::ios_base::beg);
-			backing.read(_data, maxread);
-			if(!backing)
-				throw std::runtime_error("Can't read data");
+			memcpy(_data, cluster_data(cluster) + ptr, maxread);
 			length -= maxread;
 			_data += maxread;
 			ptr += maxread;
@@ -205,24 +202,21 @@ void filesystem::write_data(uint32_t& cluster, uint32_t& ptr, const void* data,
 		//Write to end of cluster.
 		size_t maxwrite = min(length, max(static_cast<uint32_t>(CLUSTER_SIZE), ptr) - ptr);
 		if(maxwrite) {
-			char buffer[CLUSTER_SIZE];
-			memset(buffer, 0, CLUSTER_SIZE);
 			if(!assigned) {
 				real_cluster = cluster;
 				real_ptr = ptr;
 				assigned = true;
 			}
-			backing.seekp(0, std::ios_base::end);
-			uint64_t backing_size = backing.tellp();
-			if(backing_size > cluster * CLUSTER_SIZE) {
-				backing.seekg(cluster * CLUSTER_SIZE, std::ios_base::beg);
-				backing.read(buffer, CLUSTER_SIZE);
-			}
+			char* buffer = cluster_data(cluster);
 			memcpy(buffer + ptr, _data, maxwrite);
-			backing.seekp(cluster * CLUSTER_SIZE, std::ios_base::beg);
+			backing.clear();
+			backing.seekp(static_cast<uint64_t>(cluster) * CLUSTER_SIZE, std::ios_base::beg);
 			backing.write(buffer, CLUSTER_SIZE);
-			if(!backing)
+			if(!backing) {
+				//The cached copy no longer matches what is on disk.
+				cache_invalidate(cluster);
 				throw std::runtime_error("Can't write data");
+			}
 			length -= maxwrite;
 			_data += maxwrite;
 			ptr += maxwrite;
@@ -255,6 +249,42 @@ void filesystem::write_data(uint32_t& cluster, uint32_t& ptr, const void* data,
 	} while(length > 0);
 }
 
+char* filesystem::cluster_data(uint32_t cluster)
+{
+	auto i = cache.find(cluster);
+	if(i != cache.end()) {
+		cache_lru.splice(cache_lru.begin(), cache_lru, i->second.lru);
+		return i->second.data;
+	}
+	char buffer[CLUSTER_SIZE];
+	memset(buffer, 0, CLUSTER_SIZE);
+	//Clusters past the end of backing file read as zeroes.
+	backing.clear();
+	backing.seekg(static_cast<uint64_t>(cluster) * CLUSTER_SIZE, std::ios_base::beg);
+	backing.read(buffer, CLUSTER_SIZE);
+	if(backing.bad())
+		throw std::runtime_error("Can't read data");
+	backing.clear();
+	if(cache.size() >= FILESYSTEM_CACHE_CLUSTERS) {
+		cache.erase(cache_lru.back());
+		cache_lru.pop_back();
+	}
+	cached_cluster& c = cache[cluster];
+	memcpy(c.data, buffer, CLUSTER_SIZE);
+	cache_lru.push_front(cluster);
+	c.lru = cache_lru.begin();
+	return c.data;
+}
+
+void filesystem::cache_invalidate(uint32_t cluster)
+{
+	auto i = cache.find(cluster);
+	if(i == cache.end())
+		return;
+	cache_lru.erase(i->second.lru);
+	cache.erase(i);
+}
+
 void filesystem::supercluster::load(std::fstream& s, uint32_t index)
 {
 	uint64_t offset = SUPERCLUSTER_SIZE * index;
@@ -10,6 +10,9 @@ namespace framebuffer
 {
 namespace
 {
+	//Maximum number of cached layouts per font. The cache is emptied when full.
+	const size_t max_cached_runs = 1024;
+
 	inline bool readfont(const font2::glyph& fglyph, uint32_t xp1, uint32_t yp1)
 	{
 		if(xp1 < 1 || xp1 > fglyph.width || yp1 < 1 || yp1 > fglyph.height)
@@ -304,6 +307,8 @@ void font2::add(const std::u32string& key, const glyph& fglyph) throw(std::bad_a
 	glyphs[key] = fglyph;
 	if(fglyph.height > rowadvance)
 		rowadvance = fglyph.height;
+	threads::alock h(runs_lock);
+	runs.clear();
 }
 
 std::u32string font2::best_ligature_match(const std::u32string& codepoints, size_t start) const
@@ -345,18 +350,33 @@ const font2::glyph& font2::lookup_glyph(const std::u32string& key) const throw()
 
 std::pair<uint32_t, uint32_t> font2::get_metrics(const std::u32string& str, uint32_t xalign) const
 {
-	uint32_t w = 0;
-	uint32_t h = 0;
-	for_each_glyph(str, xalign, [&w, &h](uint32_t x, uint32_t y, const glyph& g) {
-		w = std::max(w, x + (uint32_t)g.width);
-		h = std::max(h, y + (uint32_t)g.height);
-	});
-	return std::make_pair(w, h);
+	auto r = get_run(str, xalign);
+	return std::make_pair(r->width, r->height);
 }
 
 void font2::for_each_glyph(const std::u32string& str, uint32_t xalign, std::function<void(uint32_t x, uint32_t y,
 	const glyph& g)> cb) const
 {
+	auto r = get_run(str, xalign);
+	for(auto& i : r->glyphs)
+		cb(i.x, i.y, *i.g);
+}
+
+std::shared_ptr<const font2::run> font2::get_run(const std::u32string& str, uint32_t xalign) const
+	throw(std::bad_alloc)
+{
+	//Alignment only matters for tabs, which are at multiples of 64.
+	xalign &= 63;
+	std::u32string key = std::u32string(1, xalign) + str;
+	{
+		threads::alock h(runs_lock);
+		auto i = runs.find(key);
+		if(i != runs.end())
+			return i->second;
+	}
+	std::shared_ptr<run> r(new run);
+	r->width = 0;
+	r->height = 0;
 	uint32_t drawx = 0;
 	uint32_t orig_x = 0;
 	uint32_t drawy = 0;
@@ -374,10 +394,41 @@ void font2::for_each_glyph(const std::u32string& str, uint32_t xalign, std::func
 			drawx = orig_x;
 			drawy += get_rowadvance();
 		} else {
-			cb(drawx, drawy, g);
+			run::entry e = {drawx, drawy, &g};
+			r->glyphs.push_back(e);
+			r->width = std::max(r->width, drawx + (uint32_t)g.width);
+			r->height = std::max(r->height, drawy + (uint32_t)g.height);
 			drawx += g.width;
 		}
 	}
+	r->advance_y = drawy;
+	threads::alock h(runs_lock);
+	if(runs.size() >= max_cached_runs)
+		runs.clear();
+	runs[key] = r;
+	return r;
+}
+
+void font2::render_run(const run& r, uint8_t* buf, size_t stride) const throw()
+{
+	for(auto& i : r.glyphs) {
+		const glyph& g = *i.g;
+		if(!g.width || !g.height)
+			continue;
+		uint8_t* row = buf + (i.y * stride + i.x);
+		const uint32_t* data = &g.fglyph[0];
+		for(unsigned y = 0; y < g.height; y++) {
+			for(unsigned x = 0; x < g.width; x += 32) {
+				uint32_t w = data[x >> 5];
+				unsigned n = std::min(g.width - x, 32U);
+				uint8_t* p = row + x;
+				for(unsigned b = 0; b < n; b++)
+					p[b] = (w >> (31 - b)) & 1;
+			}
+			row += stride;
+			data += g.stride;
+		}
+	}
 }
 
 void font2::dump(const std::string& file) const
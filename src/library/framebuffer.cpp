@@ -3,6 +3,7 @@
 #include "png.hpp"
 #include "serialization.hpp"
 #include "string.hpp"
+#include "threads.hpp"
 #include "minmax.hpp"
 #include "utf8.hpp"
 #include <cstring>
@@ -21,6 +22,13 @@ unsigned default_shift_b;
 
 namespace
 {
+	//Glyph atlas layout, see font_atlas.
+	const size_t atlas_pages_count = 0x1100;
+	const uint16_t atlas_no_block = 0xFFFF;
+	const uint32_t atlas_no_glyph = 0xFFFFFFFFU;
+	//Maximum number of cached string layouts per font. The cache is emptied when full.
+	const size_t max_cached_runs = 1024;
+
 	void recalculate_default_shifts()
 	{
 		uint32_t magic = 0x18000810;
@@ -280,7 +288,7 @@ void raw::load(const std::vector<char>& data) throw(std::bad_alloc, std::runtime
 		decode_words<4>(reinterpret_cast<uint8_t*>(addr), data2 + dataoffset, data.size() - dataoffset);
 }
 
-void raw::save(std::vector<char>& data) throw(std::bad_alloc)
+void raw::save(std::vector<char>& data) const throw(std::bad_alloc)
 {
 	uint8_t* memory = reinterpret_cast<uint8_t*>(addr);
 	unsigned m;
@@ -324,7 +332,7 @@ void raw::save(std::vector<char>& data) throw(std::bad_alloc)
 	}
 }
 
-void raw::save_png(const std::string& file) throw(std::bad_alloc, std::runtime_error)
+void raw::save_png(const std::string& file) const throw(std::bad_alloc, std::runtime_error)
 {
 	uint8_t* memory = reinterpret_cast<uint8_t*>(addr);
 	png::encoder img;
@@ -332,6 +340,7 @@ void raw::save_png(const std::string& file) throw(std::bad_alloc, std::runtime_e
 	img.height = height;
 	img.has_palette = false;
 	img.has_alpha = false;
+	img.threads = threads::thread::hardware_concurrency();
 	img.data.resize(static_cast<size_t>(width) * height);
 	for(size_t i = 0; i < height; i++)
 		fmt->decode(&img.data[width * i], memory + stride * i, width);
@@ -346,6 +355,87 @@ size_t raw::get_stride() const throw() { return stride; }
 unsigned char* raw::get_start() const throw() { return reinterpret_cast<uint8_t*>(addr); }
 pixfmt* raw::get_format() const throw() { return fmt; }
 
+namespace
+{
+	//Frame in memory lent by raw_pool. Keeps the memory from being lent again.
+	struct lent_frame
+	{
+		lent_frame(const info& finfo, std::shared_ptr<std::vector<char>> _mem)
+			: frame(finfo), mem(_mem)
+		{
+		}
+		raw frame;
+		std::shared_ptr<std::vector<char>> mem;
+	};
+}
+
+raw_pool::raw_pool(size_t _max_frames) throw()
+{
+	max_frames = _max_frames;
+	last_lent_next = 0;
+}
+
+std::shared_ptr<const raw> raw_pool::make_copy(const raw& src) throw(std::bad_alloc)
+{
+	std::shared_ptr<raw> frame;
+	{
+		threads::alock h(lock);
+		//Frames rendered into lent memory are adopted as is.
+		if(!src.user_memory && src.height && src.fmt) {
+			const char* end = src.addr + (src.height - 1) * src.stride + src.width * src.fmt->get_bpp();
+			for(auto& i : last_lent) {
+				if(!i || i->empty() || src.addr < &(*i)[0] || end > &(*i)[0] + i->size())
+					continue;
+				info finfo;
+				finfo.type = src.fmt;
+				finfo.mem = src.addr;
+				finfo.physwidth = finfo.width = src.width;
+				finfo.physheight = finfo.height = src.height;
+				finfo.physstride = finfo.stride = src.stride;
+				finfo.offset_x = finfo.offset_y = 0;
+				std::shared_ptr<lent_frame> f(new lent_frame(finfo, i));
+				return std::shared_ptr<const raw>(f, &f->frame);
+			}
+		}
+		//If only the pool references a frame, nobody can get a new reference to it, so it is free.
+		for(auto& i : frames)
+			if(i.use_count() == 1) {
+				frame = i;
+				break;
+			}
+		if(!frame) {
+			frame.reset(new raw);
+			if(frames.size() < max_frames)
+				frames.push_back(frame);
+		}
+	}
+	//Reuses the memory of frame if large enough.
+	*frame = src;
+	return frame;
+}
+
+char* raw_pool::lend(size_t size) throw(std::bad_alloc)
+{
+	threads::alock h(lock);
+	//If only the pool references memory, it is neither recently lent nor used by a frame.
+	std::shared_ptr<std::vector<char>> mem;
+	for(auto& i : lent)
+		if(i.use_count() == 1) {
+			mem = i;
+			break;
+		}
+	if(!mem) {
+		mem.reset(new std::vector<char>);
+		if(lent.size() < max_frames)
+			lent.push_back(mem);
+	}
+	if(mem->size() < size)
+		mem->resize(size);
+	last_lent[last_lent_next] = mem;
+	last_lent_next = (last_lent_next + 1) % 3;
+	return mem->size() ? &(*mem)[0] : NULL;
+}
+
 
 template<bool X>
 fb<X>::fb() throw()
@@ -377,7 +467,7 @@ fb<X>::~fb() throw()
 #define DECBUF_SIZE 4096
 
 template<bool X>
-void fb<X>::copy_from(raw& scr, size_t hscale, size_t vscale) throw()
+void fb<X>::copy_from(const raw& scr, size_t hscale, size_t vscale) throw()
 {
 	typename fb<X>::element_t decbuf[DECBUF_SIZE];
 	last_blit_w = scr.width * hscale;
@@ -542,6 +632,13 @@ void queue::copy_from(queue& q) throw(std::bad_alloc)
 	}
 }
 
+void queue::snapshot_from(queue& q) throw(std::bad_alloc)
+{
+	for(struct node* tmp = q.queue_head; tmp; tmp = tmp->next)
+		if(!tmp->killed)
+			tmp->obj->snapshot(*this);
+}
+
 template<bool X> void queue::run(struct fb<X>& scr) throw()
 {
 	//Take queue lock in order to syncronize this with killing the queue.
@@ -638,6 +735,11 @@ bool object::kill_request(void* obj) throw()
 	return false;
 }
 
+void object::snapshot(struct queue& q) throw(std::bad_alloc)
+{
+	clone(q);
+}
+
 font::font() throw(std::bad_alloc)
 {
 	bad_glyph_data[0] = 0x018001AAU;
@@ -646,6 +748,16 @@ font::font() throw(std::bad_alloc)
 	bad_glyph_data[3] = 0x55800180U;
 	bad_glyph.wide = false;
 	bad_glyph.data = bad_glyph_data;
+	atlas = NULL;
+	atlas_pages = NULL;
+}
+
+font::~font() throw()
+{
+	if(atlas_pages)
+		for(size_t i = 0; i < atlas_pages_count; i++)
+			delete[] atlas_pages[i].load();
+	delete[] atlas_pages;
 }
 
 void font::load_hex_glyph(const char* data, size_t size) throw(std::bad_alloc, std::runtime_error)
@@ -706,10 +818,63 @@ void font::load_hex(const char* data, size_t size) throw(std::bad_alloc, std::ru
 	glyphs[32].offset = memory.size() - 4;
 	for(auto& i : glyphs)
 		i.second.data = &memory[i.second.offset];
+	threads::alock h(runs_lock);
+	runs.clear();
+}
+
+void font::load_atlas(const font_atlas& _atlas) throw(std::bad_alloc)
+{
+	if(!atlas_pages) {
+		atlas_pages = new std::atomic<glyph*>[atlas_pages_count];
+		for(size_t i = 0; i < atlas_pages_count; i++)
+			atlas_pages[i].store(NULL);
+	} else {
+		for(size_t i = 0; i < atlas_pages_count; i++)
+			delete[] atlas_pages[i].exchange(NULL);
+	}
+	atlas = &_atlas;
+	threads::alock h(runs_lock);
+	runs.clear();
+}
+
+const font::glyph& font::get_atlas_glyph(uint32_t glyph) throw()
+{
+	if(glyph >= atlas_pages_count * 256)
+		return bad_glyph;
+	uint32_t page = glyph >> 8;
+	uint16_t block = atlas->pages[page];
+	if(block == atlas_no_block)
+		return bad_glyph;
+	if(atlas->blocks[256 * block + (glyph & 255)] == atlas_no_glyph)
+		return bad_glyph;
+	struct glyph* g = atlas_pages[page].load(std::memory_order_acquire);
+	if(!g) {
+		//Rendering may happen from multiple threads. If some other thread got there first, use its glyphs.
+		struct glyph* n = new(std::nothrow) struct glyph[256];
+		if(!n)
+			return bad_glyph;
+		for(unsigned i = 0; i < 256; i++) {
+			uint32_t desc = atlas->blocks[256 * block + i];
+			if(desc == atlas_no_glyph)
+				n[i] = bad_glyph;
+			else {
+				n[i].wide = desc & 1;
+				n[i].offset = desc >> 1;
+				n[i].data = const_cast<uint32_t*>(atlas->bits + n[i].offset);
+			}
+		}
+		if(atlas_pages[page].compare_exchange_strong(g, n, std::memory_order_acq_rel))
+			g = n;
+		else
+			delete[] n;
+	}
+	return g[glyph & 255];
 }
 
 const font::glyph& font::get_glyph(uint32_t glyph) throw()
 {
+	if(atlas)
+		return get_atlas_glyph(glyph);
 	if(glyphs.count(glyph))
 		return glyphs[glyph];
 	else
@@ -719,6 +884,16 @@ const font::glyph& font::get_glyph(uint32_t glyph) throw()
 std::set<uint32_t> font::get_glyphs_set()
 {
 	std::set<uint32_t> out;
+	if(atlas) {
+		for(size_t i = 0; i < atlas_pages_count; i++) {
+			if(atlas->pages[i] == atlas_no_block)
+				continue;
+			for(unsigned j = 0; j < 256; j++)
+				if(atlas->blocks[256 * atlas->pages[i] + j] != atlas_no_glyph)
+					out.insert(256 * i + j);
+		}
+		return out;
+	}
 	for(auto& i : glyphs)
 		out.insert(i.first);
 	return out;
@@ -731,37 +906,64 @@ const font::glyph& font::get_bad_glyph() throw()
 
 std::pair<size_t, size_t> font::get_metrics(const std::string& string, uint32_t xalign, bool xdbl, bool ydbl) throw()
 {
-	size_t commit_width = 0;
-	size_t commit_height = 0;
-	for_each_glyph(string, xalign, xdbl, ydbl, [&commit_width, &commit_height](uint32_t x, uint32_t y,
-		const glyph& g, bool xdbl, bool ydbl) {
-		size_t w = 1 << ((g.wide ? 4 : 3) + (xdbl ? 1 : 0));
-		size_t h = 1 << (4 + (ydbl ? 1 : 0));
-		commit_width = std::max(commit_width, (size_t)(x + w));
-		commit_height = std::max(commit_height, (size_t)(y + h));
-	});
-	return std::make_pair(commit_width, commit_height);
+	std::shared_ptr<const run> r;
+	try {
+		r = get_run(string, xalign);
+	} catch(...) {
+		return std::make_pair(0, 0);
+	}
+	return std::make_pair(r->width << (xdbl ? 1 : 0), r->height << (ydbl ? 1 : 0));
 }
 
 std::vector<font::layout> font::dolayout(const std::string& string) throw(std::bad_alloc)
 {
-	//First, calculate the number of glyphs to draw.
-	size_t chars = 0;
-	for_each_glyph(string, 0, false, false, [&chars](uint32_t x, uint32_t y, const glyph& g, bool xdbl,
-		bool ydbl) {
-		chars++;
-	});
-	//Allocate space.
-	std::vector<layout> l;
-	l.resize(chars);
-	size_t gtr = 0;
-	for_each_glyph(string, 0, false, false, [&l, &gtr](uint32_t x, uint32_t y, const glyph& g, bool xdbl,
-		bool ydbl) {
-		l[gtr].x = x;
-		l[gtr].y = y;
-		l[gtr++].dglyph = &g;
-	});
-	return l;
+	return get_run(string, 0)->glyphs;
+}
+
+std::shared_ptr<const font::run> font::get_run(const std::string& string, uint32_t alignx) throw(std::bad_alloc)
+{
+	//Alignment only matters for tabs, which are at multiples of TABSTOPS.
+	alignx %= TABSTOPS;
+	std::string key = std::string(1, (char)alignx) + string;
+	{
+		threads::alock h(runs_lock);
+		auto i = runs.find(key);
+		if(i != runs.end())
+			return i->second;
+	}
+	std::shared_ptr<run> r(new run);
+	r->width = 0;
+	r->height = 0;
+	size_t layout_x = alignx;
+	size_t layout_y = 0;
+	size_t offset = alignx;
+	utf8::to32i(string.begin(), string.end(), lambda_output_iterator<int32_t>([this, &layout_x, &layout_y,
+		offset, &r](const int32_t cp) {
+		const glyph& g = get_glyph(cp);
+		switch(cp) {
+		case 9:
+			layout_x = (layout_x + TABSTOPS) / TABSTOPS * TABSTOPS;
+			break;
+		case 10:
+			layout_x = offset;
+			layout_y = layout_y + 16;
+			break;
+		default:
+			layout l;
+			l.x = layout_x - offset;
+			l.y = layout_y;
+			l.dglyph = &g;
+			r->glyphs.push_back(l);
+			layout_x = layout_x + (g.wide ? 16 : 8);
+			r->width = std::max(r->width, layout_x - offset);
+			r->height = std::max(r->height, layout_y + 16);
+		}
+	}));
+	threads::alock h(runs_lock);
+	if(runs.size() >= max_cached_runs)
+		runs.clear();
+	runs[key] = r;
+	return r;
 }
 
 uint32_t font::get_width(const std::string& string)
@@ -791,16 +993,24 @@ template<bool X> void font::render(struct fb<X>& scr, int32_t x, int32_t y, cons
 	size_t swidth = scr.get_width();
 	size_t sheight = scr.get_height();
 
-	for_each_glyph(text, x, hdbl, vdbl, [this, x, y, &scr, swidth, sheight, &fg, &bg](uint32_t lx, uint32_t ly,
-		const glyph& g, bool hdbl, bool vdbl) {
+	std::shared_ptr<const run> text_run;
+	try {
+		text_run = get_run(text, x);
+	} catch(...) {
+		return;
+	}
+	for(auto& l : text_run->glyphs) {
+		const glyph& g = *l.dglyph;
+		uint32_t lx = l.x << (hdbl ? 1 : 0);
+		uint32_t ly = l.y << (vdbl ? 1 : 0);
 		//Render this glyph at x + lx, y + ly.
 		int32_t gx = x + lx;
 		int32_t gy = y + ly;
 		//Don't draw characters completely off-screen.
 		if(gy <= (vdbl ? -32 : -16) || gy >= (ssize_t)sheight)
-			return;
+			continue;
 		if(gx <= -(hdbl ? 2 : 1) * (g.wide ? 16 : 8) || gx >= (ssize_t)swidth)
-			return;
+			continue;
 		//Compute the bounding box.
 		uint32_t xstart = 0;
 		uint32_t ystart = 0;
@@ -845,66 +1055,46 @@ template<bool X> void font::render(struct fb<X>& scr, int32_t x, int32_t y, cons
 				for(size_t j = 0; j < xlength; j++)
 					bg.apply(r[j]);
 			}
-	});
+	}
 }
 
 void font::render(uint8_t* buf, size_t stride, const std::string& str, uint32_t alignx, bool hdbl, bool vdbl)
 {
-	for_each_glyph(str, alignx, hdbl, vdbl, [this, buf, stride]
-		(uint32_t lx, uint32_t ly, const glyph& g, bool hdbl, bool vdbl) {
-		uint8_t* ptr = buf + (ly * stride + lx);
-		size_t xlength = (g.wide ? 16 : 8) << (hdbl ? 1 : 0);
-		size_t height = 16 << (vdbl ? 1 : 0);
-
-		if(g.data)
-			for(size_t i = 0; i < height; i++) {
-				uint32_t _y = i >> (vdbl ? 1 : 0);
-				uint32_t d = g.data[_y >> (g.wide ? 1 : 2)];
-				if(g.wide)
-					d >>= 16 - ((_y & 1) << 4);
-				else
-					d >>= 24 - ((_y & 3) << 3);
-				if(hdbl)
-					for(size_t j = 0; j < xlength; j++) {
-						uint32_t b = (g.wide ? 15 : 7) - (j >> 1);
-						ptr[j] = ((d >> b) & 1);
-					}
-				else
-					for(size_t j = 0; j < xlength; j++) {
-						uint32_t b = (g.wide ? 15 : 7) - j;
-						ptr[j] = ((d >> b) & 1);
-					}
+	auto r = get_run(str, alignx);
+	for(auto& l : r->glyphs) {
+		const glyph& g = *l.dglyph;
+		if(!g.data)
+			continue;
+		uint8_t* ptr = buf + ((l.y << (vdbl ? 1 : 0)) * stride + (l.x << (hdbl ? 1 : 0)));
+		unsigned gwidth = g.wide ? 16 : 8;
+		for(size_t i = 0; i < 16; i++) {
+			uint32_t d = g.data[i >> (g.wide ? 1 : 2)];
+			if(g.wide)
+				d >>= 16 - ((i & 1) << 4);
+			else
+				d >>= 24 - ((i & 3) << 3);
+			if(hdbl)
+				for(size_t j = 0; j < gwidth; j++)
+					ptr[2 * j] = ptr[2 * j + 1] = (d >> (gwidth - 1 - j)) & 1;
+			else
+				for(size_t j = 0; j < gwidth; j++)
+					ptr[j] = (d >> (gwidth - 1 - j)) & 1;
+			if(vdbl) {
+				memcpy(ptr + stride, ptr, gwidth << (hdbl ? 1 : 0));
 				ptr += stride;
 			}
-	});
+			ptr += stride;
+		}
+	}
 }
 
 
 void font::for_each_glyph(const std::string& str, uint32_t alignx, bool xdbl, bool ydbl,
 	std::function<void(uint32_t x, uint32_t y, const glyph& g, bool xdbl, bool ydbl)> cb)
 {
-	size_t layout_x = alignx;
-	size_t layout_y = 0;
-	size_t offset = alignx;
-	unsigned _xdbl = xdbl;
-	unsigned _ydbl = ydbl;
-	auto _cb = &cb;
-	utf8::to32i(str.begin(), str.end(), lambda_output_iterator<int32_t>([this, &layout_x, &layout_y, _xdbl,
-		_ydbl, offset, _cb](const int32_t cp) {
-		const glyph& g = get_glyph(cp);
-		switch(cp) {
-		case 9:
-			layout_x = (layout_x + TABSTOPS) / TABSTOPS * TABSTOPS;
-			break;
-		case 10:
-			layout_x = offset;
-			layout_y = layout_y + 16;
-			break;
-		default:
-			(*_cb)((layout_x - offset) << _xdbl, layout_y << _ydbl, g, _xdbl, _ydbl);
-			layout_x = layout_x + (g.wide ? 16 : 8);
-		}
-	}));
+	auto r = get_run(str, alignx);
+	for(auto& l : r->glyphs)
+		cb(l.x << (xdbl ? 1 : 0), l.y << (ydbl ? 1 : 0), *l.dglyph, xdbl, ydbl);
 }
 
 
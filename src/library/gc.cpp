@@ -1,63 +1,367 @@
 #include "gc.hpp"
-#include <list>
-#include <iostream>
-#include <set>
+#include "threads.hpp"
+#include <algorithm>
+#include <vector>
+#include <sys/time.h>
 
 namespace GC
 {
 namespace
 {
-	std::set<item*>* gc_items;
+	//Minor collection is done when young generation has this many items.
+	const size_t young_limit = 4096;
+	//Major collection is started when old generation has grown to this many items and by this factor since the
+	//last major collection.
+	const size_t old_minimum = 16384;
+	const size_t old_growth = 2;
+	//Number of items scanned, traced or swept in one step of major collection.
+	const size_t step_budget = 2048;
+
+	uint64_t get_utime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+	}
+}
+
+struct heap
+{
+	enum phase_t
+	{
+		IDLE,
+		MARK,
+		SWEEP
+	};
+	heap()
+	{
+		list[0] = list[1] = NULL;
+		count[0] = count[1] = 0;
+		epoch = false;
+		phase = IDLE;
+		minor = false;
+		cursor = NULL;
+		cursor_old = false;
+		old_after_major = 0;
+		st.minor_collections = 0;
+		st.major_collections = 0;
+		st.freed = 0;
+		st.promoted = 0;
+		st.last_pause = 0;
+		st.max_pause = 0;
+	}
+	void link(item* i)
+	{
+		item*& head = list[i->old ? 1 : 0];
+		i->prev = NULL;
+		i->next = head;
+		if(head) head->prev = i;
+		head = i;
+		count[i->old ? 1 : 0]++;
+	}
+	void unlink(item* i)
+	{
+		if(i->prev) i->prev->next = i->next;
+		else list[i->old ? 1 : 0] = i->next;
+		if(i->next) i->next->prev = i->prev;
+		count[i->old ? 1 : 0]--;
+	}
+	void promote(item* i)
+	{
+		unlink(i);
+		i->old = true;
+		link(i);
+		st.promoted++;
+	}
+	void shade(item* i)
+	{
+		i->epoch = epoch;
+		i->gray = true;
+		gray_stack.push_back(i);
+	}
+	//Trace gray items, at most budget of them. Returns true if no gray items are left.
+	bool drain(size_t& budget)
+	{
+		while(!gray_stack.empty()) {
+			if(!budget)
+				return false;
+			item* i = gray_stack.back();
+			gray_stack.pop_back();
+			i->gray = false;
+			i->trace();
+			budget--;
+		}
+		return true;
+	}
+	//Collect the young generation. Old items are assumed to be reachable.
+	void minor_collect()
+	{
+		uint64_t t = get_utime();
+		minor = true;
+		for(item* i = list[0]; i; i = i->next)
+			i->epoch = !epoch;
+		for(item* i = list[0]; i; i = i->next)
+			if(i->root_count && i->epoch != epoch)
+				i->mark();
+		//Old items with changed references may point to young ones.
+		for(auto i : remembered_set) {
+			i->remembered = false;
+			i->trace();
+		}
+		remembered_set.clear();
+		size_t unlimited = static_cast<size_t>(-1);
+		drain(unlimited);
+		minor = false;
+		//Everything left in young generation is either freed or promoted.
+		while(list[0]) {
+			item* i = list[0];
+			if(i->epoch != epoch) {
+				delete i;
+				st.freed++;
+			} else
+				promote(i);
+		}
+		st.minor_collections++;
+		pause_end(t);
+	}
+	void start_major()
+	{
+		//Flipping the epoch makes all items unmarked at once. The major collection looks at all items, so
+		//nothing needs to be remembered for minor collections anymore.
+		epoch = !epoch;
+		for(auto i : remembered_set)
+			i->remembered = false;
+		remembered_set.clear();
+		phase = MARK;
+		cursor = list[0];
+		cursor_old = false;
+	}
+	//Do at most budget units of work on major collection.
+	void major_step(size_t budget)
+	{
+		if(phase == MARK) {
+			//Scan for roots.
+			while(true) {
+				if(!cursor && !cursor_old) {
+					cursor = list[1];
+					cursor_old = true;
+				}
+				if(!cursor)
+					break;
+				if(!budget)
+					return;
+				item* i = cursor;
+				cursor = i->next;
+				if(i->root_count && i->epoch != epoch)
+					i->mark();
+				budget--;
+				if(!drain(budget))
+					return;
+			}
+			if(!drain(budget))
+				return;
+			phase = SWEEP;
+			cursor = list[1];
+			cursor_old = true;
+		}
+		if(phase == SWEEP) {
+			//Old generation is swept first, so the promoted items need not be visited.
+			while(true) {
+				if(!cursor && cursor_old) {
+					cursor = list[0];
+					cursor_old = false;
+				}
+				if(!cursor)
+					break;
+				if(!budget)
+					return;
+				item* i = cursor;
+				cursor = i->next;
+				if(i->epoch != epoch) {
+					delete i;
+					st.freed++;
+				} else if(!i->old)
+					promote(i);
+				budget--;
+			}
+			phase = IDLE;
+			old_after_major = count[1];
+			st.major_collections++;
+		}
+	}
+	void pause_end(uint64_t start)
+	{
+		st.last_pause = get_utime() - start;
+		st.max_pause = std::max(st.max_pause, st.last_pause);
+	}
+	item* list[2];
+	size_t count[2];
+	std::vector<item*> gray_stack;
+	std::vector<item*> remembered_set;
+	//Item is marked if its epoch equals this. When no major collection is in progress, all items are marked.
+	bool epoch;
+	phase_t phase;
+	bool minor;
+	//Next item to scan or sweep in major collection, and the generation it is in.
+	item* cursor;
+	bool cursor_old;
+	size_t old_after_major;
+	stats st;
+	//Pointers are copied on any thread that evaluates expressions (e.g. search workers), while collection runs
+	//on the emulation thread. Recursive, as freeing items drops the pointers they hold.
+	threads::rlock lock;
+};
+
+namespace
+{
+	heap& get_heap()
+	{
+		//Never freed, as items may outlive static destruction.
+		static heap* gc_heap = new heap;
+		return *gc_heap;
+	}
 }
 
 item::item()
 {
-	if(!gc_items) gc_items = new std::set<item*>;
-	gc_items->insert(this);
 	root_count = 1;
+	old = false;
+	gray = false;
+	remembered = false;
+	enrolled = false;
+	epoch = false;
+}
+
+item::item(const item& i)
+{
+	root_count = 1;
+	old = false;
+	gray = false;
+	remembered = false;
+	enrolled = false;
+	epoch = false;
+}
+
+void item::enroll()
+{
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
+	if(enrolled)
+		return;
+	enrolled = true;
+	epoch = h.epoch;
+	h.link(this);
+	//During marking, new items are traced, as they may reference items that are no longer roots.
+	if(h.phase == heap::MARK)
+		h.shade(this);
+}
+
+item& item::operator=(const item& i)
+{
+	//Identity in collector is not copied.
+	return *this;
 }
 
 item::~item()
 {
-	gc_items->erase(this);
+	if(!enrolled)
+		return;
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
+	if(h.cursor == this)
+		h.cursor = next;
+	h.unlink(this);
+	if(gray) {
+		auto i = std::find(h.gray_stack.begin(), h.gray_stack.end(), this);
+		if(i != h.gray_stack.end()) h.gray_stack.erase(i);
+	}
+	if(remembered) {
+		auto i = std::find(h.remembered_set.begin(), h.remembered_set.end(), this);
+		if(i != h.remembered_set.end()) h.remembered_set.erase(i);
+	}
 }
 
 void item::mark_root()
 {
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
 	root_count++;
+	//A new root may be referenced only from items already traced.
+	if(h.phase == heap::MARK && epoch != h.epoch)
+		h.shade(this);
 }
 
 void item::unmark_root()
 {
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
 	if(root_count) root_count--;
 }
 
 void item::do_gc()
 {
-	if(!gc_items) return;
-	for(auto i : *gc_items)
-		i->reachable = false;
-	for(auto i : *gc_items) {
-		if(i->root_count) {
-			i->mark();
-		}
-	}
-	for(auto i = gc_items->begin(); i != gc_items->end();) {
-		if(!(*i)->reachable) {
-			auto ptr = i;
-			i++;
-			delete *ptr;
-		} else
-			i++;
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
+	uint64_t t = get_utime();
+	size_t unlimited = static_cast<size_t>(-1);
+	//Finish any collection in progress, and then do a full one, which frees everything unreachable.
+	if(h.phase != heap::IDLE)
+		h.major_step(unlimited);
+	h.start_major();
+	h.major_step(unlimited);
+	h.pause_end(t);
+}
+
+void item::gc_step()
+{
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
+	if(h.phase != heap::IDLE) {
+		uint64_t t = get_utime();
+		h.major_step(step_budget);
+		h.pause_end(t);
+	} else if(h.count[0] >= young_limit)
+		h.minor_collect();
+	else if(h.count[1] >= std::max(old_minimum, old_growth * h.old_after_major)) {
+		uint64_t t = get_utime();
+		h.start_major();
+		h.major_step(step_budget);
+		h.pause_end(t);
 	}
 }
 
+stats item::get_stats()
+{
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
+	stats s = h.st;
+	s.young_items = h.count[0];
+	s.old_items = h.count[1];
+	s.major_in_progress = (h.phase != heap::IDLE);
+	return s;
+}
+
 void item::mark()
 {
-	bool was_reachable = reachable;
-	reachable = true;
-	if(!was_reachable) {
-		trace();
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
+	//Old items are reachable as far as minor collection is concerned.
+	if(h.minor && old)
+		return;
+	if(epoch != h.epoch)
+		h.shade(this);
+}
+
+void item::write_barrier()
+{
+	heap& h = get_heap();
+	threads::arlock hl(h.lock);
+	//Retrace if already traced.
+	if(h.phase == heap::MARK && epoch == h.epoch && !gray)
+		h.shade(this);
+	if(old && !remembered) {
+		remembered = true;
+		h.remembered_set.push_back(this);
 	}
 }
 }
@@ -5,13 +5,18 @@
 #include "lua-pin.hpp"
 #include "stateobject.hpp"
 #include "threads.hpp"
+#include "minmax.hpp"
 #include <iostream>
 #include <cassert>
+#include <cstring>
 
 namespace lua
 {
 namespace
 {
+	//Memory is charged against the limit and reported to the change handler in units of this.
+	const size_t memory_batch = 65536;
+
 	threads::rlock* global_lock;
 	threads::rlock& get_lua_lock()
 	{
@@ -320,12 +325,14 @@ state::state() throw(std::bad_alloc)
 	interruptable = false;		//Assume initially not interruptable.
 	memory_limit = (size_t)-1;	//Unlimited.
 	memory_use = 0;
+	memory_credit = 0;
 }
 
 state::state(state& _master, lua_State* L)
 {
 	master = &_master;
 	lua_handle = L;
+	memory_credit = 0;
 }
 
 state::~state() throw()
@@ -341,6 +348,7 @@ state::~state() throw()
 		i.first->drop_callback(i.second);
 	if(lua_handle)
 		lua_close(lua_handle);
+	release_memory_credit();
 	state_internal_t::clear(this);
 }
 
@@ -364,25 +372,27 @@ void* state::builtin_alloc(void* user, void* old, size_t olds, size_t news)
 {
 	void* m;
 	auto& st = *reinterpret_cast<state*>(user);
+	//Lua 5.2+ passes the object type as old size of new objects.
+	if(!old)
+		olds = 0;
+	size_t grow = (news > olds) ? news - olds : 0;
 	if(news) {
-		if(news > olds && !st.charge_memory(news - olds, false)) {
+		if(!st.reserve_memory(grow)) {
 			goto retry_allocation;
 		}
-		m = realloc(old, news);
+		m = st.raw_realloc(old, olds, news);
 		if(!m && !st.get_interruptable_flag())
 			st.oom_handler();
 		if(!m) {
-			st.charge_memory(news - olds, true);	//Undo commit.
+			st.unreserve_memory(grow);	//Undo commit.
 			goto retry_allocation;
 		}
 		if(news < olds)
-			st.charge_memory(olds - news, true);	//Release memory.
-		if(m && st.memory_change) st.memory_change((ssize_t)news - (ssize_t)olds);
+			st.unreserve_memory(olds - news);	//Release memory.
 		return m;
-	} else {
-		st.charge_memory(olds, true);	//Release memory.
-		if(st.memory_change) st.memory_change(-(ssize_t)olds);
-		free(old);
+	} else if(old) {
+		st.unreserve_memory(olds);	//Release memory.
+		st.raw_free(old, olds);
 	}
 	return NULL;
 retry_allocation:
@@ -390,18 +400,53 @@ retry_allocation:
 	st.interruptable = false;			//Give everything we got for the GC.
 	lua_gc(st.lua_handle, LUA_GCCOLLECT,0);		//Do full cycle to try to free some memory.
 	st.interruptable = true;
-	if(!st.charge_memory(news - olds, false)) {	//Try to see if memory can be allocated.
+	if(!st.reserve_memory(grow)) {	//Try to see if memory can be allocated.
 		st.soft_oom_handler(-1);
 		return NULL;
 	}
-	m = realloc(old, news);
-	if(!m && news > olds)
-		st.charge_memory(news - olds, true);	//Undo commit.
+	m = st.raw_realloc(old, olds, news);
+	if(!m)
+		st.unreserve_memory(grow);	//Undo commit.
+	else if(news < olds)
+		st.unreserve_memory(olds - news);	//Release memory.
 	st.soft_oom_handler(m ? 1 : -1);
-	if(m && st.memory_change) st.memory_change((ssize_t)news - (ssize_t)olds);
 	return m;
 }
 
+void* state::raw_realloc(void* old, size_t olds, size_t news) throw()
+{
+	//Small blocks come from the pool. Lua always tells the size of old block, which tells where it came from.
+	bool old_small = old && slab::pool::handles(olds);
+	if(!slab::pool::handles(news)) {
+		if(!old_small)
+			return realloc(old, news);
+		void* m = malloc(news);
+		if(!m)
+			return NULL;
+		memcpy(m, old, olds);
+		small_blocks.release(old, olds);
+		return m;
+	}
+	if(old_small && slab::pool::same_class(olds, news))
+		return old;
+	void* m = small_blocks.allocate(news);
+	if(!m)
+		return NULL;
+	if(old) {
+		memcpy(m, old, min(olds, news));
+		raw_free(old, olds);
+	}
+	return m;
+}
+
+void state::raw_free(void* old, size_t olds) throw()
+{
+	if(slab::pool::handles(olds))
+		small_blocks.release(old, olds);
+	else
+		free(old);
+}
+
 void state::push_trampoline(int(*fn)(state& L), unsigned n_upvals)
 {
 	lua_pushlightuserdata(lua_handle, (void*)&get_master());
@@ -440,6 +485,46 @@ void state::run_interruptable(std::function<void()> fn, unsigned in, unsigned ou
 	}
 }
 
+bool state::reserve_memory(size_t amount)
+{
+	if(amount <= memory_credit) {
+		memory_credit -= amount;
+		return true;
+	}
+	//Charge whole batches, except near the limit charge just what is needed.
+	size_t need = amount - memory_credit;
+	size_t batch = (need + memory_batch - 1) / memory_batch * memory_batch;
+	if(batch < need || !charge_memory(batch, false)) {
+		if(!charge_memory(need, false))
+			return false;
+		batch = need;
+	}
+	if(memory_change) memory_change(batch);
+	memory_credit = memory_credit + batch - amount;
+	return true;
+}
+
+void state::unreserve_memory(size_t amount)
+{
+	memory_credit += amount;
+	if(memory_credit > 2 * memory_batch) {
+		//Keep one batch for future allocations.
+		size_t excess = memory_credit - memory_batch;
+		charge_memory(excess, true);
+		if(memory_change) memory_change(-(ssize_t)excess);
+		memory_credit = memory_batch;
+	}
+}
+
+void state::release_memory_credit()
+{
+	if(!memory_credit)
+		return;
+	charge_memory(memory_credit, true);
+	if(memory_change) memory_change(-(ssize_t)memory_credit);
+	memory_credit = 0;
+}
+
 bool state::charge_memory(size_t amount, bool release)
 {
 	if(master) return master->charge_memory(amount, release);
@@ -523,6 +608,9 @@ void state::deinit() throw()
 	if(lua_handle)
 		lua_close(lua_handle);
 	lua_handle = NULL;
+	//Nothing is allocated anymore.
+	release_memory_credit();
+	small_blocks.clear();
 }
 
 void state::add_function_group(function_group& group)
@@ -0,0 +1,146 @@
+#include "lzblock.hpp"
+#include "serialization.hpp"
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+//The compressed block starts with 8-byte uncompressed size. It is followed by sequences, each having a token byte
+//(high nibble is number of literals, low nibble is match length minus 4, 15 in either meaning more length bytes
+//follow), extra literal length bytes, the literals, 2-byte match offset and extra match length bytes. The last
+//sequence ends after its literals.
+namespace lzblock
+{
+namespace
+{
+	const unsigned hash_bits = 14;
+	const size_t min_match = 4;
+	const size_t max_offset = 65535;
+
+	inline uint32_t read32(const char* p)
+	{
+		uint32_t x;
+		memcpy(&x, p, 4);
+		return x;
+	}
+
+	inline uint32_t hash(uint32_t x)
+	{
+		return (x * 2654435761U) >> (32 - hash_bits);
+	}
+
+	inline void write_length(std::vector<char>& out, size_t len)
+	{
+		while(len >= 255) {
+			out.push_back((char)255);
+			len -= 255;
+		}
+		out.push_back((char)len);
+	}
+
+	void write_sequence(std::vector<char>& out, const char* lit, size_t litlen, size_t offset, size_t matchlen)
+	{
+		uint8_t token = (std::min(litlen, (size_t)15) << 4);
+		if(matchlen)
+			token |= std::min(matchlen - min_match, (size_t)15);
+		out.push_back(token);
+		if(litlen >= 15)
+			write_length(out, litlen - 15);
+		out.insert(out.end(), lit, lit + litlen);
+		if(!matchlen)
+			return;
+		out.push_back(offset & 0xFF);
+		out.push_back(offset >> 8);
+		if(matchlen - min_match >= 15)
+			write_length(out, matchlen - min_match - 15);
+	}
+
+	size_t read_length(const uint8_t*& in, const uint8_t* end, size_t len)
+	{
+		if(len != 15)
+			return len;
+		while(true) {
+			if(in == end)
+				throw std::runtime_error("Compressed data truncated");
+			uint8_t b = *(in++);
+			len += b;
+			if(b != 255)
+				return len;
+		}
+	}
+}
+
+std::vector<char> compress(const char* in, size_t size) throw(std::bad_alloc)
+{
+	std::vector<char> out;
+	out.reserve(size / 2 + 64);
+	out.resize(8);
+	serialization::u64l(&out[0], size);
+	//Positions are stored plus one, so zero means no entry.
+	std::vector<uint32_t> table(1 << hash_bits);
+	size_t pos = 0;
+	size_t anchor = 0;
+	//Matches are looked for while at least min_match bytes are left, and may extend to the end.
+	while(size >= min_match && pos <= size - min_match) {
+		uint32_t x = read32(in + pos);
+		uint32_t h = hash(x);
+		size_t cand = table[h];
+		table[h] = pos + 1;
+		if(!cand || pos - (cand - 1) > max_offset || read32(in + cand - 1) != x) {
+			//Step faster through data that does not seem to compress.
+			pos += 1 + ((pos - anchor) >> 6);
+			continue;
+		}
+		cand--;
+		size_t len = min_match;
+		while(pos + len < size && in[cand + len] == in[pos + len])
+			len++;
+		write_sequence(out, in + anchor, pos - anchor, pos - cand, len);
+		pos += len;
+		anchor = pos;
+	}
+	write_sequence(out, in + anchor, size - anchor, 0, 0);
+	return out;
+}
+
+std::vector<char> decompress(const char* _in, size_t size) throw(std::bad_alloc, std::runtime_error)
+{
+	if(size < 8)
+		throw std::runtime_error("Compressed data truncated");
+	uint64_t outsize = serialization::u64l(_in);
+	const uint8_t* in = reinterpret_cast<const uint8_t*>(_in) + 8;
+	const uint8_t* end = reinterpret_cast<const uint8_t*>(_in) + size;
+	std::vector<char> out(outsize);
+	size_t pos = 0;
+	while(true) {
+		if(in == end)
+			throw std::runtime_error("Compressed data truncated");
+		uint8_t token = *(in++);
+		size_t litlen = read_length(in, end, token >> 4);
+		if(litlen > (size_t)(end - in) || litlen > outsize - pos)
+			throw std::runtime_error("Compressed data corrupt");
+		if(litlen)
+			memcpy(&out[pos], in, litlen);
+		in += litlen;
+		pos += litlen;
+		if(pos == outsize && in == end)
+			return out;
+		if(end - in < 2)
+			throw std::runtime_error("Compressed data truncated");
+		size_t offset = in[0] | ((size_t)in[1] << 8);
+		in += 2;
+		size_t matchlen = read_length(in, end, token & 15) + min_match;
+		if(!offset || offset > pos || matchlen > outsize - pos)
+			throw std::runtime_error("Compressed data corrupt");
+		char* dst = &out[pos];
+		const char* src = dst - offset;
+		//Overlapping match repeats the last offset bytes. Copy whole periods at once, doubling each time.
+		size_t done = 0;
+		while(done < matchlen) {
+			size_t chunk = std::min(offset + done, matchlen - done);
+			memcpy(dst + done, src, chunk);
+			done += chunk;
+		}
+		pos += matchlen;
+	}
+}
+}
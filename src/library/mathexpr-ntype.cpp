@@ -151,6 +151,10 @@ namespace
 		{
 			return as_signed();
 		}
+		double tofloat()
+		{
+			return as_float();
+		}
 		void scale(uint64_t scale)
 		{
 			switch(type) {
@@ -755,6 +759,15 @@ namespace
 				throw_domain("Can't convert non-number into signed");
 			return v_numeric.tosigned();
 		}
+		double tofloat()
+		{
+			//Booleans are 0 or 1, so conditions can be used as numbers.
+			if(type == T_BOOLEAN)
+				return v_boolean ? 1 : 0;
+			if(type != T_NUMERIC)
+				throw_domain("Can't convert non-number into float");
+			return v_numeric.tofloat();
+		}
 		void scale(uint64_t _scale)
 		{
 			if(type != T_NUMERIC)
@@ -123,6 +123,7 @@ mathexpr& mathexpr::operator=(const mathexpr& m)
 	m.owns_operator = false;
 	std::swap(arguments, _arguments);
 	std::swap(_error, _xerror);
+	write_barrier();
 	return *this;
 }
 
@@ -4,6 +4,8 @@
 #include "int24.hpp"
 #include "string.hpp"
 #include <algorithm>
+#include <limits>
+#include <stdexcept>
 
 namespace
 {
@@ -59,6 +61,42 @@ namespace
 			r.read(offset, buffer, bsize);
 	}
 
+	template<typename T> void batch_decode(uint64_t& slot, const unsigned char* ptr, int endian)
+	{
+		T v = serialization::read_endian<T>(ptr, endian);
+		memcpy(&slot, &v, sizeof(T));
+	}
+
+	template<typename T> void batch_read(uint64_t& slot, memory_space& m, uint64_t addr)
+	{
+		T v = m.read<T>(addr);
+		memcpy(&slot, &v, sizeof(T));
+	}
+
+	struct batch_type_info
+	{
+		const char* name;
+		unsigned size;
+		void (*decode)(uint64_t& slot, const unsigned char* ptr, int endian);
+		void (*read)(uint64_t& slot, memory_space& m, uint64_t addr);
+	};
+
+	//Indexed by memory_batch::type.
+	const batch_type_info batch_types[] = {
+		{"byte", 1, batch_decode<uint8_t>, batch_read<uint8_t>},
+		{"sbyte", 1, batch_decode<int8_t>, batch_read<int8_t>},
+		{"word", 2, batch_decode<uint16_t>, batch_read<uint16_t>},
+		{"sword", 2, batch_decode<int16_t>, batch_read<int16_t>},
+		{"hword", 3, batch_decode<ss_uint24_t>, batch_read<ss_uint24_t>},
+		{"shword", 3, batch_decode<ss_int24_t>, batch_read<ss_int24_t>},
+		{"dword", 4, batch_decode<uint32_t>, batch_read<uint32_t>},
+		{"sdword", 4, batch_decode<int32_t>, batch_read<int32_t>},
+		{"qword", 8, batch_decode<uint64_t>, batch_read<uint64_t>},
+		{"sqword", 8, batch_decode<int64_t>, batch_read<int64_t>},
+		{"float", 4, batch_decode<float>, batch_read<float>},
+		{"double", 8, batch_decode<double>, batch_read<double>},
+	};
+
 	bool write_range_r(memory_space::region& r, uint64_t offset, const void* buffer, size_t bsize)
 	{
 		if(r.readonly)
@@ -429,3 +467,59 @@ bool memoryspace_row_limited(uint64_t base, uint64_t size, uint64_t rows, uint64
 		return true;
 	return (g.second < limit);
 }
+
+memory_batch::memory_batch(uint64_t _base, const std::vector<field>& _fields, uint64_t _rows, uint64_t _stride)
+	: base(_base), rows(_rows), stride(_stride), fields(_fields)
+{
+	recsize = 0;
+	for(auto& i : fields) {
+		uint64_t end = i.offset + type_size(i.t);
+		if(end < i.offset)
+			throw std::runtime_error("Field offset too large");
+		recsize = max(recsize, end);
+	}
+	if(fields.empty())
+		rows = 0;
+	if(rows && fields.size() > std::numeric_limits<size_t>::max() / rows)
+		throw std::runtime_error("Batch too large");
+	values.resize(rows * fields.size());
+}
+
+memory_batch::type memory_batch::type_by_name(const std::string& name)
+{
+	for(unsigned i = 0; i < sizeof(batch_types) / sizeof(batch_types[0]); i++)
+		if(name == batch_types[i].name)
+			return (type)i;
+	throw std::runtime_error("Unknown type '" + name + "'");
+}
+
+unsigned memory_batch::type_size(type t) throw()
+{
+	return batch_types[t].size;
+}
+
+void memory_batch::refresh(memory_space& m)
+{
+	if(values.empty())
+		return;
+	size_t nfields = fields.size();
+	uint64_t low, high;
+	rpair(low, high) = memoryspace_row_bounds(base, recsize, rows, stride);
+	auto g = m.lookup(low);
+	if(low <= high && g.first && g.first->direct_map && high <= g.first->last_address()) {
+		//Everything is in one directly mapped region, decode straight from it.
+		const unsigned char* rbase = g.first->direct_map;
+		int endian = g.first->endian;
+		uint64_t addr = base - g.first->base;
+		size_t k = 0;
+		for(uint64_t i = 0; i < rows; i++, addr += stride)
+			for(size_t j = 0; j < nfields; j++, k++)
+				batch_types[fields[j].t].decode(values[k], rbase + addr + fields[j].offset, endian);
+	} else {
+		uint64_t addr = base;
+		size_t k = 0;
+		for(uint64_t i = 0; i < rows; i++, addr += stride)
+			for(size_t j = 0; j < nfields; j++, k++)
+				batch_types[fields[j].t].read(values[k], m, addr + fields[j].offset);
+	}
+}
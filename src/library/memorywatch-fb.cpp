@@ -58,38 +58,21 @@ namespace
 		p.halo.set_palette(scr);
 
 		bool has_halo = p.halo;
-		//Layout the text.
-		int64_t orig_x = p.x;
-		int64_t drawx = p.x;
-		int64_t drawy = p.y;
-		int64_t max_drawx = p.x;
-		for(size_t i = 0; i < msg.size();) {
-			uint32_t cp = msg[i];
-			std::u32string k = p.font->best_ligature_match(msg, i);
-			const framebuffer::font2::glyph& glyph = p.font->lookup_glyph(k);
-			if(k.length())
-				i += k.length();
-			else
-				i++;
-			if(cp == 9) {
-				drawx = (drawx + 64) >> 6 << 6;
-			} else if(cp == 10) {
-				drawx = orig_x;
-				drawy += p.font->get_rowadvance();
-			} else {
-				drawx += glyph.width;
-				max_drawx = max(max_drawx, drawx);
-			}
+		std::shared_ptr<const framebuffer::font2::run> r;
+		try {
+			r = p.font->get_run(msg, p.x);
+		} catch(...) {
+			return;
 		}
-		uint64_t width = max_drawx - p.x;
-		uint64_t height = drawy - p.y;
+		//Layout the text.
+		uint64_t width = r->width;
+		uint64_t height = r->advance_y;
 		if(has_halo) {
 			width += 2;
 			height += 2;
 		}
-		drawx = p.x;
-		drawy = p.y;
-		orig_x = p.x;
+		int64_t drawx = p.x;
+		int64_t drawy = p.y;
 		if(p.cliprange_x) {
 			if(drawx < 0)
 				drawx = 0;
@@ -103,28 +86,19 @@ namespace
 				drawy = scr.get_height() - height;
 		}
 		if(has_halo) {
-			orig_x++;
 			drawx++;
 			drawy++;
 		}
-		for(size_t i = 0; i < msg.size();) {
-			uint32_t cp = msg[i];
-			std::u32string k = p.font->best_ligature_match(msg, i);
-			const framebuffer::font2::glyph& glyph = p.font->lookup_glyph(k);
-			if(k.length())
-				i += k.length();
-			else
-				i++;
-			if(cp == 9) {
-				drawx = (drawx + 64) >> 6 << 6;
-			} else if(cp == 10) {
-				drawx = orig_x;
-				drawy += p.font->get_rowadvance();
-			} else {
-				glyph.render(scr, drawx, drawy, p.fg, p.bg, p.halo);
-				drawx += glyph.width;
+		//Tabs depend on alignment, so clipping may change the layout.
+		if(((drawx ^ p.x) & 63) != 0) {
+			try {
+				r = p.font->get_run(msg, drawx);
+			} catch(...) {
+				return;
 			}
 		}
+		for(auto& i : r->glyphs)
+			i.g->render(scr, drawx + i.x, drawy + i.y, p.fg, p.bg, p.halo);
 	}
 }
 
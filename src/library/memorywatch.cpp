@@ -248,6 +248,8 @@ void set::refresh()
 		i.second.expr->reset();
 	for(auto& i : roots)
 		i.second.show(i.first);
+	//Free the garbage from destroyed watches a bit at a time.
+	GC::item::gc_step();
 }
 
 std::set<std::string> set::names_set()
@@ -284,7 +286,8 @@ void set::destroy(const std::string& name)
 	if(!roots.count(name))
 		return;
 	roots.erase(name);
-	GC::item::do_gc();
+	//Many watches may be destroyed in a row, so do not collect everything each time.
+	GC::item::gc_step();
 }
 
 const std::string& set::get_longest_name(std::function<size_t(const std::string& n)> rate)
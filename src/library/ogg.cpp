@@ -7,7 +7,15 @@
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 #include "string.hpp"
+#if defined(_WIN32) || defined(_WIN64)
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 namespace ogg
 {
@@ -88,6 +96,36 @@ namespace {
 			chain = (chain << 8) ^ crc_lookup[(chain >> 24) ^ data[i]];
 		return chain;
 	}
+
+	//Largest possible page: header, full segment table and 255 full segments.
+	const size_t max_page_size = 27 + 255 + 255 * 255;
+	//Offset of data in packet_writer arena.
+	const size_t arena_data_offset = 27 + 255;
+}
+
+packet_view::packet_view() throw()
+{
+	first_page = false;
+	last_page = false;
+	spans_page = false;
+	eos_page = false;
+	bos_page = false;
+	granulepos = 0;
+	data = NULL;
+	length = 0;
+}
+
+packet_view::packet_view(uint64_t granule, bool first, bool last, bool spans, bool eos, bool bos, const uint8_t* d,
+	size_t dlen) throw()
+{
+	granulepos = granule;
+	first_page = first;
+	last_page = last;
+	spans_page = spans;
+	eos_page = eos;
+	bos_page = bos;
+	data = d;
+	length = dlen;
 }
 
 
@@ -103,6 +141,17 @@ packet::packet(uint64_t granule, bool first, bool last, bool spans, bool eos, bo
 	bos_page = bos;
 }
 
+packet::packet(const packet_view& v)
+{
+	data.assign(v.get_data(), v.get_data() + v.get_length());
+	granulepos = v.get_granulepos();
+	first_page = v.get_first_page();
+	last_page = v.get_last_page();
+	spans_page = v.get_spans_page();
+	eos_page = v.get_on_eos_page();
+	bos_page = v.get_on_bos_page();
+}
+
 demuxer::demuxer(std::ostream& _errors_to)
 	: errors_to(_errors_to)
 {
@@ -189,6 +238,17 @@ void demuxer::complain_continue_errors(unsigned flags, uint32_t seqno, uint32_t
 }
 
 bool demuxer::page_in(const page& p)
+{
+	if(seen_page && p.get_stream() != imprint_stream)
+		return false;		//Wrong stream.
+	if(!wants_page_in())
+		throw std::runtime_error("Not ready for page");
+	//The packets are output from the copy.
+	owned_page = p;
+	return page_in(page_view(owned_page));
+}
+
+bool demuxer::page_in(const page_view& p)
 {
 	//Is this from the right stream? If not, ignore page.
 	uint32_t stream = p.get_stream();
@@ -196,7 +256,6 @@ bool demuxer::page_in(const page& p)
 		return false;		//Wrong stream.
 	if(!wants_page_in())
 		throw std::runtime_error("Not ready for page");
-	std::vector<uint8_t> newbuffer;
 	uint32_t sequence = p.get_sequence();
 	uint32_t pkts = p.get_packet_count();
 	uint64_t granulepos = p.get_granulepos();
@@ -227,10 +286,7 @@ bool demuxer::page_in(const page& p)
 		if(pkts == 1 && incomplete) {
 			//Nothing finishes on this page either.
 			auto frag = p.get_packet(0);
-			newbuffer.resize(partial.size() + frag.second);
-			memcpy(&newbuffer[0], &partial[0], partial.size());
-			memcpy(&newbuffer[partial.size()], frag.first, frag.second);
-			std::swap(newbuffer, partial);
+			partial.insert(partial.end(), frag.first, frag.first + frag.second);
 			damaged_packet = damaged_packet || gap;
 			seen_page = true;
 			imprint_stream = stream;
@@ -242,9 +298,7 @@ bool demuxer::page_in(const page& p)
 		} else if(pkts == 2 && incomplete && (partial.empty() || damaged_packet || gap)) {
 			//The first packet is busted and the second is incomplete. Load the rest.
 			auto frag = p.get_packet(1);
-			newbuffer.resize(frag.second);
-			memcpy(&newbuffer[0], frag.first, frag.second);
-			std::swap(newbuffer, partial);
+			partial.assign(frag.first, frag.first + frag.second);
 			seen_page = true;
 			imprint_stream = stream;
 			update_pageseq(sequence);
@@ -261,6 +315,12 @@ bool demuxer::page_in(const page& p)
 	packets = pkts;
 	if(incomplete)
 		packets--;
+	if(incomplete && !packets) {
+		//A packet starts on this page but nothing finishes, so packet_out() will not load the fragment.
+		auto frag = p.get_packet(0);
+		partial.assign(frag.first, frag.first + frag.second);
+		started_bos = bos;
+	}
 	last_page = p;
 	damaged_packet = false;
 	seen_page = true;
@@ -273,36 +333,37 @@ bool demuxer::page_in(const page& p)
 }
 
 void demuxer::packet_out(ogg::packet& pkt)
+{
+	packet_view v;
+	packet_out(v);
+	pkt = packet(v);
+}
+
+void demuxer::packet_out(packet_view& pkt)
 {
 	if(!wants_packet_out())
 		throw std::runtime_error("Not ready for packet");
 	bool firstfrag = (dpacket == 0 && last_page.get_continue());
 	bool lastfrag = (dpacket == packets - 1 && last_page.get_last_packet_incomplete());
 	if(!firstfrag) {
-		//Wholly on this page.
-		std::vector<uint8_t> newbuffer;
+		//Wholly on this page, point to the page.
 		auto frag = last_page.get_packet(dpacket);
-		newbuffer.resize(frag.second);
-		memcpy(&newbuffer[0], frag.first, frag.second);
-		pkt = packet(last_page.get_granulepos(), dpacket == 0, (dpacket == packets - 1), false,
-			last_page.get_eos(), last_page.get_bos(), newbuffer);
+		pkt = packet_view(last_page.get_granulepos(), dpacket == 0, (dpacket == packets - 1), false,
+			last_page.get_eos(), last_page.get_bos(), frag.first, frag.second);
 	} else {
-		//Continued from the last page.
-		std::vector<uint8_t> newbuffer;
+		//Continued from the last page. This has to be assembled, but the buffer is reused.
 		auto frag = last_page.get_packet(0);
-		newbuffer.resize(partial.size() + frag.second);
-		memcpy(&newbuffer[0], &partial[0], partial.size());
-		memcpy(&newbuffer[partial.size()], frag.first, frag.second);
-		pkt = packet(last_page.get_granulepos(), true, (packets == 1), true, last_page.get_eos(),
-			started_bos, newbuffer);
+		assembled.assign(partial.begin(), partial.end());
+		assembled.insert(assembled.end(), frag.first, frag.first + frag.second);
+		//Consumed, so the next page doesn't look like a continuation.
+		partial.clear();
+		pkt = packet_view(last_page.get_granulepos(), true, (packets == 1), true, last_page.get_eos(),
+			started_bos, assembled.empty() ? NULL : &assembled[0], assembled.size());
 	}
 	if(lastfrag) {
 		//Load the next packet fragment
 		auto frag2 = last_page.get_packet(dpacket + 1);
-		std::vector<uint8_t> newbuffer;
-		newbuffer.resize(frag2.second);
-		memcpy(&newbuffer[0], frag2.first, frag2.second);
-		std::swap(newbuffer, partial);
+		partial.assign(frag2.first, frag2.first + frag2.second);
 		started_bos = last_page.get_bos();
 	}
 	dpacket++;
@@ -312,14 +373,14 @@ void demuxer::discard_packet()
 {
 	if(!wants_packet_out())
 		throw std::runtime_error("Not ready for packet");
+	bool firstfrag = (dpacket == 0 && last_page.get_continue());
 	bool lastfrag = (dpacket == packets - 1 && last_page.get_last_packet_incomplete());
+	if(firstfrag)
+		partial.clear();
 	if(lastfrag) {
 		//Load the next packet fragment
 		auto frag2 = last_page.get_packet(dpacket + 1);
-		std::vector<uint8_t> newbuffer;
-		newbuffer.resize(frag2.second);
-		memcpy(&newbuffer[0], frag2.first, frag2.second);
-		std::swap(newbuffer, partial);
+		partial.assign(frag2.first, frag2.first + frag2.second);
 	}
 	dpacket++;
 }
@@ -415,12 +476,71 @@ page::page() throw()
 	segment_count = 0;
 	packet_count = 0;
 	data_count = 0;
-	memset(data, 0, sizeof(data));
+	//Data is only read up to data_count, no need to clear it.
 	memset(segments, 0, sizeof(segments));
 	memset(packets, 0, sizeof(packets));
 }
 
 page::page(const char* buffer, size_t& advance) throw(std::runtime_error)
+{
+	page_view v(buffer, advance);
+	version = v.version;
+	flag_continue = v.flag_continue;
+	flag_bos = v.flag_bos;
+	flag_eos = v.flag_eos;
+	last_incomplete = v.last_incomplete;
+	granulepos = v.granulepos;
+	stream = v.stream;
+	sequence = v.sequence;
+	segment_count = v.segment_count;
+	packet_count = v.packet_count;
+	data_count = v.data_count;
+	memset(segments, 0, sizeof(segments));
+	if(segment_count)
+		memcpy(segments, v.segments, segment_count);
+	if(data_count)
+		memcpy(data, v.data, data_count);
+	memset(packets, 0, sizeof(packets));
+	memcpy(packets, v.packets, (packet_count + 1) * sizeof(packets[0]));
+}
+
+page_view::page_view() throw()
+{
+	version = 0;
+	flag_continue = false;
+	flag_bos = false;
+	flag_eos = false;
+	last_incomplete = false;
+	granulepos = page::granulepos_none;
+	stream = 0;
+	sequence = 0;
+	segment_count = 0;
+	packet_count = 0;
+	data_count = 0;
+	data = NULL;
+	segments = NULL;
+	packets[0] = 0;
+}
+
+page_view::page_view(const page& p) throw()
+{
+	version = p.version;
+	flag_continue = p.flag_continue;
+	flag_bos = p.flag_bos;
+	flag_eos = p.flag_eos;
+	last_incomplete = p.last_incomplete;
+	granulepos = p.granulepos;
+	stream = p.stream;
+	sequence = p.sequence;
+	segment_count = p.segment_count;
+	packet_count = p.packet_count;
+	data_count = p.data_count;
+	data = p.data;
+	segments = p.segments;
+	memcpy(packets, p.packets, (packet_count + 1) * sizeof(packets[0]));
+}
+
+page_view::page_view(const char* buffer, size_t& advance) throw(std::runtime_error)
 {
 	//Check validity of page header.
 	if(buffer[0] != 'O' || buffer[1] != 'g' || buffer[2] != 'g' || buffer[3] != 'S')
@@ -431,11 +551,8 @@ page::page(const char* buffer, size_t& advance) throw(std::runtime_error)
 		throw std::runtime_error("Bad Ogg page flags");
 	//Compute length.
 	size_t b = 27 + (unsigned char)buffer[26];
-	data_count = 0;
-	for(unsigned i = 0; i < (unsigned char)buffer[26]; i++) {
+	for(unsigned i = 0; i < (unsigned char)buffer[26]; i++)
 		b += (unsigned char)buffer[27 + i];
-		data_count += (unsigned char)buffer[27 + i];
-	}
 	//Check the CRC.
 	uint32_t claimed = serialization::u32l(buffer + 22);
 	uint32_t x = 0;
@@ -446,6 +563,17 @@ page::page(const char* buffer, size_t& advance) throw(std::runtime_error)
 	if(claimed != actual)
 		throw std::runtime_error("Bad Ogg page checksum");
 	//This packet is valid.
+	parse(buffer, advance);
+}
+
+void page_view::parse(const char* buffer, size_t& advance) throw()
+{
+	size_t b = 27 + (unsigned char)buffer[26];
+	data_count = 0;
+	for(unsigned i = 0; i < (unsigned char)buffer[26]; i++) {
+		b += (unsigned char)buffer[27 + i];
+		data_count += (unsigned char)buffer[27 + i];
+	}
 	version = buffer[4];
 	uint8_t flags = buffer[5];
 	flag_continue = (flags & 1);
@@ -455,14 +583,9 @@ page::page(const char* buffer, size_t& advance) throw(std::runtime_error)
 	stream = serialization::u32l(buffer + 14);
 	sequence = serialization::u32l(buffer + 18);
 	segment_count = buffer[26];
-	memset(segments, 0, sizeof(segments));
-	if(segment_count)
-		memcpy(segments, buffer + 27, segment_count);
-	memset(data, 0, sizeof(data));
-	if(b > 27U + segment_count)
-		memcpy(data, buffer + 27 + segment_count, b - 27 - segment_count);
+	segments = reinterpret_cast<const uint8_t*>(buffer + 27);
+	data = reinterpret_cast<const uint8_t*>(buffer + 27 + segment_count);
 	packet_count = 0;
-	memset(packets, 0, sizeof(packets));
 	if(segment_count > 0)
 		packets[packet_count++] = 0;
 	uint16_t dptr = 0;
@@ -659,6 +782,7 @@ stream_reader::stream_reader() throw()
 	errors_to = &std::cerr;
 	last_offset = 0;
 	start_offset = 0;
+	pending = 0;
 }
 
 stream_reader::~stream_reader() throw()
@@ -673,7 +797,34 @@ void stream_reader::set_errors_to(std::ostream& os)
 bool stream_reader::get_page(page& spage) throw(std::exception)
 {
 	size_t advance;
+	if(!scan_page(advance))
+		return false;
+	spage = page(buffer, advance);
+	last_offset = start_offset;
+	discard_buffer(advance);
+	return true;
+}
+
+bool stream_reader::get_page(page_view& spage) throw(std::exception)
+{
+	size_t advance;
+	if(!scan_page(advance))
+		return false;
+	//Scan already checked the page.
+	spage.parse(buffer, advance);
+	last_offset = start_offset;
+	//The view points to the buffer, so discard the page only when the next one is requested.
+	pending = advance;
+	return true;
+}
+
+bool stream_reader::scan_page(size_t& advance)
+{
 	bool f;
+	if(pending) {
+		discard_buffer(pending);
+		pending = 0;
+	}
 try_again:
 	fill_buffer();
 	if(eof && !left)
@@ -687,9 +838,6 @@ try_again:
 	}
 	if(!f)
 		goto try_again;
-	spage = page(buffer, advance);
-	last_offset = start_offset;
-	discard_buffer(advance);
 	return true;
 }
 
@@ -711,6 +859,93 @@ void stream_reader::discard_buffer(size_t amount)
 	start_offset += amount;
 }
 
+stream_reader_mmap::stream_reader_mmap(const std::string& filename) throw(std::bad_alloc, std::runtime_error)
+{
+	base = NULL;
+	size = 0;
+	offset = 0;
+	last_offset = 0;
+	errors_to = &std::cerr;
+#if defined(_WIN32) || defined(_WIN64)
+	//No mmap, read the whole file instead.
+	std::ifstream s(filename, std::ios_base::in | std::ios_base::binary);
+	if(!s)
+		throw std::runtime_error("Can't open input file");
+	s.seekg(0, std::ios_base::end);
+	std::streamoff len = s.tellg();
+	s.seekg(0, std::ios_base::beg);
+	if(len < 0)
+		throw std::runtime_error("Can't get size of input file");
+	fallback.resize(len);
+	if(len) {
+		s.read(&fallback[0], len);
+		if(s.gcount() != len)
+			throw std::runtime_error("Can't read input file");
+		base = &fallback[0];
+	}
+	size = len;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error("Can't open input file");
+	struct stat st;
+	if(fstat(fd, &st) < 0) {
+		close(fd);
+		throw std::runtime_error("Can't get size of input file");
+	}
+	size = st.st_size;
+	if(size) {
+		void* m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(m == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Can't map input file");
+		}
+		//The pages are read once, in order.
+		madvise(m, size, MADV_SEQUENTIAL);
+		base = reinterpret_cast<const char*>(m);
+	}
+	//The mapping stays valid after close.
+	close(fd);
+#endif
+}
+
+stream_reader_mmap::~stream_reader_mmap() throw()
+{
+#if defined(_WIN32) || defined(_WIN64)
+#else
+	if(base)
+		munmap(const_cast<char*>(base), size);
+#endif
+}
+
+void stream_reader_mmap::set_errors_to(std::ostream& os)
+{
+	errors_to = &os;
+}
+
+bool stream_reader_mmap::get_page(page_view& spage) throw(std::exception)
+{
+	size_t advance;
+	while(offset < size) {
+		//All data is available, so scan either finds a page or skips to one.
+		bool f = page::scan(base + offset, size - offset, true, advance);
+		if(advance) {
+			//The ogg stream resyncs.
+			(*errors_to) << "Warning: Ogg stream: Recapture after " << advance << " bytes." << std::endl;
+			offset += advance;
+			continue;
+		}
+		if(!f)
+			return false;
+		//Scan already checked the page.
+		spage.parse(base + offset, advance);
+		last_offset = offset;
+		offset += advance;
+		return true;
+	}
+	return false;
+}
+
 stream_writer::stream_writer() throw()
 {
 }
@@ -761,4 +996,72 @@ void stream_writer_iostreams::write(const char* buffer, size_t size) throw(std::
 	if(!os)
 		throw std::runtime_error("Error writing data");
 }
+
+packet_writer::packet_writer(stream_writer& _out, uint32_t streamid, uint32_t _seq) throw(std::bad_alloc)
+	: out(_out)
+{
+	strmid = streamid;
+	seq = _seq;
+	cont = false;
+	granulepos = page::granulepos_none;
+	segment_count = 0;
+	data_count = 0;
+	arena = new char[max_page_size];
+}
+
+packet_writer::~packet_writer() throw()
+{
+	delete[] arena;
+}
+
+void packet_writer::put_packet(const uint8_t* _data, size_t len, uint64_t granule) throw(std::exception)
+{
+	//Start a new page if the packet does not complete on this one.
+	if(segment_count == 255 || len > (255 - segment_count) * 255 - 1U)
+		flush();
+	while(true) {
+		//Append segments, one by one.
+		while(segment_count < 255) {
+			size_t seg = min(len, static_cast<size_t>(255));
+			segments[segment_count++] = seg;
+			memcpy(arena + arena_data_offset + data_count, _data, seg);
+			data_count += seg;
+			_data += seg;
+			len -= seg;
+			if(seg < 255) {
+				granulepos = granule;
+				return;
+			}
+		}
+		//The packet continues to next page.
+		flush();
+		cont = true;
+	}
+}
+
+void packet_writer::flush(bool eos) throw(std::exception)
+{
+	if(!segment_count)
+		return;
+	//Put the header and the segment table just before the data, so the page is contiguous.
+	char* p = arena + arena_data_offset - segment_count - 27;
+	bool was_cont = cont;
+	memcpy(p, "OggS", 4);
+	p[4] = 0;
+	p[5] = (was_cont ? 1 : 0) | (seq == 0 ? 2 : 0) | (eos ? 4 : 0);
+	serialization::u64l(p + 6, granulepos);
+	serialization::u32l(p + 14, strmid);
+	serialization::u32l(p + 18, seq);
+	serialization::u32l(p + 22, 0);
+	p[26] = segment_count;
+	memcpy(p + 27, segments, segment_count);
+	size_t plen = 27 + segment_count + data_count;
+	serialization::u32l(p + 22, oggcrc32(oggcrc32(0, NULL, 0), reinterpret_cast<uint8_t*>(p), plen));
+	out.write(p, plen);
+	seq++;
+	cont = false;
+	granulepos = page::granulepos_none;
+	segment_count = 0;
+	data_count = 0;
+}
 }
@@ -3,12 +3,14 @@
 #include "minmax.hpp"
 #include "hex.hpp"
 #include "zip.hpp"
+#include "threads.hpp"
 #include <iostream>
 #include <fstream>
 #include <cstdint>
 #include <iomanip>
 #include <sstream>
 #include <stdexcept>
+#include <limits>
 #include <zlib.h>
 #include <string.hpp>
 #include <boost/iostreams/categories.hpp>
@@ -948,6 +950,238 @@ decoder::decoder()
 	has_palette = false;
 }
 
+namespace
+{
+	//=========================================================
+	//===================== PNG ENCODER =======================
+	//=========================================================
+	//Minimum amount of raw image data per parallel compression band.
+	const size_t min_band_size = 128 * 1024;
+	//Size of deflate window, used as dictionary from previous band.
+	const size_t deflate_window = 32768;
+
+	template<uint8_t(*predictor)(uint8_t left, uint8_t up, uint8_t upleft)> void do_encode_filter(uint8_t* target,
+		const uint8_t* row, const uint8_t* above, size_t pitch, size_t length)
+	{
+		for(size_t i = 0; i < pitch; i++)
+			target[i] = row[i] - predictor(0, above[i], 0);
+		for(size_t i = pitch; i < length; i++)
+			target[i] = row[i] - predictor(row[i - pitch], above[i], above[i - pitch]);
+	}
+
+	void encode_filter(uint8_t type, uint8_t* target, const uint8_t* row, const uint8_t* above, size_t pitch,
+		size_t length)
+	{
+		target[0] = type;
+		switch(type) {
+		case 0: memcpy(target + 1, row, length); break;
+		case 1: do_encode_filter<predict_left>(target + 1, row, above, pitch, length); break;
+		case 2: do_encode_filter<predict_up>(target + 1, row, above, pitch, length); break;
+		case 3: do_encode_filter<predict_average>(target + 1, row, above, pitch, length); break;
+		case 4: do_encode_filter<predict_paeth>(target + 1, row, above, pitch, length); break;
+		}
+	}
+
+	//Estimate of how well filtered row compresses (lower is better).
+	uint64_t filter_cost(const uint8_t* data, size_t length)
+	{
+		uint64_t cost = 0;
+		for(size_t i = 0; i < length; i++)
+			cost += abs((int8_t)data[i]);
+		return cost;
+	}
+
+	int zlib_header_level(int level)
+	{
+		if(level < 2) return 0;
+		if(level < 6) return 1;
+		if(level == 6) return 2;
+		return 3;
+	}
+
+	struct band_job
+	{
+		const encoder* e;
+		int level;
+		bool adaptive;
+		size_t first_row;
+		size_t last_row;
+		size_t stride;
+		uint8_t* filtered;
+		std::vector<char> output;
+		uLong adler;
+		bool last;
+		std::string error;
+	};
+
+	//Images with few colors (typical for emulator output) are mostly flat areas and repeated tiles, which
+	//compress better unfiltered. Estimate this by sampling the pixels.
+	bool few_colors(const std::vector<uint32_t>& data)
+	{
+		const size_t slots = 1024;
+		uint32_t table[slots];
+		bool used[slots] = {false};
+		size_t colors = 0;
+		for(size_t i = 0; i < data.size(); i += 7) {
+			uint32_t c = data[i];
+			size_t h = (c * 0x9E3779B1U) >> 22;
+			while(used[h] && table[h] != c)
+				h = (h + 1) & (slots - 1);
+			if(used[h])
+				continue;
+			used[h] = true;
+			table[h] = c;
+			if(++colors > 256)
+				return false;
+		}
+		return true;
+	}
+
+	void write_raw_row(const encoder& e, char* out, size_t row)
+	{
+		const uint32_t* in = &e.data[e.width * row];
+		if(e.has_palette)
+			switch(size_to_bits(e.palette.size())) {
+			case 1: write_row_pal1(out, in, e.width); break;
+			case 2: write_row_pal2(out, in, e.width); break;
+			case 4: write_row_pal4(out, in, e.width); break;
+			case 8: write_row_pal8(out, in, e.width); break;
+			case 16: write_row_pal16(out, in, e.width); break;
+			}
+		else if(e.has_alpha)
+			write_row_rgba(out, in, e.width);
+		else
+			write_row_rgb(out, in, e.width);
+	}
+
+	void filter_band(band_job& j)
+	{
+		const encoder& e = *j.e;
+		size_t length = j.stride - 1;
+		size_t pitch = e.has_palette ? ((size_to_bits(e.palette.size()) == 16) ? 2 : 1) :
+			(e.has_alpha ? 4 : 3);
+		std::vector<char> _above(length), _row(length), _trial(j.stride);
+		uint8_t* above = reinterpret_cast<uint8_t*>(&_above[0]);
+		uint8_t* row = reinterpret_cast<uint8_t*>(&_row[0]);
+		uint8_t* trial = reinterpret_cast<uint8_t*>(&_trial[0]);
+		if(j.first_row > 0)
+			write_raw_row(e, reinterpret_cast<char*>(above), j.first_row - 1);
+		for(size_t i = j.first_row; i < j.last_row; i++) {
+			uint8_t* target = j.filtered + (i - j.first_row) * j.stride;
+			write_raw_row(e, reinterpret_cast<char*>(row), i);
+			if(j.adaptive) {
+				//Sub, Up and Paeth catch nearly all gain; Average is rarely best.
+				static const uint8_t candidates[] = {0, 1, 2, 4};
+				uint64_t best = std::numeric_limits<uint64_t>::max();
+				for(auto f : candidates) {
+					encode_filter(f, trial, row, above, pitch, length);
+					uint64_t cost = filter_cost(trial + 1, length);
+					if(cost < best) {
+						best = cost;
+						memcpy(target, trial, j.stride);
+					}
+				}
+			} else
+				encode_filter(0, target, row, above, pitch, length);
+			std::swap(above, row);
+		}
+	}
+
+	void compress_band(band_job& j, const uint8_t* dict, size_t dictlen)
+	{
+		size_t insize = (j.last_row - j.first_row) * j.stride;
+		j.adler = adler32(adler32(0, NULL, 0), j.filtered, insize);
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		z.zalloc = zlib_alloc;
+		z.zfree = zlib_free;
+		//Raw deflate, so bands can be concatenated. Filtered data favors Z_FILTERED.
+		throw_zlib_error(deflateInit2(&z, j.level, Z_DEFLATED, -15, 8, j.adaptive ? Z_FILTERED :
+			Z_DEFAULT_STRATEGY));
+		try {
+			if(dictlen)
+				throw_zlib_error(deflateSetDictionary(&z, dict, dictlen));
+			j.output.resize(deflateBound(&z, insize) + 64);
+			z.next_in = j.filtered;
+			z.avail_in = insize;
+			z.next_out = reinterpret_cast<uint8_t*>(&j.output[0]);
+			z.avail_out = j.output.size();
+			while(true) {
+				//Non-final bands end on byte boundary with a non-final block.
+				int r = deflate(&z, j.last ? Z_FINISH : Z_SYNC_FLUSH);
+				if(r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR)
+					throw_zlib_error(r);
+				if(j.last ? (r == Z_STREAM_END) : (z.avail_in == 0 && z.avail_out > 0))
+					break;
+				size_t used = j.output.size() - z.avail_out;
+				j.output.resize(2 * j.output.size());
+				z.next_out = reinterpret_cast<uint8_t*>(&j.output[used]);
+				z.avail_out = j.output.size() - used;
+			}
+			j.output.resize(j.output.size() - z.avail_out);
+		} catch(...) {
+			deflateEnd(&z);
+			throw;
+		}
+		deflateEnd(&z);
+	}
+
+	//Decide between adaptive filtering and no filtering by trial compressing a few sample rows both ways.
+	//Sum-of-differences heuristic alone favors filtering too much on drawn (non-photographic) images.
+	bool prefer_filtering(const encoder& e, size_t stride)
+	{
+		const size_t samples = 4;
+		const size_t sample_rows = 8;
+		if(e.height < samples * sample_rows)
+			return true;
+		std::vector<uint8_t> buf(stride * sample_rows);
+		size_t size[2] = {0, 0};
+		for(unsigned k = 0; k < 2; k++)
+			for(size_t i = 0; i < samples; i++) {
+				band_job j;
+				j.e = &e;
+				j.level = 1;
+				j.adaptive = (k == 1);
+				j.first_row = (e.height - sample_rows) * i / (samples - 1);
+				j.last_row = j.first_row + sample_rows;
+				j.stride = stride;
+				j.filtered = &buf[0];
+				j.last = true;
+				filter_band(j);
+				compress_band(j, NULL, 0);
+				size[k] += j.output.size();
+			}
+		return size[1] < size[0];
+	}
+
+	template<typename T> void run_bands(std::vector<band_job>& jobs, T fn)
+	{
+		std::vector<threads::thread*> workers;
+		for(size_t i = 1; i < jobs.size(); i++) {
+			band_job* j = &jobs[i];
+			workers.push_back(new threads::thread([j, fn]() {
+				try {
+					fn(*j);
+				} catch(std::exception& e) {
+					j->error = e.what();
+				}
+			}));
+		}
+		try {
+			fn(jobs[0]);
+		} catch(std::exception& e) {
+			jobs[0].error = e.what();
+		}
+		for(auto i : workers) {
+			i->join();
+			delete i;
+		}
+		for(auto& i : jobs)
+			if(i.error != "")
+				throw std::runtime_error(i.error);
+	}
+}
+
 encoder::encoder()
 {
 	width = 0;
@@ -955,6 +1189,8 @@ encoder::encoder()
 	has_palette = false;
 	has_alpha = false;
 	colorkey = 0xFFFFFFFFU;
+	level = 6;
+	threads = 1;
 }
 
 void encoder::encode(const std::string& file) const
@@ -967,7 +1203,8 @@ void encoder::encode(const std::string& file) const
 
 void encoder::encode(std::ostream& file) const
 {
-	size_t pbits = size_to_bits(palette.size());
+	if(level < 0 || level > 9)
+		throw std::runtime_error("Bad PNG compression level");
 	//Write the PNG magic.
 	char png_magic[] = {-119, 80, 78, 71, 13, 10, 26, 10};
 	file.write(png_magic, sizeof(png_magic));
@@ -1006,33 +1243,49 @@ void encoder::encode(std::ostream& file) const
 		trns_h.write(&data[0], data.size());
 		trns_h.close();
 	}
-	//Write the IDAT
-	boost::iostreams::filtering_ostream idat_h;
-	boost::iostreams::zlib_params params;
-	params.noheader = false;
-	idat_h.push(boost::iostreams::zlib_compressor(params));
-	idat_h.push(png_chunk_output(file, 0x49444154));
-	std::vector<char> buf;
-	buf.resize(1 + 4 * width);
+	//Filter the image and compress it in bands of rows. Each band is raw deflate stream primed with
+	//the tail of previous band as dictionary, so the result is (nearly) as small as single stream.
 	size_t bufstride = buffer_stride(width, has_palette, has_alpha, palette.size());
-	for(size_t i = 0; i < height; i++) {
-		buf[0] = 0;	//No filter.
-		if(has_palette)
-			switch(pbits) {
-			case 1: write_row_pal1(&buf[1], &data[width * i], width); break;
-			case 2: write_row_pal2(&buf[1], &data[width * i], width); break;
-			case 4: write_row_pal4(&buf[1], &data[width * i], width); break;
-			case 8: write_row_pal8(&buf[1], &data[width * i], width); break;
-			case 16: write_row_pal16(&buf[1], &data[width * i], width); break;
-			}
-		else if(has_alpha)
-			write_row_rgba(&buf[1], &data[width * i], width);
-		else
-			write_row_rgb(&buf[1], &data[width * i], width);
-		idat_h.write(&buf[0], bufstride);
+	std::vector<uint8_t> filtered(bufstride * height + 1);
+	size_t bands = min((size_t)threads, min(bufstride * height / min_band_size, height));
+	bands = max(bands, (size_t)1);
+	//Paletted images and level 0 compress best (or fastest) unfiltered.
+	bool adaptive = level > 0 && !has_palette && !few_colors(data) && prefer_filtering(*this, bufstride);
+	std::vector<band_job> jobs(bands);
+	for(size_t i = 0; i < bands; i++) {
+		jobs[i].e = this;
+		jobs[i].level = level;
+		jobs[i].adaptive = adaptive;
+		jobs[i].first_row = height * i / bands;
+		jobs[i].last_row = height * (i + 1) / bands;
+		jobs[i].stride = bufstride;
+		jobs[i].filtered = &filtered[jobs[i].first_row * bufstride];
+		jobs[i].last = (i == bands - 1);
+	}
+	run_bands(jobs, filter_band);
+	run_bands(jobs, [&filtered](band_job& j) {
+		size_t offset = j.filtered - &filtered[0];
+		size_t dictlen = min(offset, deflate_window);
+		compress_band(j, j.filtered - dictlen, dictlen);
+	});
+	//Write the IDAT
+	boost::iostreams::stream<png_chunk_output> idat_h(file, 0x49444154);
+	uint16_t zhdr = 0x7800 | (zlib_header_level(level) << 6);
+	zhdr += 31 - zhdr % 31;
+	char zhdr_buf[2];
+	serialization::u16b(zhdr_buf, zhdr);
+	idat_h.write(zhdr_buf, 2);
+	uLong adler = jobs[0].adler;
+	for(size_t i = 0; i < bands; i++) {
+		if(i > 0)
+			adler = adler32_combine(adler, jobs[i].adler, (jobs[i].last_row - jobs[i].first_row) *
+				bufstride);
+		idat_h.write(&jobs[i].output[0], jobs[i].output.size());
 	}
-	idat_h.pop();
-	idat_h.pop();
+	char ztrailer[4];
+	serialization::u32b(ztrailer, adler);
+	idat_h.write(ztrailer, 4);
+	idat_h.close();
 	//Write the IEND and finish.
 	boost::iostreams::stream<png_chunk_output> iend_h(file, 0x49454E44);
 	iend_h.close();
@@ -4,10 +4,15 @@
 #include <sstream>
 #include <iostream>
 #include <iomanip>
-#include "arch-detect.hpp"
+#include <algorithm>
+#include "minmax.hpp"
+#include "cpufeatures.hpp"
+#ifdef ARCH_HAS_X86_DISPATCH
+#include <immintrin.h>
+#endif
 
-//Since this isn't used for anything too performance-sensitive, just write a implementation, no need to specially
-//optimize.
+//The portable implementation is used unless the CPU has SHA extensions. Hashing many small blocks at once can also
+//use AVX2 to run eight hashes in parallel.
 
 namespace
 {
@@ -107,35 +112,212 @@ namespace
 	ROUND(b, c, d, e, f, g, h, a, i, 7)
 
 
-	void compress_sha256(uint32_t* state, uint32_t* datablock, unsigned& blockbytes)
-	{
-		uint32_t a = state[0];
-		uint32_t b = state[1];
-		uint32_t c = state[2];
-		uint32_t d = state[3];
-		uint32_t e = state[4];
-		uint32_t f = state[5];
-		uint32_t g = state[6];
-		uint32_t h = state[7];
-		uint32_t X, Xsigma0, Xsigma1;
-		ROUND8A(a, b, c, d, e, f, g, h, 0);
-		ROUND8A(a, b, c, d, e, f, g, h, 8);
-		ROUND8B(a, b, c, d, e, f, g, h, 16);
-		ROUND8B(a, b, c, d, e, f, g, h, 24);
-		ROUND8B(a, b, c, d, e, f, g, h, 32);
-		ROUND8B(a, b, c, d, e, f, g, h, 40);
-		ROUND8B(a, b, c, d, e, f, g, h, 48);
-		ROUND8B(a, b, c, d, e, f, g, h, 56);
-		state[0] += a;
-		state[1] += b;
-		state[2] += c;
-		state[3] += d;
-		state[4] += e;
-		state[5] += f;
-		state[6] += g;
-		state[7] += h;
-		memset(datablock, 0, 64);
-		blockbytes = 0;
+	inline uint32_t load_be32(const uint8_t* p)
+	{
+		return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+			(static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+	}
+
+	void compress_sha256_portable(uint32_t* state, const uint8_t* data, size_t blocks)
+	{
+		uint32_t datablock[16];
+		for(size_t j = 0; j < blocks; j++, data += 64) {
+			for(unsigned i = 0; i < 16; i++)
+				datablock[i] = load_be32(data + 4 * i);
+			uint32_t a = state[0];
+			uint32_t b = state[1];
+			uint32_t c = state[2];
+			uint32_t d = state[3];
+			uint32_t e = state[4];
+			uint32_t f = state[5];
+			uint32_t g = state[6];
+			uint32_t h = state[7];
+			uint32_t X, Xsigma0, Xsigma1;
+			ROUND8A(a, b, c, d, e, f, g, h, 0);
+			ROUND8A(a, b, c, d, e, f, g, h, 8);
+			ROUND8B(a, b, c, d, e, f, g, h, 16);
+			ROUND8B(a, b, c, d, e, f, g, h, 24);
+			ROUND8B(a, b, c, d, e, f, g, h, 32);
+			ROUND8B(a, b, c, d, e, f, g, h, 40);
+			ROUND8B(a, b, c, d, e, f, g, h, 48);
+			ROUND8B(a, b, c, d, e, f, g, h, 56);
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+			state[5] += f;
+			state[6] += g;
+			state[7] += h;
+		}
+	}
+
+#ifdef ARCH_HAS_X86_DISPATCH
+	//SHA extensions. State is kept as ABEF and CDGH halves, as the instructions want it.
+	__attribute__((target("sha,sse4.1,ssse3")))
+	void compress_sha256_shani(uint32_t* state, const uint8_t* data, size_t blocks)
+	{
+		const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+		__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+		__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)),
+			0x1B);
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+		state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+		for(size_t j = 0; j < blocks; j++, data += 64) {
+			__m128i save0 = state0;
+			__m128i save1 = state1;
+			__m128i m[4];
+			for(unsigned i = 0; i < 16; i++) {
+				if(i < 4)
+					m[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data +
+						16 * i)), bswap);
+				__m128i msg = _mm_add_epi32(m[i & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+					k + 4 * i)));
+				state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+				//Message schedule: Finish next-next group and start the group after that.
+				if(i >= 3 && i < 15) {
+					tmp = _mm_alignr_epi8(m[i & 3], m[(i - 1) & 3], 4);
+					m[(i + 1) & 3] = _mm_add_epi32(m[(i + 1) & 3], tmp);
+					m[(i + 1) & 3] = _mm_sha256msg2_epu32(m[(i + 1) & 3], m[i & 3]);
+				}
+				msg = _mm_shuffle_epi32(msg, 0x0E);
+				state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+				if(i >= 1 && i < 13)
+					m[(i - 1) & 3] = _mm_sha256msg1_epu32(m[(i - 1) & 3], m[i & 3]);
+			}
+			state0 = _mm_add_epi32(state0, save0);
+			state1 = _mm_add_epi32(state1, save1);
+		}
+
+		tmp = _mm_shuffle_epi32(state0, 0x1B);
+		state1 = _mm_shuffle_epi32(state1, 0xB1);
+		state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+		state1 = _mm_alignr_epi8(state1, tmp, 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+	}
+
+	//Eight independent messages at once, one in each 32-bit lane.
+	template<unsigned p>
+	__attribute__((target("avx2"))) inline __m256i rotate_r8(__m256i x)
+	{
+		return _mm256_or_si256(_mm256_srli_epi32(x, p), _mm256_slli_epi32(x, 32 - p));
+	}
+
+	__attribute__((target("avx2")))
+	void compress_sha256_x8(uint32_t (*state)[8], const uint32_t (*w)[8], const uint32_t* active)
+	{
+		__m256i s[8], v[8], W[16];
+		for(unsigned i = 0; i < 8; i++) {
+			s[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state[i]));
+			v[i] = s[i];
+		}
+		for(unsigned i = 0; i < 16; i++)
+			W[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w[i]));
+		for(unsigned i = 0; i < 64; i++) {
+			if(i >= 16) {
+				__m256i w15 = W[(i + 1) & 15];
+				__m256i w2 = W[(i + 14) & 15];
+				__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotate_r8<7>(w15), rotate_r8<18>(w15)),
+					_mm256_srli_epi32(w15, 3));
+				__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotate_r8<17>(w2), rotate_r8<19>(w2)),
+					_mm256_srli_epi32(w2, 10));
+				W[i & 15] = _mm256_add_epi32(_mm256_add_epi32(W[i & 15], s0),
+					_mm256_add_epi32(s1, W[(i + 9) & 15]));
+			}
+			__m256i e = v[4];
+			__m256i a = v[0];
+			__m256i S1 = _mm256_xor_si256(_mm256_xor_si256(rotate_r8<6>(e), rotate_r8<11>(e)),
+				rotate_r8<25>(e));
+			__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, v[5]), _mm256_andnot_si256(e, v[6]));
+			__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(v[7], S1), _mm256_add_epi32(ch,
+				_mm256_add_epi32(W[i & 15], _mm256_set1_epi32(k[i]))));
+			__m256i S0 = _mm256_xor_si256(_mm256_xor_si256(rotate_r8<2>(a), rotate_r8<13>(a)),
+				rotate_r8<22>(a));
+			__m256i maj = _mm256_or_si256(_mm256_and_si256(a, v[1]), _mm256_and_si256(v[2],
+				_mm256_or_si256(a, v[1])));
+			__m256i t2 = _mm256_add_epi32(S0, maj);
+			v[7] = v[6];
+			v[6] = v[5];
+			v[5] = v[4];
+			v[4] = _mm256_add_epi32(v[3], t1);
+			v[3] = v[2];
+			v[2] = v[1];
+			v[1] = v[0];
+			v[0] = _mm256_add_epi32(t1, t2);
+		}
+		//Lanes that have already finished keep their old state.
+		__m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(active));
+		for(unsigned i = 0; i < 8; i++)
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(state[i]), _mm256_blendv_epi8(s[i],
+				_mm256_add_epi32(s[i], v[i]), mask));
+	}
+
+	//Get block of padded message. Returns pointer to the data, which is either in message or in buf.
+	const uint8_t* padded_block(uint8_t* buf, const uint8_t* data, size_t len, size_t block)
+	{
+		size_t offset = 64 * block;
+		if(offset + 64 <= len)
+			return data + offset;
+		memset(buf, 0, 64);
+		if(offset < len)
+			memcpy(buf, data + offset, len - offset);
+		if(offset <= len)
+			buf[len - offset] = 0x80;
+		if(offset + 64 == 64 * ((len + 72) / 64)) {
+			uint64_t bits = static_cast<uint64_t>(len) << 3;
+			for(unsigned i = 0; i < 8; i++)
+				buf[56 + i] = bits >> (56 - 8 * i);
+		}
+		return buf;
+	}
+
+	void hash_sha256_x8(uint8_t* const* hashout, const uint8_t* const* data, const size_t* datalen,
+		size_t count)
+	{
+		uint32_t state[8][8];
+		uint32_t w[16][8];
+		uint32_t active[8];
+		size_t blocks[8];
+		size_t maxblocks = 0;
+		uint8_t buf[64];
+		for(unsigned i = 0; i < 8; i++)
+			for(unsigned j = 0; j < 8; j++)
+				state[i][j] = sha256_initial_state[i];
+		for(unsigned j = 0; j < 8; j++) {
+			blocks[j] = (j < count) ? (datalen[j] + 72) / 64 : 0;
+			maxblocks = max(maxblocks, blocks[j]);
+		}
+		for(size_t b = 0; b < maxblocks; b++) {
+			for(unsigned j = 0; j < 8; j++) {
+				active[j] = (b < blocks[j]) ? 0xFFFFFFFFU : 0;
+				if(!active[j])
+					continue;
+				const uint8_t* blk = padded_block(buf, data[j], datalen[j], b);
+				for(unsigned i = 0; i < 16; i++)
+					w[i][j] = load_be32(blk + 4 * i);
+			}
+			compress_sha256_x8(state, w, active);
+		}
+		for(unsigned j = 0; j < count && j < 8; j++)
+			for(unsigned i = 0; i < 32; i++)
+				hashout[j][i] = state[i / 4][j] >> (24 - i % 4 * 8);
+	}
+#endif
+
+	void (*compress_sha256_impl())(uint32_t* state, const uint8_t* data, size_t blocks)
+	{
+#ifdef ARCH_HAS_X86_DISPATCH
+		if(cpufeatures::has_sha())
+			return compress_sha256_shani;
+#endif
+		return compress_sha256_portable;
+	}
+
+	void compress_sha256(uint32_t* state, const uint8_t* data, size_t blocks)
+	{
+		compress_sha256_impl()(state, data, blocks);
 	}
 }
 
@@ -154,60 +336,78 @@ void sha256::real_destroy()
 
 void sha256::real_finish(uint8_t* hash)
 {
-	datablock[blockbytes / 4] |= (static_cast<uint32_t>(0x80) << (24 - blockbytes % 4 * 8));
-	if(blockbytes > 55)
+	datablock[blockbytes++] = 0x80;
+	memset(datablock + blockbytes, 0, 64 - blockbytes);
+	if(blockbytes > 56) {
 		//We can't fit the length into this block.
-		compress_sha256(state, datablock, blockbytes);
+		compress_sha256(state, datablock, 1);
+		memset(datablock, 0, 64);
+	}
 	//Write the length.
-	datablock[14] = totalbytes >> 29;
-	datablock[15] = totalbytes << 3;
-	compress_sha256(state, datablock, blockbytes);
+	uint64_t bits = totalbytes << 3;
+	for(unsigned i = 0; i < 8; i++)
+		datablock[56 + i] = bits >> (56 - 8 * i);
+	compress_sha256(state, datablock, 1);
+	blockbytes = 0;
 	for(unsigned i = 0; i < 32; i++)
 		hash[i] = state[i / 4] >> (24 - i % 4 * 8);
 }
 
 void sha256::real_write(const uint8_t* data, size_t datalen)
 {
-#ifdef ARCH_IS_I386
-	//First pad blockbytes to multiple of four.
-	size_t i = 0;
-	while(blockbytes & 3 && i < datalen) {
-		datablock[blockbytes / 4] |= (static_cast<uint32_t>(data[i]) << (24 - blockbytes % 4 * 8));
-		blockbytes++;
-		if(blockbytes == 64)
-			compress_sha256(state, datablock, blockbytes);
-		i++;
-	}
-	size_t blocks = (datalen - i) / 4;
-	unsigned ptr = blockbytes / 4;
-	//Then process four bytes ata time.
-	for(size_t j = 0; j < blocks; j++) {
-		uint32_t x = *reinterpret_cast<const uint32_t*>(data + i);
-		asm("bswap %0" : "+r"(x));
-		datablock[ptr] = x;
-		ptr = (ptr + 1) & 15;
-		i += 4;
-		blockbytes += 4;
-		if(blockbytes == 64)
-			compress_sha256(state, datablock, blockbytes);
-	}
-	//And finally process tail.
-	while(i < datalen) {
-		datablock[blockbytes / 4] |= (static_cast<uint32_t>(data[i]) << (24 - blockbytes % 4 * 8));
-		blockbytes++;
-		if(blockbytes == 64)
-			compress_sha256(state, datablock, blockbytes);
-		i++;
-	}
-#else
-	for(size_t i = 0; i < datalen; i++) {
-		datablock[blockbytes / 4] |= (static_cast<uint32_t>(data[i]) << (24 - blockbytes % 4 * 8));
-		blockbytes++;
-		if(blockbytes == 64)
-			compress_sha256(state, datablock, blockbytes);
+	totalbytes += datalen;
+	//Fill up any partial block first.
+	if(blockbytes) {
+		size_t fill = min(datalen, static_cast<size_t>(64 - blockbytes));
+		memcpy(datablock + blockbytes, data, fill);
+		blockbytes += fill;
+		data += fill;
+		datalen -= fill;
+		if(blockbytes < 64)
+			return;
+		compress_sha256(state, datablock, 1);
+		blockbytes = 0;
+	}
+	//Then whole blocks straight from the input.
+	if(datalen >= 64) {
+		compress_sha256(state, data, datalen / 64);
+		data += datalen / 64 * 64;
+		datalen %= 64;
+	}
+	//And finally buffer the tail.
+	memcpy(datablock, data, datalen);
+	blockbytes = datalen;
+}
+
+void sha256::hash_multi(uint8_t* const* hashout, const uint8_t* const* data, const size_t* datalen,
+	size_t count) throw(std::bad_alloc)
+{
+#ifdef ARCH_HAS_X86_DISPATCH
+	//SHA extensions beat running eight streams in parallel, so only do the latter without them.
+	if(!cpufeatures::has_sha() && cpufeatures::has_avx2()) {
+		//Group blocks of similar length together, so lanes don't idle waiting for the longest one.
+		std::vector<size_t> order(count);
+		for(size_t i = 0; i < count; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [datalen](size_t a, size_t b) { return datalen[a] <
+			datalen[b]; });
+		for(size_t i = 0; i < count; i += 8) {
+			uint8_t* _hashout[8];
+			const uint8_t* _data[8];
+			size_t _datalen[8];
+			size_t n = min(count - i, static_cast<size_t>(8));
+			for(size_t j = 0; j < n; j++) {
+				_hashout[j] = hashout[order[i + j]];
+				_data[j] = data[order[i + j]];
+				_datalen[j] = datalen[order[i + j]];
+			}
+			hash_sha256_x8(_hashout, _data, _datalen, n);
+		}
+		return;
 	}
 #endif
-	totalbytes += datalen;
+	for(size_t i = 0; i < count; i++)
+		hash(hashout[i], data[i], datalen[i]);
 }
 
 #ifdef SHA256_SELFTEST
@@ -5,7 +5,11 @@
 #include <stdexcept>
 #include <iomanip>
 #include <algorithm>
-#include "arch-detect.hpp"
+#include <vector>
+#include "cpufeatures.hpp"
+#ifdef ARCH_HAS_X86_DISPATCH
+#include <immintrin.h>
+#endif
 #ifdef TEST_SKEIN_CODE
 #include "hex.hpp"
 #endif
@@ -244,6 +248,159 @@ void hash::read(uint8_t* output) throw()
 	read_partial(output, 0, outbits);
 }
 
+#ifdef ARCH_HAS_X86_DISPATCH
+namespace
+{
+	template<unsigned n>
+	__attribute__((target("avx2"))) inline __m256i rotate_l4(__m256i x)
+	{
+		return _mm256_or_si256(_mm256_slli_epi64(x, n), _mm256_srli_epi64(x, 64 - n));
+	}
+
+//Threefish MIX. The word permutation is done by renaming words (it is identity after four rounds).
+#define MIX4(a, b, r) \
+	v[a] = _mm256_add_epi64(v[a], v[b]); \
+	v[b] = _mm256_xor_si256(rotate_l4<r>(v[b]), v[a]);
+
+#define ROUND4(r00, r01, r02, r03, r10, r11, r12, r13, r20, r21, r22, r23, r30, r31, r32, r33) \
+	MIX4(0, 1, r00); MIX4(2, 3, r01); MIX4(4, 5, r02); MIX4(6, 7, r03); \
+	MIX4(2, 1, r10); MIX4(4, 7, r11); MIX4(6, 5, r12); MIX4(0, 3, r13); \
+	MIX4(4, 1, r20); MIX4(6, 3, r21); MIX4(0, 5, r22); MIX4(2, 7, r23); \
+	MIX4(6, 1, r30); MIX4(0, 7, r31); MIX4(2, 5, r32); MIX4(4, 3, r33);
+
+	__attribute__((target("avx2"))) inline void inject4(__m256i* v, const __m256i* k, const __m256i* t,
+		unsigned s)
+	{
+		for(unsigned i = 0; i < 8; i++)
+			v[i] = _mm256_add_epi64(v[i], k[(s + i) % 9]);
+		v[5] = _mm256_add_epi64(v[5], t[s % 3]);
+		v[6] = _mm256_add_epi64(v[6], t[(s + 1) % 3]);
+		v[7] = _mm256_add_epi64(v[7], _mm256_set1_epi64x(s));
+	}
+
+	//Skein-512 UBI block for four independent messages, one in each 64-bit lane. Arrays are word-major.
+	__attribute__((target("avx2")))
+	void ubi512_x4(uint64_t (*chain)[4], const uint64_t (*msg)[4], const uint64_t* tweak0,
+		const uint64_t* tweak1, const uint64_t* active)
+	{
+		__m256i k[9], t[3], m[8], v[8];
+		k[8] = _mm256_set1_epi64x(0x1BD11BDAA9FC1A22ULL);
+		for(unsigned i = 0; i < 8; i++) {
+			k[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chain[i]));
+			k[8] = _mm256_xor_si256(k[8], k[i]);
+			m[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(msg[i]));
+			v[i] = m[i];
+		}
+		t[0] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tweak0));
+		t[1] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tweak1));
+		t[2] = _mm256_xor_si256(t[0], t[1]);
+		for(unsigned s = 0; s < 18; s += 2) {
+			inject4(v, k, t, s);
+			ROUND4(46, 36, 19, 37, 33, 27, 14, 42, 17, 49, 36, 39, 44, 9, 54, 56);
+			inject4(v, k, t, s + 1);
+			ROUND4(39, 30, 34, 24, 13, 50, 10, 17, 25, 29, 39, 43, 8, 35, 56, 22);
+		}
+		inject4(v, k, t, 18);
+		//Feedforward. Lanes that have already finished keep their old chain.
+		__m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(active));
+		for(unsigned i = 0; i < 8; i++)
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(chain[i]), _mm256_blendv_epi8(k[i],
+				_mm256_xor_si256(v[i], m[i]), mask));
+	}
+
+	void skein512_x4(uint64_t outbits, uint8_t* const* output, const uint8_t* const* data,
+		const size_t* datalen, size_t count)
+	{
+		uint64_t chain[8][4];
+		uint64_t msg[8][4];
+		uint64_t tweak0[4];
+		uint64_t tweak1[4];
+		uint64_t active[4];
+		size_t blocks[4];
+		size_t maxblocks = 0;
+		//Configuration block is the same for all messages.
+		uint64_t config[8] = {0x133414853ULL, outbits};
+		uint64_t ctweak[2] = {32, 0xC400000000000000ULL};
+		uint64_t zero[8] = {0};
+		uint64_t iv[8];
+		skein512_compress(iv, config, zero, ctweak);
+		for(unsigned i = 0; i < 8; i++)
+			for(unsigned j = 0; j < 4; j++)
+				chain[i][j] = iv[i];
+		for(unsigned j = 0; j < 4; j++) {
+			blocks[j] = (j < count) ? std::max((datalen[j] + 63) / 64, static_cast<size_t>(1)) : 0;
+			maxblocks = std::max(maxblocks, blocks[j]);
+		}
+		for(size_t b = 0; b < maxblocks; b++) {
+			for(unsigned j = 0; j < 4; j++) {
+				active[j] = (b < blocks[j]) ? 0xFFFFFFFFFFFFFFFFULL : 0;
+				if(!active[j])
+					continue;
+				uint8_t buf[64] = {0};
+				size_t bytes = std::min(datalen[j] - std::min(datalen[j], 64 * b), static_cast<size_t>(64));
+				if(bytes)
+					memcpy(buf, data[j] + 64 * b, bytes);
+				for(unsigned i = 0; i < 8; i++)
+					memcpy(&msg[i][j], buf + 8 * i, 8);
+				tweak0[j] = 64 * b + bytes;
+				tweak1[j] = (48ULL << 56) | (b ? 0 : (1ULL << 62)) | ((b + 1 < blocks[j]) ? 0 :
+					(1ULL << 63));
+			}
+			ubi512_x4(chain, msg, tweak0, tweak1, active);
+		}
+		//Output stage.
+		for(unsigned j = 0; j < 4; j++) {
+			for(unsigned i = 0; i < 8; i++)
+				msg[i][j] = 0;
+			tweak0[j] = 8;
+			tweak1[j] = 0xFF00000000000000ULL;
+			active[j] = 0xFFFFFFFFFFFFFFFFULL;
+		}
+		ubi512_x4(chain, msg, tweak0, tweak1, active);
+		for(unsigned j = 0; j < count && j < 4; j++) {
+			uint64_t out[8];
+			for(unsigned i = 0; i < 8; i++)
+				out[i] = chain[i][j];
+			memcpy(output[j], out, outbits / 8);
+		}
+	}
+}
+#endif
+
+void hash::hash_multi(variant v, uint64_t outbits, uint8_t* const* output, const uint8_t* const* data,
+	const size_t* datalen, size_t count) throw(std::bad_alloc, std::runtime_error)
+{
+#ifdef ARCH_HAS_X86_DISPATCH
+	//Four-way parallel version only exists for 512-bit variant with single output block.
+	if(v == PIPE_512 && outbits <= 512 && outbits % 8 == 0 && cpufeatures::has_avx2()) {
+		//Group messages of similar length together, so lanes don't idle waiting for the longest one.
+		std::vector<size_t> order(count);
+		for(size_t i = 0; i < count; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [datalen](size_t a, size_t b) { return datalen[a] <
+			datalen[b]; });
+		for(size_t i = 0; i < count; i += 4) {
+			uint8_t* _output[4];
+			const uint8_t* _data[4];
+			size_t _datalen[4];
+			size_t n = std::min(count - i, static_cast<size_t>(4));
+			for(size_t j = 0; j < n; j++) {
+				_output[j] = output[order[i + j]];
+				_data[j] = data[order[i + j]];
+				_datalen[j] = datalen[order[i + j]];
+			}
+			skein512_x4(outbits, _output, _data, _datalen, n);
+		}
+		return;
+	}
+#endif
+	for(size_t i = 0; i < count; i++) {
+		hash h(v, outbits);
+		h.write(data[i], datalen[i]);
+		h.read(output[i]);
+	}
+}
+
 prng::prng() throw()
 {
 	_is_seeded = false;
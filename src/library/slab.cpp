@@ -0,0 +1,52 @@
+#include "slab.hpp"
+
+namespace slab
+{
+pool::pool() throw()
+{
+	for(unsigned i = 0; i < max_size / granularity; i++)
+		free_list[i] = NULL;
+	bump = NULL;
+	bump_left = 0;
+}
+
+pool::~pool() throw()
+{
+	clear();
+}
+
+void pool::clear() throw()
+{
+	for(auto i : chunks)
+		free(i);
+	chunks.clear();
+	for(unsigned i = 0; i < max_size / granularity; i++)
+		free_list[i] = NULL;
+	bump = NULL;
+	bump_left = 0;
+}
+
+void* pool::allocate_slow(unsigned sclass) throw()
+{
+	size_t size = (sclass + 1) * granularity;
+	if(bump_left < size) {
+		//The tail of current chunk is too small, it is just abandoned. Chunks are malloc()ed, so blocks get
+		//the same alignment as malloc() gives, since the sizes are multiples of granularity.
+		char* c = reinterpret_cast<char*>(malloc(chunk_size));
+		if(!c)
+			return NULL;
+		try {
+			chunks.push_back(c);
+		} catch(...) {
+			free(c);
+			return NULL;
+		}
+		bump = c;
+		bump_left = chunk_size;
+	}
+	void* ret = bump;
+	bump += size;
+	bump_left -= size;
+	return ret;
+}
+}
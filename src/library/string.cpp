@@ -3,7 +3,8 @@
 #include "threads.hpp"
 #include "eatarg.hpp"
 #include <cctype>
-#include "map-pointer.hpp"
+#include <list>
+#include <memory>
 
 #ifdef USE_BOOST_REGEX
 #include <boost/regex.hpp>
@@ -91,27 +92,122 @@ std::pair<size_t, size_t> regex_results::match(size_t i) const
 	return matches[i];
 }
 
-regex_results regex(const std::string& regexp, const std::string& str, const char* ex) throw(std::bad_alloc,
-	std::runtime_error)
+namespace
 {
-	static threads::lock m;
-	threads::alock h(m);
-	static std::map<std::string, map_pointer<regex_ns::regex>> regexps;
-	if(!regexps.count(regexp)) {
-		regex_ns::regex* y = NULL;
+	//Maximum number of compiled regexes to keep around.
+	const size_t regex_cache_max = 256;
+	//Pseudo-mode used for regex() (with submatches, case-sensitive).
+	const int REGEX_CAPTURE = -1;
+
+	struct regex_cache
+	{
+		typedef std::pair<int, std::string> key_t;
+		struct entry
+		{
+			std::shared_ptr<regex_ns::regex> rx;
+			std::list<key_t>::iterator lru;
+		};
+		std::shared_ptr<regex_ns::regex> lookup(int mode, const std::string& regexp);
+	private:
+		threads::lock m;
+		std::map<key_t, entry> cache;
+		std::list<key_t> lru;	//Most recently used first.
+	};
+
+	std::string regex_transform(int mode, const std::string& regexp, bool& icase)
+	{
+		std::ostringstream y;
+		switch(mode) {
+		case REGEX_MATCH_IWILDCARDS:
+		case REGEX_MATCH_LITERIAL:
+			for(size_t i = 0; i < regexp.length(); i++)
+				if(regexp[i] == '?' && mode == REGEX_MATCH_IWILDCARDS)
+					y << ".";
+				else if(regexp[i] == '*' && mode == REGEX_MATCH_IWILDCARDS)
+					y << ".*";
+				else if(regexp[i] >= 'A' && regexp[i] <= 'Z')
+					y << regexp[i];
+				else if(regexp[i] >= 'a' && regexp[i] <= 'z')
+					y << regexp[i];
+				else if(regexp[i] >= '0' && regexp[i] <= '9')
+					y << regexp[i];
+				else if((unsigned char)regexp[i] > 127)	//UTF-8.
+					y << regexp[i];
+				else
+					y << "\\" << regexp[i];
+			icase = true;
+			return ".*" + y.str() + ".*";
+		case REGEX_MATCH_IREGEX:
+			icase = true;
+			return ".*" + regexp + ".*";
+		case REGEX_MATCH_REGEX:
+		default:
+			icase = false;
+			return regexp;
+		}
+	}
+
+	std::shared_ptr<regex_ns::regex> regex_cache::lookup(int mode, const std::string& regexp)
+	{
+		key_t key(mode, regexp);
+		{
+			threads::alock h(m);
+			auto i = cache.find(key);
+			if(i != cache.end()) {
+				lru.splice(lru.begin(), lru, i->second.lru);
+				return i->second.rx;
+			}
+		}
+		//Compile outside the lock, compiling can be slow. If two threads race, both compile and one of the
+		//results wins.
+		bool icase;
+		std::string _regexp = regex_transform(mode, regexp, icase);
+		auto flags = regex_ns::regex::extended & ~regex_ns::regex::collate;
+		if(mode != REGEX_CAPTURE) flags |= regex_ns::regex::nosubs;
+		if(icase) flags |= regex_ns::regex::icase;
+		std::shared_ptr<regex_ns::regex> rx;
 		try {
-			y = new regex_ns::regex(regexp, regex_ns::regex::extended & ~regex_ns::regex::collate);
-			regexps[regexp] = y;
+			rx.reset(new regex_ns::regex(_regexp, flags));
 		} catch(std::bad_alloc& e) {
-			delete y;
 			throw;
 		} catch(std::exception& e) {
 			throw std::runtime_error(e.what());
 		}
+		threads::alock h(m);
+		auto i = cache.find(key);
+		if(i != cache.end()) {
+			lru.splice(lru.begin(), lru, i->second.lru);
+			return i->second.rx;
+		}
+		lru.push_front(key);
+		try {
+			entry& e = cache[key];
+			e.rx = rx;
+			e.lru = lru.begin();
+		} catch(...) {
+			lru.pop_front();
+			throw;
+		}
+		while(cache.size() > regex_cache_max) {
+			cache.erase(lru.back());
+			lru.pop_back();
+		}
+		return rx;
 	}
 
+	regex_cache& get_regex_cache()
+	{
+		static regex_cache c;
+		return c;
+	}
+}
+
+regex_results regex(const std::string& regexp, const std::string& str, const char* ex) throw(std::bad_alloc,
+	std::runtime_error)
+{
+	auto rx = get_regex_cache().lookup(REGEX_CAPTURE, regexp);
 	regex_ns::smatch matches;
-	bool x = regex_ns::regex_match(str.begin(), str.end(), matches, *(regexps[regexp]));
+	bool x = regex_ns::regex_match(str.begin(), str.end(), matches, *rx);
 	if(x) {
 		std::vector<std::string> res;
 		std::vector<std::pair<size_t, size_t>> mch;
@@ -130,75 +226,8 @@ regex_results regex(const std::string& regexp, const std::string& str, const cha
 bool regex_match(const std::string& regexp, const std::string& str, enum regex_match_mode mode)
 	throw(std::bad_alloc, std::runtime_error)
 {
-	static threads::lock m;
-	static std::map<std::string, map_pointer<regex_ns::regex>> regexps;
-	static std::map<std::pair<regex_match_mode, std::string> , std::pair<std::string, bool>> transform_cache;
-	std::string _regexp;
-	bool icase = false;
-	std::ostringstream y;
-	{
-		//See if we have cached transform.
-		threads::alock h(m);
-		auto key = std::make_pair(mode, regexp);
-		if(transform_cache.count(key)) {
-			auto entry = transform_cache[key];
-			_regexp = entry.first;
-			icase = entry.second;
-			goto transformed;
-		}
-	}
-	switch(mode) {
-	case REGEX_MATCH_REGEX:
-		icase = false;
-		_regexp = regexp;
-		break;
-	case REGEX_MATCH_IWILDCARDS:
-	case REGEX_MATCH_LITERIAL:
-		for(size_t i = 0; i < regexp.length(); i++)
-			if(regexp[i] == '?' && mode == REGEX_MATCH_IWILDCARDS)
-				y << ".";
-			else if(regexp[i] == '*' && mode == REGEX_MATCH_IWILDCARDS)
-				y << ".*";
-			else if(regexp[i] >= 'A' && regexp[i] <= 'Z')
-				y << regexp[i];
-			else if(regexp[i] >= 'a' && regexp[i] <= 'z')
-				y << regexp[i];
-			else if(regexp[i] >= '0' && regexp[i] <= '9')
-				y << regexp[i];
-			else if((unsigned char)regexp[i] > 127)	//UTF-8.
-				y << regexp[i];
-			else
-				y << "\\" << regexp[i];
-		_regexp = ".*" + y.str() + ".*";
-		icase = true;
-		break;
-	case REGEX_MATCH_IREGEX:
-		icase = true;
-		_regexp = ".*" + regexp + ".*";
-		break;
-	}
-transformed:
-	threads::alock h(m);
-	auto key = std::make_pair(mode, regexp);
-	if(!transform_cache.count(key))
-		transform_cache[key] = std::make_pair(_regexp, icase);
-
-	if(!regexps.count(regexp)) {
-		regex_ns::regex* y = NULL;
-		auto flags = regex_ns::regex::extended & ~regex_ns::regex::collate;
-		flags |= regex_ns::regex::nosubs;
-		if(icase) flags |= regex_ns::regex::icase;
-		try {
-			y = new regex_ns::regex(_regexp, flags);
-			regexps[_regexp] = y;
-		} catch(std::bad_alloc& e) {
-			delete y;
-			throw;
-		} catch(std::exception& e) {
-			throw std::runtime_error(e.what());
-		}
-	}
-	return regex_ns::regex_match(str.begin(), str.end(), *(regexps[_regexp]));
+	auto rx = get_regex_cache().lookup(mode, regexp);
+	return regex_ns::regex_match(str.begin(), str.end(), *rx);
 }
 
 namespace
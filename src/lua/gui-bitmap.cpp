@@ -59,6 +59,22 @@ std::vector<char> lua_bitmap::save_png(const lua_palette& pal) const
 	return std::vector<char>(tmp2.begin(), tmp2.end());
 }
 
+lua_bitmap_snapshot::lua_bitmap_snapshot(lua_bitmap& b, lua_palette& p)
+{
+	width = b.width;
+	height = b.height;
+	indices.assign(b.pixels, b.pixels + width * height);
+	threads::alock h(p.palette_mutex);
+	colors.assign(p.colors, p.colors + p.color_count);
+}
+
+lua_bitmap_snapshot::lua_bitmap_snapshot(lua_dbitmap& d)
+{
+	width = d.width;
+	height = d.height;
+	colors.assign(d.pixels, d.pixels + width * height);
+}
+
 namespace
 {
 	const char* CONST_base64chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
@@ -93,6 +109,19 @@ namespace
 			outside = _outside;
 		}
 
+		render_object_bitmap(int32_t _x, int32_t _y, std::shared_ptr<lua_bitmap_snapshot> _bitmap, int32_t _x0,
+			int32_t _y0, uint32_t _dw, uint32_t _dh, bool _outside) throw()
+		{
+			x = _x;
+			y = _y;
+			s = _bitmap;
+			x0 = _x0;
+			y0 = _y0;
+			dw = _dw;
+			dh = _dh;
+			outside = _outside;
+		}
+
 		~render_object_bitmap() throw()
 		{
 		}
@@ -112,9 +141,12 @@ namespace
 			if(b) {
 				w = b->width;
 				h = b->height;
-			} else {
+			} else if(b2) {
 				w = b2->width;
 				h = b2->height;
+			} else {
+				w = s->width;
+				h = s->height;
 			}
 
 			range bX = ((range::make_w(scr.get_width()) - oX) & range::make_w(w) &
@@ -127,19 +159,33 @@ namespace
 			if(b)
 				lua_bitmap_composite(scr, oX, oY, bX, bY, sX, sY, outside,
 					lua_bitmap_holder<T>(*b, *p));
-			else
+			else if(b2)
 				lua_bitmap_composite(scr, oX, oY, bX, bY, sX, sY, outside,
 					lua_dbitmap_holder<T>(*b2));
+			else
+				lua_bitmap_composite(scr, oX, oY, bX, bY, sX, sY, outside,
+					lua_bitmap_snapshot_holder<T>(*s));
 		}
 		void operator()(struct framebuffer::fb<false>& x) throw() { composite_op(x); }
 		void operator()(struct framebuffer::fb<true>& x) throw() { composite_op(x); }
 		void clone(framebuffer::queue& q) const throw(std::bad_alloc) { q.clone_helper(this); }
+		void snapshot(framebuffer::queue& q) throw(std::bad_alloc)
+		{
+			if(!b && !b2) {
+				clone(q);
+				return;
+			}
+			std::shared_ptr<lua_bitmap_snapshot> _s(b ? new lua_bitmap_snapshot(*b, *p) :
+				new lua_bitmap_snapshot(*b2));
+			q.create_add<render_object_bitmap>(x, y, _s, x0, y0, dw, dh, outside);
+		}
 	private:
 		int32_t x;
 		int32_t y;
 		lua::objpin<lua_bitmap> b;
 		lua::objpin<lua_dbitmap> b2;
 		lua::objpin<lua_palette> p;
+		std::shared_ptr<lua_bitmap_snapshot> s;
 		int32_t x0;
 		int32_t y0;
 		uint32_t dw;
@@ -54,15 +54,30 @@ namespace
 		render_object_text_cf(int32_t _x, int32_t _y, const std::string& _text, framebuffer::color _fg,
 			framebuffer::color _bg, framebuffer::color _hl, lua::objpin<lua_customfont>& _font) throw()
 			: x(_x), y(_y), text(_text), fg(_fg), bg(_bg), hl(_hl), font(_font) {}
+		render_object_text_cf(int32_t _x, int32_t _y, framebuffer::color _fg, framebuffer::color _bg,
+			framebuffer::color _hl, std::shared_ptr<std::vector<uint8_t>> _rendered,
+			std::pair<size_t, size_t> _size, std::pair<size_t, size_t> _orig_size) throw()
+			: x(_x), y(_y), fg(_fg), bg(_bg), hl(_hl), rendered(_rendered), size(_size),
+			orig_size(_orig_size) {}
 		~render_object_text_cf() throw()
 		{
 		}
 		template<bool X> void op(struct framebuffer::fb<X>& scr) throw()
 		{
+			if(rendered) {
+				halo_blit(scr, &(*rendered)[0], size.first, size.second, orig_size.first,
+					orig_size.second, x + scr.get_origin_x() - 1, y + scr.get_origin_y() - 1, bg, fg, hl);
+				return;
+			}
 			const framebuffer::font2& fdata = font->get_font();
-			std::u32string _text = utf8::to32(text);
+			std::shared_ptr<const framebuffer::font2::run> r;
+			try {
+				r = fdata.get_run(utf8::to32(text), x);
+			} catch(...) {
+				return;
+			}
 
-			auto size = fdata.get_metrics(_text, x);
+			auto size = std::make_pair(r->width, r->height);
 			auto orig_size = size;
 			//Enlarge size by 2 in each dimension, in order to accomodiate halo, if any.
 			//Round up width to multiple of 32.
@@ -73,25 +88,20 @@ namespace
 			if(allocsize > 32768) {
 				std::vector<uint8_t> memory;
 				memory.resize(allocsize);
-				op_with(scr, &memory[0], size, orig_size, _text, fdata);
+				op_with(scr, &memory[0], size, orig_size, *r, fdata);
 			} else {
 				uint8_t memory[allocsize];
-				op_with(scr, memory, size, orig_size, _text, fdata);
+				op_with(scr, memory, size, orig_size, *r, fdata);
 			}
 		}
 		template<bool X> void op_with(struct framebuffer::fb<X>& scr, unsigned char* mem,
 			std::pair<size_t, size_t> size, std::pair<size_t, size_t> orig_size,
-			const std::u32string& _text, const framebuffer::font2& fdata) throw()
+			const framebuffer::font2::run& r, const framebuffer::font2& fdata) throw()
 		{
 			memset(mem, 0, size.first * size.second);
 			int32_t rx = x + scr.get_origin_x() - 1;
 			int32_t ry = y + scr.get_origin_y() - 1;
-			fdata.for_each_glyph(_text, x, [mem, size](uint32_t x, uint32_t y,
-				const framebuffer::font2::glyph& glyph) {
-				x++;
-				y++;
-				glyph.render(mem + (y * size.first + x), size.first, 0, 0, glyph.width, glyph.height);
-			});
+			fdata.render_run(r, mem + size.first + 1, size.first);
 			halo_blit(scr, mem, size.first, size.second, orig_size.first, orig_size.second, rx, ry, bg,
 				fg, hl);
 		}
@@ -102,6 +112,29 @@ namespace
 		void operator()(struct framebuffer::fb<true>& scr) throw()  { op(scr); }
 		void operator()(struct framebuffer::fb<false>& scr) throw() { op(scr); }
 		void clone(framebuffer::queue& q) const throw(std::bad_alloc) { q.clone_helper(this); }
+		void snapshot(framebuffer::queue& q) throw(std::bad_alloc)
+		{
+			if(!font) {
+				clone(q);
+				return;
+			}
+			//Render the text now, so the copy does not need the font.
+			const framebuffer::font2& fdata = font->get_font();
+			std::shared_ptr<const framebuffer::font2::run> r;
+			try {
+				r = fdata.get_run(utf8::to32(text), x);
+			} catch(std::bad_alloc& e) {
+				throw;
+			} catch(...) {
+				return;
+			}
+			std::shared_ptr<std::vector<uint8_t>> mem(new std::vector<uint8_t>);
+			auto _orig_size = std::make_pair(r->width, r->height);
+			auto _size = std::make_pair((_orig_size.first + 33) >> 5 << 5, _orig_size.second + 2);
+			mem->resize(_size.first * _size.second + 32);
+			fdata.render_run(*r, &(*mem)[0] + _size.first + 1, _size.first);
+			q.create_add<render_object_text_cf>(x, y, fg, bg, hl, mem, _size, _orig_size);
+		}
 	private:
 		int32_t x;
 		int32_t y;
@@ -110,6 +143,10 @@ namespace
 		framebuffer::color bg;
 		framebuffer::color hl;
 		lua::objpin<lua_customfont> font;
+		//Text rendered by snapshot().
+		std::shared_ptr<std::vector<uint8_t>> rendered;
+		std::pair<size_t, size_t> size;
+		std::pair<size_t, size_t> orig_size;
 	};
 
 	lua_customfont::lua_customfont(lua::state& L, const std::string& filename, const std::string& filename2)
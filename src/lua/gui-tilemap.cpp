@@ -7,6 +7,7 @@
 #include "library/lua-framebuffer.hpp"
 #include "library/zip.hpp"
 #include "lua/bitmap.hpp"
+#include <map>
 #include <vector>
 #include <sstream>
 
@@ -167,11 +168,48 @@ namespace
 		threads::lock lock;
 	};
 
+	//Copy of tilemap, with each distinct tile copied once.
+	struct tilemap_snapshot
+	{
+		tilemap_snapshot(tilemap& _map)
+		{
+			threads::alock h(_map.lock);
+			width = _map.width;
+			height = _map.height;
+			cwidth = _map.cwidth;
+			cheight = _map.cheight;
+			std::map<void*, std::shared_ptr<lua_bitmap_snapshot>> tiles;
+			cells.resize(width * height);
+			for(size_t i = 0; i < width * height; i++) {
+				tilemap_entry& e = _map.map[i];
+				if(e.b && e.p) {
+					auto& t = tiles[e.b.object()];
+					if(!t)
+						t.reset(new lua_bitmap_snapshot(*e.b, *e.p));
+					cells[i] = t;
+				} else if(e.d) {
+					auto& t = tiles[e.d.object()];
+					if(!t)
+						t.reset(new lua_bitmap_snapshot(*e.d));
+					cells[i] = t;
+				}
+			}
+		}
+		size_t width;
+		size_t height;
+		size_t cwidth;
+		size_t cheight;
+		std::vector<std::shared_ptr<lua_bitmap_snapshot>> cells;
+	};
+
 	struct render_object_tilemap : public framebuffer::object
 	{
 		render_object_tilemap(int32_t _x, int32_t _y, int32_t _x0, int32_t _y0, uint32_t _w,
 			uint32_t _h, bool _outside, lua::objpin<tilemap>& _map)
 			: x(_x), y(_y), x0(_x0), y0(_y0), w(_w), h(_h), outside(_outside), map(_map) {}
+		render_object_tilemap(int32_t _x, int32_t _y, int32_t _x0, int32_t _y0, uint32_t _w,
+			uint32_t _h, bool _outside, std::shared_ptr<tilemap_snapshot> _snap)
+			: x(_x), y(_y), x0(_x0), y0(_y0), w(_w), h(_h), outside(_outside), snap(_snap) {}
 		~render_object_tilemap() throw()
 		{
 		}
@@ -181,6 +219,16 @@ namespace
 		}
 		template<bool T> void composite_op(struct framebuffer::fb<T>& scr) throw()
 		{
+			if(snap) {
+				for(size_t ty = 0; ty < snap->height; ty++)
+					for(size_t tx = 0; tx < snap->width; tx++) {
+						auto& t = snap->cells[ty * snap->width + tx];
+						if(t)
+							composite_tile(scr, t->width, t->height, snap->cwidth * tx,
+								snap->cheight * ty, lua_bitmap_snapshot_holder<T>(*t));
+					}
+				return;
+			}
 			tilemap& _map = *map;
 			threads::alock h(_map.lock);
 			for(size_t ty = 0; ty < _map.height; ty++) {
@@ -194,16 +242,14 @@ namespace
 		template<bool T> void composite_op(struct framebuffer::fb<T>& scr, tilemap_entry& e, int32_t bx,
 			int32_t by) throw()
 		{
-			size_t _w, _h;
-			if(e.b) {
-				_w = e.b->width;
-				_h = e.b->height;
-			} else if(e.d) {
-				_w = e.d->width;
-				_h = e.d->height;
-			} else
-				return;
-
+			if(e.b)
+				composite_tile(scr, e.b->width, e.b->height, bx, by, lua_bitmap_holder<T>(*e.b, *e.p));
+			else if(e.d)
+				composite_tile(scr, e.d->width, e.d->height, bx, by, lua_dbitmap_holder<T>(*e.d));
+		}
+		template<bool T, class B> void composite_tile(struct framebuffer::fb<T>& scr, size_t _w, size_t _h,
+			int32_t bx, int32_t by, B bmp) throw()
+		{
 			uint32_t oX = x + scr.get_origin_x() - x0;
 			uint32_t oY = y + scr.get_origin_y() - y0;
 			range bX = ((range::make_w(scr.get_width()) - oX) & range::make_s(bx, _w) &
@@ -212,17 +258,20 @@ namespace
 				range::make_s(y0, h)) - by;
 			range sX = range::make_s(-x - bx + x0, scr.get_last_blit_width());
 			range sY = range::make_s(-y - by + y0, scr.get_last_blit_height());
-
-			if(e.b)
-				lua_bitmap_composite(scr, oX + bx, oY + by, bX, bY, sX, sY, outside,
-					lua_bitmap_holder<T>(*e.b, *e.p));
-			else if(e.d)
-				lua_bitmap_composite(scr, oX + bx, oY + by, bX, bY, sX, sY, outside,
-					lua_dbitmap_holder<T>(*e.d));
+			lua_bitmap_composite(scr, oX + bx, oY + by, bX, bY, sX, sY, outside, bmp);
 		}
 		void operator()(struct framebuffer::fb<false>& x) throw() { composite_op(x); }
 		void operator()(struct framebuffer::fb<true>& x) throw() { composite_op(x); }
 		void clone(framebuffer::queue& q) const throw(std::bad_alloc) { q.clone_helper(this); }
+		void snapshot(framebuffer::queue& q) throw(std::bad_alloc)
+		{
+			if(!map) {
+				clone(q);
+				return;
+			}
+			std::shared_ptr<tilemap_snapshot> _snap(new tilemap_snapshot(*map));
+			q.create_add<render_object_tilemap>(x, y, x0, y0, w, h, outside, _snap);
+		}
 	private:
 		int32_t x;
 		int32_t y;
@@ -232,6 +281,7 @@ namespace
 		uint32_t h;
 		bool outside;
 		lua::objpin<tilemap> map;
+		std::shared_ptr<tilemap_snapshot> snap;
 	};
 
 	template<bool outside> int tilemap::draw(lua::state& L, lua::parameters& P)
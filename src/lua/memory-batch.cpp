@@ -0,0 +1,198 @@
+#include "lua/internal.hpp"
+#include "lua/address.hpp"
+#include "core/instance.hpp"
+#include "core/memorymanip.hpp"
+#include "library/memoryspace.hpp"
+#include "library/minmax.hpp"
+#include "library/int24.hpp"
+#include "library/string.hpp"
+
+namespace
+{
+	class batch_obj
+	{
+	public:
+		batch_obj(lua::state& L, uint64_t addr, const std::vector<memory_batch::field>& fields,
+			const std::vector<std::string>& names, uint64_t rows, uint64_t stride);
+		static size_t overcommit(uint64_t addr, const std::vector<memory_batch::field>& fields,
+			const std::vector<std::string>& names, uint64_t rows, uint64_t stride)
+		{
+			return 0;
+		}
+		static int create(lua::state& L, lua::parameters& P);
+		static int create_struct(lua::state& L, lua::parameters& P);
+		int index(lua::state& L, lua::parameters& P);
+		int len(lua::state& L, lua::parameters& P);
+		int refresh(lua::state& L, lua::parameters& P);
+		int get(lua::state& L, lua::parameters& P);
+		std::string print()
+		{
+			std::ostringstream x;
+			x << "addr=0x" << std::hex << addr << " rows=" << std::dec << batch.row_count() << " fields="
+				<< batch.field_count();
+			return x.str();
+		}
+	private:
+		void push_value(lua::state& L, size_t i);
+		uint64_t addr;
+		memory_batch batch;
+		std::map<std::string, size_t> names;
+	};
+
+	batch_obj::batch_obj(lua::state& L, uint64_t _addr, const std::vector<memory_batch::field>& fields,
+		const std::vector<std::string>& _names, uint64_t rows, uint64_t stride)
+		: addr(_addr), batch(_addr, fields, rows, stride)
+	{
+		for(size_t i = 0; i < _names.size(); i++)
+			if(_names[i] != "")
+				names[_names[i]] = i;
+	}
+
+	int batch_obj::create(lua::state& L, lua::parameters& P)
+	{
+		uint64_t addr, rows, stride;
+		std::string type;
+
+		addr = lua_get_read_address(P);
+		P(type, rows);
+		std::vector<memory_batch::field> fields;
+		fields.push_back(memory_batch::field(0, memory_batch::type_by_name(type)));
+		P(P.optional(stride, memory_batch::type_size(fields[0].t)));
+
+		batch_obj* o = lua::_class<batch_obj>::create(L, addr, fields, std::vector<std::string>(), rows,
+			stride);
+		o->batch.refresh(*CORE().memory);
+		return 1;
+	}
+
+	int batch_obj::create_struct(lua::state& L, lua::parameters& P)
+	{
+		uint64_t addr, rows, stride;
+		int ltbl;
+		std::vector<memory_batch::field> fields;
+		std::vector<std::string> fnames;
+
+		addr = lua_get_read_address(P);
+		P(P.table(ltbl), P.optional(rows, 1));
+		for(int i = 1;; i++) {
+			L.rawgeti(ltbl, i);
+			if(L.type(-1) == LUA_TNIL) {
+				L.pop(1);
+				break;
+			}
+			if(L.type(-1) != LUA_TTABLE)
+				(stringfmt() << P.get_fname() << ": Layout entry #" << i << " must be a table").throwex();
+			int ent = L.gettop();
+			L.rawgeti(ent, 1);
+			L.rawgeti(ent, 2);
+			L.rawgeti(ent, 3);
+			if(L.type(ent + 1) != LUA_TSTRING || L.type(ent + 2) != LUA_TNUMBER ||
+				L.type(ent + 3) != LUA_TSTRING)
+				(stringfmt() << P.get_fname() << ": Layout entry #" << i
+					<< " must be {name, offset, type}").throwex();
+			fnames.push_back(L.tostring(ent + 1));
+			fields.push_back(memory_batch::field(L.tointeger(ent + 2),
+				memory_batch::type_by_name(L.tostring(ent + 3))));
+			L.pop(4);
+		}
+		if(fields.empty())
+			(stringfmt() << P.get_fname() << ": Layout must have at least one field").throwex();
+		uint64_t recsize = 0;
+		for(auto& i : fields)
+			recsize = max(recsize, i.offset + memory_batch::type_size(i.t));
+		P(P.optional(stride, recsize));
+
+		batch_obj* o = lua::_class<batch_obj>::create(L, addr, fields, fnames, rows, stride);
+		o->batch.refresh(*CORE().memory);
+		return 1;
+	}
+
+	void batch_obj::push_value(lua::state& L, size_t i)
+	{
+		switch(batch.get_type(i)) {
+		case memory_batch::T_U8:	L.pushnumber(batch.get<uint8_t>(i)); break;
+		case memory_batch::T_S8:	L.pushnumber(batch.get<int8_t>(i)); break;
+		case memory_batch::T_U16:	L.pushnumber(batch.get<uint16_t>(i)); break;
+		case memory_batch::T_S16:	L.pushnumber(batch.get<int16_t>(i)); break;
+		case memory_batch::T_U24:	L.pushnumber(batch.get<ss_uint24_t>(i)); break;
+		case memory_batch::T_S24:	L.pushnumber(batch.get<ss_int24_t>(i)); break;
+		case memory_batch::T_U32:	L.pushnumber(batch.get<uint32_t>(i)); break;
+		case memory_batch::T_S32:	L.pushnumber(batch.get<int32_t>(i)); break;
+		case memory_batch::T_U64:	L.pushnumber(batch.get<uint64_t>(i)); break;
+		case memory_batch::T_S64:	L.pushnumber(batch.get<int64_t>(i)); break;
+		case memory_batch::T_F32:	L.pushnumber(batch.get<float>(i)); break;
+		case memory_batch::T_F64:	L.pushnumber(batch.get<double>(i)); break;
+		}
+	}
+
+	int batch_obj::index(lua::state& L, lua::parameters& P)
+	{
+		if(L.type(2) == LUA_TNUMBER) {
+			//Flat index (1-based).
+			uint64_t i = L.tointeger(2);
+			if(i < 1 || i > batch.size()) {
+				L.pushnil();
+				return 1;
+			}
+			push_value(L, i - 1);
+			return 1;
+		}
+		if(L.type(2) != LUA_TSTRING) {
+			L.pushnil();
+			return 1;
+		}
+		std::string key = L.tostring(2);
+		if(names.count(key)) {
+			push_value(L, names[key]);
+			return 1;
+		}
+		//Not a field, look up methods.
+		L.getmetatable(1);
+		L.pushvalue(2);
+		L.rawget(-2);
+		return 1;
+	}
+
+	int batch_obj::len(lua::state& L, lua::parameters& P)
+	{
+		L.pushnumber(batch.size());
+		return 1;
+	}
+
+	int batch_obj::refresh(lua::state& L, lua::parameters& P)
+	{
+		batch.refresh(*CORE().memory);
+		return 0;
+	}
+
+	int batch_obj::get(lua::state& L, lua::parameters& P)
+	{
+		uint64_t row, field;
+
+		P(P.skipped(), row);
+		if(P.is_string()) {
+			std::string name;
+			P(name);
+			if(!names.count(name))
+				(stringfmt() << P.get_fname() << ": No such field '" << name << "'").throwex();
+			field = names[name] + 1;
+		} else
+			P(P.optional(field, 1));
+		if(row < 1 || row > batch.row_count() || field < 1 || field > batch.field_count()) {
+			L.pushnil();
+			return 1;
+		}
+		push_value(L, (row - 1) * batch.field_count() + (field - 1));
+		return 1;
+	}
+
+	lua::_class<batch_obj> LUA_class_batch(lua_class_memory, "MEMORY_BATCH", {
+		{"new", batch_obj::create},
+		{"new_struct", batch_obj::create_struct},
+	}, {
+		{"__index", &batch_obj::index},
+		{"__len", &batch_obj::len},
+		{"refresh", &batch_obj::refresh},
+		{"get", &batch_obj::get},
+	}, &batch_obj::print);
+}
@@ -730,6 +730,48 @@ namespace
 		return hash_core<skein::hash, lua_skein_update, lua_skein_read, true>(h, L, P);
 	}
 
+	template<bool use_skein>
+	int hash_regions(lua::state& L, lua::parameters& P)
+	{
+		auto& core = CORE();
+		std::list<std::vector<char>> copies;
+		std::vector<const uint8_t*> data;
+		std::vector<size_t> lens;
+
+		while(P.more()) {
+			uint64_t addr, size;
+			addr = lua_get_read_address(P);
+			P(size);
+			char* pbuffer = size ? core.memory->get_physical_mapping(addr, size) : NULL;
+			if(size && !pbuffer) {
+				//Not directly mappable, copy it.
+				copies.push_back(std::vector<char>(size));
+				pbuffer = &copies.back()[0];
+				for(uint64_t i = 0; i < size; i++)
+					pbuffer[i] = core.memory->read<uint8_t>(addr + i);
+			}
+			data.push_back(reinterpret_cast<const uint8_t*>(pbuffer));
+			lens.push_back(size);
+		}
+		L.newtable();
+		if(data.empty())
+			return 1;
+		std::vector<uint8_t> out(32 * data.size());
+		std::vector<uint8_t*> outp;
+		for(size_t i = 0; i < data.size(); i++)
+			outp.push_back(&out[32 * i]);
+		if(use_skein)
+			skein::hash::hash_multi(skein::hash::PIPE_512, 256, &outp[0], &data[0], &lens[0], data.size());
+		else
+			sha256::hash_multi(&outp[0], &data[0], &lens[0], data.size());
+		for(size_t i = 0; i < data.size(); i++) {
+			L.pushnumber(i + 1);
+			L.pushlstring(hex::b_to(outp[i], 32, false));
+			L.rawset(-3);
+		}
+		return 1;
+	}
+
 	template<bool cmp>
 	int copy_to_host(lua::state& L, lua::parameters& P)
 	{
@@ -849,6 +891,8 @@ namespace
 		{"hash_region", hash_region<false>},
 		{"hash_region2", hash_region<true>},
 		{"hash_region_skein", hash_region_skein},
+		{"hash_regions", hash_regions<false>},
+		{"hash_regions_skein", hash_regions<true>},
 		{"store", copy_to_host<false>},
 		{"storecmp", copy_to_host<true>},
 		{"readregion", readregion},
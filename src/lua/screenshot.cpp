@@ -18,7 +18,7 @@ namespace
 	int screenshot_bitmap(lua::state& L, lua::parameters& P)
 	{
 		auto& core = CORE();
-		framebuffer::raw& _fb = core.fbuf->render_get_latest_screen();
+		const framebuffer::raw& _fb = core.fbuf->render_get_latest_screen();
 		try {
 			auto osize = std::make_pair(_fb.get_width(), _fb.get_height());
 			std::vector<uint32_t> tmp(_fb.get_width());
@@ -76,6 +76,8 @@ callback=classes.CALLBACKS_LIST.new();
 memory.mkaddr = classes.ADDRESS.new;
 memory.map_structure=classes.MMAP_STRUCT.new;
 memory.compare_new=classes.COMPARE_OBJ.new;
+memory.batch=classes.MEMORY_BATCH.new;
+memory.batch_struct=classes.MEMORY_BATCH.new_struct;
 zip.create=classes.ZIPWRITER.new;
 gui.tilemap=classes.TILEMAP.new;
 gui.renderq_new=classes.RENDERCTX.new;
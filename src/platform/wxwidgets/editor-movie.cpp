@@ -1475,7 +1475,7 @@ void wxeditor_movie::_moviepanel::popup_axis_panel(uint64_t row, control_info ci
 		});
 		signal_repaint();
 	} else if(ci.axistype == portctrl::button::TYPE_LIGHTGUN) {
-		framebuffer::raw& _fb = inst.fbuf->render_get_latest_screen();
+		const framebuffer::raw& _fb = inst.fbuf->render_get_latest_screen();
 		framebuffer::fb<false> fb;
 		auto osize = std::make_pair(_fb.get_width(), _fb.get_height());
 		auto size = inst.rom->lightgun_scale();
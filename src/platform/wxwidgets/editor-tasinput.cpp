@@ -274,7 +274,7 @@ void wxeditor_tasinput::xypanel::on_paint(wxPaintEvent& e)
 	wxPaintDC dc(graphics);
 	if(lightgun) {
 		//Draw the current screen.
-		framebuffer::raw& _fb = inst.fbuf->render_get_latest_screen();
+		const framebuffer::raw& _fb = inst.fbuf->render_get_latest_screen();
 		framebuffer::fb<false> fb;
 		auto osize = std::make_pair(_fb.get_width(), _fb.get_height());
 		auto size = inst.rom->lightgun_scale();
@@ -41,6 +41,7 @@ public:
 	void on_load(wxCommandEvent& e);
 	void on_unload(wxCommandEvent& e);
 	void on_refresh(wxCommandEvent& e);
+	void on_cancel(wxCommandEvent& e);
 	void on_close(wxCommandEvent& e);
 	void on_wclose(wxCloseEvent& e);
 	void refresh();
@@ -61,8 +62,12 @@ private:
 	wxButton* unloadbutton;
 	wxButton* refreshbutton;
 	wxButton* closebutton;
+	wxStaticText* jobstatus;
+	wxButton* cancelbutton;
 	struct dispatch::target<> corechange;
 	struct dispatch::target<> vstreamchange;
+	struct dispatch::target<uint64_t, uint64_t> jobprogress;
+	struct dispatch::target<bool, std::string> jobfinish;
 };
 
 wxeditor_voicesub::wxeditor_voicesub(wxWindow* parent, emulator_instance& _inst)
@@ -72,7 +77,7 @@ wxeditor_voicesub::wxeditor_voicesub(wxWindow* parent, emulator_instance& _inst)
 	CHECK_UI_THREAD;
 	closing = false;
 	Centre();
-	wxFlexGridSizer* top_s = new wxFlexGridSizer(6, 1, 0, 0);
+	wxFlexGridSizer* top_s = new wxFlexGridSizer(7, 1, 0, 0);
 	SetSizer(top_s);
 
 	top_s->Add(subtitles = new wxListBox(this, wxID_ANY, wxDefaultPosition, wxSize(300, 400), 0, NULL,
@@ -93,6 +98,12 @@ wxeditor_voicesub::wxeditor_voicesub(wxWindow* parent, emulator_instance& _inst)
 	top_s->Add(pbutton_s, 1, wxGROW);
 	pbutton_s->SetSizeHints(this);
 
+	pbutton_s = new wxBoxSizer(wxHORIZONTAL);
+	pbutton_s->Add(jobstatus = new wxStaticText(this, wxID_ANY, wxT("")), 1, wxGROW);
+	pbutton_s->Add(cancelbutton = new wxButton(this, wxID_ANY, wxT("Cancel")), 0, wxGROW);
+	top_s->Add(pbutton_s, 1, wxGROW);
+	pbutton_s->SetSizeHints(this);
+
 	pbutton_s = new wxBoxSizer(wxHORIZONTAL);
 	pbutton_s->Add(new wxStaticText(this, wxID_ANY, wxT("Misc.")), 0, wxGROW);
 	pbutton_s->Add(changetsbutton = new wxButton(this, wxID_ANY, wxT("Change time")), 0, wxGROW);
@@ -134,6 +145,8 @@ wxeditor_voicesub::wxeditor_voicesub(wxWindow* parent, emulator_instance& _inst)
 		wxCommandEventHandler(wxeditor_voicesub::on_unload), NULL, this);
 	refreshbutton->Connect(wxEVT_COMMAND_BUTTON_CLICKED,
 		wxCommandEventHandler(wxeditor_voicesub::on_refresh), NULL, this);
+	cancelbutton->Connect(wxEVT_COMMAND_BUTTON_CLICKED,
+		wxCommandEventHandler(wxeditor_voicesub::on_cancel), NULL, this);
 	closebutton->Connect(wxEVT_COMMAND_BUTTON_CLICKED,
 		wxCommandEventHandler(wxeditor_voicesub::on_close), NULL, this);
 	subtitles->Connect(wxEVT_COMMAND_LISTBOX_SELECTED,
@@ -148,6 +161,25 @@ wxeditor_voicesub::wxeditor_voicesub(wxWindow* parent, emulator_instance& _inst)
 	corechange.set(inst.dispatch->core_change, [this]() {
 		runuifun([this]() -> void { this->refresh(); });
 	});
+	jobprogress.set(inst.dispatch->voice_job_progress, [this](uint64_t done, uint64_t total) {
+		runuifun([this, done, total]() -> void {
+			if(this->closing)
+				return;
+			this->jobstatus->SetLabel(towxstring((stringfmt() << "Working: " << 100 * done / total
+				<< "%").str()));
+			this->cancelbutton->Enable(true);
+		});
+	});
+	jobfinish.set(inst.dispatch->voice_job_finish, [this](bool ok, std::string error) {
+		runuifun([this, ok, error]() -> void {
+			if(this->closing)
+				return;
+			this->jobstatus->SetLabel(towxstring(ok ? "Done" : "Not completed"));
+			this->cancelbutton->Enable(false);
+			if(error != "")
+				show_message_ok(this, "Error", error, wxICON_EXCLAMATION);
+		});
+	});
 	refresh();
 }
 
@@ -332,6 +364,12 @@ void wxeditor_voicesub::on_refresh(wxCommandEvent& e)
 	refresh();
 }
 
+void wxeditor_voicesub::on_cancel(wxCommandEvent& e)
+{
+	CHECK_UI_THREAD;
+	inst.commentary->cancel_job();
+}
+
 void wxeditor_voicesub::on_close(wxCommandEvent& e)
 {
 	CHECK_UI_THREAD;
@@ -350,6 +388,7 @@ void wxeditor_voicesub::refresh()
 	loadbutton->Enable(!pflag);
 	exportsbutton->Enable(cflag);
 	importpbutton->Enable(cflag);
+	cancelbutton->Enable(inst.commentary->job_running());
 	int sel = subtitles->GetSelection();
 	subtitles->Clear();
 	smap.clear();
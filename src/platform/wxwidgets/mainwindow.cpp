@@ -1232,6 +1232,7 @@ wxwin_mainwindow::wxwin_mainwindow(emulator_instance& _inst, bool fscreen)
 	});
 	gpanel->SetDropTarget(new loadfile(this, inst));
 	spanel->SetDropTarget(new loadfile(this, inst));
+	lsnes_image_hasher.set_cache_file(get_config_path() + "/hash.db");
 	set_hasher_callback(hash_callback);
 	reinterpret_cast<system_menu*>(sysmenu)->update(false);
 	menubar->SetMenuLabel(1, towxstring(inst.rom->get_systemmenu_name()));
@@ -404,7 +404,8 @@ void wxwin_vumeter::refresh()
 	auto rate_cur = inst.audio->voice_rate();
 	unsigned rate_nom = inst.audio->orig_voice_rate();
 	rate->SetLabel(towxstring((stringfmt() << "Current: " << rate_cur.second << "Hz (nominal " << rate_nom
-		<< "Hz), record: " << rate_cur.first << "Hz").str()));
+		<< "Hz), record: " << rate_cur.first << "Hz, underruns: " << inst.audio->music_underruns()
+		<< ", overruns: " << inst.audio->music_overruns()).str()));
 	vupanel->signal_repaint();
 }
 
@@ -0,0 +1,107 @@
+#include "sha256.hpp"
+#include "skein.hpp"
+#include "cpufeatures.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <sys/time.h>
+
+uint64_t get_utime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+//Hashing a few dozen small regions each frame, like a desync detection script.
+const size_t regions = 64;
+const size_t bulksize = 64 << 20;
+const unsigned frames = 2000;
+
+void run_sha256(const char* name, std::vector<std::vector<uint8_t>>& out, const std::vector<uint8_t*>& ptrs,
+	const std::vector<size_t>& lens, bool multi)
+{
+	std::vector<uint8_t*> outp;
+	for(auto& i : out)
+		outp.push_back(&i[0]);
+	uint64_t t = get_utime();
+	for(unsigned f = 0; f < frames; f++) {
+		if(multi)
+			sha256::hash_multi(&outp[0], &ptrs[0], &lens[0], regions);
+		else
+			for(size_t i = 0; i < regions; i++)
+				sha256::hash(outp[i], ptrs[i], lens[i]);
+	}
+	std::cout << name << ": " << (double)(get_utime() - t) / 1000000 << "s" << std::endl;
+}
+
+void run_skein(const char* name, std::vector<std::vector<uint8_t>>& out, const std::vector<uint8_t*>& ptrs,
+	const std::vector<size_t>& lens, bool multi)
+{
+	std::vector<uint8_t*> outp;
+	for(auto& i : out)
+		outp.push_back(&i[0]);
+	uint64_t t = get_utime();
+	for(unsigned f = 0; f < frames; f++) {
+		if(multi)
+			skein::hash::hash_multi(skein::hash::PIPE_512, 256, &outp[0], &ptrs[0], &lens[0], regions);
+		else
+			for(size_t i = 0; i < regions; i++) {
+				skein::hash h(skein::hash::PIPE_512, 256);
+				h.write(ptrs[i], lens[i]);
+				h.read(outp[i]);
+			}
+	}
+	std::cout << name << ": " << (double)(get_utime() - t) / 1000000 << "s" << std::endl;
+}
+
+double bulk_sha256(const std::vector<uint8_t>& data)
+{
+	uint8_t out[32];
+	uint64_t t = get_utime();
+	sha256::hash(out, data);
+	return (double)data.size() / (get_utime() - t);
+}
+
+int main()
+{
+	std::cout << "SHA extensions: " << (cpufeatures::has_sha() ? "yes" : "no") << ", AVX2: "
+		<< (cpufeatures::has_avx2() ? "yes" : "no") << std::endl;
+	std::vector<uint8_t> mem(1 << 20);
+	for(size_t i = 0; i < mem.size(); i++)
+		mem[i] = rand();
+	std::vector<uint8_t*> ptrs;
+	std::vector<size_t> lens;
+	for(size_t i = 0; i < regions; i++) {
+		lens.push_back(rand() % 2048);
+		ptrs.push_back(&mem[rand() % (mem.size() - 2048)]);
+	}
+	std::vector<std::vector<uint8_t>> a(regions, std::vector<uint8_t>(32));
+	std::vector<std::vector<uint8_t>> b = a, c = a, d = a;
+
+	cpufeatures::set_disabled(true);
+	run_sha256("SHA-256 portable", a, ptrs, lens, false);
+	cpufeatures::set_disabled(false);
+	run_sha256("SHA-256 accelerated", b, ptrs, lens, false);
+	run_sha256("SHA-256 multi-buffer", c, ptrs, lens, true);
+	bool ok = (a == b && a == c);
+
+	cpufeatures::set_disabled(true);
+	run_skein("Skein-512 portable", a, ptrs, lens, false);
+	cpufeatures::set_disabled(false);
+	run_skein("Skein-512 multi-buffer", d, ptrs, lens, true);
+	ok = ok && (a == d);
+
+	std::vector<uint8_t> bulk(bulksize);
+	for(size_t i = 0; i < bulk.size(); i++)
+		bulk[i] = i * 31 + 7;
+	cpufeatures::set_disabled(true);
+	std::cout << "SHA-256 bulk portable: " << bulk_sha256(bulk) << "MB/s" << std::endl;
+	cpufeatures::set_disabled(false);
+	std::cout << "SHA-256 bulk accelerated: " << bulk_sha256(bulk) << "MB/s" << std::endl;
+
+	if(!ok) {
+		std::cout << "\e[31mMISMATCH\e[0m" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include "lua-base.hpp"
+#include "memtracker.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <sys/time.h>
+extern "C"
+{
+#include <lauxlib.h>
+}
+
+uint64_t get_utime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+//A HUD script building a table per object every frame.
+const char* script =
+	"local last;\n"
+	"for frame = 1, 3000 do\n"
+	"	local objs = {};\n"
+	"	for i = 1, 100 do\n"
+	"		objs[i] = {x = i, y = frame, state = i % 7, hp = {i, i + 1, i + 2}};\n"
+	"	end\n"
+	"	last = objs;\n"
+	"end\n";
+
+//The old allocator: realloc for everything, accounting on every call.
+size_t old_use = 0;
+std::function<void(ssize_t change)> old_change = [](ssize_t delta) {
+	memtracker::singleton()("Lua VM (old)", delta);
+};
+
+void* old_alloc(void* user, void* old, size_t olds, size_t news)
+{
+	if(!old)
+		olds = 0;
+	if(!news) {
+		old_use -= olds;
+		old_change(-(ssize_t)olds);
+		free(old);
+		return NULL;
+	}
+	void* m = realloc(old, news);
+	if(m) {
+		old_use = old_use + news - olds;
+		old_change((ssize_t)news - (ssize_t)olds);
+	}
+	return m;
+}
+
+void run(lua_State* L)
+{
+	if(luaL_loadstring(L, script) || lua_pcall(L, 0, 0, 0)) {
+		std::cerr << "Error: " << lua_tostring(L, -1) << std::endl;
+		exit(1);
+	}
+}
+
+int main()
+{
+	uint64_t t1 = get_utime();
+	lua_State* L1 = lua_newstate(old_alloc, NULL);
+	run(L1);
+	lua_close(L1);
+	uint64_t d1 = get_utime() - t1;
+
+	t1 = get_utime();
+	{
+		lua::state L2;
+		L2.set_memory_change_handler([](ssize_t delta) {
+			memtracker::singleton()("Lua VM (new)", delta);
+		});
+		L2.reset();
+		run(L2.handle());
+		std::cout << "Memory use at end: " << L2.get_memory_use() << " bytes" << std::endl;
+	}
+	uint64_t d2 = get_utime() - t1;
+
+	std::cout << "realloc() allocator: " << (double)d1 / 1000000 << "s" << std::endl;
+	std::cout << "Pooled allocator: " << (double)d2 / 1000000 << "s" << std::endl;
+	auto r = memtracker::singleton().report();
+	for(auto i : r)
+		std::cout << "Leftover " << i.first << ": " << i.second << " bytes" << std::endl;
+	return 0;
+}
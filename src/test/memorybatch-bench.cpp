@@ -0,0 +1,67 @@
+#include "memoryspace.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <sys/time.h>
+
+uint64_t get_utime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+//A typical HUD script: 128 objects of 16 bytes, reading x, y (words) and state (byte) of each.
+const uint64_t objects = 128;
+const uint64_t objsize = 16;
+const unsigned frames = 100000;
+
+int main()
+{
+	unsigned char wram[131072];
+	for(size_t i = 0; i < sizeof(wram); i++)
+		wram[i] = rand();
+	memory_space mspace;
+	std::list<memory_space::region*> regions;
+	regions.push_back(new memory_space::region_direct("WRAM", 0x7E0000, -1, wram, sizeof(wram)));
+	mspace.set_regions(regions);
+	uint64_t base = 0x7E1000;
+
+	uint64_t sum1 = 0;
+	uint64_t t1 = get_utime();
+	for(unsigned f = 0; f < frames; f++) {
+		for(uint64_t i = 0; i < objects; i++) {
+			sum1 += mspace.read<uint16_t>(base + i * objsize + 0);
+			sum1 += mspace.read<uint16_t>(base + i * objsize + 2);
+			sum1 += mspace.read<uint8_t>(base + i * objsize + 8);
+		}
+	}
+	uint64_t d1 = get_utime() - t1;
+
+	std::vector<memory_batch::field> fields;
+	fields.push_back(memory_batch::field(0, memory_batch::T_U16));
+	fields.push_back(memory_batch::field(2, memory_batch::T_U16));
+	fields.push_back(memory_batch::field(8, memory_batch::T_U8));
+	memory_batch batch(base, fields, objects, objsize);
+	uint64_t sum2 = 0;
+	t1 = get_utime();
+	for(unsigned f = 0; f < frames; f++) {
+		batch.refresh(mspace);
+		for(size_t i = 0; i < batch.size(); i += 3) {
+			sum2 += batch.get<uint16_t>(i + 0);
+			sum2 += batch.get<uint16_t>(i + 1);
+			sum2 += batch.get<uint8_t>(i + 2);
+		}
+	}
+	uint64_t d2 = get_utime() - t1;
+
+	std::cout << "Per-call reads: " << (double)d1 / 1000000 << "s" << std::endl;
+	std::cout << "Batched reads: " << (double)d2 / 1000000 << "s" << std::endl;
+	mspace.set_regions(std::list<memory_space::region*>());
+	for(auto i : regions)
+		delete i;
+	if(sum1 != sum2) {
+		std::cout << "\e[31mMISMATCH\e[0m" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,194 @@
+#include "ogg.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <sys/time.h>
+
+uint64_t get_utime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+//One hour of 20ms Opus packets at about 48kbps.
+const uint64_t packets = 3600 * 50;
+const uint32_t packet_samples = 960;
+
+uint64_t checksum(uint64_t sum, const uint8_t* data, size_t len, uint64_t granule)
+{
+	//Cheap, so the time is spent reading.
+	uint32_t s = 0;
+	for(size_t i = 0; i < len; i++)
+		s += data[i];
+	return sum * 31 + s + len + granule;
+}
+
+std::vector<uint8_t> make_packet(uint64_t i)
+{
+	std::vector<uint8_t> p;
+	p.resize(100 + rand() % 41);
+	for(size_t j = 0; j < p.size(); j++)
+		p[j] = rand();
+	p[0] = 0xFC;	//CELT-only FB 20ms, one frame.
+	return p;
+}
+
+//Packets of 65025 bytes or more span pages. Check they come back intact through the demuxer. The muxer can't be
+//compared against here, as it puts the tail of a spanning packet on a page of its own.
+bool check_large_packets()
+{
+	const size_t sizes[] = {120, 65024, 65025, 130, 70000, 255, 200000, 130050, 0, 140};
+	const size_t count = sizeof(sizes) / sizeof(sizes[0]);
+	std::vector<std::vector<uint8_t>> pkts;
+	for(size_t i = 0; i < count; i++) {
+		pkts.push_back(std::vector<uint8_t>(sizes[i]));
+		for(size_t j = 0; j < sizes[i]; j++)
+			pkts[i][j] = rand();
+	}
+	std::ostringstream o;
+	{
+		ogg::stream_writer_iostreams w(o);
+		ogg::packet_writer pw(w, 1, 0);
+		for(size_t i = 0; i < count; i++)
+			pw.put_packet(pkts[i].empty() ? NULL : &pkts[i][0], pkts[i].size(), (i + 1) * packet_samples);
+		pw.flush(true);
+	}
+	std::istringstream is(o.str());
+	ogg::stream_reader_iostreams r(is);
+	ogg::demuxer d(std::cerr);
+	ogg::page pg;
+	size_t n = 0;
+	while(true) {
+		if(!d.wants_packet_out()) {
+			if(!r.get_page(pg))
+				break;
+			if(!d.page_in(pg))
+				return false;
+			continue;
+		}
+		ogg::packet p;
+		d.packet_out(p);
+		if(n >= count || p.get_vector() != pkts[n])
+			return false;
+		if(p.get_last_page() && p.get_granulepos() != (n + 1) * packet_samples)
+			return false;
+		n++;
+	}
+	return n == count;
+}
+
+int main(int argc, char** argv)
+{
+	std::string filename = (argc > 1) ? argv[1] : "ogg-bench.opus";
+	uint64_t d1, d2, t1;
+	if(argc <= 1) {
+		//No file given, synthetize one. Write it both ways, the results should be the same.
+		std::vector<std::vector<uint8_t>> pkts;
+		for(uint64_t i = 0; i < packets; i++)
+			pkts.push_back(make_packet(i));
+		std::ostringstream o1;
+		t1 = get_utime();
+		{
+			ogg::stream_writer_iostreams w(o1);
+			ogg::muxer mux(1, 0);
+			ogg::page p;
+			for(uint64_t i = 0; i < packets; i++) {
+				if(!mux.wants_packet_in() || !mux.packet_fits(pkts[i].size()))
+					while(mux.has_page_out()) {
+						mux.page_out(p);
+						w.put_page(p);
+					}
+				mux.packet_in(pkts[i], (i + 1) * packet_samples);
+			}
+			mux.signal_eos();
+			while(mux.has_page_out()) {
+				mux.page_out(p);
+				w.put_page(p);
+			}
+		}
+		d1 = get_utime() - t1;
+		std::ostringstream o2;
+		t1 = get_utime();
+		{
+			ogg::stream_writer_iostreams w(o2);
+			ogg::packet_writer pw(w, 1, 0);
+			for(uint64_t i = 0; i < packets; i++)
+				pw.put_packet(&pkts[i][0], pkts[i].size(), (i + 1) * packet_samples);
+			pw.flush(true);
+		}
+		d2 = get_utime() - t1;
+		std::cout << "Muxer write: " << (double)d1 / 1000000 << "s" << std::endl;
+		std::cout << "Packet writer write: " << (double)d2 / 1000000 << "s" << std::endl;
+		if(o1.str() != o2.str()) {
+			std::cout << "Written streams differ!" << std::endl;
+			return 1;
+		}
+		if(!check_large_packets()) {
+			std::cout << "Large packets don't read back!" << std::endl;
+			return 1;
+		}
+		std::ofstream f(filename, std::ios_base::out | std::ios_base::binary);
+		f << o1.str();
+		if(!f) {
+			std::cout << "Can't write " << filename << std::endl;
+			return 1;
+		}
+	}
+
+	uint64_t sum1 = 0, n1 = 0;
+	t1 = get_utime();
+	{
+		std::ifstream f(filename, std::ios_base::in | std::ios_base::binary);
+		ogg::stream_reader_iostreams r(f);
+		ogg::demuxer d(std::cerr);
+		ogg::page pg;
+		while(true) {
+			if(!d.wants_packet_out()) {
+				if(!r.get_page(pg))
+					break;
+				d.page_in(pg);
+				continue;
+			}
+			ogg::packet p;
+			d.packet_out(p);
+			const std::vector<uint8_t>& v = p.get_vector();
+			sum1 = checksum(sum1, &v[0], v.size(), p.get_granulepos());
+			n1++;
+		}
+	}
+	d1 = get_utime() - t1;
+
+	uint64_t sum2 = 0, n2 = 0;
+	t1 = get_utime();
+	{
+		ogg::stream_reader_mmap r(filename);
+		ogg::demuxer d(std::cerr);
+		ogg::page_view pg;
+		while(true) {
+			if(!d.wants_packet_out()) {
+				if(!r.get_page(pg))
+					break;
+				d.page_in(pg);
+				continue;
+			}
+			ogg::packet_view p;
+			d.packet_out(p);
+			sum2 = checksum(sum2, p.get_data(), p.get_length(), p.get_granulepos());
+			n2++;
+		}
+	}
+	d2 = get_utime() - t1;
+
+	std::cout << "Copying read (" << n1 << " packets): " << (double)d1 / 1000000 << "s" << std::endl;
+	std::cout << "Mapped view read (" << n2 << " packets): " << (double)d2 / 1000000 << "s" << std::endl;
+	if(argc <= 1)
+		remove(filename.c_str());
+	if(sum1 != sum2 || n1 != n2) {
+		std::cout << "Read results differ!" << std::endl;
+		return 1;
+	}
+	return 0;
+}
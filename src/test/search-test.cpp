@@ -0,0 +1,181 @@
+#include "core/instance.hpp"
+#include "core/mainloop.hpp"
+#include "core/memorywatch.hpp"
+#include "core/misc.hpp"
+#include "core/moviedata.hpp"
+#include "core/moviefile.hpp"
+#include "core/queue.hpp"
+#include "core/random.hpp"
+#include "core/rom.hpp"
+#include "core/romimage.hpp"
+#include "core/search.hpp"
+#include "core/window.hpp"
+#include "library/crandom.hpp"
+#include "library/framebuffer.hpp"
+#include "lua/lua.hpp"
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <unistd.h>
+
+//Beam search over the test core. Needs the emulator, so link like the programs in src/util.
+//
+//The test core keeps a position that left/right move by one and A doubles each frame. So the best input for each
+//step is right+A (0 -> 2 -> 6 -> 14), and left+right does the same as nothing, which must be deduplicated.
+
+namespace
+{
+	const char* romfile = "search-test.tmp";
+	const char* specfile = "search-test.json";
+	const unsigned button_A = 6;
+	const unsigned button_left = 17;
+	const unsigned button_right = 18;
+
+	void write_file(const std::string& name, const std::string& content)
+	{
+		std::ofstream f(name, std::ios::binary);
+		f << content;
+		if(!f)
+			throw std::runtime_error("Can't write '" + name + "'");
+	}
+
+	//Replace and refresh memory watches, making garbage for the collector as displaying frames does.
+	void churn_watches()
+	{
+		static unsigned n = 0;
+		memwatch_set& mw = *lsnes_instance.mwatch;
+		for(unsigned i = 0; i < 16; i++, n++) {
+			memwatch_item item;
+			item.expr = (stringfmt() << "(1+" << n << ")*(2+" << n << ")-" << n).str();
+			mw.set((stringfmt() << "churn" << n % 32).str(), item);
+			if(n % 3 == 0)
+				mw.clear((stringfmt() << "churn" << (n + 7) % 32).str());
+		}
+		framebuffer::queue rq;
+		mw.watch(rq);
+	}
+
+	void run_search(unsigned threads, unsigned results, bool churn = false)
+	{
+		write_file(specfile, (stringfmt() << "{\"buttons\":[\"1 left\",\"1 right\",\"1 A\"],"
+			<< "\"vars\":{\"x\":\"w 0\"},\"fitness\":\"$x\",\"steps\":3,\"beam\":4,\"results\":"
+			<< results << ",\"threads\":" << threads << ",\"branch\":\"searchtest\"}").str());
+		lsnes_instance.search->start(specfile);
+		while(lsnes_instance.search->running()) {
+			lsnes_instance.iqueue->run_queues();
+			if(churn)
+				churn_watches();
+			else
+				usleep(10000);
+		}
+	}
+
+	//Get final positions reached by the result branches, in order.
+	std::vector<int> result_positions(unsigned results)
+	{
+		moviefile& mf = lsnes_instance.mlogic->get_mfile();
+		std::vector<int> r;
+		for(unsigned i = 1; i <= results; i++) {
+			std::string name = (stringfmt() << "searchtest-" << i).str();
+			if(!mf.branches.count(name))
+				throw std::runtime_error("Branch '" + name + "' not created");
+			portctrl::frame_vector& v = mf.branches[name];
+			if(v.size() != 3)
+				throw std::runtime_error("Branch '" + name + "' has wrong length");
+			auto pcid = v.get_types().lcid_to_pcid(0);
+			int16_t x = 0;
+			for(size_t j = 0; j < v.size(); j++) {
+				portctrl::frame f = v[j];
+				if(f.axis3(pcid.first, pcid.second, button_left))
+					x--;
+				if(f.axis3(pcid.first, pcid.second, button_right))
+					x++;
+				if(f.axis3(pcid.first, pcid.second, button_A))
+					x *= 2;
+			}
+			r.push_back(x);
+		}
+		return r;
+	}
+
+	struct test
+	{
+		const char* name;
+		std::function<bool()> run;
+	};
+
+	struct test tests[] = {
+		{"Best branch", []() {
+			run_search(2, 1);
+			return result_positions(1)[0] == 14;
+		}},{"Results ordered and distinct", []() {
+			run_search(2, 4);
+			auto r = result_positions(4);
+			std::set<int> distinct(r.begin(), r.end());
+			for(size_t i = 1; i < r.size(); i++)
+				if(r[i] > r[i - 1])
+					return false;
+			return distinct.size() == r.size() && r[0] == 14;
+		}},{"Same result with any number of workers", []() {
+			run_search(1, 4);
+			auto r1 = result_positions(4);
+			run_search(4, 4);
+			auto r4 = result_positions(4);
+			return r1 == r4;
+		}},{"Same result while memory watches refresh", []() {
+			run_search(4, 4);
+			auto r1 = result_positions(4);
+			run_search(4, 4, true);
+			auto r2 = result_positions(4);
+			return r1 == r2;
+		}},{NULL, std::function<bool()>()}
+	};
+}
+
+int main()
+{
+	crandom::init();
+	reached_main();
+	set_random_seed();
+	platform::init();
+	init_lua(lsnes_instance);
+	init_main_callbacks();
+	lsnes_instance.emu_thread = threads::id();
+	try {
+		write_file(romfile, "test");
+		rom_image_handle img(new rom_image(romfile, "TEST", "test", ""));
+		loaded_rom r(img);
+		std::map<std::string, std::string> settings;
+		r.load(settings, 1000000000, 0);
+		*lsnes_instance.rom = r;
+		do_load_rom();
+	} catch(std::exception& e) {
+		std::cout << "\e[31mCan't load test core: " << e.what() << "\e[0m" << std::endl;
+		return 1;
+	}
+	struct test* t = tests;
+	int rc = 0;
+	while(t->name) {
+		std::cout << t->name << "..." << std::flush;
+		try {
+			if(t->run())
+				std::cout << "\e[32mPASS\e[0m" << std::endl;
+			else {
+				std::cout << "\e[31mFAILED\e[0m" << std::endl;
+				rc = 1;
+				break;
+			}
+		} catch(std::exception& e) {
+			std::cout << "\e[31mEXCEPTION: " << e.what() << "\e[0m" << std::endl;
+			rc = 1;
+			break;
+		}
+		t++;
+	}
+	unlink(romfile);
+	unlink(specfile);
+	quit_lua(lsnes_instance);
+	lsnes_instance.mlogic->release_memory();
+	return rc;
+}
@@ -0,0 +1,67 @@
+#include "../emulation/sky/draw.hpp"
+#include "../emulation/sky/instance.hpp"
+#include "../emulation/sky/romimage.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <sys/time.h>
+
+//Renders every level of the given ROM. Link with the sky core (src/emulation/sky).
+
+namespace
+{
+	uint64_t get_utime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+	}
+
+	//Fly through the level at constant speed, returning a checksum of the rendered frames.
+	uint32_t run_level(sky::instance& inst, uint8_t stage, unsigned frames, bool skip, uint64_t& time)
+	{
+		inst.state.curlevel = sky::level(inst.levels[stage]);
+		inst.state.level_init(stage);
+		sky::combine_background(inst, stage ? (stage - 1) / 3 : 0);
+		sky::level& c = inst.state.curlevel;
+		sky::rebuild_pipe_quad_caches(inst, c.get_palette_color(68), c.get_palette_color(69),
+			c.get_palette_color(70), c.get_palette_color(71));
+		uint32_t len = c.apparent_length();
+		uint32_t sum = 0;
+		uint64_t t = get_utime();
+		for(unsigned i = 0; i < frames; i++) {
+			inst.state.p.lpos = (uint64_t)i * 0x2000 % len;
+			sky::draw_level(inst, skip);
+			if(!skip)
+				sum = sum * 31 + inst.framebuffer[(i * 7919) % (FB_WIDTH * FB_HEIGHT)];
+		}
+		time += get_utime() - t;
+		return sum;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2) {
+		std::cerr << "Syntax: " << argv[0] << " <rom> [<frames>]" << std::endl;
+		return 1;
+	}
+	unsigned frames = (argc > 2) ? atoi(argv[2]) : 1000;
+	sky::instance* inst = new sky::instance;
+	sky::load_rom(*inst, argv[1]);
+	uint64_t rtime = 0, stime = 0;
+	unsigned total = 0;
+	for(uint8_t i = 0; i < 31; i++) {
+		if(!inst->levels.present(i))
+			continue;
+		uint32_t sum = run_level(*inst, i, frames, false, rtime);
+		run_level(*inst, i, frames, true, stime);
+		std::cout << "Level " << (int)i << ": checksum " << std::hex << sum << std::dec << std::endl;
+		total += frames;
+	}
+	if(!total)
+		return 1;
+	std::cout << "Render: " << 1000000.0 * total / rtime << " fps" << std::endl;
+	std::cout << "Skip: " << 1000000.0 * total / stime << " fps" << std::endl;
+	delete inst;
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include "core/dispatch.hpp"
 #include "core/mainloop.hpp"
 #include "core/framerate.hpp"
+#include "core/headless.hpp"
 #include "core/keymapper.hpp"
 #include "interface/romtype.hpp"
 #include "core/loadlib.hpp"
@@ -16,12 +17,10 @@
 #include "core/misc.hpp"
 #include "core/instance.hpp"
 #include "core/moviedata.hpp"
-#include "core/random.hpp"
 #include "core/rom.hpp"
 #include "core/settings.hpp"
 #include "core/window.hpp"
 #include "library/directory.hpp"
-#include "library/crandom.hpp"
 #include "library/string.hpp"
 
 #include <sys/time.h>
@@ -88,6 +87,7 @@ namespace
 			: dumper(_dumper)
 		{
 			frames_dumped = 0;
+			frames_queued = 0;
 			total = frames_to_dump;
 			lsnes_instance.mdumper->add_dumper(*this);
 		}
@@ -97,17 +97,23 @@ namespace
 			lsnes_instance.mdumper->drop_dumper(*this);
 		}
 
-		void on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		bool video_geometry(const struct framebuffer::raw& _frame, uint32_t& hscl, uint32_t& vscl,
+			uint32_t& lgap, uint32_t& tgap, uint32_t& rgap, uint32_t& bgap)
+		{
+			//Counted on the emulation thread, so no frame past the last one reaches the dumper.
+			if(++frames_queued == total) {
+				//Rough way to end it.
+				CORE().command->invoke("quit-emulator");
+			}
+			return false;
+		}
+		void on_frame(const struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
 		{
 			frames_dumped++;
 			if(frames_dumped % 100 == 0) {
 				std::cout << "Dumping frame " << frames_dumped << "/" << total << " ("
 					<< (100 * frames_dumped / total) << "%)" << std::endl;
 			}
-			if(frames_dumped >= total) {
-				//Rough way to end it.
-				CORE().command->invoke("quit-emulator");
-			}
 		}
 		void on_sample(short l, short r)
 		{
@@ -132,6 +138,7 @@ namespace
 		}
 	private:
 		uint64_t frames_dumped;
+		uint64_t frames_queued;
 		uint64_t total;
 		dumper_base& dumper;
 	};
@@ -317,27 +324,16 @@ namespace
 
 int main(int argc, char** argv)
 {
-	try {
-		crandom::init();
-	} catch(std::exception& e) {
-		std::cerr << "Error initializing system RNG" << std::endl;
-		return 1;
-	}
-
-	reached_main();
-	std::vector<std::string> cmdline;
-	for(int i = 1; i < argc; i++)
-		cmdline.push_back(argv[i]);
+	std::vector<std::string> cmdline = headless_startup(argc, argv);
 	uint64_t length, overdump_length;
 	bool overdump_mode;
 	std::string mode, prefix;
 
 	dumper_factory_base& dumper = get_dumper(cmdline, mode, prefix, length, overdump_mode, overdump_length);
 
-	set_random_seed();
-	platform::init();
-	init_lua(lsnes_instance);
+	headless_init();
 	lsnes_instance.mdumper->set_output(&messages.getstream());
+	lsnes_image_hasher.set_cache_file(get_config_path() + "/hash.db");
 	set_hasher_callback(hash_callback);
 
 	messages << "lsnes version: lsnes rr" << lsnes_version << std::endl;
@@ -372,12 +368,7 @@ int main(int argc, char** argv)
 		}
 	}
 
-	std::string movfn;
-	for(auto i : cmdline) {
-		if(i.length() > 0 && i[0] != '-') {
-			movfn = i;
-		}
-	}
+	std::string movfn = headless_movie_filename(cmdline);
 	if(movfn == "") {
 		messages << "Movie filename required" << std::endl;
 		return 0;
@@ -392,50 +383,17 @@ int main(int argc, char** argv)
 		exit(1);
 	}
 
-	init_main_callbacks();
 	messages << "--- Loading ROM ---" << std::endl;
-	struct loaded_rom r;
-	try {
-		std::map<std::string, std::string> tmp;
-		r = construct_rom(movfn, cmdline);
-		r.load(tmp, 1000000000, 0);
-		messages << "Using core: " << r.get_core_identifier() << std::endl;
-	} catch(std::bad_alloc& e) {
-		OOM_panic();
-	} catch(std::exception& e) {
-		messages << "FATAL: Can't load ROM: " << e.what() << std::endl;
-		quit_lua(lsnes_instance);
-		fatal_error();
-		exit(1);
-	}
+	struct loaded_rom r = headless_load_rom(movfn, cmdline);
 	messages << "Detected region: " << r.get_sysregion().get_name() << std::endl;
-	lsnes_instance.framerate->set_nominal_framerate(r.region_approx_framerate());
 
 	messages << "--- End of Startup --- " << std::endl;
 
-	moviefile* movie;
-	try {
-		movie = new moviefile(movfn, r.get_internal_rom_type());
-		//Load ROM before starting the dumper.
-		*lsnes_instance.rom = r;
-		messages << "Using core: " << lsnes_instance.rom->get_core_identifier() << std::endl;
-		lsnes_instance.rom->set_internal_region(movie->gametype->get_region());
-		lsnes_instance.rom->load(movie->settings, movie->movie_rtc_second, movie->movie_rtc_subsecond);
+	headless_run(r, movfn, [&](moviefile& mv) {
 		startup_lua_scripts(cmdline);
 		if(overdump_mode)
-			length = overdump_length + movie->get_frame_count();
+			length = overdump_length + mv.get_frame_count();
 		dumper_startup(dumper, mode, prefix, length);
-		main_loop(r, *movie, true);
-	} catch(std::bad_alloc& e) {
-		OOM_panic();
-	} catch(std::exception& e) {
-		messages << "FATAL: " << e.what() << std::endl;
-		quit_lua(lsnes_instance);
-		fatal_error();
-		return 1;
-	}
-	quit_lua(lsnes_instance);
-	lsnes_instance.mlogic->release_memory();
-	lsnes_instance.buttons->cleanup();
+	});
 	return 0;
 }
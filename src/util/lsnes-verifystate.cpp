@@ -0,0 +1,122 @@
+#include "lsnes.hpp"
+
+#include "core/command.hpp"
+#include "core/controller.hpp"
+#include "core/dispatch.hpp"
+#include "core/mainloop.hpp"
+#include "core/headless.hpp"
+#include "core/keymapper.hpp"
+#include "interface/romtype.hpp"
+#include "core/loadlib.hpp"
+#include "lua/lua.hpp"
+#include "core/messages.hpp"
+#include "core/misc.hpp"
+#include "core/instance.hpp"
+#include "core/moviedata.hpp"
+#include "core/rom.hpp"
+#include "core/settings.hpp"
+#include "core/statelog.hpp"
+#include "core/window.hpp"
+#include "library/string.hpp"
+
+#include <sstream>
+
+//Headless state hash log recorder/verifier.
+//
+//Record: lsnes-verifystate --record --log=<file> <movie>
+//Verify: lsnes-verifystate --log=<file> [--checkpoint-interval=<frames>] <movie>
+//
+//Exit status when verifying is 0 if no differences were found, 2 if a difference was found.
+
+namespace
+{
+	void usage()
+	{
+		std::cerr << "Syntax: lsnes-verifystate [--record] --log=<file> [--checkpoint-interval=<frames>] "
+			"[<options>] <movie>" << std::endl;
+		exit(1);
+	}
+
+	void parse_options(const std::vector<std::string>& cmdline, std::string& logfile, bool& record,
+		uint64_t& interval)
+	{
+		record = false;
+		interval = 1000;
+		for(auto i : cmdline) {
+			regex_results r;
+			if(i == "--record")
+				record = true;
+			else if(r = regex("--log=(.+)", i))
+				logfile = r[1];
+			else if(r = regex("--checkpoint-interval=(.+)", i))
+				try {
+					interval = raw_lexical_cast<uint64_t>(r[1]);
+					if(!interval)
+						throw std::runtime_error("Interval out of range (1-)");
+				} catch(std::exception& e) {
+					std::cerr << "Bad --checkpoint-interval: " << e.what() << std::endl;
+					exit(1);
+				}
+			else if(r = regex("--option=([^=]+)=(.*)", i))
+				try {
+					lsnes_instance.setcache->set(r[1], r[2]);
+				} catch(std::exception& e) {
+					std::cerr << "Can't set '" << r[1] << "' to '" << r[2] << "': " << e.what()
+						<< std::endl;
+					exit(1);
+				}
+			else if(r = regex("--load-library=(.+)", i))
+				try {
+					with_loaded_library(*new loadlib::module(loadlib::library(r[1])));
+					handle_post_loadlibrary();
+				} catch(std::runtime_error& e) {
+					std::cerr << "Can't load '" << r[1] << "': " << e.what() << std::endl;
+					exit(1);
+				}
+			else if(r = regex("--firmware-path=(.*)", i))
+				try {
+					lsnes_instance.setcache->set("firmwarepath", r[1]);
+				} catch(std::exception& e) {
+					std::cerr << "Can't set firmware path to '" << r[1] << "': " << e.what()
+						<< std::endl;
+				}
+			else if(i.length() > 0 && i[0] == '-') {
+				std::cerr << "Unknown option '" << i << "'" << std::endl;
+				usage();
+			}
+		}
+		if(logfile == "")
+			usage();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::string> cmdline = headless_startup(argc, argv);
+	std::string logfile;
+	bool record;
+	uint64_t interval;
+
+	headless_init();
+	parse_options(cmdline, logfile, record, interval);
+
+	messages << "lsnes version: lsnes rr" << lsnes_version << std::endl;
+	autoload_libraries();
+
+	std::string movfn = headless_movie_filename(cmdline);
+	if(movfn == "") {
+		messages << "Movie filename required" << std::endl;
+		return 1;
+	}
+
+	struct loaded_rom r = headless_load_rom(movfn, cmdline);
+	headless_run(r, movfn, [record, &logfile, interval](moviefile& mv) {
+		if(record)
+			lsnes_instance.statelog->start(logfile, mv.get_frame_count());
+		else
+			lsnes_instance.statelog->verify(logfile, interval, true);
+	});
+	if(!record && lsnes_instance.statelog->get_verify_status() != state_hash_log::V_MATCH)
+		return 2;
+	return 0;
+}
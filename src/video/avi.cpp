@@ -388,22 +388,23 @@ again:
 		}
 		~avi_dumper_obj() throw()
 		{
+			//Let the dump thread deliver what is queued first.
+			mdumper.drop_dumper(*this);
 			if(worker) {
 				if(resampler_w)
 					resampler_w->sendend();
 				worker->request_quit();
 			}
-			mdumper.drop_dumper(*this);
 			if(resampler_w)
 				delete resampler_w;
 			delete worker;
 			delete soxdumper;
 			messages << "AVI Dump finished" << std::endl;
 		}
-		void on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		bool video_geometry(const struct framebuffer::raw& _frame, uint32_t& hscl, uint32_t& vscl,
+			uint32_t& lgap, uint32_t& tgap, uint32_t& rgap, uint32_t& bgap)
 		{
 			auto& core = CORE();
-			uint32_t hscl = 1, vscl = 1;
 			unsigned fxfact = fixed_xfact(*core.settings);
 			unsigned fyfact = fixed_yfact(*core.settings);
 			if(fxfact != 0 && fyfact != 0) {
@@ -413,9 +414,15 @@ again:
 				rpair(hscl, vscl) = core.rom->get_scale_factors(_frame.get_width(),
 					_frame.get_height());
 			}
-			if(!render_video_hud(dscr, _frame, fps_n, fps_d, hscl, vscl, dlb(*core.settings),
-				dtb(*core.settings), drb(*core.settings), dbb(*core.settings),
-				[this]() -> void { this->worker->wait_busy(); }))
+			lgap = dlb(*core.settings);
+			tgap = dtb(*core.settings);
+			rgap = drb(*core.settings);
+			bgap = dbb(*core.settings);
+			return true;
+		}
+		void on_frame(const struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		{
+			if(!render_video_hud(dscr, _frame, [this]() -> void { this->worker->wait_busy(); }))
 				return;
 			worker->queue_video(dscr.rowptr(0), dscr.get_stride(), dscr.get_width(), dscr.get_height(),
 				fps_n, fps_d);
@@ -452,7 +459,7 @@ again:
 		{
 			messages << "Warning: Changing AVI sound rate mid-dump is not supported!" << std::endl;
 			//Try to do it anyway.
-			soundrate = mdumper.get_rate();
+			soundrate = std::make_pair(n, d);
 			dcounter = 0;
 			double ratio =  1.0 * audio_record_rate * soundrate.second / soundrate.first;
 			if(resampler_w)
@@ -120,9 +120,14 @@ out:
 			}
 		}
 
-		void on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		bool video_geometry(const struct framebuffer::raw& _frame, uint32_t& hscl, uint32_t& vscl,
+			uint32_t& lgap, uint32_t& tgap, uint32_t& rgap, uint32_t& bgap)
 		{
-			if(!render_video_hud(dscr, _frame, fps_n, fps_d, 1, 1, 0, 0, 0, 0, NULL))
+			return true;
+		}
+		void on_frame(const struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		{
+			if(!render_video_hud(dscr, _frame, NULL))
 				return;
 			frame_buffer f;
 			f.ts = get_next_video_ts(fps_n, fps_d);
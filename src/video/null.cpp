@@ -45,7 +45,7 @@ namespace
 		{
 			mdumper.drop_dumper(*this);
 		}
-		void on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		void on_frame(const struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
 		{
 			//Do nothing.
 		}
@@ -53,6 +53,10 @@ namespace
 		{
 			//Do nothing.
 		}
+		void on_samples(const short* samples, size_t count, bool stereo)
+		{
+			//Do nothing.
+		}
 		void on_rate_change(uint32_t n, uint32_t d)
 		{
 			//Do nothing.
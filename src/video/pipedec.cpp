@@ -126,9 +126,14 @@ namespace
 				pclose(video);
 			messages << "PIPEDEC Dump finished" << std::endl;
 		}
-		void on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		bool video_geometry(const struct framebuffer::raw& _frame, uint32_t& hscl, uint32_t& vscl,
+			uint32_t& lgap, uint32_t& tgap, uint32_t& rgap, uint32_t& bgap)
 		{
-			if(!render_video_hud(dscr, _frame, fps_n, fps_d, 1, 1, 0, 0, 0, 0, NULL))
+			return true;
+		}
+		void on_frame(const struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		{
+			if(!render_video_hud(dscr, _frame, NULL))
 				return;
 			size_t w = dscr.get_width();
 			size_t h = dscr.get_height();
@@ -0,0 +1,351 @@
+#include "core/advdumper.hpp"
+#include "core/dispatch.hpp"
+#include "core/instance.hpp"
+#include "core/messages.hpp"
+#include "core/rom.hpp"
+#include "core/settings.hpp"
+#include "library/minmax.hpp"
+#include "library/png.hpp"
+#include "library/serialization.hpp"
+#include "library/string.hpp"
+#include "library/threads.hpp"
+
+#include <iomanip>
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include <fstream>
+#include <deque>
+#include <list>
+#include <map>
+
+namespace
+{
+	settingvar::supervariable<settingvar::model_int<0,9>> clevel(lsnes_setgrp, "png-compression",
+		"PNG‣Compression", 3);
+	settingvar::supervariable<settingvar::model_int<0,64>> cthreads(lsnes_setgrp, "png-threads",
+		"PNG‣Threads (0 = auto)", 0);
+
+	struct png_job
+	{
+		uint64_t seq;
+		std::string filename;
+		png::encoder img;
+	};
+
+	class png_dump_obj : public dumper_base
+	{
+	public:
+		png_dump_obj(master_dumper& _mdumper, dumper_factory_base& _fbase, const std::string& mode,
+			const std::string& _prefix)
+			: dumper_base(_mdumper, _fbase), mdumper(_mdumper), prefix(_prefix)
+		{
+			auto& core = CORE();
+			if(prefix == "")
+				throw std::runtime_error("Expected prefix");
+			try {
+				wav = (mode == "wav");
+				audio.open(prefix + (wav ? ".wav" : ".audio"), std::ios::out | std::ios::binary);
+				if(!audio)
+					throw std::runtime_error("Can't open audio output file");
+				audio_samples = 0;
+				soundrate = mdumper.get_rate();
+				if(wav)
+					write_wav_header();
+				level = clevel(*core.settings);
+				unsigned nthreads = cthreads(*core.settings);
+				if(!nthreads)
+					nthreads = threads::thread::hardware_concurrency();
+				if(!nthreads)
+					nthreads = 1;
+				//Frames queued, being encoded or waiting to be written in order.
+				max_inflight = 2 * nthreads + 2;
+				inflight = 0;
+				next_seq = 0;
+				next_write = 0;
+				writing = false;
+				quitting = false;
+				have_dumped_frame = false;
+				dscr.set_palette(16, 8, 0);
+				for(unsigned i = 0; i < nthreads; i++)
+					workers.push_back(new threads::thread([this]() { this->worker(); }));
+				mdumper.add_dumper(*this);
+			} catch(std::bad_alloc& e) {
+				shutdown_workers();
+				throw;
+			} catch(std::exception& e) {
+				shutdown_workers();
+				std::ostringstream x;
+				x << "Error starting PNG dump: " << e.what();
+				throw std::runtime_error(x.str());
+			}
+			messages << "Dumping to " << prefix << " using " << workers.size() << " threads" << std::endl;
+		}
+		~png_dump_obj() throw()
+		{
+			mdumper.drop_dumper(*this);
+			{
+				threads::alock h(qlock);
+				while(inflight > 0)
+					qcond.wait(h);
+			}
+			shutdown_workers();
+			report_errors();
+			if(wav)
+				fixup_wav_header();
+			audio.close();
+			messages << "PNG Dump finished (" << next_write << " frames)" << std::endl;
+		}
+		bool video_geometry(const struct framebuffer::raw& _frame, uint32_t& hscl, uint32_t& vscl,
+			uint32_t& lgap, uint32_t& tgap, uint32_t& rgap, uint32_t& bgap)
+		{
+			auto& core = CORE();
+			rpair(hscl, vscl) = core.rom->get_scale_factors(_frame.get_width(), _frame.get_height());
+			return true;
+		}
+		void on_frame(const struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		{
+			if(!render_video_hud(dscr, _frame, NULL))
+				return;
+			report_errors();
+			{
+				//Wait for a free slot, so memory use stays bounded if encoding can't keep up.
+				threads::alock h(qlock);
+				while(inflight >= max_inflight)
+					qcond.wait(h);
+				inflight++;
+			}
+			png_job* j = new png_job;
+			j->seq = next_seq++;
+			j->filename = (stringfmt() << prefix << "_" << std::setw(8) << std::setfill('0') << j->seq
+				<< ".png").str();
+			size_t w = dscr.get_width();
+			size_t h = dscr.get_height();
+			j->img.width = w;
+			j->img.height = h;
+			j->img.level = level;
+			j->img.data.resize(w * h);
+			for(size_t i = 0; i < h; i++) {
+				const uint32_t* row = dscr.rowptr(i);
+				for(size_t k = 0; k < w; k++)
+					j->img.data[i * w + k] = row[k] & 0xFFFFFF;
+			}
+			{
+				threads::alock h(qlock);
+				queue.push_back(j);
+			}
+			qcond.notify_all();
+			have_dumped_frame = true;
+		}
+		void on_sample(short l, short r)
+		{
+			short x[2] = {l, r};
+			on_samples(x, 1, true);
+		}
+		void on_samples(const short* samples, size_t count, bool stereo)
+		{
+			if(!have_dumped_frame)
+				return;
+			char buffer[4096];
+			while(count) {
+				size_t n = min(count, sizeof(buffer) / 4);
+				for(size_t i = 0; i < n; i++) {
+					serialization::s16l(buffer + 4 * i + 0, samples[0]);
+					serialization::s16l(buffer + 4 * i + 2, samples[stereo ? 1 : 0]);
+					samples += (stereo ? 2 : 1);
+				}
+				audio.write(buffer, 4 * n);
+				audio_samples += n;
+				count -= n;
+			}
+		}
+		void on_rate_change(uint32_t n, uint32_t d)
+		{
+			if(wav && audio_samples) {
+				messages << "Warning: Changing WAV sound rate mid-dump is not supported!" << std::endl;
+				return;
+			}
+			soundrate = std::make_pair(n, d);
+			if(wav) {
+				audio.seekp(0, std::ios::beg);
+				write_wav_header();
+			}
+		}
+		void on_gameinfo_change(const master_dumper::gameinfo& gi)
+		{
+			//Do nothing.
+		}
+		void on_end()
+		{
+			delete this;
+		}
+	private:
+		void worker()
+		{
+			threads::alock h(qlock);
+			while(true) {
+				while(queue.empty() && !quitting)
+					qcond.wait(h);
+				if(queue.empty())
+					return;
+				png_job* j = queue.front();
+				queue.pop_front();
+				h.unlock();
+				std::string out;
+				try {
+					std::ostringstream s;
+					j->img.encode(s);
+					out = s.str();
+				} catch(std::exception& e) {
+					set_error(std::string("Error encoding ") + j->filename + ": " + e.what());
+				}
+				h.lock();
+				//Write out in order. The thread that completes the next frame writes all consecutive
+				//finished frames, so the files on disk never have gaps.
+				finished[j->seq] = std::make_pair(j->filename, out);
+				delete j;
+				while(!writing && finished.count(next_write)) {
+					auto f = finished[next_write];
+					finished.erase(next_write);
+					writing = true;
+					h.unlock();
+					write_file(f.first, f.second);
+					h.lock();
+					writing = false;
+					next_write++;
+					inflight--;
+					qcond.notify_all();
+				}
+			}
+		}
+		void write_file(const std::string& filename, const std::string& data)
+		{
+			if(data == "")
+				return;		//Failed to encode.
+			std::ofstream f(filename, std::ios::out | std::ios::binary);
+			f.write(data.c_str(), data.length());
+			if(!f)
+				set_error("Can't write " + filename);
+		}
+		void set_error(const std::string& err)
+		{
+			threads::alock h(elock);
+			errors.push_back(err);
+		}
+		void report_errors()
+		{
+			threads::alock h(elock);
+			for(auto i : errors)
+				messages << i << std::endl;
+			errors.clear();
+		}
+		void shutdown_workers()
+		{
+			{
+				threads::alock h(qlock);
+				quitting = true;
+			}
+			qcond.notify_all();
+			for(auto i : workers) {
+				i->join();
+				delete i;
+			}
+			workers.clear();
+		}
+		void write_wav_header()
+		{
+			char header[44];
+			uint32_t rate = floor(1.0 * soundrate.first / soundrate.second + 0.5);
+			memcpy(header + 0, "RIFF", 4);
+			serialization::u32l(header + 4, 36);
+			memcpy(header + 8, "WAVEfmt ", 8);
+			serialization::u32l(header + 16, 16);
+			serialization::u16l(header + 20, 1);		//PCM.
+			serialization::u16l(header + 22, 2);		//Stereo.
+			serialization::u32l(header + 24, rate);
+			serialization::u32l(header + 28, 4 * rate);
+			serialization::u16l(header + 32, 4);
+			serialization::u16l(header + 34, 16);
+			memcpy(header + 36, "data", 4);
+			serialization::u32l(header + 40, 0);
+			audio.write(header, sizeof(header));
+		}
+		void fixup_wav_header()
+		{
+			char buf[4];
+			uint32_t datalen = 4 * audio_samples;
+			audio.seekp(4, std::ios::beg);
+			serialization::u32l(buf, datalen + 36);
+			audio.write(buf, 4);
+			audio.seekp(40, std::ios::beg);
+			serialization::u32l(buf, datalen);
+			audio.write(buf, 4);
+			if(!audio)
+				messages << "Can't fixup WAV header" << std::endl;
+		}
+		master_dumper& mdumper;
+		std::string prefix;
+		bool wav;
+		std::ofstream audio;
+		uint64_t audio_samples;
+		std::pair<uint32_t, uint32_t> soundrate;
+		int level;
+		bool have_dumped_frame;
+		framebuffer::fb<false> dscr;
+		std::vector<threads::thread*> workers;
+		threads::lock qlock;
+		threads::cv qcond;
+		std::deque<png_job*> queue;
+		std::map<uint64_t, std::pair<std::string, std::string>> finished;
+		size_t max_inflight;
+		size_t inflight;
+		uint64_t next_seq;
+		uint64_t next_write;
+		bool writing;
+		bool quitting;
+		threads::lock elock;
+		std::list<std::string> errors;
+	};
+
+	class adv_png_dumper : public dumper_factory_base
+	{
+	public:
+		adv_png_dumper() : dumper_factory_base("INTERNAL-PNG")
+		{
+			ctor_notify();
+		}
+		~adv_png_dumper() throw();
+		std::set<std::string> list_submodes() throw(std::bad_alloc)
+		{
+			std::set<std::string> x;
+			x.insert("wav");
+			x.insert("raw");
+			return x;
+		}
+		unsigned mode_details(const std::string& mode) throw()
+		{
+			return target_type_prefix;
+		}
+		std::string mode_extension(const std::string& mode) throw()
+		{
+			return "";	//Nothing interesting.
+		}
+		std::string name() throw(std::bad_alloc)
+		{
+			return "PNG";
+		}
+		std::string modename(const std::string& mode) throw(std::bad_alloc)
+		{
+			return (mode == "wav") ? "frames + WAV audio" : "frames + raw audio";
+		}
+		png_dump_obj* start(master_dumper& _mdumper, const std::string& mode, const std::string& prefix)
+			throw(std::bad_alloc, std::runtime_error)
+		{
+			return new png_dump_obj(_mdumper, *this, mode, prefix);
+		}
+	} adv;
+
+	adv_png_dumper::~adv_png_dumper() throw()
+	{
+	}
+}
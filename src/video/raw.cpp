@@ -96,14 +96,20 @@ namespace
 				deleter(audio);
 			messages << "RAW Dump finished" << std::endl;
 		}
-		void on_frame(struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		bool video_geometry(const struct framebuffer::raw& _frame, uint32_t& hscl, uint32_t& vscl,
+			uint32_t& lgap, uint32_t& tgap, uint32_t& rgap, uint32_t& bgap)
 		{
 			auto& core = CORE();
 			if(!video)
-				return;
-			uint32_t hscl, vscl;
+				return false;
 			rpair(hscl, vscl) = core.rom->get_scale_factors(_frame.get_width(),
 				_frame.get_height());
+			return true;
+		}
+		void on_frame(const struct framebuffer::raw& _frame, uint32_t fps_n, uint32_t fps_d)
+		{
+			if(!video)
+				return;
 			if(bits64) {
 				size_t w = dscr2.get_width();
 				size_t h = dscr2.get_height();
@@ -111,7 +117,7 @@ namespace
 				std::vector<uint16_t> tmp;
 				tmp.resize(8 * s + 8);
 				uint32_t alignment = (16 - reinterpret_cast<size_t>(&tmp[0])) % 16 / 2;
-				if(!render_video_hud(dscr2, _frame, fps_n, fps_d, hscl, vscl, 0, 0, 0, 0, NULL))
+				if(!render_video_hud(dscr2, _frame, NULL))
 					return;
 				for(size_t i = 0; i < h; i++) {
 					if(!swap)
@@ -127,7 +133,7 @@ namespace
 				std::vector<uint8_t> tmp;
 				tmp.resize(4 * s + 16);
 				uint32_t alignment = (16 - reinterpret_cast<size_t>(&tmp[0])) % 16;
-				if(!render_video_hud(dscr, _frame, fps_n, fps_d, hscl, vscl, 0, 0, 0, 0, NULL))
+				if(!render_video_hud(dscr, _frame, NULL))
 					return;
 				for(size_t i = 0; i < h; i++) {
 					if(!swap)
@@ -151,6 +157,22 @@ namespace
 				audio->write(buffer, 4);
 			}
 		}
+		void on_samples(const short* samples, size_t count, bool stereo)
+		{
+			if(!have_dumped_frame || !audio)
+				return;
+			char buffer[4096];
+			while(count) {
+				size_t n = min(count, sizeof(buffer) / 4);
+				for(size_t i = 0; i < n; i++) {
+					serialization::s16b(buffer + 4 * i + 0, samples[0]);
+					serialization::s16b(buffer + 4 * i + 2, samples[stereo ? 1 : 0]);
+					samples += (stereo ? 2 : 1);
+				}
+				audio->write(buffer, 4 * n);
+				count -= n;
+			}
+		}
 		void on_rate_change(uint32_t n, uint32_t d)
 		{
 			//Do nothing.